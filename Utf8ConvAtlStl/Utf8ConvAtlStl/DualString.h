@@ -0,0 +1,249 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_DUALSTRING_H
+#define GIOVANNI_DICANIO_INCLUDE_DUALSTRING_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Lazily Converting UTF-8 / UTF-16 Dual-Representation String
+//          ===========================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module providing DualString, which stores a string in its
+// original encoding (UTF-8 std::string, or UTF-16 CStringW), and converts it
+// to the other encoding only the first time it's requested.
+//
+// The converted result is cached, so objects passed many times to UTF-16
+// (or UTF-8) APIs pay for the conversion only once.
+// Concurrent reads are thread-safe: the conversion is done exactly once,
+// by the first reader. Assigning a new value drops the cached conversion.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Core conversion functions
+
+#include <atomic>       // For std::atomic
+#include <mutex>        // For std::mutex, std::lock_guard
+#include <string>       // For std::string
+#include <utility>      // For std::move
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+//------------------------------------------------------------------------------
+// String stored in UTF-8 or UTF-16, converted lazily to the other encoding.
+//
+// Const member functions can be called concurrently from several threads.
+// As with the standard library types, modifying a DualString while other
+// threads are reading it is not allowed.
+//
+// Conversion errors (e.g. invalid UTF-8 sequences in the original string)
+// are signaled throwing Utf8ConversionException from Utf8() or Utf16().
+//------------------------------------------------------------------------------
+class DualString
+{
+public:
+
+    // Create an empty string
+    DualString()
+        : m_originalIsUtf8(true)
+        , m_converted(true)
+    {}
+
+    // Create a string from UTF-8 text
+    explicit DualString(std::string utf8)
+        : m_originalIsUtf8(true)
+        , m_utf8(std::move(utf8))
+        , m_converted(false)
+    {}
+
+    // Create a string from UTF-16 text
+    explicit DualString(const CStringW& utf16)
+        : m_originalIsUtf8(false)
+        , m_utf16(utf16)
+        , m_converted(false)
+    {}
+
+    DualString(const DualString& other)
+        : m_converted(false)
+    {
+        CopyFrom(other);
+    }
+
+    DualString& operator=(const DualString& other)
+    {
+        if (this != &other)
+        {
+            CopyFrom(other);
+        }
+        return *this;
+    }
+
+    // The moved-from string is left empty
+    DualString(DualString&& other)
+        : m_converted(false)
+    {
+        MoveFrom(other);
+    }
+
+    DualString& operator=(DualString&& other)
+    {
+        if (this != &other)
+        {
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    // Assign UTF-8 text, dropping the cached conversion
+    DualString& operator=(std::string utf8)
+    {
+        m_originalIsUtf8 = true;
+        m_utf8 = std::move(utf8);
+        m_utf16.Empty();
+        m_converted.store(false, std::memory_order_relaxed);
+        return *this;
+    }
+
+    // Assign UTF-16 text, dropping the cached conversion
+    DualString& operator=(const CStringW& utf16)
+    {
+        m_originalIsUtf8 = false;
+        m_utf16 = utf16;
+        m_utf8.clear();
+        m_converted.store(false, std::memory_order_relaxed);
+        return *this;
+    }
+
+    // The string in UTF-8, converted on first request
+    const std::string& Utf8() const
+    {
+        if (!m_originalIsUtf8)
+        {
+            EnsureConverted();
+        }
+        return m_utf8;
+    }
+
+    // The string in UTF-16, converted on first request
+    const CStringW& Utf16() const
+    {
+        if (m_originalIsUtf8)
+        {
+            EnsureConverted();
+        }
+        return m_utf16;
+    }
+
+    // Was the string originally stored in UTF-8?
+    bool IsOriginalUtf8() const noexcept
+    {
+        return m_originalIsUtf8;
+    }
+
+    // Is the conversion to the other encoding already cached?
+    bool IsConverted() const noexcept
+    {
+        return m_converted.load(std::memory_order_acquire);
+    }
+
+    bool IsEmpty() const noexcept
+    {
+        return m_originalIsUtf8 ? m_utf8.empty() : m_utf16.IsEmpty();
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    bool m_originalIsUtf8;
+
+    // The original string, and the cached conversion (valid when m_converted is true)
+    mutable std::string m_utf8;
+    mutable CStringW m_utf16;
+
+    // Double-checked one-time conversion: the flag is published with release
+    // semantics after the cached string is written under the mutex
+    mutable std::atomic<bool> m_converted;
+    mutable std::mutex m_mutex;
+
+    void EnsureConverted() const
+    {
+        if (m_converted.load(std::memory_order_acquire))
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_converted.load(std::memory_order_relaxed))
+        {
+            if (m_originalIsUtf8)
+            {
+                m_utf16 = Utf16FromUtf8(m_utf8);
+            }
+            else
+            {
+                m_utf8 = Utf8FromUtf16(m_utf16);
+            }
+            m_converted.store(true, std::memory_order_release);
+        }
+    }
+
+    // Copy the original string, and the other's cached conversion if available
+    void CopyFrom(const DualString& other)
+    {
+        const bool otherConverted = other.IsConverted();
+
+        m_originalIsUtf8 = other.m_originalIsUtf8;
+        if (m_originalIsUtf8 || otherConverted)
+        {
+            m_utf8 = other.m_utf8;
+        }
+        else
+        {
+            m_utf8.clear();
+        }
+
+        if (!m_originalIsUtf8 || otherConverted)
+        {
+            m_utf16 = other.m_utf16;
+        }
+        else
+        {
+            m_utf16.Empty();
+        }
+
+        m_converted.store(otherConverted, std::memory_order_relaxed);
+    }
+
+    // Take the other's original string and cached conversion, leaving it empty.
+    // The cached state is read under the other's mutex, so a conversion
+    // running in another thread is either fully taken or not at all
+    void MoveFrom(DualString& other)
+    {
+        std::lock_guard<std::mutex> lock(other.m_mutex);
+        const bool otherConverted = other.m_converted.load(std::memory_order_relaxed);
+
+        m_originalIsUtf8 = other.m_originalIsUtf8;
+        m_utf8 = std::move(other.m_utf8);
+        m_utf16 = other.m_utf16;
+        m_converted.store(otherConverted, std::memory_order_relaxed);
+
+        other.m_originalIsUtf8 = true;
+        other.m_utf8.clear();
+        other.m_utf16.Empty();
+        other.m_converted.store(true, std::memory_order_relaxed);
+    }
+};
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_DUALSTRING_H
@@ -0,0 +1,310 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF16INTERNER_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF16INTERNER_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Interning Table for Converted UTF-16 Strings
+//          ============================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module providing Utf16Interner, which converts UTF-8 strings
+// to UTF-16 keeping a single, deduplicated copy of each distinct value.
+//
+// Interning returns a lightweight handle (InternedUtf16) to the unique UTF-16
+// copy, instead of a new CStringW: highly repetitive text is converted only
+// once per distinct value, and stored only once in memory.
+//
+// The UTF-16 copies (and the UTF-8 keys) are stored in arenas of large
+// memory blocks, so interning doesn't cause an allocation per string.
+// The table is split in independently locked shards, so it can be used
+// concurrently by many threads.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"       // Core conversion functions
+
+#include <cstddef>          // For std::size_t
+#include <cstdint>          // For std::uint64_t
+#include <cstring>          // For std::memcmp, std::memcpy
+#include <memory>           // For std::unique_ptr
+#include <mutex>            // For std::mutex, std::lock_guard
+#include <string>           // For std::string
+#include <unordered_map>    // For std::unordered_multimap
+#include <utility>          // For std::make_pair
+#include <vector>           // For std::vector
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+//------------------------------------------------------------------------------
+// Handle to an interned UTF-16 string.
+//
+// The pointed string is NUL-terminated, and valid as long as the interner
+// that returned the handle is alive.
+// Handles returned by the same interner are equal if and only if they refer
+// to the same string, so they can be compared by pointer.
+//------------------------------------------------------------------------------
+class InternedUtf16
+{
+public:
+    InternedUtf16() noexcept
+        : m_data(GIOVANNI_DICANIO_UTF16_LITERAL(""))
+        , m_length(0)
+    {}
+
+    // Pointer to the NUL-terminated UTF-16 string
+    const Utf16Char* Data() const noexcept
+    {
+        return m_data;
+    }
+
+    // Length of the string, in UTF-16 code units (not including the terminating NUL)
+    std::size_t Length() const noexcept
+    {
+        return m_length;
+    }
+
+    bool IsEmpty() const noexcept
+    {
+        return m_length == 0;
+    }
+
+    // Copy the interned string into a CStringW
+    CStringW ToCStringW() const
+    {
+        return CStringW(m_data, static_cast<int>(m_length));
+    }
+
+    friend bool operator==(const InternedUtf16& lhs, const InternedUtf16& rhs) noexcept
+    {
+        return lhs.m_data == rhs.m_data;
+    }
+
+    friend bool operator!=(const InternedUtf16& lhs, const InternedUtf16& rhs) noexcept
+    {
+        return lhs.m_data != rhs.m_data;
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    const Utf16Char* m_data;
+    std::size_t m_length;
+
+    InternedUtf16(const Utf16Char* data, std::size_t length) noexcept
+        : m_data(data)
+        , m_length(length)
+    {}
+
+    friend class Utf16Interner;
+};
+
+
+//------------------------------------------------------------------------------
+// Interning UTF-8 -> UTF-16 converter.
+//
+// All the member functions can be called concurrently from several threads.
+// On conversion errors, throws Utf8ConversionException.
+//------------------------------------------------------------------------------
+class Utf16Interner
+{
+public:
+
+    // Default number of independently locked shards
+    static constexpr std::size_t kDefaultShardCount = 16;
+
+    explicit Utf16Interner(std::size_t shardCount = kDefaultShardCount)
+        : m_shardCount(shardCount)
+    {
+        ATLASSERT(shardCount > 0);
+        m_shards.reset(new Shard[shardCount]);
+    }
+
+    Utf16Interner(const Utf16Interner&) = delete;
+    Utf16Interner& operator=(const Utf16Interner&) = delete;
+
+    //
+    // Return the interned UTF-16 conversion of the given UTF-8 string.
+    // UTF-8 strings are specified using an STL-style [start, finish) range.
+    //
+    InternedUtf16 Intern(const char* utf8Start, const char* utf8Finish)
+    {
+        ATLASSERT(utf8Start <= utf8Finish);
+
+        if (utf8Start == utf8Finish)
+        {
+            return InternedUtf16();
+        }
+
+        const std::size_t length = utf8Finish - utf8Start;
+        const std::uint64_t hash = detail::HashBytes(utf8Start, length);
+        Shard& shard = m_shards[(hash >> 32) % m_shardCount];
+
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            const Entry* const entry = shard.Find(hash, utf8Start, length);
+            if (entry != nullptr)
+            {
+                return entry->utf16;
+            }
+        }
+
+        // Convert without holding the lock
+        const CStringW utf16 = Utf16FromUtf8(utf8Start, utf8Finish);
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const Entry* const entry = shard.Find(hash, utf8Start, length);
+        if (entry != nullptr)
+        {
+            // Interned meanwhile by another thread
+            return entry->utf16;
+        }
+
+        // Copy the key and the converted string in the shard's arenas
+        char * const key = static_cast<char*>(shard.arena.Allocate(length, alignof(char)));
+        std::memcpy(key, utf8Start, length);
+
+        const std::size_t utf16Length = utf16.GetLength();
+        Utf16Char * const data = static_cast<Utf16Char*>(
+            shard.arena.Allocate((utf16Length + 1) * sizeof(Utf16Char), alignof(Utf16Char)));
+        std::memcpy(data, utf16.GetString(), (utf16Length + 1) * sizeof(Utf16Char));
+
+        shard.entries.push_back(Entry{ key, length, InternedUtf16(data, utf16Length) });
+        shard.index.insert(std::make_pair(hash, shard.entries.size() - 1));
+        return shard.entries.back().utf16;
+    }
+
+    // Return the interned UTF-16 conversion of the given UTF-8 string
+    InternedUtf16 Intern(const std::string& utf8)
+    {
+        const char * const utf8Start = utf8.data();
+        return Intern(utf8Start, utf8Start + utf8.length());
+    }
+
+    // Number of distinct interned strings
+    std::size_t Size() const
+    {
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < m_shardCount; ++i)
+        {
+            std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+            size += m_shards[i].entries.size();
+        }
+        return size;
+    }
+
+    // Memory reserved by the arenas, in bytes
+    std::size_t ArenaBytes() const
+    {
+        std::size_t bytes = 0;
+        for (std::size_t i = 0; i < m_shardCount; ++i)
+        {
+            std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+            bytes += m_shards[i].arena.ReservedBytes();
+        }
+        return bytes;
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+
+    //
+    // Simple bump-pointer arena: memory is carved out of large blocks,
+    // and released only when the arena is destroyed.
+    //
+    class Arena
+    {
+    public:
+        static constexpr std::size_t kBlockSize = 64 * 1024;
+
+        Arena() noexcept
+            : m_next(nullptr)
+            , m_available(0)
+            , m_reserved(0)
+        {}
+
+        void* Allocate(std::size_t bytes, std::size_t alignment)
+        {
+            std::size_t padding = (alignment - reinterpret_cast<std::uintptr_t>(m_next) % alignment) % alignment;
+            if (padding + bytes > m_available)
+            {
+                // Strings larger than a block get their own block
+                const std::size_t blockSize = (bytes > kBlockSize) ? bytes : kBlockSize;
+                m_blocks.emplace_back(new unsigned char[blockSize]);
+                m_next = m_blocks.back().get();
+                m_available = blockSize;
+                m_reserved += blockSize;
+                padding = 0;
+            }
+
+            void * const result = m_next + padding;
+            m_next += padding + bytes;
+            m_available -= padding + bytes;
+            return result;
+        }
+
+        std::size_t ReservedBytes() const noexcept
+        {
+            return m_reserved;
+        }
+
+    private:
+        std::vector<std::unique_ptr<unsigned char[]>> m_blocks;
+        unsigned char* m_next;
+        std::size_t m_available;
+        std::size_t m_reserved;
+    };
+
+    struct Entry
+    {
+        const char* utf8;           // input bytes (key), stored in the arena
+        std::size_t utf8Length;
+        InternedUtf16 utf16;        // interned conversion, stored in the arena
+    };
+
+    // Independently locked portion of the table
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        Arena arena;
+        std::vector<Entry> entries;
+
+        // Indexes in 'entries', by hash (colliding hashes are disambiguated comparing bytes)
+        std::unordered_multimap<std::uint64_t, std::size_t, detail::IdentityHash> index;
+
+        // Find the entry with the given input bytes (lock must be held)
+        const Entry* Find(std::uint64_t hash, const char* utf8, std::size_t length) const
+        {
+            const auto range = index.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                const Entry& entry = entries[it->second];
+                if (entry.utf8Length == length && std::memcmp(entry.utf8, utf8, length) == 0)
+                {
+                    return &entry;
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    std::unique_ptr<Shard[]> m_shards;
+    std::size_t m_shardCount;
+};
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF16INTERNER_H
@@ -0,0 +1,247 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF16MIRROR_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF16MIRROR_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Incremental UTF-16 Mirror of an Edited UTF-8 Buffer
+//          ===================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module providing Utf16Mirror, which keeps a UTF-8 text buffer
+// together with its UTF-16 conversion (CStringW) and the offset map between
+// the two (see Utf8OffsetMap.h).
+//
+// When the UTF-8 text is edited, only the code points touched by the edit are
+// converted again, and the result is spliced into the UTF-16 mirror; the
+// offset map is patched as well, instead of being rebuilt from scratch.
+// So the conversion work scales with the size of the edit, not with the size
+// of the whole document.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"       // Core conversion functions
+#include "Utf8OffsetMap.h"  // Utf8Utf16OffsetMap
+
+#include <cstddef>          // For std::size_t
+#include <cstring>          // For std::memcpy, std::memmove
+#include <limits>           // For std::numeric_limits
+#include <string>           // For std::string
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+//------------------------------------------------------------------------------
+// UTF-8 text buffer, with its UTF-16 mirror kept up to date incrementally.
+//
+// Errors (e.g. edits introducing invalid UTF-8 sequences, or out-of-range
+// edit offsets) are signaled throwing Utf8ConversionException; in that case,
+// the content of the mirror is left unchanged.
+//------------------------------------------------------------------------------
+class Utf16Mirror
+{
+public:
+
+    // Create an empty mirror, with the given distance between offset map checkpoints
+    explicit Utf16Mirror(std::size_t stride = Utf8Utf16OffsetMap::kDefaultStride)
+        : m_offsetMap(stride)
+    {}
+
+    // Create a mirror of the given UTF-8 text
+    explicit Utf16Mirror(const std::string& utf8,
+                         std::size_t stride = Utf8Utf16OffsetMap::kDefaultStride)
+        : m_offsetMap(stride)
+    {
+        Assign(utf8.data(), utf8.data() + utf8.length());
+    }
+
+    // Replace the whole content, doing a full conversion
+    void Assign(const char* utf8Start, const char* utf8Finish)
+    {
+        Utf8Utf16OffsetMap offsetMap(m_offsetMap.Stride());
+        CStringW utf16 = Utf16FromUtf8(utf8Start, utf8Finish, offsetMap);
+
+        m_utf8.assign(utf8Start, utf8Finish);
+        m_utf16 = utf16;
+        m_offsetMap.Swap(offsetMap);
+    }
+
+    //
+    // Replace 'removedLength' bytes starting at 'utf8Offset' with the UTF-8 bytes
+    // in [insertedStart, insertedFinish).
+    //
+    // The edit offsets don't need to be at code point boundaries: the edit is
+    // widened to the enclosing code points, and the result is validated.
+    //
+    void Edit(std::size_t utf8Offset, std::size_t removedLength,
+              const char* insertedStart, const char* insertedFinish)
+    {
+        ATLASSERT(insertedStart <= insertedFinish);
+
+        if (utf8Offset > m_utf8.length() || removedLength > m_utf8.length() - utf8Offset)
+        {
+            throw Utf8ConversionException(
+                "Edit range out of the text bounds.\n",
+                ERROR_INVALID_PARAMETER);
+        }
+
+        // Widen the edited range to the enclosing code point boundaries
+        const std::size_t begin = CodePointStart(utf8Offset);
+        const std::size_t oldEnd = CodePointEnd(utf8Offset + removedLength);
+
+        // Bytes replacing the old [begin, oldEnd) range
+        std::string replacement;
+        replacement.reserve((utf8Offset - begin) + (insertedFinish - insertedStart)
+                            + (oldEnd - utf8Offset - removedLength));
+        replacement.append(m_utf8, begin, utf8Offset - begin);
+        replacement.append(insertedStart, insertedFinish);
+        replacement.append(m_utf8, utf8Offset + removedLength, oldEnd - utf8Offset - removedLength);
+
+        // Convert (and validate) only the replacement
+        const CStringW replacementUtf16 = Utf16FromUtf8(replacement);
+
+        const std::size_t utf16Begin = m_offsetMap.Utf16OffsetFromUtf8(m_utf8.data(), begin);
+        const std::size_t oldUtf16End = m_offsetMap.Utf16OffsetFromUtf8(m_utf8.data(), oldEnd);
+        const std::size_t newUtf16End = utf16Begin + replacementUtf16.GetLength();
+
+        const std::size_t newUtf16Length = m_utf16.GetLength() - (oldUtf16End - utf16Begin)
+                                           + replacementUtf16.GetLength();
+        if (newUtf16Length > static_cast<size_t>((std::numeric_limits<int>::max)()))
+        {
+            throw Utf8ConversionException(
+                "Resulting string too long: size_t-length doesn't fit into int.\n",
+                detail::InputTooLongTag());
+        }
+
+        // Allocate everything up front, so that the mirror is left unchanged
+        // if an allocation fails: the removed bytes are saved to undo the UTF-8
+        // splice, and the capacity reserved below makes both splices non-throwing
+        const std::string removed(m_utf8, begin, oldEnd - begin);
+        const std::size_t newUtf8Length = m_utf8.length() - removed.length() + replacement.length();
+        m_utf8.reserve((newUtf8Length > m_utf8.length()) ? newUtf8Length : m_utf8.length());
+        m_utf16.Preallocate((static_cast<int>(newUtf16Length) > m_utf16.GetLength())
+                            ? static_cast<int>(newUtf16Length) : m_utf16.GetLength());
+
+        // Splice the UTF-8 text
+        m_utf8.replace(begin, removed.length(), replacement);
+
+        // Patch the offset map, which walks the new UTF-8 text
+        try
+        {
+            m_offsetMap.Splice(m_utf8.data(),
+                               begin, oldEnd, begin + replacement.length(),
+                               utf16Begin, oldUtf16End, newUtf16End);
+        }
+        catch (...)
+        {
+            m_utf8.replace(begin, replacement.length(), removed);
+            throw;
+        }
+
+        // Splice the UTF-16 mirror
+        SpliceUtf16(utf16Begin, oldUtf16End, replacementUtf16, static_cast<int>(newUtf16Length));
+    }
+
+    // Replace 'removedLength' bytes starting at 'utf8Offset' with the given UTF-8 text
+    void Edit(std::size_t utf8Offset, std::size_t removedLength, const std::string& inserted)
+    {
+        const char * const insertedStart = inserted.data();
+        Edit(utf8Offset, removedLength, insertedStart, insertedStart + inserted.length());
+    }
+
+    // The UTF-8 text
+    const std::string& Utf8() const noexcept
+    {
+        return m_utf8;
+    }
+
+    // The UTF-16 mirror of the text
+    const CStringW& Utf16() const noexcept
+    {
+        return m_utf16;
+    }
+
+    // Map between UTF-8 and UTF-16 offsets of the text
+    const Utf8Utf16OffsetMap& OffsetMap() const noexcept
+    {
+        return m_offsetMap;
+    }
+
+    // Translate a UTF-8 byte offset to the corresponding UTF-16 code unit offset
+    std::size_t Utf16OffsetFromUtf8(std::size_t utf8Offset) const noexcept
+    {
+        return m_offsetMap.Utf16OffsetFromUtf8(m_utf8.data(), utf8Offset);
+    }
+
+    // Translate a UTF-16 code unit offset to the corresponding UTF-8 byte offset
+    std::size_t Utf8OffsetFromUtf16(std::size_t utf16Offset) const noexcept
+    {
+        return m_offsetMap.Utf8OffsetFromUtf16(m_utf8.data(), utf16Offset);
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    std::string m_utf8;
+    CStringW m_utf16;
+    Utf8Utf16OffsetMap m_offsetMap;
+
+    // Beginning of the code point containing the given UTF-8 offset
+    std::size_t CodePointStart(std::size_t utf8Offset) const noexcept
+    {
+        while (utf8Offset > 0
+               && utf8Offset < m_utf8.length()
+               && (static_cast<unsigned char>(m_utf8[utf8Offset]) & 0xC0) == 0x80)
+        {
+            --utf8Offset;
+        }
+        return utf8Offset;
+    }
+
+    // End of the code point containing the byte preceding the given UTF-8 offset
+    std::size_t CodePointEnd(std::size_t utf8Offset) const noexcept
+    {
+        while (utf8Offset < m_utf8.length()
+               && (static_cast<unsigned char>(m_utf8[utf8Offset]) & 0xC0) == 0x80)
+        {
+            ++utf8Offset;
+        }
+        return utf8Offset;
+    }
+
+    // Replace the [begin, oldEnd) code units of the UTF-16 mirror with 'replacement';
+    // doesn't allocate, if the mirror buffer was preallocated for newLength code units
+    void SpliceUtf16(std::size_t begin, std::size_t oldEnd,
+                     const CStringW& replacement, int newLength)
+    {
+        const int oldLength = m_utf16.GetLength();
+        const std::size_t tailLength = oldLength - oldEnd;
+
+        // GetBuffer preserves the current content
+        Utf16Char * const buffer = m_utf16.GetBuffer((newLength > oldLength) ? newLength : oldLength);
+        ATLASSERT(buffer != nullptr);
+
+        std::memmove(buffer + begin + replacement.GetLength(),
+                     buffer + oldEnd,
+                     tailLength * sizeof(Utf16Char));
+        std::memcpy(buffer + begin,
+                    replacement.GetString(),
+                    replacement.GetLength() * sizeof(Utf16Char));
+
+        m_utf16.ReleaseBuffer(newLength);
+    }
+};
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF16MIRROR_H
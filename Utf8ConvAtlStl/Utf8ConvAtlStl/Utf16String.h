@@ -0,0 +1,348 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF16STRING_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF16STRING_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Portable Reference-Counted UTF-16 String
+//          ========================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module providing Utf16String, a char16_t string class offering
+// the subset of the CStringW interface used by the conversion functions.
+//
+// Utf8Conv.h uses it in place of CStringW when ATL is not available (e.g. in
+// Linux builds): in that case, CStringW is a typedef for Utf16String.
+//
+// As with ATL's CString, the string data is reference-counted and shared by
+// copies (so copying a string is O(1)), and copied on write: GetBuffer()
+// returns a private, uninitialized-beyond-the-current-length buffer that
+// can be filled in place, and ReleaseBuffer() sets the final length.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <atomic>       // For std::atomic
+#include <cassert>      // For assert
+#include <cstddef>      // For std::size_t
+#include <cstring>      // For std::memcpy, std::memcmp
+#include <limits>       // For std::numeric_limits
+#include <new>          // For operator new, placement new
+#include <stdexcept>    // For std::length_error
+#include <string>       // For std::char_traits
+
+// Without ATL, debug checks are done using the standard assert
+#ifndef ATLASSERT
+#define ATLASSERT(expr) assert(expr)
+#endif // ATLASSERT
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+//------------------------------------------------------------------------------
+// Reference-counted, copy-on-write UTF-16 string.
+//
+// Lengths are expressed in char16_t code units, using int as CString does.
+// Distinct Utf16String objects can be used concurrently from several threads,
+// even if they share the same data.
+//------------------------------------------------------------------------------
+class Utf16String
+{
+public:
+
+    typedef char16_t XCHAR;
+
+    Utf16String() noexcept
+        : m_data(nullptr)
+    {}
+
+    // Create from a NUL-terminated string
+    Utf16String(const char16_t* psz)
+        : m_data(nullptr)
+    {
+        if (psz != nullptr)
+        {
+            Assign(psz, CheckedLength(std::char_traits<char16_t>::length(psz)));
+        }
+    }
+
+    // Create from the first 'length' code units of the given string
+    Utf16String(const char16_t* pch, int length)
+        : m_data(nullptr)
+    {
+        ATLASSERT(length >= 0);
+        Assign(pch, length);
+    }
+
+    Utf16String(const Utf16String& other) noexcept
+        : m_data(other.m_data)
+    {
+        if (m_data != nullptr)
+        {
+            m_data->refCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    Utf16String(Utf16String&& other) noexcept
+        : m_data(other.m_data)
+    {
+        other.m_data = nullptr;
+    }
+
+    ~Utf16String()
+    {
+        Release(m_data);
+    }
+
+    Utf16String& operator=(const Utf16String& other) noexcept
+    {
+        if (m_data != other.m_data)
+        {
+            StringData * const old = m_data;
+            m_data = other.m_data;
+            if (m_data != nullptr)
+            {
+                m_data->refCount.fetch_add(1, std::memory_order_relaxed);
+            }
+            Release(old);
+        }
+        return *this;
+    }
+
+    Utf16String& operator=(Utf16String&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Release(m_data);
+            m_data = other.m_data;
+            other.m_data = nullptr;
+        }
+        return *this;
+    }
+
+    Utf16String& operator=(const char16_t* psz)
+    {
+        return *this = Utf16String(psz);
+    }
+
+    // Length of the string, in char16_ts (not including the terminating NUL)
+    int GetLength() const noexcept
+    {
+        return (m_data != nullptr) ? m_data->length : 0;
+    }
+
+    bool IsEmpty() const noexcept
+    {
+        return GetLength() == 0;
+    }
+
+    // Pointer to the NUL-terminated string
+    const char16_t* GetString() const noexcept
+    {
+        return (m_data != nullptr) ? m_data->Chars() : u"";
+    }
+
+    operator const char16_t*() const noexcept
+    {
+        return GetString();
+    }
+
+    char16_t GetAt(int index) const noexcept
+    {
+        ATLASSERT(index >= 0 && index < GetLength());
+        return GetString()[index];
+    }
+
+    char16_t operator[](int index) const noexcept
+    {
+        return GetAt(index);
+    }
+
+    // Make the string empty, releasing its data
+    void Empty() noexcept
+    {
+        Release(m_data);
+        m_data = nullptr;
+    }
+
+    //
+    // Return a private, writable buffer of at least 'minBufferLength' char16_ts
+    // (plus the terminating NUL), preserving the current contents.
+    // The code units past the current length are uninitialized.
+    // Call ReleaseBuffer() when done writing.
+    //
+    char16_t* GetBuffer(int minBufferLength)
+    {
+        ATLASSERT(minBufferLength >= 0);
+
+        if (m_data == nullptr
+            || m_data->refCount.load(std::memory_order_acquire) != 1
+            || m_data->allocLength < minBufferLength)
+        {
+            Reallocate((minBufferLength > GetLength()) ? minBufferLength : GetLength());
+        }
+        return m_data->Chars();
+    }
+
+    char16_t* GetBuffer()
+    {
+        return GetBuffer(GetLength());
+    }
+
+    //
+    // Set the length of the string written in the buffer returned by GetBuffer().
+    // With the default -1 argument, the string is assumed NUL-terminated.
+    //
+    void ReleaseBuffer(int newLength = -1) noexcept
+    {
+        if (m_data == nullptr)
+        {
+            ATLASSERT(newLength <= 0);
+            return;
+        }
+
+        if (newLength == -1)
+        {
+            newLength = static_cast<int>(std::char_traits<char16_t>::length(m_data->Chars()));
+        }
+
+        ATLASSERT(newLength >= 0 && newLength <= m_data->allocLength);
+        m_data->length = newLength;
+        m_data->Chars()[newLength] = 0;
+    }
+
+    // Make sure the buffer can store at least 'length' char16_ts without reallocations
+    void Preallocate(int length)
+    {
+        GetBuffer(length);
+        ReleaseBuffer(GetLength());
+    }
+
+    friend bool operator==(const Utf16String& lhs, const Utf16String& rhs) noexcept
+    {
+        return lhs.m_data == rhs.m_data
+            || (lhs.GetLength() == rhs.GetLength()
+                && std::memcmp(lhs.GetString(), rhs.GetString(),
+                               lhs.GetLength() * sizeof(char16_t)) == 0);
+    }
+
+    friend bool operator!=(const Utf16String& lhs, const Utf16String& rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+
+    // As with CStringW, compares up to the first NUL, without reading past the end of rhs
+    friend bool operator==(const Utf16String& lhs, const char16_t* rhs) noexcept
+    {
+        const char16_t* chars = lhs.GetString();
+        while (*chars == *rhs && *chars != 0)
+        {
+            ++chars;
+            ++rhs;
+        }
+        return *chars == *rhs;
+    }
+
+    friend bool operator!=(const Utf16String& lhs, const char16_t* rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+
+    //
+    // Header of the shared string data: the NUL-terminated char16_t buffer
+    // immediately follows it, in the same memory block.
+    //
+    struct StringData
+    {
+        std::atomic<int> refCount;
+        int length;         // in char16_ts, not including the terminating NUL
+        int allocLength;    // in char16_ts, not including the terminating NUL
+
+        char16_t* Chars() noexcept
+        {
+            return reinterpret_cast<char16_t*>(this + 1);
+        }
+    };
+
+    // nullptr for empty strings
+    StringData* m_data;
+
+    // Lengths are stored in int, as CString does
+    static int CheckedLength(std::size_t length)
+    {
+        if (length > static_cast<std::size_t>((std::numeric_limits<int>::max)()))
+        {
+            throw std::length_error("Utf16String too long.");
+        }
+        return static_cast<int>(length);
+    }
+
+    static StringData* Allocate(int allocLength)
+    {
+        if (static_cast<std::size_t>(allocLength) >
+            ((std::numeric_limits<std::size_t>::max)() - sizeof(StringData)) / sizeof(char16_t) - 1)
+        {
+            throw std::length_error("Utf16String too long.");
+        }
+
+        void * const block = ::operator new(
+            sizeof(StringData) + (static_cast<std::size_t>(allocLength) + 1) * sizeof(char16_t));
+        StringData * const data = new (block) StringData;
+        data->refCount.store(1, std::memory_order_relaxed);
+        data->length = 0;
+        data->allocLength = allocLength;
+        data->Chars()[0] = 0;
+        return data;
+    }
+
+    static void Release(StringData* data) noexcept
+    {
+        if (data != nullptr && data->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            data->~StringData();
+            ::operator delete(data);
+        }
+    }
+
+    // Replace the data with a private copy of at least 'allocLength' char16_ts
+    void Reallocate(int allocLength)
+    {
+        StringData * const data = Allocate(allocLength);
+        const int length = GetLength();
+        std::memcpy(data->Chars(), GetString(), (length + 1) * sizeof(char16_t));
+        data->length = length;
+
+        Release(m_data);
+        m_data = data;
+    }
+
+    void Assign(const char16_t* pch, int length)
+    {
+        if (length == 0)
+        {
+            return;
+        }
+
+        m_data = Allocate(length);
+        std::memcpy(m_data->Chars(), pch, length * sizeof(char16_t));
+        m_data->length = length;
+        m_data->Chars()[length] = 0;
+    }
+};
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF16STRING_H
@@ -0,0 +1,361 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CODEPOINTS_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CODEPOINTS_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Code-Point Iterators over UTF-8 and UTF-16 Buffers
+//          ==================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module to walk the code points stored in UTF-8 and UTF-16
+// buffers, without converting them (and allocating memory) first.
+//
+// The iterators are bidirectional, decode on demand, and work with the
+// standard algorithms (std::find, std::count_if, std::distance, ...).
+// The input is specified using the same STL-style [start, finish) ranges
+// accepted by the conversion functions in Utf8Conv.h.
+//
+// Invalid sequences are detected using the same validation rules of the
+// conversion functions, and signaled throwing Utf8ConversionException.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Utf8ConversionException and decoding helpers
+
+#include <cstddef>      // For std::ptrdiff_t, std::size_t
+#include <iterator>     // For std::bidirectional_iterator_tag
+#include <string>       // For std::string
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+namespace detail
+{
+
+//
+// Encoding-specific operations used by CodePointIterator, selected by
+// the code unit type: char for UTF-8, Utf16Char for UTF-16.
+//
+
+inline char32_t DecodeForward(const char*& pos, const char* finish)
+{
+    const char32_t codePoint = DecodeUtf8(pos, finish);
+    if (codePoint == kInvalidCodePoint)
+    {
+        ThrowInvalidUtf8();
+    }
+    return codePoint;
+}
+
+inline char32_t DecodeBackward(const char* start, const char*& pos)
+{
+    const char32_t codePoint = DecodeUtf8Backward(start, pos);
+    if (codePoint == kInvalidCodePoint)
+    {
+        ThrowInvalidUtf8();
+    }
+    return codePoint;
+}
+
+inline const char* SkipAscii(const char* pos, const char* finish) noexcept
+{
+    return SkipAsciiUtf8(pos, finish);
+}
+
+inline char32_t DecodeForward(const Utf16Char*& pos, const Utf16Char* finish)
+{
+    const char32_t codePoint = DecodeUtf16(pos, finish);
+    if (codePoint == kInvalidCodePoint)
+    {
+        ThrowInvalidUtf16();
+    }
+    return codePoint;
+}
+
+inline char32_t DecodeBackward(const Utf16Char* start, const Utf16Char*& pos)
+{
+    const char32_t codePoint = DecodeUtf16Backward(start, pos);
+    if (codePoint == kInvalidCodePoint)
+    {
+        ThrowInvalidUtf16();
+    }
+    return codePoint;
+}
+
+inline const Utf16Char* SkipAscii(const Utf16Char* pos, const Utf16Char* finish) noexcept
+{
+    return SkipAsciiUtf16(pos, finish);
+}
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// Bidirectional iterator over the code points stored in a [start, finish)
+// range of code units.
+//
+// CharT is char for UTF-8 input, and Utf16Char for UTF-16 input.
+//
+// The iterator doesn't allocate memory: it just stores pointers into the
+// input buffer, and the code point at the current position, decoded when
+// the iterator is moved.
+// Dereferencing returns the code point by value (char32_t).
+//
+// On invalid input sequences, throws Utf8ConversionException.
+//------------------------------------------------------------------------------
+template <typename CharT>
+class CodePointIterator
+{
+public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef char32_t                        value_type;
+    typedef std::ptrdiff_t                  difference_type;
+    typedef const char32_t*                 pointer;
+    typedef char32_t                        reference;
+
+    // Create a singular iterator
+    CodePointIterator() noexcept
+        : m_start(nullptr)
+        , m_position(nullptr)
+        , m_next(nullptr)
+        , m_finish(nullptr)
+        , m_codePoint(0)
+    {}
+
+    // Create an iterator pointing to 'position' inside the [start, finish) range.
+    // 'position' must be at the beginning of a code point, or equal to 'finish'.
+    CodePointIterator(const CharT* start, const CharT* position, const CharT* finish)
+        : m_start(start)
+        , m_position(position)
+        , m_next(position)
+        , m_finish(finish)
+        , m_codePoint(0)
+    {
+        ATLASSERT(start <= position && position <= finish);
+        DecodeCurrent();
+    }
+
+    // Code point at the current position
+    char32_t operator*() const noexcept
+    {
+        ATLASSERT(m_position != m_finish);
+        return m_codePoint;
+    }
+
+    CodePointIterator& operator++()
+    {
+        ATLASSERT(m_position != m_finish);
+        m_position = m_next;
+        DecodeCurrent();
+        return *this;
+    }
+
+    CodePointIterator operator++(int)
+    {
+        CodePointIterator old(*this);
+        ++(*this);
+        return old;
+    }
+
+    CodePointIterator& operator--()
+    {
+        ATLASSERT(m_position != m_start);
+        const CharT* previous = m_position;
+        m_codePoint = detail::DecodeBackward(m_start, previous);
+        m_next = m_position;
+        m_position = previous;
+        return *this;
+    }
+
+    CodePointIterator operator--(int)
+    {
+        CodePointIterator old(*this);
+        --(*this);
+        return old;
+    }
+
+    // Pointer to the first code unit of the current code point
+    const CharT* Position() const noexcept
+    {
+        return m_position;
+    }
+
+    // Offset of the current code point, in code units, from the start of the range
+    std::ptrdiff_t Offset() const noexcept
+    {
+        return m_position - m_start;
+    }
+
+    // Move forward to the first non-ASCII code point (or to the end of the range),
+    // checking several code units at a time.
+    CodePointIterator& SkipAscii()
+    {
+        if (m_position != m_finish && m_codePoint < 0x80)
+        {
+            m_position = detail::SkipAscii(m_position, m_finish);
+            m_next = m_position;
+            DecodeCurrent();
+        }
+        return *this;
+    }
+
+    friend bool operator==(const CodePointIterator& lhs, const CodePointIterator& rhs) noexcept
+    {
+        return lhs.m_position == rhs.m_position;
+    }
+
+    friend bool operator!=(const CodePointIterator& lhs, const CodePointIterator& rhs) noexcept
+    {
+        return lhs.m_position != rhs.m_position;
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    const CharT* m_start;       // beginning of the input range
+    const CharT* m_position;    // first code unit of the current code point
+    const CharT* m_next;        // first code unit past the current code point
+    const CharT* m_finish;      // end of the input range
+    char32_t m_codePoint;       // decoded current code point
+
+    // Decode the code point starting at m_position (if any)
+    void DecodeCurrent()
+    {
+        if (m_position != m_finish)
+        {
+            m_next = m_position;
+            m_codePoint = detail::DecodeForward(m_next, m_finish);
+        }
+    }
+};
+
+
+typedef CodePointIterator<char>    Utf8CodePointIterator;
+typedef CodePointIterator<Utf16Char> Utf16CodePointIterator;
+
+
+//------------------------------------------------------------------------------
+// Lightweight range view over the code points stored in a [start, finish)
+// range of code units. Doesn't own the input buffer.
+//------------------------------------------------------------------------------
+template <typename CharT>
+class CodePointView
+{
+public:
+    typedef CodePointIterator<CharT> iterator;
+    typedef CodePointIterator<CharT> const_iterator;
+
+    CodePointView(const CharT* start, const CharT* finish) noexcept
+        : m_start(start)
+        , m_finish(finish)
+    {
+        ATLASSERT(start <= finish);
+    }
+
+    iterator begin() const
+    {
+        return iterator(m_start, m_start, m_finish);
+    }
+
+    iterator end() const
+    {
+        return iterator(m_start, m_finish, m_finish);
+    }
+
+    bool empty() const noexcept
+    {
+        return m_start == m_finish;
+    }
+
+    // Count the code points in the range, skipping ASCII runs in bulk.
+    // On invalid input sequences, throws Utf8ConversionException.
+    std::size_t CountCodePoints() const
+    {
+        std::size_t count = 0;
+        const CharT* pos = m_start;
+        while (pos != m_finish)
+        {
+            const CharT* const asciiEnd = detail::SkipAscii(pos, m_finish);
+            count += static_cast<std::size_t>(asciiEnd - pos);
+            pos = asciiEnd;
+
+            if (pos != m_finish)
+            {
+                detail::DecodeForward(pos, m_finish);
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    // Return an iterator to the first occurrence of the given code point,
+    // or end() if not found. ASCII runs are skipped in bulk when searching
+    // for a non-ASCII code point.
+    iterator Find(char32_t codePoint) const
+    {
+        iterator it = begin();
+        const iterator last = end();
+        while (it != last && *it != codePoint)
+        {
+            ++it;
+            if (codePoint >= 0x80)
+            {
+                it.SkipAscii();
+            }
+        }
+        return it;
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    const CharT* m_start;
+    const CharT* m_finish;
+};
+
+
+typedef CodePointView<char>    Utf8CodePointView;
+typedef CodePointView<Utf16Char> Utf16CodePointView;
+
+
+//------------------------------------------------------------------------------
+// Create views over the code points of UTF-8 and UTF-16 strings.
+// The viewed strings must outlive the returned views.
+//------------------------------------------------------------------------------
+inline Utf8CodePointView CodePointsFromUtf8(const char* utf8Start, const char* utf8Finish)
+{
+    return Utf8CodePointView(utf8Start, utf8Finish);
+}
+
+inline Utf8CodePointView CodePointsFromUtf8(const std::string& utf8)
+{
+    const char * const utf8Start = utf8.data();
+    return Utf8CodePointView(utf8Start, utf8Start + utf8.length());
+}
+
+inline Utf16CodePointView CodePointsFromUtf16(const Utf16Char* utf16Start, const Utf16Char* utf16Finish)
+{
+    return Utf16CodePointView(utf16Start, utf16Finish);
+}
+
+inline Utf16CodePointView CodePointsFromUtf16(const CStringW& utf16)
+{
+    const Utf16Char * const utf16Start = utf16.GetString();
+    return Utf16CodePointView(utf16Start, utf16Start + utf16.GetLength());
+}
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CODEPOINTS_H
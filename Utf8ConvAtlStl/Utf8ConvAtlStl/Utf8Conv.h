@@ -30,87 +30,1135 @@
 // In addition, it's also possible to specify views of input source strings
 // using an STL-style [start, finish) range.
 // 
+// When ATL is not available (e.g. in Linux builds), CStringW is replaced by
+// the portable, reference-counted Utf16String class (see Utf16String.h),
+// storing char16_t code units, and the conversions are done by portable code
+// instead of the Win32 APIs. Define GIOVANNI_DICANIO_UTF8CONV_NO_ATL to get
+// the portable implementation in Windows builds too.
+// 
+// Conversions can be sampled, e.g. to capture the shape of a production
+// workload (see Utf8ConvTrace.h): define GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+// before including this header, and install a sampler with
+// SetConversionSampler. Without that macro, no sampling code is compiled in.
+// 
+// Similarly, define GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY to count the
+// calls, bytes, time and errors of the conversions (see Utf8ConvTelemetry.h).
+// 
+// On Linux, when <sys/sdt.h> is available (e.g. from systemtap-sdt-dev),
+// the conversions have USDT probes (provider "utf8conv"), usable with
+// bpftrace, SystemTap or perf without rebuilding: each is a single NOP until
+// a tracer attaches to it. Define GIOVANNI_DICANIO_UTF8CONV_NO_PROBES to
+// leave them out. The probes, and their arguments, are:
+// 
+//      utf16_from_utf8_entry  (const char* input, ptrdiff_t inputLength)
+//      utf16_from_utf8_return (int inputLength, int outputLength)
+//      utf8_from_utf16_entry  (const Utf16Char* input, ptrdiff_t inputLength)
+//      utf8_from_utf16_return (int inputLength, int outputLength)
+//      conversion_error       (DWORD errorCode, const char* message)
+// 
+// Lengths are in code units; inputLength is -1 for NUL-terminated inputs
+// when not known (at entry, and at return with the Win32 APIs). Empty
+// inputs are not probed. The conversions of the helper headers (offset map,
+// allocators, scratch buffers, small strings, 16-bit wchar_t, adaptive)
+// fire the same entry and return probes. conversion_error fires whenever a
+// Utf8ConversionException is created. For example:
+// 
+//      bpftrace -e 'usdt:./app:utf8conv:utf16_from_utf8_return
+//                   { @bytes = hist(arg0); }'
+// 
 // Code developed using Visual Studio 2015.
 // Compiles cleanly at /W4 in both 32-bit builds and 64-bit builds.
 // 
 ////////////////////////////////////////////////////////////////////////////////
 
 
-//
-// Note: I suggest to disable implicit CString conversions between ANSI and Unicode strings,
-// defining the _CSTRING_DISABLE_NARROW_WIDE_CONVERSION preprocessor macro:
-// 
-#ifndef _CSTRING_DISABLE_NARROW_WIDE_CONVERSION
-#define _CSTRING_DISABLE_NARROW_WIDE_CONVERSION
-#endif // _CSTRING_DISABLE_NARROW_WIDE_CONVERSION
+//
+// Note: I suggest to disable implicit CString conversions between ANSI and Unicode strings,
+// defining the _CSTRING_DISABLE_NARROW_WIDE_CONVERSION preprocessor macro:
+// 
+#ifndef _CSTRING_DISABLE_NARROW_WIDE_CONVERSION
+#define _CSTRING_DISABLE_NARROW_WIDE_CONVERSION
+#endif // _CSTRING_DISABLE_NARROW_WIDE_CONVERSION
+
+
+//
+// ATL is used in Windows builds, unless GIOVANNI_DICANIO_UTF8CONV_NO_ATL is defined
+//
+#if defined(_WIN32) && !defined(GIOVANNI_DICANIO_UTF8CONV_NO_ATL) \
+    && !defined(GIOVANNI_DICANIO_UTF8CONV_HAS_ATL)
+#define GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+#endif
+
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+#include <Windows.h>    // Win32 Platform SDK main header        
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+
+//
+// USDT probes, on Linux when <sys/sdt.h> is available
+//
+#if defined(__linux__) && defined(__has_include) && !defined(GIOVANNI_DICANIO_UTF8CONV_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>    // For STAP_PROBE2
+#define GIOVANNI_DICANIO_UTF8CONV_PROBE2(name, arg1, arg2) STAP_PROBE2(utf8conv, name, arg1, arg2)
+#endif // __has_include(<sys/sdt.h>)
+#endif // __linux__ && __has_include && !GIOVANNI_DICANIO_UTF8CONV_NO_PROBES
+
+#ifndef GIOVANNI_DICANIO_UTF8CONV_PROBE2
+#define GIOVANNI_DICANIO_UTF8CONV_PROBE2(name, arg1, arg2) ((void)0)
+#endif
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+#include <atomic>       // For std::atomic (conversion sampling)
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+#include "Utf8ConvTelemetry.h" // Conversion telemetry counters
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+#include <cstddef>      // For std::ptrdiff_t, std::size_t
+#include <cstdint>      // For std::uint32_t, std::uint64_t
+#include <cstring>      // For std::memcpy
+#include <limits>       // For std::numeric_limits
+#include <stdexcept>    // For std::runtime_error
+#include <string>       // For std::string (UTF-8)
+
+// std::string_view is available starting from C++17,
+// char8_t and std::u8string_view starting from C++20
+#if (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L
+#define GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+#include <string_view>  // For std::string_view
+#if defined(__cpp_char8_t) && defined(__cpp_lib_char8_t)
+#define GIOVANNI_DICANIO_UTF8CONV_HAS_CHAR8_T
+#endif // __cpp_char8_t && __cpp_lib_char8_t
+#endif // C++17
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+#include <atldef.h>     // For ATLASSERT
+#include <atlstr.h>     // For CStringW (UTF-16)
+#else
+#include "Utf16String.h" // Portable replacement for CStringW (UTF-16)
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+
+// UTF-16 string literal: L"..." with ATL, u"..." in portable builds
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+#define GIOVANNI_DICANIO_UTF16_LITERAL(s) L ## s
+#else
+#define GIOVANNI_DICANIO_UTF16_LITERAL(s) u ## s
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+// UTF-16 code unit
+typedef wchar_t Utf16Char;
+
+#else
+
+// UTF-16 code unit
+typedef char16_t Utf16Char;
+
+// Portable replacement for ATL's CStringW
+typedef Utf16String CStringW;
+
+// Error codes, with the same values used by the Win32 APIs
+typedef std::uint32_t DWORD;
+constexpr DWORD ERROR_INVALID_PARAMETER      = 87;
+constexpr DWORD ERROR_INSUFFICIENT_BUFFER    = 122;
+constexpr DWORD ERROR_NO_UNICODE_TRANSLATION = 1113;
+
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+
+//==============================================================================
+//                  Forward Declarations and Prototypes
+//==============================================================================
+
+class Utf8ConversionException;
+
+CStringW    Utf16FromUtf8(const std::string& utf8);
+CStringW    Utf16FromUtf8(const char* utf8Start, const char* utf8Finish);
+std::string Utf8FromUtf16(const CStringW& utf16);
+std::string Utf8FromUtf16(const Utf16Char* utf16Start, const Utf16Char* utf16Finish);
+CStringW    Utf16FromUtf8(const char* utf8);
+std::string Utf8FromUtf16(const Utf16Char* utf16);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+CStringW    Utf16FromUtf8(std::string_view utf8);
+std::string Utf8FromUtf16(std::basic_string_view<Utf16Char> utf16);
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_CHAR8_T
+CStringW    Utf16FromUtf8(std::u8string_view utf8);
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_CHAR8_T
+
+
+//==============================================================================
+//                          Implementations
+//==============================================================================
+
+
+namespace detail
+{
+
+// Selects the Utf8ConversionException constructor for lengths that don't fit
+// into an int, to tell them apart from the other ERROR_INVALID_PARAMETER errors
+struct InputTooLongTag {};
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// Exception class representing a conversion error between UTF-8 and UTF-16.
+//------------------------------------------------------------------------------
+class Utf8ConversionException
+    : public std::runtime_error
+{
+public:
+
+    // Create the exception object from error message and error code.
+    Utf8ConversionException(const char* message, DWORD errorCode)
+        : std::runtime_error(message)
+        , m_errorCode(errorCode)
+    {
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(conversion_error, errorCode, message);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        detail::CountConversionError(ErrorKind(errorCode));
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    }
+
+    // Create the exception object from error message and error code.
+    Utf8ConversionException(const std::string& message, DWORD errorCode)
+        : std::runtime_error(message)
+        , m_errorCode(errorCode)
+    {
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(conversion_error, errorCode, message.c_str());
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        detail::CountConversionError(ErrorKind(errorCode));
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    }
+
+    // Create the exception object for a string length that doesn't fit into an int
+    // (error code ERROR_INVALID_PARAMETER).
+    Utf8ConversionException(const char* message, detail::InputTooLongTag)
+        : std::runtime_error(message)
+        , m_errorCode(ERROR_INVALID_PARAMETER)
+    {
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(conversion_error, m_errorCode, message);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        detail::CountConversionError(ConversionErrorKind::InputTooLong);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    }
+
+    // Conversion error code (as returned by GetLastError).
+    DWORD ErrorCode() const
+    {
+        return m_errorCode;
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    // Error code as returned by GetLastError
+    DWORD m_errorCode;
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    static ConversionErrorKind ErrorKind(DWORD errorCode) noexcept
+    {
+        switch (errorCode)
+        {
+        case ERROR_NO_UNICODE_TRANSLATION:  return ConversionErrorKind::InvalidSequence;
+        case ERROR_INVALID_PARAMETER:       return ConversionErrorKind::InvalidArgument;
+        case ERROR_INSUFFICIENT_BUFFER:     return ConversionErrorKind::InsufficientBuffer;
+        default:                            return ConversionErrorKind::Other;
+        }
+    }
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+};
+
+
+//------------------------------------------------------------------------------
+// Implementation details, shared with the helper headers built on top of
+// this module (e.g. the code-point iterators in Utf8CodePoints.h).
+// Not meant to be used directly.
+//------------------------------------------------------------------------------
+namespace detail
+{
+
+// Returned by the decoding functions on invalid input sequences
+constexpr char32_t kInvalidCodePoint = 0xFFFFFFFF;
+
+//
+// Decode the code point starting at 'pos' in the UTF-8 range [pos, finish).
+// On success, 'pos' is advanced past the decoded sequence.
+// On invalid input, kInvalidCodePoint is returned and 'pos' is left unchanged.
+//
+// The validation rules are the same ones applied by MultiByteToWideChar
+// with MB_ERR_INVALID_CHARS: overlong forms, encoded surrogates, code points
+// above U+10FFFF, stray continuation bytes and truncated sequences are rejected.
+//
+inline char32_t DecodeUtf8(const char*& pos, const char* finish) noexcept
+{
+    ATLASSERT(pos < finish);
+
+    const unsigned char* const p = reinterpret_cast<const unsigned char*>(pos);
+    const unsigned char lead = p[0];
+
+    // Fast path for ASCII
+    if (lead < 0x80)
+    {
+        ++pos;
+        return lead;
+    }
+
+    // Allowed range for the second byte (see Table 3-7 in the Unicode Standard)
+    unsigned char secondMin = 0x80;
+    unsigned char secondMax = 0xBF;
+
+    std::ptrdiff_t length = 0;
+    char32_t codePoint = 0;
+    if (lead < 0xC2)
+    {
+        // Stray continuation byte, or overlong 2-byte sequence
+        return kInvalidCodePoint;
+    }
+    else if (lead < 0xE0)
+    {
+        length = 2;
+        codePoint = lead & 0x1F;
+    }
+    else if (lead < 0xF0)
+    {
+        length = 3;
+        codePoint = lead & 0x0F;
+        if (lead == 0xE0)
+        {
+            secondMin = 0xA0;   // overlong
+        }
+        else if (lead == 0xED)
+        {
+            secondMax = 0x9F;   // surrogates
+        }
+    }
+    else if (lead < 0xF5)
+    {
+        length = 4;
+        codePoint = lead & 0x07;
+        if (lead == 0xF0)
+        {
+            secondMin = 0x90;   // overlong
+        }
+        else if (lead == 0xF4)
+        {
+            secondMax = 0x8F;   // above U+10FFFF
+        }
+    }
+    else
+    {
+        return kInvalidCodePoint;
+    }
+
+    if (finish - pos < length)
+    {
+        // Truncated sequence
+        return kInvalidCodePoint;
+    }
+
+    if (p[1] < secondMin || p[1] > secondMax)
+    {
+        return kInvalidCodePoint;
+    }
+    codePoint = (codePoint << 6) | (p[1] & 0x3F);
+
+    for (std::ptrdiff_t i = 2; i < length; ++i)
+    {
+        if ((p[i] & 0xC0) != 0x80)
+        {
+            return kInvalidCodePoint;
+        }
+        codePoint = (codePoint << 6) | (p[i] & 0x3F);
+    }
+
+    pos += length;
+    return codePoint;
+}
+
+//
+// Decode the code point ending right before 'pos' in the UTF-8 range [start, pos).
+// On success, 'pos' is moved back to the beginning of the decoded sequence.
+// On invalid input, kInvalidCodePoint is returned and 'pos' is left unchanged.
+//
+inline char32_t DecodeUtf8Backward(const char* start, const char*& pos) noexcept
+{
+    ATLASSERT(start < pos);
+
+    // Walk back over (at most three) continuation bytes to find the lead byte
+    const char* lead = pos - 1;
+    while (lead > start
+           && (pos - lead) < 4
+           && (static_cast<unsigned char>(*lead) & 0xC0) == 0x80)
+    {
+        --lead;
+    }
+
+    // The sequence starting at the lead byte must end exactly at 'pos'
+    const char* next = lead;
+    const char32_t codePoint = DecodeUtf8(next, pos);
+    if (codePoint == kInvalidCodePoint || next != pos)
+    {
+        return kInvalidCodePoint;
+    }
+
+    pos = lead;
+    return codePoint;
+}
+
+//
+// Decode the code point starting at 'pos' in the UTF-16 range [pos, finish).
+// On success, 'pos' is advanced past the decoded code units.
+// On invalid input (unpaired surrogates), kInvalidCodePoint is returned
+// and 'pos' is left unchanged.
+//
+template <typename CharT>
+inline char32_t DecodeUtf16(const CharT*& pos, const CharT* finish) noexcept
+{
+    ATLASSERT(pos < finish);
+
+    const char32_t first = static_cast<char16_t>(pos[0]);
+    if (first < 0xD800 || first > 0xDFFF)
+    {
+        ++pos;
+        return first;
+    }
+
+    if (first > 0xDBFF || finish - pos < 2)
+    {
+        // Unpaired trail surrogate, or lead surrogate at the end of input
+        return kInvalidCodePoint;
+    }
+
+    const char32_t second = static_cast<char16_t>(pos[1]);
+    if (second < 0xDC00 || second > 0xDFFF)
+    {
+        return kInvalidCodePoint;
+    }
+
+    pos += 2;
+    return 0x10000 + ((first - 0xD800) << 10) + (second - 0xDC00);
+}
+
+//
+// Decode the code point ending right before 'pos' in the UTF-16 range [start, pos).
+// On success, 'pos' is moved back to the first code unit of the decoded code point.
+// On invalid input, kInvalidCodePoint is returned and 'pos' is left unchanged.
+//
+template <typename CharT>
+inline char32_t DecodeUtf16Backward(const CharT* start, const CharT*& pos) noexcept
+{
+    ATLASSERT(start < pos);
+
+    const char32_t last = static_cast<char16_t>(pos[-1]);
+    if (last < 0xD800 || last > 0xDFFF)
+    {
+        --pos;
+        return last;
+    }
+
+    if (last < 0xDC00 || pos - start < 2)
+    {
+        return kInvalidCodePoint;
+    }
+
+    const char32_t first = static_cast<char16_t>(pos[-2]);
+    if (first < 0xD800 || first > 0xDBFF)
+    {
+        return kInvalidCodePoint;
+    }
+
+    pos -= 2;
+    return 0x10000 + ((first - 0xD800) << 10) + (last - 0xDC00);
+}
+
+//
+// Return a pointer to the first non-ASCII byte in the UTF-8 range [pos, finish),
+// or 'finish' if the range is pure ASCII.
+// Eight bytes are checked at a time.
+//
+inline const char* SkipAsciiUtf8(const char* pos, const char* finish) noexcept
+{
+    constexpr std::uint64_t kHighBits = 0x8080808080808080ULL;
+
+    while (finish - pos >= 8)
+    {
+        std::uint64_t block;
+        std::memcpy(&block, pos, sizeof(block));
+        if ((block & kHighBits) != 0)
+        {
+            break;
+        }
+        pos += 8;
+    }
+
+    while (pos != finish && static_cast<unsigned char>(*pos) < 0x80)
+    {
+        ++pos;
+    }
+
+    return pos;
+}
+
+//
+// Return a pointer to the first non-ASCII code unit in the UTF-16 range [pos, finish),
+// or 'finish' if the range is pure ASCII.
+// Four code units are checked at a time.
+//
+template <typename CharT>
+inline const CharT* SkipAsciiUtf16(const CharT* pos, const CharT* finish) noexcept
+{
+    static_assert(sizeof(CharT) == 2, "UTF-16 code units must be 16 bits wide.");
+    constexpr std::uint64_t kNonAsciiBits = 0xFF80FF80FF80FF80ULL;
+
+    while (finish - pos >= 4)
+    {
+        std::uint64_t block;
+        std::memcpy(&block, pos, sizeof(block));
+        if ((block & kNonAsciiBits) != 0)
+        {
+            break;
+        }
+        pos += 4;
+    }
+
+    while (pos != finish && static_cast<char16_t>(*pos) < 0x80)
+    {
+        ++pos;
+    }
+
+    return pos;
+}
+
+//
+// Length, in bytes, of the UTF-8 sequence starting with the given lead byte.
+// The sequence is assumed to be already validated.
+//
+inline std::ptrdiff_t Utf8SequenceLength(unsigned char lead) noexcept
+{
+    if (lead < 0x80)
+    {
+        return 1;
+    }
+    else if (lead < 0xE0)
+    {
+        return 2;
+    }
+    else if (lead < 0xF0)
+    {
+        return 3;
+    }
+    return 4;
+}
+
+//
+// Write the UTF-16 encoding of the given (valid) code point at 'out',
+// and return a pointer past the written code units.
+//
+template <typename CharT>
+inline CharT* EncodeUtf16(char32_t codePoint, CharT* out) noexcept
+{
+    if (codePoint < 0x10000)
+    {
+        *out++ = static_cast<CharT>(codePoint);
+    }
+    else
+    {
+        codePoint -= 0x10000;
+        *out++ = static_cast<CharT>(0xD800 + (codePoint >> 10));
+        *out++ = static_cast<CharT>(0xDC00 + (codePoint & 0x3FF));
+    }
+    return out;
+}
+
+//
+// Length, in bytes, of the UTF-8 encoding of the given (valid) code point
+//
+inline int Utf8EncodedLength(char32_t codePoint) noexcept
+{
+    return (codePoint < 0x80) ? 1 : (codePoint < 0x800) ? 2 : (codePoint < 0x10000) ? 3 : 4;
+}
+
+//
+// Write the UTF-8 encoding of the given (valid) code point at 'out',
+// and return a pointer past the written bytes.
+//
+inline char* EncodeUtf8(char32_t codePoint, char* out) noexcept
+{
+    if (codePoint < 0x80)
+    {
+        *out++ = static_cast<char>(codePoint);
+    }
+    else if (codePoint < 0x800)
+    {
+        *out++ = static_cast<char>(0xC0 | (codePoint >> 6));
+        *out++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+    else if (codePoint < 0x10000)
+    {
+        *out++ = static_cast<char>(0xE0 | (codePoint >> 12));
+        *out++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+    else
+    {
+        *out++ = static_cast<char>(0xF0 | (codePoint >> 18));
+        *out++ = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+        *out++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+    return out;
+}
+
+//
+// Fast 64-bit hash of a byte sequence, processing eight bytes at a time.
+// Used by the caching and interning helpers to key strings by their content.
+//
+inline std::uint64_t HashBytes(const void* data, std::size_t length) noexcept
+{
+    constexpr std::uint64_t kMultiplier = 0x9E3779B97F4A7C15ULL;
+
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    std::uint64_t hash = length * kMultiplier;
+
+    while (length >= 8)
+    {
+        std::uint64_t block;
+        std::memcpy(&block, p, sizeof(block));
+        hash = (hash ^ block) * kMultiplier;
+        hash ^= hash >> 29;
+        p += 8;
+        length -= 8;
+    }
+
+    if (length > 0)
+    {
+        std::uint64_t block = 0;
+        std::memcpy(&block, p, length);
+        hash = (hash ^ block) * kMultiplier;
+    }
+
+    // Final avalanche (from MurmurHash3's fmix64)
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Hasher for hash tables keyed by HashBytes values, which are already well mixed
+struct IdentityHash
+{
+    std::size_t operator()(std::uint64_t hash) const noexcept
+    {
+        return static_cast<std::size_t>(hash);
+    }
+};
+
+// Throw the exception signaling an invalid UTF-8 sequence
+[[noreturn]] inline void ThrowInvalidUtf8()
+{
+    throw Utf8ConversionException(
+        "Invalid UTF-8 sequence in input string.\n",
+        ERROR_NO_UNICODE_TRANSLATION);
+}
+
+// Throw the exception signaling an invalid UTF-16 sequence
+[[noreturn]] inline void ThrowInvalidUtf16()
+{
+    throw Utf8ConversionException(
+        "Invalid UTF-16 sequence in input string.\n",
+        ERROR_NO_UNICODE_TRANSLATION);
+}
+
+//
+// Safely cast a source string length from size_t to int, for the
+// MultiByteToWideChar and WideCharToMultiByte APIs.
+// Throws if the size_t value is too big to be stored into an int.
+//
+inline int CheckedIntLength(std::size_t length)
+{
+    if (length > static_cast<std::size_t>((std::numeric_limits<int>::max)()))
+    {
+        throw Utf8ConversionException(
+            "Input string too long: size_t-length doesn't fit into int.\n",
+            InputTooLongTag());
+    }
+    return static_cast<int>(length);
+}
+
+//
+// Conversion kernels writing into caller-provided buffers, for the helpers
+// that manage their own destination storage.
+// They apply the same flags (and error handling) of the conversion functions.
+//
+// The *NulTerminated* length functions find the end of a NUL-terminated input
+// string in the same scan that computes the length of its conversion, and
+// store in the output parameter the input length to pass to the Convert*
+// functions. That's -1 with the Win32 APIs, which process NUL-terminated
+// strings directly, converting the terminator too: in that case, the
+// destination buffer must have room for it.
+//
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+// Length, in wchar_ts, of the UTF-16 conversion of a non-empty UTF-8 string
+inline int Utf16LengthFromUtf8(const char* utf8, int utf8Length)
+{
+    ATLASSERT(utf8Length > 0);
+
+    const int utf16Length = ::MultiByteToWideChar(
+        CP_UTF8, MB_ERR_INVALID_CHARS, utf8, utf8Length, nullptr, 0);
+    if (utf16Length == 0)
+    {
+        const DWORD error = ::GetLastError();
+        throw Utf8ConversionException(
+            "Error in converting from UTF-8 to UTF-16.\n",
+            error);
+    }
+    return utf16Length;
+}
+
+// Convert a non-empty UTF-8 string to UTF-16, in a buffer of at least utf16Length wchar_ts.
+// Returns the number of wchar_ts written.
+inline int ConvertUtf8ToUtf16(const char* utf8, int utf8Length, Utf16Char* utf16, int utf16Length)
+{
+    ATLASSERT(utf8Length > 0 || utf8Length == -1);
+
+    const int result = ::MultiByteToWideChar(
+        CP_UTF8, MB_ERR_INVALID_CHARS, utf8, utf8Length, utf16, utf16Length);
+    if (result == 0)
+    {
+        const DWORD error = ::GetLastError();
+        throw Utf8ConversionException(
+            "Error in converting from UTF-8 to UTF-16.\n",
+            error);
+    }
+    return result;
+}
+
+// Length, in chars, of the UTF-8 conversion of a non-empty UTF-16 string
+inline int Utf8LengthFromUtf16(const Utf16Char* utf16, int utf16Length)
+{
+    ATLASSERT(utf16Length > 0);
+
+    const int utf8Length = ::WideCharToMultiByte(
+        CP_UTF8, WC_ERR_INVALID_CHARS, utf16, utf16Length, nullptr, 0, nullptr, nullptr);
+    if (utf8Length == 0)
+    {
+        const DWORD error = ::GetLastError();
+        throw Utf8ConversionException(
+            "Error in converting from UTF-16 to UTF-8.\n",
+            error);
+    }
+    return utf8Length;
+}
+
+// Convert a non-empty UTF-16 string to UTF-8, in a buffer of at least utf8Length chars.
+// Returns the number of chars written.
+inline int ConvertUtf16ToUtf8(const Utf16Char* utf16, int utf16Length, char* utf8, int utf8Length)
+{
+    ATLASSERT(utf16Length > 0 || utf16Length == -1);
+
+    const int result = ::WideCharToMultiByte(
+        CP_UTF8, WC_ERR_INVALID_CHARS, utf16, utf16Length, utf8, utf8Length, nullptr, nullptr);
+    if (result == 0)
+    {
+        const DWORD error = ::GetLastError();
+        throw Utf8ConversionException(
+            "Error in converting from UTF-16 to UTF-8.\n",
+            error);
+    }
+    return result;
+}
+
+// Length, in wchar_ts, of the UTF-16 conversion of a non-empty NUL-terminated UTF-8 string
+inline int Utf16LengthFromNulTerminatedUtf8(const char* utf8, int& utf8Length)
+{
+    const int utf16Length = ::MultiByteToWideChar(
+        CP_UTF8, MB_ERR_INVALID_CHARS, utf8, -1, nullptr, 0);
+    if (utf16Length == 0)
+    {
+        const DWORD error = ::GetLastError();
+        throw Utf8ConversionException(
+            "Error in converting from UTF-8 to UTF-16.\n",
+            error);
+    }
+
+    // The returned length includes the terminating NUL
+    utf8Length = -1;
+    return utf16Length - 1;
+}
+
+// Length, in chars, of the UTF-8 conversion of a non-empty NUL-terminated UTF-16 string
+inline int Utf8LengthFromNulTerminatedUtf16(const Utf16Char* utf16, int& utf16Length)
+{
+    const int utf8Length = ::WideCharToMultiByte(
+        CP_UTF8, WC_ERR_INVALID_CHARS, utf16, -1, nullptr, 0, nullptr, nullptr);
+    if (utf8Length == 0)
+    {
+        const DWORD error = ::GetLastError();
+        throw Utf8ConversionException(
+            "Error in converting from UTF-16 to UTF-8.\n",
+            error);
+    }
+
+    // The returned length includes the terminating NUL
+    utf16Length = -1;
+    return utf8Length - 1;
+}
+
+#else
+
+//
+// Portable implementations of the kernels, with the same validation rules
+// (and error codes) of the Win32 APIs
+//
+
+// Length, in char16_ts, of the UTF-16 conversion of a non-empty UTF-8 string
+inline int Utf16LengthFromUtf8(const char* utf8, int utf8Length)
+{
+    ATLASSERT(utf8Length > 0);
+
+    const char* pos = utf8;
+    const char* const finish = utf8 + utf8Length;
+    int utf16Length = 0;
+    while (pos != finish)
+    {
+        // ASCII runs map one-to-one
+        const char* const asciiEnd = SkipAsciiUtf8(pos, finish);
+        utf16Length += static_cast<int>(asciiEnd - pos);
+        pos = asciiEnd;
+        if (pos == finish)
+        {
+            break;
+        }
+
+        const char32_t codePoint = DecodeUtf8(pos, finish);
+        if (codePoint == kInvalidCodePoint)
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-8 to UTF-16.\n",
+                ERROR_NO_UNICODE_TRANSLATION);
+        }
+        utf16Length += (codePoint < 0x10000) ? 1 : 2;
+    }
+    return utf16Length;
+}
 
+// Convert a non-empty UTF-8 string to UTF-16, in a buffer of at least utf16Length char16_ts.
+// Returns the number of char16_ts written.
+inline int ConvertUtf8ToUtf16(const char* utf8, int utf8Length, Utf16Char* utf16, int utf16Length)
+{
+    ATLASSERT(utf8Length > 0);
 
-#include <Windows.h>    // Win32 Platform SDK main header        
+    const char* pos = utf8;
+    const char* const finish = utf8 + utf8Length;
+    Utf16Char* out = utf16;
+    Utf16Char* const outFinish = utf16 + utf16Length;
+    while (pos != finish)
+    {
+        const char* const asciiEnd = SkipAsciiUtf8(pos, finish);
+        if (asciiEnd - pos > outFinish - out)
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-8 to UTF-16.\n",
+                ERROR_INSUFFICIENT_BUFFER);
+        }
+        while (pos != asciiEnd)
+        {
+            *out++ = static_cast<unsigned char>(*pos++);
+        }
+        if (pos == finish)
+        {
+            break;
+        }
 
-#include <limits>       // For std::numeric_limits
-#include <stdexcept>    // For std::runtime_error
-#include <string>       // For std::string (UTF-8)
+        const char32_t codePoint = DecodeUtf8(pos, finish);
+        if (codePoint == kInvalidCodePoint)
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-8 to UTF-16.\n",
+                ERROR_NO_UNICODE_TRANSLATION);
+        }
+        if (outFinish - out < ((codePoint < 0x10000) ? 1 : 2))
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-8 to UTF-16.\n",
+                ERROR_INSUFFICIENT_BUFFER);
+        }
+        out = EncodeUtf16(codePoint, out);
+    }
+    return static_cast<int>(out - utf16);
+}
 
-#include <atldef.h>     // For ATLASSERT
-#include <atlstr.h>     // For CStringW (UTF-16)
+// Length, in chars, of the UTF-8 conversion of a non-empty UTF-16 string
+inline int Utf8LengthFromUtf16(const Utf16Char* utf16, int utf16Length)
+{
+    ATLASSERT(utf16Length > 0);
 
+    const Utf16Char* pos = utf16;
+    const Utf16Char* const finish = utf16 + utf16Length;
+    std::size_t utf8Length = 0;
+    while (pos != finish)
+    {
+        const Utf16Char* const asciiEnd = SkipAsciiUtf16(pos, finish);
+        utf8Length += asciiEnd - pos;
+        pos = asciiEnd;
+        if (pos == finish)
+        {
+            break;
+        }
 
-namespace GiovanniDicanio
+        const char32_t codePoint = DecodeUtf16(pos, finish);
+        if (codePoint == kInvalidCodePoint)
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-16 to UTF-8.\n",
+                ERROR_NO_UNICODE_TRANSLATION);
+        }
+        utf8Length += Utf8EncodedLength(codePoint);
+    }
+
+    // Up to three UTF-8 bytes per UTF-16 code unit: the result may not fit into an int
+    return CheckedIntLength(utf8Length);
+}
+
+// Convert a non-empty UTF-16 string to UTF-8, in a buffer of at least utf8Length chars.
+// Returns the number of chars written.
+inline int ConvertUtf16ToUtf8(const Utf16Char* utf16, int utf16Length, char* utf8, int utf8Length)
 {
+    ATLASSERT(utf16Length > 0);
 
-namespace win32
+    const Utf16Char* pos = utf16;
+    const Utf16Char* const finish = utf16 + utf16Length;
+    char* out = utf8;
+    char* const outFinish = utf8 + utf8Length;
+    while (pos != finish)
+    {
+        const Utf16Char* const asciiEnd = SkipAsciiUtf16(pos, finish);
+        if (asciiEnd - pos > outFinish - out)
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-16 to UTF-8.\n",
+                ERROR_INSUFFICIENT_BUFFER);
+        }
+        while (pos != asciiEnd)
+        {
+            *out++ = static_cast<char>(*pos++);
+        }
+        if (pos == finish)
+        {
+            break;
+        }
+
+        const char32_t codePoint = DecodeUtf16(pos, finish);
+        if (codePoint == kInvalidCodePoint)
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-16 to UTF-8.\n",
+                ERROR_NO_UNICODE_TRANSLATION);
+        }
+        if (outFinish - out < Utf8EncodedLength(codePoint))
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-16 to UTF-8.\n",
+                ERROR_INSUFFICIENT_BUFFER);
+        }
+        out = EncodeUtf8(codePoint, out);
+    }
+    return static_cast<int>(out - utf8);
+}
+
+// End of the (at most) maxLength code units starting at 'pos', in a NUL-terminated
+// string: stops at the terminator, to bound a decoding without forming pointers
+// past the end of the string.
+template <typename CharT>
+inline const CharT* NulBoundedFinish(const CharT* pos, std::ptrdiff_t maxLength) noexcept
 {
+    const CharT* finish = pos;
+    while (finish - pos < maxLength && *finish != 0)
+    {
+        ++finish;
+    }
+    return finish;
+}
 
-//==============================================================================
-//                  Forward Declarations and Prototypes
-//==============================================================================
+// Length, in char16_ts, of the UTF-16 conversion of a non-empty NUL-terminated UTF-8 string
+inline int Utf16LengthFromNulTerminatedUtf8(const char* utf8, int& utf8Length)
+{
+    const char* pos = utf8;
+    std::size_t utf16Length = 0;
+    for (;;)
+    {
+        // ASCII runs map one-to-one
+        while (static_cast<unsigned char>(*pos) < 0x80 && *pos != '\0')
+        {
+            ++pos;
+            ++utf16Length;
+        }
+        if (*pos == '\0')
+        {
+            break;
+        }
 
-class Utf8ConversionException;
+        // A sequence cut by the terminator is rejected as truncated
+        const char32_t codePoint = DecodeUtf8(pos, NulBoundedFinish(pos, 4));
+        if (codePoint == kInvalidCodePoint)
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-8 to UTF-16.\n",
+                ERROR_NO_UNICODE_TRANSLATION);
+        }
+        utf16Length += (codePoint < 0x10000) ? 1 : 2;
+    }
 
-CStringW    Utf16FromUtf8(const std::string& utf8);
-CStringW    Utf16FromUtf8(const char* utf8Start, const char* utf8Finish);
-std::string Utf8FromUtf16(const CStringW& utf16);
-std::string Utf8FromUtf16(const wchar_t* utf16Start, const wchar_t* utf16Finish);
+    utf8Length = CheckedIntLength(pos - utf8);
+    return static_cast<int>(utf16Length);
+}
+
+// Length, in chars, of the UTF-8 conversion of a non-empty NUL-terminated UTF-16 string
+inline int Utf8LengthFromNulTerminatedUtf16(const Utf16Char* utf16, int& utf16Length)
+{
+    const Utf16Char* pos = utf16;
+    std::size_t utf8Length = 0;
+    for (;;)
+    {
+        while (*pos < 0x80 && *pos != 0)
+        {
+            ++pos;
+            ++utf8Length;
+        }
+        if (*pos == 0)
+        {
+            break;
+        }
 
+        // A lead surrogate followed by the terminator is rejected as unpaired
+        const char32_t codePoint = DecodeUtf16(pos, NulBoundedFinish(pos, 2));
+        if (codePoint == kInvalidCodePoint)
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-16 to UTF-8.\n",
+                ERROR_NO_UNICODE_TRANSLATION);
+        }
+        utf8Length += Utf8EncodedLength(codePoint);
+    }
 
-//==============================================================================
-//                          Implementations
-//==============================================================================
+    utf16Length = CheckedIntLength(pos - utf16);
+    return CheckedIntLength(utf8Length);
+}
+
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
 
+} // namespace detail
+
+
+// Direction of a conversion (e.g. in sampled workload traces)
+enum class ConversionDirection
+{
+    Utf8ToUtf16,
+    Utf16ToUtf8
+};
+
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
 
 //------------------------------------------------------------------------------
-// Exception class representing a conversion error between UTF-8 and UTF-16.
+// Conversion sampling
 //------------------------------------------------------------------------------
-class Utf8ConversionException
-    : public std::runtime_error
+
+//
+// Function called with the input of the sampled conversions: 'input' points
+// to 'length' chars (Utf8ToUtf16) or Utf16Chars (Utf16ToUtf8) of valid text.
+// It's called on the converting thread, before the result is allocated, and
+// must not throw.
+//
+typedef void (*ConversionSampler)(ConversionDirection direction, const void* input, std::size_t length);
+
+namespace detail
 {
-public:
 
-    // Create the exception object from error message and error code.
-    Utf8ConversionException(const char* message, DWORD errorCode)
-        : std::runtime_error(message)
-        , m_errorCode(errorCode)
-    {}
+// Currently installed sampler (null if none)
+inline std::atomic<ConversionSampler>& SamplerSlot() noexcept
+{
+    static std::atomic<ConversionSampler> sampler(nullptr);
+    return sampler;
+}
 
-    // Create the exception object from error message and error code.
-    Utf8ConversionException(const std::string& message, DWORD errorCode)
-        : std::runtime_error(message)
-        , m_errorCode(errorCode)
-    {}
+// One conversion in every 'period' is sampled
+inline std::atomic<std::uint32_t>& SamplingPeriodSlot() noexcept
+{
+    static std::atomic<std::uint32_t> period(1);
+    return period;
+}
 
-    // Conversion error code (as returned by GetLastError).
-    DWORD ErrorCode() const
+//
+// Called by the conversion functions with their (validated, non-empty) input,
+// of 'length' code units, or NUL-terminated if 'length' is negative.
+// Without a sampler installed, the cost is a relaxed atomic load and a branch.
+//
+template <typename CharT>
+inline void SampleConversion(ConversionDirection direction, const CharT* input, int length) noexcept
+{
+    const ConversionSampler sampler = SamplerSlot().load(std::memory_order_relaxed);
+    if (sampler == nullptr)
     {
-        return m_errorCode;
+        return;
     }
 
+    // Count down the conversions to skip on this thread
+    thread_local std::uint32_t skipped = 0;
+    if (skipped != 0)
+    {
+        --skipped;
+        return;
+    }
+    skipped = SamplingPeriodSlot().load(std::memory_order_relaxed) - 1;
 
-    // *** PRIVATE IMPLEMENTATION ***
+    sampler(direction, input,
+            (length >= 0) ? static_cast<std::size_t>(length) : std::char_traits<CharT>::length(input));
+}
 
-private:
-    // Error code as returned by GetLastError
-    DWORD m_errorCode;
-};
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// Install a sampler called with the input of one conversion in every
+// 'period' (counted on each thread, for each direction), or remove it
+// passing nullptr.
+//
+// The conversions of the helper headers (allocator, offset map, scratch-buffer,
+// small-string and adaptive conversions, and the 16-bit wchar_t ones) are
+// sampled too; the UTF-32 conversions and empty inputs are not.
+//------------------------------------------------------------------------------
+inline void SetConversionSampler(ConversionSampler sampler, std::uint32_t period = 1) noexcept
+{
+    detail::SamplingPeriodSlot().store(period != 0 ? period : 1, std::memory_order_relaxed);
+    detail::SamplerSlot().store(sampler, std::memory_order_release);
+}
+
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
 
 
 //------------------------------------------------------------------------------
@@ -134,71 +1182,46 @@ inline CStringW Utf16FromUtf8(const char* utf8Start, const char* utf8Finish)
         return CStringW();
     }
 
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_entry, utf8Start, utf8Finish - utf8Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    detail::TelemetryScope telemetry(detail::kTelemetryUtf16FromUtf8);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
 
     // Result of the conversion
     CStringW utf16;
 
-    // Safely fail if an invalid UTF-8 character sequence is encountered
-    constexpr DWORD kFlags = MB_ERR_INVALID_CHARS;
-
     // Safely cast the length of the source UTF-8 string (expressed in chars)
-    // from size_t to int for the MultiByteToWideChar API.
+    // from size_t to int for the conversion kernels (MultiByteToWideChar).
     // If the size_t value is too big to be stored into an int, 
     // throw an exception to prevent conversion errors (bugs) like huge size_t values 
     // converted to *negative* integers.
-    const size_t utf8LengthUsingSizet = utf8Finish - utf8Start;
-    if (utf8LengthUsingSizet > static_cast<size_t>((std::numeric_limits<int>::max)()))
-    {
-        throw Utf8ConversionException(
-            "Input string too long: size_t-length doesn't fit into int.\n",
-            ERROR_INVALID_PARAMETER);
-    }
-
-    const int utf8Length = static_cast<int>(utf8LengthUsingSizet);
+    const int utf8Length = detail::CheckedIntLength(utf8Finish - utf8Start);
 
     // Get the size of the destination UTF-16 string
-    const int utf16Length = ::MultiByteToWideChar(
-        CP_UTF8,       // source string is in UTF-8
-        kFlags,        // conversion flags
-        utf8Start,     // source UTF-8 string pointer
-        utf8Length,    // length of the source UTF-8 string, in chars
-        nullptr,       // unused - no conversion done in this step
-        0              // request size of destination buffer, in wchar_ts
-    );
-    if (utf16Length == 0)
-    {
-        // Conversion error: capture error code and throw
-        const DWORD error = ::GetLastError();
-        throw Utf8ConversionException(
-            "Error in converting from UTF-8 to UTF-16.\n",
-            error);
-    }
+    // (safely failing if an invalid UTF-8 character sequence is encountered)
+    const int utf16Length = detail::Utf16LengthFromUtf8(utf8Start, utf8Length);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+    detail::SampleConversion(ConversionDirection::Utf8ToUtf16, utf8Start, utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
 
     // Make room in the destination string for the converted bits
-    wchar_t * utf16Buffer = utf16.GetBuffer(utf16Length);
+    Utf16Char * utf16Buffer = utf16.GetBuffer(utf16Length);
     ATLASSERT(utf16Buffer != nullptr);
 
     // Do the actual conversion from UTF-8 to UTF-16
-    int result = ::MultiByteToWideChar(
-        CP_UTF8,       // source string is in UTF-8
-        kFlags,        // conversion flags
-        utf8Start,     // source UTF-8 string pointer
-        utf8Length,    // length of source UTF-8 string, in chars
-        utf16Buffer,   // pointer to destination buffer
-        utf16Length    // size of destination buffer, in wchar_ts           
-    );
-    if (result == 0)
-    {
-        // Conversion error: capture error code and throw
-        const DWORD error = ::GetLastError();
-        throw Utf8ConversionException(
-            "Error in converting from UTF-8 to UTF-16.\n",
-            error);
-    }
+    detail::ConvertUtf8ToUtf16(utf8Start, utf8Length, utf16Buffer, utf16Length);
 
     // Don't forget to release the internal CString's buffer
     utf16.ReleaseBuffer(utf16Length);
 
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    telemetry.Complete(utf8Length, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_return, utf8Length, utf16Length);
+
     // Return the converted result string
     return utf16;
 }
@@ -237,7 +1260,7 @@ inline CStringW Utf16FromUtf8(const std::string& utf8)
 // On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
 // Utf8ConversionException.
 //------------------------------------------------------------------------------
-inline std::string Utf8FromUtf16(const wchar_t* utf16Start, const wchar_t* utf16Finish)
+inline std::string Utf8FromUtf16(const Utf16Char* utf16Start, const Utf16Char* utf16Finish)
 {
     // Check input range parameters in debug builds
     ATLASSERT(utf16Start <= utf16Finish);
@@ -249,69 +1272,41 @@ inline std::string Utf8FromUtf16(const wchar_t* utf16Start, const wchar_t* utf16
         return std::string();
     }
 
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_entry, utf16Start, utf16Finish - utf16Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    detail::TelemetryScope telemetry(detail::kTelemetryUtf8FromUtf16);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
 
     // Result of the conversion
     std::string utf8;
 
-    // Safely fail if an invalid UTF-16 character sequence is encountered
-    constexpr DWORD kFlags = WC_ERR_INVALID_CHARS;
-
-    // Safely cast the length of the source UTF-16 string (expressed in wchar_ts)
-    // from size_t to int for the WideCharToMultiByte API.
+    // Safely cast the length of the source UTF-16 string (expressed in code units)
+    // from size_t to int for the conversion kernels (WideCharToMultiByte).
     // If the size_t value is too big to be stored into an int, 
     // throw an exception to prevent conversion errors (bugs) like huge size_t values 
     // converted to *negative* integers.
-    const size_t utf16LengthUsingSizet = utf16Finish - utf16Start;
-    if (utf16LengthUsingSizet > static_cast<size_t>((std::numeric_limits<int>::max)()))
-    {
-        throw Utf8ConversionException(
-            "Input string too long: size_t-length doesn't fit into int.\n",
-            ERROR_INVALID_PARAMETER);
-    }
-
-    // Length of source string view, in wchar_ts
-    const int utf16Length = static_cast<int>(utf16LengthUsingSizet);
+    const int utf16Length = detail::CheckedIntLength(utf16Finish - utf16Start);
 
     // Get the length, in chars, of the resulting UTF-8 string
-    const int utf8Length = ::WideCharToMultiByte(
-        CP_UTF8,            // convert to UTF-8
-        kFlags,             // conversion flags
-        utf16Start,         // source UTF-16 string
-        utf16Length,        // length of source UTF-16 string, in wchar_ts
-        nullptr,            // unused - no conversion required in this step
-        0,                  // request size of destination buffer, in chars
-        nullptr, nullptr    // unused
-    );
-    if (utf8Length == 0)
-    {
-        // Conversion error: capture error code and throw
-        const DWORD error = ::GetLastError();
-        throw Utf8ConversionException(
-            "Error in converting from UTF-16 to UTF-8.\n",
-            error);
-    }
+    // (safely failing if an invalid UTF-16 character sequence is encountered)
+    const int utf8Length = detail::Utf8LengthFromUtf16(utf16Start, utf16Length);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+    detail::SampleConversion(ConversionDirection::Utf16ToUtf8, utf16Start, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
 
     // Make room in the destination string for the converted bits
     utf8.resize(utf8Length);
 
     // Do the actual conversion from UTF-16 to UTF-8
-    int result = ::WideCharToMultiByte(
-        CP_UTF8,            // convert to UTF-8
-        kFlags,             // conversion flags
-        utf16Start,         // source UTF-16 string
-        utf16Length,        // length of source UTF-16 string, in wchar_ts
-        &utf8[0],           // pointer to destination buffer
-        utf8Length,         // size of destination buffer, in chars
-        nullptr, nullptr    // unused
-    );
-    if (result == 0)
-    {
-        // Conversion error: capture error code and throw
-        const DWORD error = ::GetLastError();
-        throw Utf8ConversionException(
-            "Error in converting from UTF-16 to UTF-8.\n",
-            error);
-    }
+    detail::ConvertUtf16ToUtf8(utf16Start, utf16Length, &utf8[0], utf8Length);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    telemetry.Complete(utf16Length * sizeof(Utf16Char), utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_return, utf16Length, utf8Length);
 
     // Return the converted result string
     return utf8;
@@ -337,12 +1332,184 @@ inline std::string Utf8FromUtf16(const CStringW& utf16)
     }
 
     // Delegate the conversion to the [start, finish) range overload
-    const wchar_t * const utf16Start = utf16.GetString();
-    const wchar_t * const utf16Finish = utf16Start + utf16.GetLength();
+    const Utf16Char * const utf16Start = utf16.GetString();
+    const Utf16Char * const utf16Finish = utf16Start + utf16.GetLength();
     return Utf8FromUtf16(utf16Start, utf16Finish);
 }
 
 
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-16.
+//
+// UTF-8 strings are specified as NUL-terminated C-style strings.
+// UTF-16 strings are stored in CStringW.
+//
+// The input is scanned only once to get both its length and the length of
+// the result, without creating a temporary std::string.
+// 
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline CStringW Utf16FromUtf8(const char* utf8)
+{
+    ATLASSERT(utf8 != nullptr);
+
+    // Special case of empty input
+    if (*utf8 == '\0')
+    {
+        return CStringW();
+    }
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_entry, utf8, -1);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    detail::TelemetryScope telemetry(detail::kTelemetryUtf16FromUtf8);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    CStringW utf16;
+
+    // Get the length of the destination UTF-16 string, and the length of the
+    // source UTF-8 string to pass to the conversion kernel
+    int utf8Length = 0;
+    const int utf16Length = detail::Utf16LengthFromNulTerminatedUtf8(utf8, utf8Length);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+    detail::SampleConversion(ConversionDirection::Utf8ToUtf16, utf8, utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+    // Leave room for the terminating NUL, which may be converted too
+    Utf16Char * utf16Buffer = utf16.GetBuffer(utf16Length);
+    ATLASSERT(utf16Buffer != nullptr);
+    detail::ConvertUtf8ToUtf16(utf8, utf8Length, utf16Buffer, utf16Length + 1);
+    utf16.ReleaseBuffer(utf16Length);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    // The Win32 kernels don't return the input length: count it separately
+    telemetry.Complete((utf8Length >= 0) ? utf8Length : std::char_traits<char>::length(utf8), utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_return, utf8Length, utf16Length);
+
+    return utf16;
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-16 to UTF-8.
+//
+// UTF-16 strings are specified as NUL-terminated C-style strings.
+// UTF-8 strings are stored using std::string.
+//
+// The input is scanned only once to get both its length and the length of
+// the result, without creating a temporary CStringW.
+// 
+// On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::string Utf8FromUtf16(const Utf16Char* utf16)
+{
+    ATLASSERT(utf16 != nullptr);
+
+    // Special case of empty input
+    if (*utf16 == 0)
+    {
+        return std::string();
+    }
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_entry, utf16, -1);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    detail::TelemetryScope telemetry(detail::kTelemetryUtf8FromUtf16);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    std::string utf8;
+
+    // Get the length of the destination UTF-8 string, and the length of the
+    // source UTF-16 string to pass to the conversion kernel
+    int utf16Length = 0;
+    const int utf8Length = detail::Utf8LengthFromNulTerminatedUtf16(utf16, utf16Length);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+    detail::SampleConversion(ConversionDirection::Utf16ToUtf8, utf16, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+    // Leave room for the terminating NUL, which may be converted too
+    utf8.resize(static_cast<std::size_t>(utf8Length) + 1);
+    detail::ConvertUtf16ToUtf8(utf16, utf16Length, &utf8[0], utf8Length + 1);
+    utf8.resize(utf8Length);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    // The Win32 kernels don't return the input length: count it separately
+    const std::size_t inputLength =
+        (utf16Length >= 0) ? utf16Length : std::char_traits<Utf16Char>::length(utf16);
+    telemetry.Complete(inputLength * sizeof(Utf16Char), utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_return, utf16Length, utf8Length);
+
+    return utf8;
+}
+
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-16.
+//
+// UTF-8 strings are specified using std::string_view (C++17), so any
+// contiguous char sequence (including substrings) is converted in place.
+// UTF-16 strings are stored in CStringW.
+// 
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline CStringW Utf16FromUtf8(std::string_view utf8)
+{
+    const char * const utf8Start = utf8.data();
+    return Utf16FromUtf8(utf8Start, utf8Start + utf8.length());
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-16 to UTF-8.
+//
+// UTF-16 strings are specified using std::basic_string_view (C++17).
+// UTF-8 strings are stored using std::string.
+// 
+// On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::string Utf8FromUtf16(std::basic_string_view<Utf16Char> utf16)
+{
+    const Utf16Char * const utf16Start = utf16.data();
+    return Utf8FromUtf16(utf16Start, utf16Start + utf16.length());
+}
+
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_CHAR8_T
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-16.
+//
+// UTF-8 strings are specified using std::u8string_view (C++20), which also
+// accepts u8"..." literals and std::u8string.
+// UTF-16 strings are stored in CStringW.
+// 
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline CStringW Utf16FromUtf8(std::u8string_view utf8)
+{
+    // char8_t and char share the same object representation
+    const char * const utf8Start = reinterpret_cast<const char*>(utf8.data());
+    return Utf16FromUtf8(utf8Start, utf8Start + utf8.length());
+}
+
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_CHAR8_T
+
+
 } // namespace win32
 
 } // namespace GiovanniDicanio
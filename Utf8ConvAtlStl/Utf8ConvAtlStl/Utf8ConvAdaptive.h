@@ -0,0 +1,707 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CONVADAPTIVE_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CONVADAPTIVE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Adaptive Kernel Selection for UTF-8 <-> UTF-16 Conversions
+//          ==========================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module providing AdaptiveConverter, whose Utf16FromUtf8 and
+// Utf8FromUtf16 member functions pick, for each conversion direction, one of
+// two conversion kernels, based on the content of the recent inputs:
+//
+//  - the ASCII kernel converts in a single pass, into a destination sized
+//    for the worst case (UTF-8 -> UTF-16), or for all-ASCII input and then
+//    grown on the first non-ASCII code unit (UTF-16 -> UTF-8); the ends of
+//    ASCII runs are found a machine word at a time, and the runs copied in bulk;
+//
+//  - the multibyte kernel first computes the exact length of the result, with
+//    a branch-free count, and then converts code point by code point, without
+//    looking for ASCII runs that aren't there.
+//
+// The kernels keep running averages (over about the last 'window' inputs) of
+// the fractions of the input code units that are ASCII, other BMP characters
+// (multibyte), or supplementary characters (surrogate pairs in UTF-16), and
+// the converter switches to the multibyte kernel when the ASCII fraction drops
+// below a threshold, and back to the ASCII kernel when it rises above a second,
+// higher threshold: inputs near a single threshold don't make it flip-flop.
+//
+// The current choice and statistics can be read with Status, and a kernel can
+// be pinned (e.g. in tests, or when the traffic is known in advance) with
+// PinKernel. Both kernels apply the same validation rules (and error codes)
+// of the other conversion functions, and produce the same results.
+//
+// The member functions can be called concurrently from several threads: the
+// statistics are updated with relaxed loads and stores (so concurrent updates
+// can occasionally be lost, which doesn't matter for a heuristic). As each
+// conversion writes them, a thread_local converter per thread avoids bouncing
+// their cache line between the cores in heavily multi-threaded code.
+//
+// The kernels are portable code, in ATL builds too. The conversions of this
+// module are counted by the telemetry, sampled and probed as the other ones.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Core conversion functions
+
+#include <atomic>       // For std::atomic
+#include <cstddef>      // For std::size_t
+#include <cstdint>      // For std::uint32_t, std::uint64_t
+#include <cstring>      // For std::memcpy
+#include <string>       // For std::string
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+// Conversion kernels chosen by AdaptiveConverter
+enum class ConversionKernel
+{
+    Ascii,
+    Multibyte
+};
+
+// Name of a conversion kernel ("ascii", "multibyte")
+inline const char* ConversionKernelName(ConversionKernel kernel) noexcept
+{
+    return (kernel == ConversionKernel::Ascii) ? "ascii" : "multibyte";
+}
+
+// Kernel choice and content statistics of an AdaptiveConverter, for a direction
+struct AdaptiveKernelStatus
+{
+    ConversionKernel kernel;        // kernel used by the next conversions
+    bool pinned;                    // set with PinKernel, rather than chosen adaptively
+    double asciiFraction;           // running averages of the fractions of the
+    double multibyteFraction;       //  input code units that are ASCII, other BMP
+    double surrogateFraction;       //  characters, or supplementary characters
+    std::uint64_t conversions;      // non-empty conversions done
+    std::uint64_t switches;         // adaptive kernel changes
+};
+
+
+namespace detail
+{
+
+// Input code units of a conversion that aren't ASCII
+struct ContentCounts
+{
+    std::size_t multibyteUnits = 0;     // of BMP characters
+    std::size_t surrogateUnits = 0;     // of supplementary characters
+};
+
+//
+// Length, in code units, of the UTF-16 conversion of the UTF-8 range [pos, finish),
+// if valid: one code unit per non-continuation byte, and one more per four-byte lead.
+//
+// The bytes are counted eight at a time, without branches. On invalid input the
+// result isn't exact (it can be up to twice the input length), but it's never less
+// than the length of the conversion of the input up to the first invalid sequence,
+// where the conversion stops.
+//
+inline std::size_t Utf16LengthFromValidUtf8(const char* pos, const char* finish) noexcept
+{
+    constexpr std::uint64_t kHighBits = 0x8080808080808080ULL;
+    constexpr std::uint64_t kLowBits = 0x0101010101010101ULL;
+
+    std::size_t length = 0;
+    while (finish - pos >= 8)
+    {
+        std::uint64_t block;
+        std::memcpy(&block, pos, sizeof(block));
+
+        // High bit of each byte: set for continuation bytes (10xxxxxx),
+        // and for four-byte leads (11110xxx, or invalid bytes above)
+        const std::uint64_t continuations = block & ~(block << 1) & kHighBits;
+        const std::uint64_t fourByteLeads = block & (block << 1) & (block << 2) & (block << 3) & kHighBits;
+
+        // Add up the flags of the eight bytes in the top byte
+        length += 8 - (((continuations >> 7) * kLowBits) >> 56) + (((fourByteLeads >> 7) * kLowBits) >> 56);
+        pos += 8;
+    }
+    for (; pos != finish; ++pos)
+    {
+        const unsigned char byte = static_cast<unsigned char>(*pos);
+        length += static_cast<std::size_t>((byte & 0xC0) != 0x80) + (byte >= 0xF0);
+    }
+    return length;
+}
+
+//
+// Length, in chars, of the UTF-8 conversion of the UTF-16 range [pos, finish),
+// if valid: one to three bytes per code unit, and two per surrogate.
+// As above, branch-free, and never less than the length of the conversion of
+// the input up to the first invalid sequence.
+//
+inline std::size_t Utf8LengthFromValidUtf16(const Utf16Char* pos, const Utf16Char* finish) noexcept
+{
+    std::size_t length = 0;
+    for (; pos != finish; ++pos)
+    {
+        const char16_t unit = static_cast<char16_t>(*pos);
+        length += 1 + static_cast<std::size_t>(unit >= 0x80) + (unit >= 0x800)
+            - ((unit & 0xF800) == 0xD800);
+    }
+    return length;
+}
+
+[[noreturn]] inline void ThrowInvalidUtf8Input()
+{
+    throw Utf8ConversionException(
+        "Error in converting from UTF-8 to UTF-16.\n",
+        ERROR_NO_UNICODE_TRANSLATION);
+}
+
+[[noreturn]] inline void ThrowInvalidUtf16Input()
+{
+    throw Utf8ConversionException(
+        "Error in converting from UTF-16 to UTF-8.\n",
+        ERROR_NO_UNICODE_TRANSLATION);
+}
+
+//
+// ASCII kernel, UTF-8 -> UTF-16: convert the non-empty UTF-8 string in a single
+// pass, into a buffer of at least utf8Length code units (the UTF-16 length
+// can't be longer). Returns the number of code units written.
+//
+inline int ConvertUtf8ToUtf16Ascii(const char* utf8, int utf8Length, Utf16Char* utf16,
+                                   ContentCounts& counts)
+{
+    const char* pos = utf8;
+    const char* const finish = utf8 + utf8Length;
+    Utf16Char* out = utf16;
+    for (;;)
+    {
+        // Find the end of the ASCII run eight bytes at a time, then widen it
+        // (a simple loop, which compilers vectorize)
+        const char* const asciiEnd = SkipAsciiUtf8(pos, finish);
+        while (pos != asciiEnd)
+        {
+            *out++ = static_cast<unsigned char>(*pos++);
+        }
+        if (pos == finish)
+        {
+            break;
+        }
+
+        const char* const sequence = pos;
+        const char32_t codePoint = DecodeUtf8(pos, finish);
+        if (codePoint == kInvalidCodePoint)
+        {
+            ThrowInvalidUtf8Input();
+        }
+        if (codePoint < 0x10000)
+        {
+            counts.multibyteUnits += pos - sequence;
+        }
+        else
+        {
+            counts.surrogateUnits += pos - sequence;
+        }
+        out = EncodeUtf16(codePoint, out);
+    }
+    return static_cast<int>(out - utf16);
+}
+
+//
+// Multibyte kernel, UTF-8 -> UTF-16: convert the non-empty UTF-8 string code
+// point by code point, in a buffer of utf16Length code units, as computed by
+// Utf16LengthFromValidUtf8. Returns the number of code units written.
+//
+inline int ConvertUtf8ToUtf16Multibyte(const char* utf8, int utf8Length, Utf16Char* utf16, int utf16Length,
+                                       ContentCounts& counts)
+{
+    const char* pos = utf8;
+    const char* const finish = utf8 + utf8Length;
+    Utf16Char* out = utf16;
+    while (pos != finish)
+    {
+        const unsigned char lead = static_cast<unsigned char>(*pos);
+        if (lead < 0x80)
+        {
+            *out++ = lead;
+            ++pos;
+            continue;
+        }
+
+        const char* const sequence = pos;
+        const char32_t codePoint = DecodeUtf8(pos, finish);
+        if (codePoint < 0x10000)
+        {
+            counts.multibyteUnits += pos - sequence;
+            *out++ = static_cast<Utf16Char>(codePoint);
+        }
+        else if (codePoint != kInvalidCodePoint)
+        {
+            counts.surrogateUnits += pos - sequence;
+            out = EncodeUtf16(codePoint, out);
+        }
+        else
+        {
+            ThrowInvalidUtf8Input();
+        }
+    }
+
+    // The length is exact for valid input: no overruns before an invalid sequence
+    ATLASSERT(out - utf16 == utf16Length);
+    (void)utf16Length;
+    return static_cast<int>(out - utf16);
+}
+
+//
+// Convert the non-empty UTF-16 range [pos, finish) to UTF-8 at 'out', copying
+// ASCII runs in bulk, in a buffer of at least
+// Utf8LengthFromValidUtf16(pos, finish) chars. Returns the end of the output.
+//
+inline char* ConvertUtf16ToUtf8Runs(const Utf16Char* pos, const Utf16Char* finish, char* out,
+                                    ContentCounts& counts)
+{
+    for (;;)
+    {
+        const Utf16Char* const asciiEnd = SkipAsciiUtf16(pos, finish);
+        while (pos != asciiEnd)
+        {
+            *out++ = static_cast<char>(*pos++);
+        }
+        if (pos == finish)
+        {
+            break;
+        }
+
+        const Utf16Char* const sequence = pos;
+        const char32_t codePoint = DecodeUtf16(pos, finish);
+        if (codePoint == kInvalidCodePoint)
+        {
+            ThrowInvalidUtf16Input();
+        }
+        if (codePoint < 0x10000)
+        {
+            ++counts.multibyteUnits;
+        }
+        else
+        {
+            counts.surrogateUnits += pos - sequence;
+        }
+        out = EncodeUtf8(codePoint, out);
+    }
+    return out;
+}
+
+//
+// ASCII kernel, UTF-16 -> UTF-8: convert the non-empty UTF-16 string in a single
+// pass into 'utf8', sized for all-ASCII input; on the first non-ASCII code unit,
+// the rest of the input is measured, and 'utf8' grown to fit it.
+//
+inline void ConvertUtf16ToUtf8Ascii(const Utf16Char* utf16, int utf16Length, std::string& utf8,
+                                    ContentCounts& counts)
+{
+    const Utf16Char* pos = utf16;
+    const Utf16Char* const finish = utf16 + utf16Length;
+    utf8.resize(utf16Length);
+    char* out = &utf8[0];
+
+    // Narrow the ASCII prefix
+    const Utf16Char* const asciiEnd = SkipAsciiUtf16(pos, finish);
+    while (pos != asciiEnd)
+    {
+        *out++ = static_cast<char>(*pos++);
+    }
+    if (pos == finish)
+    {
+        return;
+    }
+
+    // Grow the result to fit the rest of the input
+    const std::size_t prefixLength = pos - utf16;
+    utf8.resize(CheckedIntLength(prefixLength + Utf8LengthFromValidUtf16(pos, finish)));
+    out = ConvertUtf16ToUtf8Runs(pos, finish, &utf8[prefixLength], counts);
+    ATLASSERT(out == &utf8[0] + utf8.size());
+}
+
+//
+// Multibyte kernel, UTF-16 -> UTF-8: convert the non-empty UTF-16 string code
+// point by code point, in a buffer of utf8Length chars, as computed by
+// Utf8LengthFromValidUtf16. Returns the number of chars written.
+//
+inline int ConvertUtf16ToUtf8Multibyte(const Utf16Char* utf16, int utf16Length, char* utf8, int utf8Length,
+                                       ContentCounts& counts)
+{
+    const Utf16Char* pos = utf16;
+    const Utf16Char* const finish = utf16 + utf16Length;
+    char* out = utf8;
+    while (pos != finish)
+    {
+        const char16_t unit = static_cast<char16_t>(*pos);
+        if (unit < 0x80)
+        {
+            *out++ = static_cast<char>(unit);
+            ++pos;
+            continue;
+        }
+
+        const Utf16Char* const sequence = pos;
+        const char32_t codePoint = DecodeUtf16(pos, finish);
+        if (codePoint == kInvalidCodePoint)
+        {
+            ThrowInvalidUtf16Input();
+        }
+        if (codePoint < 0x10000)
+        {
+            ++counts.multibyteUnits;
+        }
+        else
+        {
+            counts.surrogateUnits += pos - sequence;
+        }
+        out = EncodeUtf8(codePoint, out);
+    }
+
+    // As in ConvertUtf8ToUtf16Multibyte, the length is exact for valid input
+    ATLASSERT(out - utf8 == utf8Length);
+    (void)utf8Length;
+    return static_cast<int>(out - utf8);
+}
+
+//------------------------------------------------------------------------------
+// Kernel choice, with hysteresis, and content statistics for a conversion direction
+//------------------------------------------------------------------------------
+class AdaptiveKernelSelector
+{
+public:
+
+    AdaptiveKernelSelector(double multibyteThreshold, double asciiThreshold, unsigned int window) noexcept
+        : m_multibyteThreshold(ToFixed(multibyteThreshold))
+        , m_asciiThreshold(ToFixed(asciiThreshold))
+        , m_window(window)
+    {
+        ATLASSERT(multibyteThreshold <= asciiThreshold);
+        ATLASSERT(window > 0);
+    }
+
+    ConversionKernel Kernel() const noexcept
+    {
+        return static_cast<ConversionKernel>(m_state.load(std::memory_order_relaxed) & kKernelMask);
+    }
+
+    // Record the content of a successfully converted input of 'units' code units,
+    // and update the kernel choice
+    void Record(std::size_t units, const ContentCounts& counts) noexcept
+    {
+        const std::uint32_t ascii = Average(m_asciiShare,
+            Share(units - counts.multibyteUnits - counts.surrogateUnits, units));
+        Average(m_surrogateShare, Share(counts.surrogateUnits, units));
+        Increment(m_conversions);
+
+        std::uint32_t state = m_state.load(std::memory_order_relaxed);
+        if ((state & kPinned) != 0)
+        {
+            return;
+        }
+
+        std::uint32_t newState = state;
+        if (state == static_cast<std::uint32_t>(ConversionKernel::Ascii) && ascii < m_multibyteThreshold)
+        {
+            newState = static_cast<std::uint32_t>(ConversionKernel::Multibyte);
+        }
+        else if (state == static_cast<std::uint32_t>(ConversionKernel::Multibyte) && ascii > m_asciiThreshold)
+        {
+            newState = static_cast<std::uint32_t>(ConversionKernel::Ascii);
+        }
+
+        // Don't override a concurrent PinKernel
+        if (newState != state
+            && m_state.compare_exchange_strong(state, newState, std::memory_order_relaxed))
+        {
+            Increment(m_switches);
+        }
+    }
+
+    void Pin(ConversionKernel kernel) noexcept
+    {
+        m_state.store(static_cast<std::uint32_t>(kernel) | kPinned, std::memory_order_relaxed);
+    }
+
+    void Unpin() noexcept
+    {
+        m_state.fetch_and(kKernelMask, std::memory_order_relaxed);
+    }
+
+    AdaptiveKernelStatus Status() const noexcept
+    {
+        const std::uint32_t state = m_state.load(std::memory_order_relaxed);
+        const double ascii = FromFixed(m_asciiShare.load(std::memory_order_relaxed));
+        const double surrogate = FromFixed(m_surrogateShare.load(std::memory_order_relaxed));
+        const double multibyte = 1.0 - ascii - surrogate;
+
+        AdaptiveKernelStatus status;
+        status.kernel = static_cast<ConversionKernel>(state & kKernelMask);
+        status.pinned = (state & kPinned) != 0;
+        status.asciiFraction = ascii;
+        status.multibyteFraction = (multibyte > 0.0) ? multibyte : 0.0;  // averages are rounded
+        status.surrogateFraction = surrogate;
+        status.conversions = m_conversions.load(std::memory_order_relaxed);
+        status.switches = m_switches.load(std::memory_order_relaxed);
+        return status;
+    }
+
+private:
+
+    // Fractions are stored in 16.16 fixed point
+    static constexpr std::uint32_t kOne = 1U << 16;
+
+    // m_state: the current kernel, and whether it's pinned
+    static constexpr std::uint32_t kKernelMask = 1;
+    static constexpr std::uint32_t kPinned = 2;
+
+    std::atomic<std::uint32_t> m_state{ static_cast<std::uint32_t>(ConversionKernel::Ascii) };
+    std::atomic<std::uint32_t> m_asciiShare{ kOne };
+    std::atomic<std::uint32_t> m_surrogateShare{ 0 };
+    std::atomic<std::uint64_t> m_conversions{ 0 };
+    std::atomic<std::uint64_t> m_switches{ 0 };
+
+    const std::uint32_t m_multibyteThreshold;
+    const std::uint32_t m_asciiThreshold;
+    const unsigned int m_window;
+
+    static std::uint32_t ToFixed(double fraction) noexcept
+    {
+        return static_cast<std::uint32_t>(fraction * kOne + 0.5);
+    }
+
+    static double FromFixed(std::uint32_t share) noexcept
+    {
+        return static_cast<double>(share) / kOne;
+    }
+
+    static std::uint32_t Share(std::size_t part, std::size_t total) noexcept
+    {
+        return static_cast<std::uint32_t>((static_cast<std::uint64_t>(part) << 16) / total);
+    }
+
+    // Move the running average a 1/window step towards the sample, and return it
+    std::uint32_t Average(std::atomic<std::uint32_t>& average, std::uint32_t sample) const noexcept
+    {
+        const std::int64_t current = average.load(std::memory_order_relaxed);
+        const std::int64_t updated = current + (static_cast<std::int64_t>(sample) - current) / m_window;
+        average.store(static_cast<std::uint32_t>(updated), std::memory_order_relaxed);
+        return static_cast<std::uint32_t>(updated);
+    }
+
+    // Relaxed load and store, not an atomic increment, as the telemetry counters
+    static void Increment(std::atomic<std::uint64_t>& counter) noexcept
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// UTF-8 <-> UTF-16 conversions choosing, for each direction, between an ASCII
+// and a multibyte kernel, based on the content of the recent inputs.
+//
+// All the member functions can be called concurrently from several threads.
+// On conversion errors, throws Utf8ConversionException.
+//------------------------------------------------------------------------------
+class AdaptiveConverter
+{
+public:
+
+    // Default ASCII fraction below which the multibyte kernel is chosen:
+    // measured with Utf8ConvBench --adaptive, the ASCII kernel is faster only
+    // on text that is almost all ASCII
+    static constexpr double kDefaultMultibyteThreshold = 0.95;
+
+    // Default ASCII fraction above which the ASCII kernel is chosen again
+    static constexpr double kDefaultAsciiThreshold = 0.99;
+
+    // Default number of recent conversions the running averages are mostly made of
+    static constexpr unsigned int kDefaultWindow = 16;
+
+    // Create a converter switching to the multibyte kernel when the average
+    // fraction of ASCII input drops below 'multibyteThreshold', and back to the
+    // ASCII kernel when it rises above 'asciiThreshold'.
+    // The averages give each conversion a weight of 1/window.
+    explicit AdaptiveConverter(double multibyteThreshold = kDefaultMultibyteThreshold,
+                               double asciiThreshold = kDefaultAsciiThreshold,
+                               unsigned int window = kDefaultWindow) noexcept
+        : m_toUtf16(multibyteThreshold, asciiThreshold, window)
+        , m_toUtf8(multibyteThreshold, asciiThreshold, window)
+    {
+    }
+
+    AdaptiveConverter(const AdaptiveConverter&) = delete;
+    AdaptiveConverter& operator=(const AdaptiveConverter&) = delete;
+
+    //
+    // Convert from UTF-8 to UTF-16.
+    // UTF-8 strings are specified using an STL-style [start, finish) range.
+    //
+    CStringW Utf16FromUtf8(const char* utf8Start, const char* utf8Finish)
+    {
+        ATLASSERT(utf8Start <= utf8Finish);
+
+        if (utf8Start == utf8Finish)
+        {
+            return CStringW();
+        }
+
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_entry, utf8Start, utf8Finish - utf8Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        detail::TelemetryScope telemetry(detail::kTelemetryUtf16FromUtf8);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+        CStringW utf16;
+        const int utf8Length = detail::CheckedIntLength(utf8Finish - utf8Start);
+        detail::ContentCounts counts;
+        if (m_toUtf16.Kernel() == ConversionKernel::Ascii)
+        {
+            Utf16Char* const utf16Buffer = utf16.GetBuffer(utf8Length);
+            ATLASSERT(utf16Buffer != nullptr);
+            utf16.ReleaseBuffer(detail::ConvertUtf8ToUtf16Ascii(utf8Start, utf8Length, utf16Buffer, counts));
+        }
+        else
+        {
+            // On invalid input, the estimate can be up to twice the input length
+            const int utf16Length = detail::CheckedIntLength(
+                detail::Utf16LengthFromValidUtf8(utf8Start, utf8Finish));
+            Utf16Char* const utf16Buffer = utf16.GetBuffer(utf16Length);
+            ATLASSERT(utf16Buffer != nullptr);
+            utf16.ReleaseBuffer(detail::ConvertUtf8ToUtf16Multibyte(
+                utf8Start, utf8Length, utf16Buffer, utf16Length, counts));
+        }
+
+        m_toUtf16.Record(utf8Length, counts);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+        detail::SampleConversion(ConversionDirection::Utf8ToUtf16, utf8Start, utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        telemetry.Complete(utf8Length, utf16.GetLength());
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_return, utf8Length, utf16.GetLength());
+
+        return utf16;
+    }
+
+    //
+    // Convert from UTF-8 to UTF-16.
+    // UTF-8 strings are stored using std::string.
+    //
+    CStringW Utf16FromUtf8(const std::string& utf8)
+    {
+        return Utf16FromUtf8(utf8.data(), utf8.data() + utf8.length());
+    }
+
+    //
+    // Convert from UTF-16 to UTF-8.
+    // UTF-16 strings are specified passing an STL-style [start, finish) range.
+    //
+    std::string Utf8FromUtf16(const Utf16Char* utf16Start, const Utf16Char* utf16Finish)
+    {
+        ATLASSERT(utf16Start <= utf16Finish);
+
+        if (utf16Start == utf16Finish)
+        {
+            return std::string();
+        }
+
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_entry, utf16Start, utf16Finish - utf16Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        detail::TelemetryScope telemetry(detail::kTelemetryUtf8FromUtf16);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+        std::string utf8;
+        const int utf16Length = detail::CheckedIntLength(utf16Finish - utf16Start);
+        detail::ContentCounts counts;
+        if (m_toUtf8.Kernel() == ConversionKernel::Ascii)
+        {
+            detail::ConvertUtf16ToUtf8Ascii(utf16Start, utf16Length, utf8, counts);
+        }
+        else
+        {
+            const int utf8Length = detail::CheckedIntLength(
+                detail::Utf8LengthFromValidUtf16(utf16Start, utf16Finish));
+            utf8.resize(utf8Length);
+            const int written = detail::ConvertUtf16ToUtf8Multibyte(
+                utf16Start, utf16Length, &utf8[0], utf8Length, counts);
+            ATLASSERT(written == utf8Length);
+            (void)written;
+        }
+
+        m_toUtf8.Record(utf16Length, counts);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+        detail::SampleConversion(ConversionDirection::Utf16ToUtf8, utf16Start, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        telemetry.Complete(utf16Length * sizeof(Utf16Char), utf8.length());
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_return, utf16Length, static_cast<int>(utf8.length()));
+
+        return utf8;
+    }
+
+    //
+    // Convert from UTF-16 to UTF-8.
+    // UTF-16 strings are stored in CStringW.
+    //
+    std::string Utf8FromUtf16(const CStringW& utf16)
+    {
+        const Utf16Char* const utf16Start = utf16.GetString();
+        return Utf8FromUtf16(utf16Start, utf16Start + utf16.GetLength());
+    }
+
+    // Current kernel choice and content statistics for the given direction
+    AdaptiveKernelStatus Status(ConversionDirection direction) const noexcept
+    {
+        return Selector(direction).Status();
+    }
+
+    // Use the given kernel for the given direction, until UnpinKernel is called
+    void PinKernel(ConversionDirection direction, ConversionKernel kernel) noexcept
+    {
+        Selector(direction).Pin(kernel);
+    }
+
+    // Resume choosing the kernel for the given direction adaptively
+    void UnpinKernel(ConversionDirection direction) noexcept
+    {
+        Selector(direction).Unpin();
+    }
+
+private:
+    detail::AdaptiveKernelSelector m_toUtf16;
+    detail::AdaptiveKernelSelector m_toUtf8;
+
+    detail::AdaptiveKernelSelector& Selector(ConversionDirection direction) noexcept
+    {
+        return (direction == ConversionDirection::Utf8ToUtf16) ? m_toUtf16 : m_toUtf8;
+    }
+
+    const detail::AdaptiveKernelSelector& Selector(ConversionDirection direction) const noexcept
+    {
+        return (direction == ConversionDirection::Utf8ToUtf16) ? m_toUtf16 : m_toUtf8;
+    }
+};
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CONVADAPTIVE_H
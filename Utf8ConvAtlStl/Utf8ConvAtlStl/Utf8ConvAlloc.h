@@ -0,0 +1,273 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CONVALLOC_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CONVALLOC_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          UTF-8 <-> UTF-16 Conversions with Custom Allocators
+//          ===================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module providing overloads of Utf16FromUtf8 and Utf8FromUtf16
+// that take an allocator, and return STL strings using it.
+//
+// When compiling in C++17 mode, overloads taking a std::pmr::memory_resource
+// are available too: so, for example, the results of all the conversions done
+// while serving a request can be allocated from a request-scoped monotonic
+// arena, and released all at once.
+//
+// The conversions don't allocate any temporary buffer: the only memory
+// requested from the allocator is the result string.
+// Note that exceptions thrown on conversion errors are still allocated
+// by the C++ runtime, and Utf8ConversionException stores its message as
+// std::runtime_error does.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Core conversion functions
+
+#include <string>       // For std::basic_string
+#include <type_traits>  // For std::enable_if, std::is_same
+
+// std::pmr is available starting from C++17
+#if (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L
+#if defined(__has_include)
+#if __has_include(<memory_resource>)
+#define GIOVANNI_DICANIO_UTF8CONV_HAS_PMR
+#endif // __has_include(<memory_resource>)
+#endif // defined(__has_include)
+#endif // C++17
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_PMR
+#include <memory_resource>  // For std::pmr::memory_resource, std::pmr::polymorphic_allocator
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_PMR
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-16.
+//
+// UTF-8 strings are specified using an STL-style [start, finish) range.
+// UTF-16 strings are stored in a std::basic_string<Utf16Char> using the
+// given allocator.
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+template <typename Allocator,
+          typename = typename std::enable_if<
+              std::is_same<typename Allocator::value_type, Utf16Char>::value>::type>
+inline std::basic_string<Utf16Char, std::char_traits<Utf16Char>, Allocator>
+Utf16FromUtf8(const char* utf8Start, const char* utf8Finish, const Allocator& allocator)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(utf8Start <= utf8Finish);
+
+    // Result of the conversion, allocated with the caller's allocator
+    std::basic_string<Utf16Char, std::char_traits<Utf16Char>, Allocator> utf16(allocator);
+
+    // Special case of empty input
+    if (utf8Start == utf8Finish)
+    {
+        // Empty input ==> empty result
+        return utf16;
+    }
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_entry, utf8Start, utf8Finish - utf8Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    detail::TelemetryScope telemetry(detail::kTelemetryUtf16FromUtf8);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    // Safely cast the length of the source UTF-8 string from size_t to int
+    // for the conversion kernels
+    const int utf8Length = detail::CheckedIntLength(utf8Finish - utf8Start);
+
+    // Get the size of the destination UTF-16 string
+    const int utf16Length = detail::Utf16LengthFromUtf8(utf8Start, utf8Length);
+
+    // Make room in the destination string for the converted bits
+    utf16.resize(utf16Length);
+
+    // Do the actual conversion from UTF-8 to UTF-16
+    detail::ConvertUtf8ToUtf16(utf8Start, utf8Length, &utf16[0], utf16Length);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+    detail::SampleConversion(ConversionDirection::Utf8ToUtf16, utf8Start, utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    telemetry.Complete(utf8Length, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_return, utf8Length, utf16Length);
+
+    // Return the converted result string
+    return utf16;
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-16.
+//
+// UTF-8 strings are stored using std::string.
+// UTF-16 strings are stored in a std::basic_string<Utf16Char> using the
+// given allocator.
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+template <typename Allocator,
+          typename = typename std::enable_if<
+              std::is_same<typename Allocator::value_type, Utf16Char>::value>::type>
+inline std::basic_string<Utf16Char, std::char_traits<Utf16Char>, Allocator>
+Utf16FromUtf8(const std::string& utf8, const Allocator& allocator)
+{
+    // Delegate the conversion to the [start, finish) range overload
+    const char * const utf8Start = utf8.data();
+    const char * const utf8Finish = utf8Start + utf8.length();
+    return Utf16FromUtf8(utf8Start, utf8Finish, allocator);
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-16 to UTF-8.
+//
+// UTF-16 strings are specified passing an STL-style [start, finish) range.
+// UTF-8 strings are stored in a std::basic_string<char> using the
+// given allocator.
+//
+// On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+template <typename Allocator,
+          typename = typename std::enable_if<
+              std::is_same<typename Allocator::value_type, char>::value>::type>
+inline std::basic_string<char, std::char_traits<char>, Allocator>
+Utf8FromUtf16(const Utf16Char* utf16Start, const Utf16Char* utf16Finish, const Allocator& allocator)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(utf16Start <= utf16Finish);
+
+    // Result of the conversion, allocated with the caller's allocator
+    std::basic_string<char, std::char_traits<char>, Allocator> utf8(allocator);
+
+    // Special case of empty input
+    if (utf16Start == utf16Finish)
+    {
+        // Empty input ==> empty result
+        return utf8;
+    }
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_entry, utf16Start, utf16Finish - utf16Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    detail::TelemetryScope telemetry(detail::kTelemetryUtf8FromUtf16);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    // Safely cast the length of the source UTF-16 string from size_t to int
+    // for the conversion kernels
+    const int utf16Length = detail::CheckedIntLength(utf16Finish - utf16Start);
+
+    // Get the length, in chars, of the resulting UTF-8 string
+    const int utf8Length = detail::Utf8LengthFromUtf16(utf16Start, utf16Length);
+
+    // Make room in the destination string for the converted bits
+    utf8.resize(utf8Length);
+
+    // Do the actual conversion from UTF-16 to UTF-8
+    detail::ConvertUtf16ToUtf8(utf16Start, utf16Length, &utf8[0], utf8Length);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+    detail::SampleConversion(ConversionDirection::Utf16ToUtf8, utf16Start, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    telemetry.Complete(utf16Length * sizeof(Utf16Char), utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_return, utf16Length, utf8Length);
+
+    // Return the converted result string
+    return utf8;
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-16 to UTF-8.
+//
+// UTF-16 strings are stored in CStringW.
+// UTF-8 strings are stored in a std::basic_string<char> using the
+// given allocator.
+//
+// On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+template <typename Allocator,
+          typename = typename std::enable_if<
+              std::is_same<typename Allocator::value_type, char>::value>::type>
+inline std::basic_string<char, std::char_traits<char>, Allocator>
+Utf8FromUtf16(const CStringW& utf16, const Allocator& allocator)
+{
+    // Delegate the conversion to the [start, finish) range overload
+    const Utf16Char * const utf16Start = utf16.GetString();
+    const Utf16Char * const utf16Finish = utf16Start + utf16.GetLength();
+    return Utf8FromUtf16(utf16Start, utf16Finish, allocator);
+}
+
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_PMR
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-16, allocating the result from the given
+// memory resource (e.g. a std::pmr::monotonic_buffer_resource arena).
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::pmr::basic_string<Utf16Char> Utf16FromUtf8(const char* utf8Start, const char* utf8Finish,
+                                                        std::pmr::memory_resource* resource)
+{
+    return Utf16FromUtf8(utf8Start, utf8Finish, std::pmr::polymorphic_allocator<Utf16Char>(resource));
+}
+
+inline std::pmr::basic_string<Utf16Char> Utf16FromUtf8(const std::string& utf8,
+                                                        std::pmr::memory_resource* resource)
+{
+    return Utf16FromUtf8(utf8, std::pmr::polymorphic_allocator<Utf16Char>(resource));
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-16 to UTF-8, allocating the result from the given
+// memory resource (e.g. a std::pmr::monotonic_buffer_resource arena).
+//
+// On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::pmr::string Utf8FromUtf16(const Utf16Char* utf16Start, const Utf16Char* utf16Finish,
+                                      std::pmr::memory_resource* resource)
+{
+    return Utf8FromUtf16(utf16Start, utf16Finish, std::pmr::polymorphic_allocator<char>(resource));
+}
+
+inline std::pmr::string Utf8FromUtf16(const CStringW& utf16, std::pmr::memory_resource* resource)
+{
+    return Utf8FromUtf16(utf16, std::pmr::polymorphic_allocator<char>(resource));
+}
+
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_PMR
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CONVALLOC_H
@@ -0,0 +1,255 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CONVBATCH_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CONVBATCH_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Dictionary-Aware Batch UTF-8 <-> UTF-16 Conversions
+//          ===================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module to convert batches of strings (e.g. the values of a
+// column of a table) between UTF-8 and UTF-16.
+//
+// The input strings are hashed, and each distinct value is converted only
+// once. This pays off for low-cardinality data (countries, status codes,
+// product names, ...), where conversion work drops by orders of magnitude.
+//
+// The results can be requested in dictionary-encoded form (the distinct
+// converted values, plus an index into them for each input string),
+// or expanded (one converted string per input string).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"       // Core conversion functions
+
+#include <cstddef>          // For std::size_t
+#include <cstdint>          // For std::uint64_t
+#include <cstring>          // For std::memcmp
+#include <string>           // For std::string
+#include <unordered_map>    // For std::unordered_multimap
+#include <utility>          // For std::make_pair
+#include <vector>           // For std::vector
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+//------------------------------------------------------------------------------
+// Dictionary-encoded result of a batch conversion.
+//
+// 'dictionary' stores the distinct converted values, in order of first
+// appearance; the i-th input string was converted to dictionary[indices[i]].
+//------------------------------------------------------------------------------
+template <typename StringT>
+struct DictionaryBatch
+{
+    std::vector<StringT>     dictionary;
+    std::vector<std::size_t> indices;
+};
+
+typedef DictionaryBatch<CStringW>    Utf16DictionaryBatch;
+typedef DictionaryBatch<std::string> Utf8DictionaryBatch;
+
+
+namespace detail
+{
+
+//
+// Per-encoding helpers for the dictionary conversion
+//
+
+inline const void* BytesOf(const std::string& s) noexcept
+{
+    return s.data();
+}
+
+inline std::size_t ByteLengthOf(const std::string& s) noexcept
+{
+    return s.length();
+}
+
+inline const void* BytesOf(const CStringW& s) noexcept
+{
+    return s.GetString();
+}
+
+inline std::size_t ByteLengthOf(const CStringW& s) noexcept
+{
+    return s.GetLength() * sizeof(Utf16Char);
+}
+
+inline CStringW ConvertValue(const std::string& utf8)
+{
+    return Utf16FromUtf8(utf8);
+}
+
+inline std::string ConvertValue(const CStringW& utf16)
+{
+    return Utf8FromUtf16(utf16);
+}
+
+//
+// Convert each distinct string in [first, last) once, filling the dictionary
+// of converted values and the per-input indices into it.
+//
+template <typename InputStringT, typename OutputStringT>
+void DictionaryConvert(const InputStringT* first, const InputStringT* last,
+                       DictionaryBatch<OutputStringT>& result)
+{
+    ATLASSERT(first <= last);
+
+    result.dictionary.clear();
+    result.indices.clear();
+    result.indices.reserve(last - first);
+
+    // First occurrence in the input of each dictionary value, indexed by hash
+    std::vector<const InputStringT*> representatives;
+    std::unordered_multimap<std::uint64_t, std::size_t, IdentityHash> index;
+
+    for (const InputStringT* input = first; input != last; ++input)
+    {
+        const void * const bytes = BytesOf(*input);
+        const std::size_t length = ByteLengthOf(*input);
+        const std::uint64_t hash = HashBytes(bytes, length);
+
+        std::size_t found = static_cast<std::size_t>(-1);
+        const auto range = index.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            const InputStringT& candidate = *representatives[it->second];
+            if (ByteLengthOf(candidate) == length
+                && std::memcmp(BytesOf(candidate), bytes, length) == 0)
+            {
+                found = it->second;
+                break;
+            }
+        }
+
+        if (found == static_cast<std::size_t>(-1))
+        {
+            // New distinct value: convert it
+            found = result.dictionary.size();
+            result.dictionary.push_back(ConvertValue(*input));
+            representatives.push_back(input);
+            index.insert(std::make_pair(hash, found));
+        }
+
+        result.indices.push_back(found);
+    }
+}
+
+// Expand a dictionary-encoded batch to one string per input
+template <typename StringT>
+std::vector<StringT> ExpandDictionary(const DictionaryBatch<StringT>& batch)
+{
+    std::vector<StringT> expanded;
+    expanded.reserve(batch.indices.size());
+    for (std::size_t index : batch.indices)
+    {
+        expanded.push_back(batch.dictionary[index]);
+    }
+    return expanded;
+}
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// Convert a batch of UTF-8 strings to UTF-16, converting each distinct value
+// only once, and return the dictionary-encoded result.
+//
+// Input strings are specified using an STL-style [start, finish) range.
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in an input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline Utf16DictionaryBatch Utf16DictionaryFromUtf8(const std::string* utf8Start,
+                                                    const std::string* utf8Finish)
+{
+    Utf16DictionaryBatch batch;
+    detail::DictionaryConvert(utf8Start, utf8Finish, batch);
+    return batch;
+}
+
+inline Utf16DictionaryBatch Utf16DictionaryFromUtf8(const std::vector<std::string>& utf8)
+{
+    const std::string * const utf8Start = utf8.data();
+    return Utf16DictionaryFromUtf8(utf8Start, utf8Start + utf8.size());
+}
+
+
+//------------------------------------------------------------------------------
+// Convert a batch of UTF-8 strings to UTF-16, converting each distinct value
+// only once, and return one UTF-16 string per input string.
+//
+// Equal results share the same CStringW reference-counted buffer.
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in an input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::vector<CStringW> Utf16BatchFromUtf8(const std::string* utf8Start,
+                                                const std::string* utf8Finish)
+{
+    return detail::ExpandDictionary(Utf16DictionaryFromUtf8(utf8Start, utf8Finish));
+}
+
+inline std::vector<CStringW> Utf16BatchFromUtf8(const std::vector<std::string>& utf8)
+{
+    return detail::ExpandDictionary(Utf16DictionaryFromUtf8(utf8));
+}
+
+
+//------------------------------------------------------------------------------
+// Convert a batch of UTF-16 strings to UTF-8, converting each distinct value
+// only once, and return the dictionary-encoded result.
+//
+// Input strings are specified using an STL-style [start, finish) range.
+//
+// On conversion errors (e.g. invalid UTF-16 sequence in an input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline Utf8DictionaryBatch Utf8DictionaryFromUtf16(const CStringW* utf16Start,
+                                                   const CStringW* utf16Finish)
+{
+    Utf8DictionaryBatch batch;
+    detail::DictionaryConvert(utf16Start, utf16Finish, batch);
+    return batch;
+}
+
+inline Utf8DictionaryBatch Utf8DictionaryFromUtf16(const std::vector<CStringW>& utf16)
+{
+    const CStringW * const utf16Start = utf16.data();
+    return Utf8DictionaryFromUtf16(utf16Start, utf16Start + utf16.size());
+}
+
+
+//------------------------------------------------------------------------------
+// Convert a batch of UTF-16 strings to UTF-8, converting each distinct value
+// only once, and return one UTF-8 string per input string.
+//
+// On conversion errors (e.g. invalid UTF-16 sequence in an input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::vector<std::string> Utf8BatchFromUtf16(const CStringW* utf16Start,
+                                                   const CStringW* utf16Finish)
+{
+    return detail::ExpandDictionary(Utf8DictionaryFromUtf16(utf16Start, utf16Finish));
+}
+
+inline std::vector<std::string> Utf8BatchFromUtf16(const std::vector<CStringW>& utf16)
+{
+    return detail::ExpandDictionary(Utf8DictionaryFromUtf16(utf16));
+}
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CONVBATCH_H
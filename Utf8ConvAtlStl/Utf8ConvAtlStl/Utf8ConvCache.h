@@ -0,0 +1,260 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CONVCACHE_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CONVCACHE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Memoization Cache for Repeated UTF-8 -> UTF-16 Conversions
+//          ==========================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module providing Utf16ConversionCache, an opt-in, bounded,
+// sharded LRU cache of Utf16FromUtf8 results, keyed by the input bytes.
+//
+// It pays off when a small set of strings (column names, enum labels, path
+// prefixes, ...) makes up most of the conversions: looking up the input
+// (hashing it, and comparing the bytes) is cheaper than converting it.
+//
+// The cached CStringW results are returned by value: CStringW copies share
+// the same reference-counted buffer, so a cache hit doesn't allocate.
+// Each shard has its own lock, so the cache scales across many threads.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"       // Core conversion functions
+
+#include <atomic>           // For std::atomic
+#include <cstddef>          // For std::size_t
+#include <cstdint>          // For std::uint64_t
+#include <cstring>          // For std::memcmp
+#include <iterator>         // For std::prev
+#include <list>             // For std::list
+#include <memory>           // For std::unique_ptr
+#include <mutex>            // For std::mutex, std::lock_guard
+#include <string>           // For std::string
+#include <unordered_map>    // For std::unordered_multimap
+#include <utility>          // For std::make_pair
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+//------------------------------------------------------------------------------
+// Bounded, sharded LRU cache of UTF-8 -> UTF-16 conversions.
+//
+// All the member functions can be called concurrently from several threads.
+// On conversion errors, throws Utf8ConversionException (invalid inputs are
+// not cached).
+//------------------------------------------------------------------------------
+class Utf16ConversionCache
+{
+public:
+
+    // Default maximum number of cached strings
+    static constexpr std::size_t kDefaultCapacity = 4096;
+
+    // Default number of independently locked shards
+    static constexpr std::size_t kDefaultShardCount = 16;
+
+    // Default maximum length, in bytes, of the cached inputs:
+    // longer inputs are converted without being cached
+    static constexpr std::size_t kDefaultMaxInputLength = 256;
+
+    // Cache usage counters
+    struct Statistics
+    {
+        std::uint64_t hits;         // conversions served from the cache
+        std::uint64_t misses;       // conversions done and added to the cache
+        std::uint64_t bypasses;     // inputs too long to be cached
+        std::uint64_t evictions;    // least recently used entries dropped
+        std::size_t   size;         // strings currently cached
+    };
+
+    // Create a cache holding at most 'capacity' strings, split in 'shardCount' shards
+    explicit Utf16ConversionCache(std::size_t capacity = kDefaultCapacity,
+                                  std::size_t shardCount = kDefaultShardCount,
+                                  std::size_t maxInputLength = kDefaultMaxInputLength)
+        : m_shardCount(shardCount)
+        , m_maxInputLength(maxInputLength)
+    {
+        ATLASSERT(capacity > 0);
+        ATLASSERT(shardCount > 0);
+
+        const std::size_t shardCapacity = (capacity + shardCount - 1) / shardCount;
+        m_shards.reset(new Shard[shardCount]);
+        for (std::size_t i = 0; i < shardCount; ++i)
+        {
+            m_shards[i].capacity = shardCapacity;
+        }
+    }
+
+    Utf16ConversionCache(const Utf16ConversionCache&) = delete;
+    Utf16ConversionCache& operator=(const Utf16ConversionCache&) = delete;
+
+    //
+    // Convert from UTF-8 to UTF-16, returning the cached result if available.
+    // UTF-8 strings are specified using an STL-style [start, finish) range.
+    //
+    CStringW Utf16FromUtf8(const char* utf8Start, const char* utf8Finish)
+    {
+        ATLASSERT(utf8Start <= utf8Finish);
+
+        const std::size_t length = utf8Finish - utf8Start;
+        if (length > m_maxInputLength)
+        {
+            // Don't pollute the cache with long, likely unique, strings
+            // (counted without taking the shard's lock)
+            m_shards[length % m_shardCount].bypasses.fetch_add(1, std::memory_order_relaxed);
+            return win32::Utf16FromUtf8(utf8Start, utf8Finish);
+        }
+
+        const std::uint64_t hash = detail::HashBytes(utf8Start, length);
+        Shard& shard = m_shards[(hash >> 32) % m_shardCount];
+
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            const EntryIterator entry = shard.Find(hash, utf8Start, length);
+            if (entry != shard.entries.end())
+            {
+                // Hit: mark the entry as the most recently used
+                ++shard.hits;
+                shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+                return entry->utf16;
+            }
+        }
+
+        // Miss: convert without holding the lock
+        CStringW utf16 = win32::Utf16FromUtf8(utf8Start, utf8Finish);
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        ++shard.misses;
+        if (shard.Find(hash, utf8Start, length) == shard.entries.end())
+        {
+            // Not added meanwhile by another thread
+            shard.entries.push_front(Entry{ std::string(utf8Start, utf8Finish), hash, utf16 });
+            shard.index.insert(std::make_pair(hash, shard.entries.begin()));
+
+            if (shard.entries.size() > shard.capacity)
+            {
+                shard.EvictLeastRecentlyUsed();
+            }
+        }
+        return utf16;
+    }
+
+    // Convert from UTF-8 to UTF-16, returning the cached result if available
+    CStringW Utf16FromUtf8(const std::string& utf8)
+    {
+        const char * const utf8Start = utf8.data();
+        return Utf16FromUtf8(utf8Start, utf8Start + utf8.length());
+    }
+
+    // Sum of the usage counters of all the shards
+    Statistics GetStatistics() const
+    {
+        Statistics statistics = {};
+        for (std::size_t i = 0; i < m_shardCount; ++i)
+        {
+            const Shard& shard = m_shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            statistics.hits += shard.hits;
+            statistics.misses += shard.misses;
+            statistics.bypasses += shard.bypasses.load(std::memory_order_relaxed);
+            statistics.evictions += shard.evictions;
+            statistics.size += shard.entries.size();
+        }
+        return statistics;
+    }
+
+    // Drop all the cached strings (the counters are preserved)
+    void Clear()
+    {
+        for (std::size_t i = 0; i < m_shardCount; ++i)
+        {
+            Shard& shard = m_shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.index.clear();
+            shard.entries.clear();
+        }
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+
+    struct Entry
+    {
+        std::string utf8;       // input bytes (cache key)
+        std::uint64_t hash;     // hash of the input bytes
+        CStringW utf16;         // converted result
+    };
+
+    typedef std::list<Entry>::iterator EntryIterator;
+
+    // Independently locked portion of the cache
+    struct Shard
+    {
+        mutable std::mutex mutex;
+
+        // Entries, sorted from the most recently used to the least recently used
+        std::list<Entry> entries;
+
+        // Entries indexed by hash (colliding hashes are disambiguated comparing bytes)
+        std::unordered_multimap<std::uint64_t, EntryIterator, detail::IdentityHash> index;
+
+        std::size_t capacity = 0;
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::atomic<std::uint64_t> bypasses{ 0 };   // updated without holding the lock
+        std::uint64_t evictions = 0;
+
+        // Find the entry with the given input bytes (lock must be held)
+        EntryIterator Find(std::uint64_t hash, const char* utf8, std::size_t length)
+        {
+            const auto range = index.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                const std::string& key = it->second->utf8;
+                if (key.length() == length && std::memcmp(key.data(), utf8, length) == 0)
+                {
+                    return it->second;
+                }
+            }
+            return entries.end();
+        }
+
+        // Drop the least recently used entry (lock must be held)
+        void EvictLeastRecentlyUsed()
+        {
+            const EntryIterator victim = std::prev(entries.end());
+            const auto range = index.equal_range(victim->hash);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                if (it->second == victim)
+                {
+                    index.erase(it);
+                    break;
+                }
+            }
+            entries.erase(victim);
+            ++evictions;
+        }
+    };
+
+    std::unique_ptr<Shard[]> m_shards;
+    std::size_t m_shardCount;
+    std::size_t m_maxInputLength;
+};
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CONVCACHE_H
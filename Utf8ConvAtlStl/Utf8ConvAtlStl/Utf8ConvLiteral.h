@@ -0,0 +1,290 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CONVLITERAL_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CONVLITERAL_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Compile-Time UTF-8 -> UTF-16 Conversions of String Literals
+//          ===========================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module converting constant UTF-8 text (keys, table names,
+// format strings, ...) to UTF-16 at compile time, into fixed-size strings
+// stored in static storage: no runtime conversion cost, and no runtime
+// exceptions for constant text.
+//
+//      constexpr auto kKey = win32::Utf16FromUtf8Literal("Kin \xE9\x87\x91");
+//
+// In C++20, the "..."_u16 literal operator (in the win32::literals namespace)
+// does the same, sizing the result exactly:
+//
+//      using namespace GiovanniDicanio::win32::literals;
+//      ::SetWindowTextW(hwnd, "Kin \xE9\x87\x91"_u16);
+//
+// Invalid UTF-8 in a literal converted at compile time is a compile error.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Core conversion functions
+
+#include <cstddef>      // For std::size_t
+#include <cstring>      // For std::memcpy
+#include <string>       // For std::u16string
+
+// The literal operator needs class types as non-type template parameters (C++20)
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+#define GIOVANNI_DICANIO_UTF8CONV_HAS_LITERAL_OPERATOR
+#endif // __cpp_nontype_template_args
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+namespace detail
+{
+
+//
+// Decode the code point starting at utf8[pos], in a UTF-8 string of the given
+// length, advancing 'pos' past it.
+// Applies the same validation rules of DecodeUtf8, but can run at compile time:
+// on invalid input it throws, which in constant evaluation is a compile error.
+//
+constexpr char32_t DecodeUtf8Literal(const char* utf8, std::size_t length, std::size_t& pos)
+{
+    const unsigned char lead = static_cast<unsigned char>(utf8[pos]);
+    if (lead < 0x80)
+    {
+        ++pos;
+        return lead;
+    }
+
+    unsigned char secondMin = 0x80;
+    unsigned char secondMax = 0xBF;
+    std::size_t sequenceLength = 0;
+    char32_t codePoint = 0;
+    if (lead >= 0xC2 && lead < 0xE0)
+    {
+        sequenceLength = 2;
+        codePoint = lead & 0x1F;
+    }
+    else if (lead >= 0xE0 && lead < 0xF0)
+    {
+        sequenceLength = 3;
+        codePoint = lead & 0x0F;
+        secondMin = (lead == 0xE0) ? 0xA0 : 0x80;   // overlong
+        secondMax = (lead == 0xED) ? 0x9F : 0xBF;   // surrogates
+    }
+    else if (lead >= 0xF0 && lead < 0xF5)
+    {
+        sequenceLength = 4;
+        codePoint = lead & 0x07;
+        secondMin = (lead == 0xF0) ? 0x90 : 0x80;   // overlong
+        secondMax = (lead == 0xF4) ? 0x8F : 0xBF;   // above U+10FFFF
+    }
+
+    bool valid = (sequenceLength != 0) && (length - pos >= sequenceLength);
+    for (std::size_t i = 1; valid && i < sequenceLength; ++i)
+    {
+        const unsigned char trail = static_cast<unsigned char>(utf8[pos + i]);
+        valid = (i == 1) ? (trail >= secondMin && trail <= secondMax)
+                         : ((trail & 0xC0) == 0x80);
+        codePoint = (codePoint << 6) | (trail & 0x3F);
+    }
+
+    if (!valid)
+    {
+        // If you get a compile error here, the literal is not valid UTF-8
+        throw Utf8ConversionException(
+            "Invalid UTF-8 sequence in string literal.\n",
+            ERROR_NO_UNICODE_TRANSLATION);
+    }
+
+    pos += sequenceLength;
+    return codePoint;
+}
+
+// Length, in UTF-16 code units, of the conversion of the given UTF-8 string
+constexpr std::size_t Utf16LengthFromUtf8Literal(const char* utf8, std::size_t length)
+{
+    std::size_t utf16Length = 0;
+    std::size_t pos = 0;
+    while (pos < length)
+    {
+        utf16Length += (DecodeUtf8Literal(utf8, length, pos) < 0x10000) ? 1 : 2;
+    }
+    return utf16Length;
+}
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// Fixed-capacity UTF-16 string, holding up to N code units (plus the
+// terminating NUL) in place, built by a compile-time conversion from UTF-8.
+//------------------------------------------------------------------------------
+template <std::size_t N>
+class FixedUtf16String
+{
+public:
+
+    // Maximum length of the string, in code units
+    static constexpr std::size_t kCapacity = N;
+
+    //
+    // Convert the given UTF-8 string (of 'utf8Length' chars), whose UTF-16
+    // conversion must fit in N code units.
+    // When evaluated at compile time, invalid UTF-8 is a compile error;
+    // at runtime, Utf8ConversionException is thrown.
+    //
+    constexpr FixedUtf16String(const char* utf8, std::size_t utf8Length)
+        : m_data{}
+        , m_length(0)
+    {
+        std::size_t pos = 0;
+        while (pos < utf8Length)
+        {
+            const char32_t codePoint = detail::DecodeUtf8Literal(utf8, utf8Length, pos);
+            const std::size_t codeUnits = (codePoint < 0x10000) ? 1 : 2;
+            if (N - m_length < codeUnits)
+            {
+                throw Utf8ConversionException(
+                    "UTF-16 conversion of string literal exceeds the fixed capacity.\n",
+                    ERROR_INSUFFICIENT_BUFFER);
+            }
+
+            if (codeUnits == 1)
+            {
+                m_data[m_length++] = static_cast<Utf16Char>(codePoint);
+            }
+            else
+            {
+                m_data[m_length++] = static_cast<Utf16Char>(0xD800 + ((codePoint - 0x10000) >> 10));
+                m_data[m_length++] = static_cast<Utf16Char>(0xDC00 + ((codePoint - 0x10000) & 0x3FF));
+            }
+        }
+    }
+
+    // Pointer to the NUL-terminated string
+    constexpr const Utf16Char* Data() const noexcept
+    {
+        return m_data;
+    }
+
+    constexpr operator const Utf16Char*() const noexcept
+    {
+        return m_data;
+    }
+
+    // Length of the string, in code units (not including the terminating NUL)
+    constexpr std::size_t Length() const noexcept
+    {
+        return m_length;
+    }
+
+    constexpr bool IsEmpty() const noexcept
+    {
+        return m_length == 0;
+    }
+
+    // Copy the string into a CStringW
+    CStringW ToCStringW() const
+    {
+        return CStringW(m_data, static_cast<int>(m_length));
+    }
+
+    // Copy the string into a std::u16string
+    std::u16string ToU16String() const
+    {
+        std::u16string result(m_length, u'\0');
+        if (m_length != 0)
+        {
+            std::memcpy(&result[0], m_data, m_length * sizeof(char16_t));
+        }
+        return result;
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    Utf16Char m_data[N + 1];
+    std::size_t m_length;
+};
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-16 at compile time, when the result initializes
+// a constexpr variable (invalid UTF-8 is then a compile error).
+//
+// The input is a string literal (or char array), whose terminating NUL is
+// not converted. The capacity of the result is the size of the UTF-8 input,
+// which its UTF-16 conversion can't exceed.
+//
+// When evaluated at runtime, throws Utf8ConversionException on conversion
+// errors (e.g. invalid UTF-8 sequence in input string).
+//------------------------------------------------------------------------------
+template <std::size_t N>
+constexpr FixedUtf16String<N - 1> Utf16FromUtf8Literal(const char (&utf8)[N])
+{
+    return FixedUtf16String<N - 1>(utf8, N - 1);
+}
+
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_LITERAL_OPERATOR
+
+namespace detail
+{
+
+// String literal passed as template argument to the literal operator
+template <std::size_t N>
+struct Utf8Literal
+{
+    char chars[N];
+
+    constexpr Utf8Literal(const char (&literal)[N]) noexcept
+        : chars{}
+    {
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            chars[i] = literal[i];
+        }
+    }
+};
+
+// Exactly-sized UTF-16 conversion of the given literal, in static storage
+template <Utf8Literal Literal>
+inline constexpr FixedUtf16String<Utf16LengthFromUtf8Literal(Literal.chars, sizeof(Literal.chars) - 1)>
+    kUtf16FromUtf8Literal{ Literal.chars, sizeof(Literal.chars) - 1 };
+
+} // namespace detail
+
+
+namespace literals
+{
+
+//------------------------------------------------------------------------------
+// "..."_u16 converts a UTF-8 string literal to UTF-16 at compile time (C++20),
+// returning a reference to a FixedUtf16String in static storage.
+// Invalid UTF-8 in the literal is a compile error.
+//------------------------------------------------------------------------------
+template <detail::Utf8Literal Literal>
+constexpr const auto& operator""_u16() noexcept
+{
+    return detail::kUtf16FromUtf8Literal<Literal>;
+}
+
+} // namespace literals
+
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_LITERAL_OPERATOR
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CONVLITERAL_H
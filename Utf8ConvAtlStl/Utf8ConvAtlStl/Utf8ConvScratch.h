@@ -0,0 +1,270 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CONVSCRATCH_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CONVSCRATCH_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Scoped Conversions into Thread-Local Scratch Buffers
+//          ====================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module for transient conversions: when a converted string is
+// needed only to be passed to a single call (a Win32 API, a hash, a lookup),
+// allocating and freeing a new CStringW (or std::string) every time is wasted
+// work.
+//
+// ScopedUtf16FromUtf8 and ScopedUtf8FromUtf16 convert into a growable
+// thread-local scratch buffer, and expose a view of the result that is valid
+// until the scoped object is destroyed:
+//
+//      ScopedUtf16FromUtf8 path(utf8Path);
+//      ::DeleteFileW(path.Data());
+//
+// The scratch buffer is reused by the following conversions on the same
+// thread. To prevent a single huge input from pinning memory forever,
+// buffers grown above a high-water mark are released at the end of the scope.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Core conversion functions
+
+#include <cstddef>      // For std::size_t
+#include <string>       // For std::string
+#include <vector>       // For std::vector
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+namespace detail
+{
+
+// Per-thread scratch buffer for scoped conversions
+template <typename CharT>
+struct ScratchBuffer
+{
+    std::vector<CharT> buffer;
+    bool inUse = false;
+};
+
+template <typename CharT>
+inline ScratchBuffer<CharT>& ThreadScratchBuffer()
+{
+    thread_local ScratchBuffer<CharT> scratch;
+    return scratch;
+}
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// Common implementation of the scoped conversions: owns the thread's scratch
+// buffer for the lifetime of the object.
+//
+// If the scratch buffer is already in use (nested scoped conversions on the
+// same thread), a private heap buffer is used instead.
+//------------------------------------------------------------------------------
+template <typename CharT>
+class BasicScopedConversion
+{
+public:
+
+    // Scratch buffers larger than this (in code units) are released at the end of the scope
+    static constexpr std::size_t kMaxRetainedLength = 64 * 1024;
+
+    BasicScopedConversion(const BasicScopedConversion&) = delete;
+    BasicScopedConversion& operator=(const BasicScopedConversion&) = delete;
+
+    ~BasicScopedConversion()
+    {
+        if (m_usesScratch)
+        {
+            detail::ScratchBuffer<CharT>& scratch = detail::ThreadScratchBuffer<CharT>();
+            if (scratch.buffer.capacity() > kMaxRetainedLength)
+            {
+                // High-water mark exceeded: give the memory back
+                std::vector<CharT>().swap(scratch.buffer);
+            }
+            scratch.inUse = false;
+        }
+    }
+
+    // Pointer to the NUL-terminated converted string, valid in the object's scope
+    const CharT* Data() const noexcept
+    {
+        return m_data;
+    }
+
+    // Length of the converted string, in code units (not including the terminating NUL)
+    std::size_t Length() const noexcept
+    {
+        return m_length;
+    }
+
+    bool IsEmpty() const noexcept
+    {
+        return m_length == 0;
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+protected:
+    BasicScopedConversion() noexcept
+        : m_data(m_empty)
+        , m_length(0)
+        , m_usesScratch(false)
+    {
+        m_empty[0] = 0;
+    }
+
+    // Run 'convert(buffer)' on a buffer of 'length' + 1 code units,
+    // using the thread's scratch buffer if available
+    template <typename ConvertFunction>
+    void ConvertInto(std::size_t length, ConvertFunction convert)
+    {
+        detail::ScratchBuffer<CharT>& scratch = detail::ThreadScratchBuffer<CharT>();
+        std::vector<CharT>& buffer = scratch.inUse ? m_fallback : scratch.buffer;
+
+        if (buffer.size() < length + 1)
+        {
+            buffer.resize(length + 1);
+        }
+        convert(buffer.data());
+        buffer[length] = 0;
+
+        // Take ownership of the scratch buffer only after a successful conversion
+        if (&buffer == &scratch.buffer)
+        {
+            scratch.inUse = true;
+            m_usesScratch = true;
+        }
+        m_data = buffer.data();
+        m_length = length;
+    }
+
+private:
+    const CharT* m_data;
+    std::size_t m_length;
+    bool m_usesScratch;
+    CharT m_empty[1];
+    std::vector<CharT> m_fallback;
+};
+
+
+//------------------------------------------------------------------------------
+// Scoped conversion form UTF-8 to UTF-16, into a thread-local scratch buffer.
+//
+// UTF-8 strings are specified using an STL-style [start, finish) range,
+// or std::string.
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+class ScopedUtf16FromUtf8
+    : public BasicScopedConversion<Utf16Char>
+{
+public:
+    ScopedUtf16FromUtf8(const char* utf8Start, const char* utf8Finish)
+    {
+        // Check input range parameters in debug builds
+        ATLASSERT(utf8Start <= utf8Finish);
+
+        if (utf8Start == utf8Finish)
+        {
+            return;
+        }
+
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_entry, utf8Start, utf8Finish - utf8Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        detail::TelemetryScope telemetry(detail::kTelemetryUtf16FromUtf8);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+        const int utf8Length = detail::CheckedIntLength(utf8Finish - utf8Start);
+        const int utf16Length = detail::Utf16LengthFromUtf8(utf8Start, utf8Length);
+        ConvertInto(utf16Length, [=](Utf16Char* buffer)
+        {
+            detail::ConvertUtf8ToUtf16(utf8Start, utf8Length, buffer, utf16Length);
+        });
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+        detail::SampleConversion(ConversionDirection::Utf8ToUtf16, utf8Start, utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        telemetry.Complete(utf8Length, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_return, utf8Length, utf16Length);
+    }
+
+    explicit ScopedUtf16FromUtf8(const std::string& utf8)
+        : ScopedUtf16FromUtf8(utf8.data(), utf8.data() + utf8.length())
+    {}
+};
+
+
+//------------------------------------------------------------------------------
+// Scoped conversion form UTF-16 to UTF-8, into a thread-local scratch buffer.
+//
+// UTF-16 strings are specified using an STL-style [start, finish) range,
+// or CStringW.
+//
+// On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+class ScopedUtf8FromUtf16
+    : public BasicScopedConversion<char>
+{
+public:
+    ScopedUtf8FromUtf16(const Utf16Char* utf16Start, const Utf16Char* utf16Finish)
+    {
+        // Check input range parameters in debug builds
+        ATLASSERT(utf16Start <= utf16Finish);
+
+        if (utf16Start == utf16Finish)
+        {
+            return;
+        }
+
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_entry, utf16Start, utf16Finish - utf16Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        detail::TelemetryScope telemetry(detail::kTelemetryUtf8FromUtf16);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+        const int utf16Length = detail::CheckedIntLength(utf16Finish - utf16Start);
+        const int utf8Length = detail::Utf8LengthFromUtf16(utf16Start, utf16Length);
+        ConvertInto(utf8Length, [=](char* buffer)
+        {
+            detail::ConvertUtf16ToUtf8(utf16Start, utf16Length, buffer, utf8Length);
+        });
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+        detail::SampleConversion(ConversionDirection::Utf16ToUtf8, utf16Start, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        telemetry.Complete(utf16Length * sizeof(Utf16Char), utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_return, utf16Length, utf8Length);
+    }
+
+    explicit ScopedUtf8FromUtf16(const CStringW& utf16)
+        : ScopedUtf8FromUtf16(utf16.GetString(), utf16.GetString() + utf16.GetLength())
+    {}
+};
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CONVSCRATCH_H
@@ -0,0 +1,378 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CONVSMALLSTRING_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CONVSMALLSTRING_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Small-Buffer Results for UTF-8 <-> UTF-16 Conversions
+//          =====================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module providing conversion functions that return their result
+// in a string type with inline storage for up to N code units (64 by default).
+//
+// Most strings (identifiers, keys, file names, ...) are short: converting
+// them into BasicSmallString doesn't touch the heap at all, as the conversion
+// writes straight into the inline buffer. Only results longer than N code
+// units spill to a heap-allocated buffer.
+//
+// When an owning string is needed, the result can be converted to CStringW,
+// std::u16string or std::string.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Core conversion functions
+
+#include <cstddef>      // For std::size_t
+#include <cstring>      // For std::memcpy
+#include <memory>       // For std::unique_ptr
+#include <string>       // For std::string, std::u16string
+#include <type_traits>  // For std::is_same
+#include <utility>      // For std::move
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+// Default inline capacity of the small-buffer results, in code units
+constexpr std::size_t kDefaultSmallStringCapacity = 64;
+
+
+//------------------------------------------------------------------------------
+// String with inline storage for up to N code units (plus the terminating
+// NUL), spilling to the heap only for longer contents.
+//
+// The buffer can be written in place, CString-style, using GetBuffer()
+// followed by ReleaseBuffer().
+//------------------------------------------------------------------------------
+template <typename CharT, std::size_t N>
+class BasicSmallString
+{
+public:
+
+    // Maximum length, in code units, stored without heap allocations
+    static constexpr std::size_t kInlineCapacity = N;
+
+    BasicSmallString() noexcept
+        : m_length(0)
+        , m_capacity(N)
+    {
+        m_inline[0] = 0;
+    }
+
+    BasicSmallString(const CharT* data, std::size_t length)
+        : BasicSmallString()
+    {
+        Assign(data, length);
+    }
+
+    BasicSmallString(const BasicSmallString& other)
+        : BasicSmallString()
+    {
+        Assign(other.Data(), other.Length());
+    }
+
+    BasicSmallString(BasicSmallString&& other) noexcept
+        : BasicSmallString()
+    {
+        MoveFrom(other);
+    }
+
+    BasicSmallString& operator=(const BasicSmallString& other)
+    {
+        if (this != &other)
+        {
+            Assign(other.Data(), other.Length());
+        }
+        return *this;
+    }
+
+    BasicSmallString& operator=(BasicSmallString&& other) noexcept
+    {
+        if (this != &other)
+        {
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    // Pointer to the NUL-terminated string
+    const CharT* Data() const noexcept
+    {
+        return m_heap ? m_heap.get() : m_inline;
+    }
+
+    // Length of the string, in code units (not including the terminating NUL)
+    std::size_t Length() const noexcept
+    {
+        return m_length;
+    }
+
+    bool IsEmpty() const noexcept
+    {
+        return m_length == 0;
+    }
+
+    // Is the string stored in the inline buffer?
+    bool IsInline() const noexcept
+    {
+        return !m_heap;
+    }
+
+    //
+    // Return a writable buffer for at least 'minLength' code units (plus the
+    // terminating NUL), preserving the current contents.
+    // Call ReleaseBuffer() with the new length when done writing.
+    //
+    CharT* GetBuffer(std::size_t minLength)
+    {
+        if (minLength > m_capacity)
+        {
+            std::unique_ptr<CharT[]> heap(new CharT[minLength + 1]);
+            std::memcpy(heap.get(), Data(), (m_length + 1) * sizeof(CharT));
+            m_heap = std::move(heap);
+            m_capacity = minLength;
+        }
+        return m_heap ? m_heap.get() : m_inline;
+    }
+
+    // Set the length of the string written in the buffer returned by GetBuffer()
+    void ReleaseBuffer(std::size_t newLength) noexcept
+    {
+        ATLASSERT(newLength <= m_capacity);
+
+        CharT * const data = m_heap ? m_heap.get() : m_inline;
+        data[newLength] = 0;
+        m_length = newLength;
+    }
+
+    // Copy the UTF-16 string into a CStringW
+    CStringW ToCStringW() const
+    {
+        static_assert(std::is_same<CharT, Utf16Char>::value, "ToCStringW requires a UTF-16 string");
+        return CStringW(Data(), static_cast<int>(m_length));
+    }
+
+    // Copy the UTF-16 string into a std::u16string
+    std::u16string ToU16String() const
+    {
+        static_assert(std::is_same<CharT, Utf16Char>::value, "ToU16String requires a UTF-16 string");
+
+        std::u16string result(m_length, u'\0');
+        if (m_length != 0)
+        {
+            std::memcpy(&result[0], Data(), m_length * sizeof(char16_t));
+        }
+        return result;
+    }
+
+    // Copy the UTF-8 string into a std::string
+    std::string ToStdString() const
+    {
+        static_assert(std::is_same<CharT, char>::value, "ToStdString requires a UTF-8 string");
+        return std::string(Data(), m_length);
+    }
+
+    friend bool operator==(const BasicSmallString& lhs, const BasicSmallString& rhs) noexcept
+    {
+        return lhs.m_length == rhs.m_length
+            && std::memcmp(lhs.Data(), rhs.Data(), lhs.m_length * sizeof(CharT)) == 0;
+    }
+
+    friend bool operator!=(const BasicSmallString& lhs, const BasicSmallString& rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    CharT m_inline[N + 1];
+    std::unique_ptr<CharT[]> m_heap;
+    std::size_t m_length;
+    std::size_t m_capacity;     // current capacity, in code units (not including the NUL)
+
+    void Assign(const CharT* data, std::size_t length)
+    {
+        CharT * const buffer = GetBuffer(length);
+        std::memcpy(buffer, data, length * sizeof(CharT));
+        ReleaseBuffer(length);
+    }
+
+    void MoveFrom(BasicSmallString& other) noexcept
+    {
+        if (other.m_heap)
+        {
+            // Steal the heap buffer
+            m_heap = std::move(other.m_heap);
+            m_capacity = other.m_capacity;
+        }
+        else
+        {
+            m_heap.reset();
+            m_capacity = N;
+            std::memcpy(m_inline, other.m_inline, (other.m_length + 1) * sizeof(CharT));
+        }
+        m_length = other.m_length;
+
+        other.m_capacity = N;
+        other.m_inline[0] = 0;
+        other.m_length = 0;
+    }
+};
+
+typedef BasicSmallString<Utf16Char, kDefaultSmallStringCapacity> SmallUtf16String;
+typedef BasicSmallString<char, kDefaultSmallStringCapacity>      SmallUtf8String;
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-16, into a string with inline storage for N
+// UTF-16 code units.
+//
+// Inputs of at most N bytes are converted in a single pass straight into
+// the inline buffer, as their UTF-16 conversion can't be longer than that.
+//
+// UTF-8 strings are specified using an STL-style [start, finish) range,
+// or std::string.
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+template <std::size_t N = kDefaultSmallStringCapacity>
+BasicSmallString<Utf16Char, N> SmallUtf16FromUtf8(const char* utf8Start, const char* utf8Finish)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(utf8Start <= utf8Finish);
+
+    BasicSmallString<Utf16Char, N> utf16;
+    if (utf8Start == utf8Finish)
+    {
+        return utf16;
+    }
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_entry, utf8Start, utf8Finish - utf8Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    detail::TelemetryScope telemetry(detail::kTelemetryUtf16FromUtf8);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    const int utf8Length = detail::CheckedIntLength(utf8Finish - utf8Start);
+    if (static_cast<std::size_t>(utf8Length) <= N)
+    {
+        // Each UTF-8 byte maps to at most one UTF-16 code unit: no need to get the
+        // destination length first
+        Utf16Char * const buffer = utf16.GetBuffer(N);
+        const int utf16Length = detail::ConvertUtf8ToUtf16(
+            utf8Start, utf8Length, buffer, static_cast<int>(N));
+        utf16.ReleaseBuffer(utf16Length);
+    }
+    else
+    {
+        const int utf16Length = detail::Utf16LengthFromUtf8(utf8Start, utf8Length);
+        Utf16Char * const buffer = utf16.GetBuffer(utf16Length);
+        detail::ConvertUtf8ToUtf16(utf8Start, utf8Length, buffer, utf16Length);
+        utf16.ReleaseBuffer(utf16Length);
+    }
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+    detail::SampleConversion(ConversionDirection::Utf8ToUtf16, utf8Start, utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    telemetry.Complete(utf8Length, utf16.Length());
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_return, utf8Length, static_cast<int>(utf16.Length()));
+
+    return utf16;
+}
+
+template <std::size_t N = kDefaultSmallStringCapacity>
+BasicSmallString<Utf16Char, N> SmallUtf16FromUtf8(const std::string& utf8)
+{
+    const char * const utf8Start = utf8.data();
+    return SmallUtf16FromUtf8<N>(utf8Start, utf8Start + utf8.length());
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-16 to UTF-8, into a string with inline storage for N chars.
+//
+// Inputs of at most N/3 UTF-16 code units are converted in a single pass
+// straight into the inline buffer, as their UTF-8 conversion can't be longer
+// than that.
+//
+// UTF-16 strings are specified using an STL-style [start, finish) range,
+// or CStringW.
+//
+// On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+template <std::size_t N = kDefaultSmallStringCapacity>
+BasicSmallString<char, N> SmallUtf8FromUtf16(const Utf16Char* utf16Start, const Utf16Char* utf16Finish)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(utf16Start <= utf16Finish);
+
+    BasicSmallString<char, N> utf8;
+    if (utf16Start == utf16Finish)
+    {
+        return utf8;
+    }
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_entry, utf16Start, utf16Finish - utf16Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    detail::TelemetryScope telemetry(detail::kTelemetryUtf8FromUtf16);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    const int utf16Length = detail::CheckedIntLength(utf16Finish - utf16Start);
+    if (static_cast<std::size_t>(utf16Length) <= N / 3)
+    {
+        // Each UTF-16 code unit maps to at most three UTF-8 bytes: no need to get the
+        // destination length first
+        char * const buffer = utf8.GetBuffer(N);
+        const int utf8Length = detail::ConvertUtf16ToUtf8(
+            utf16Start, utf16Length, buffer, static_cast<int>(N));
+        utf8.ReleaseBuffer(utf8Length);
+    }
+    else
+    {
+        const int utf8Length = detail::Utf8LengthFromUtf16(utf16Start, utf16Length);
+        char * const buffer = utf8.GetBuffer(utf8Length);
+        detail::ConvertUtf16ToUtf8(utf16Start, utf16Length, buffer, utf8Length);
+        utf8.ReleaseBuffer(utf8Length);
+    }
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+    detail::SampleConversion(ConversionDirection::Utf16ToUtf8, utf16Start, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    telemetry.Complete(utf16Length * sizeof(Utf16Char), utf8.Length());
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf8_from_utf16_return, utf16Length, static_cast<int>(utf8.Length()));
+
+    return utf8;
+}
+
+template <std::size_t N = kDefaultSmallStringCapacity>
+BasicSmallString<char, N> SmallUtf8FromUtf16(const CStringW& utf16)
+{
+    const Utf16Char * const utf16Start = utf16.GetString();
+    return SmallUtf8FromUtf16<N>(utf16Start, utf16Start + utf16.GetLength());
+}
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CONVSMALLSTRING_H
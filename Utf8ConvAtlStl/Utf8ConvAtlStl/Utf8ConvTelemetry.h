@@ -0,0 +1,387 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CONVTELEMETRY_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CONVTELEMETRY_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Telemetry Counters of UTF-8 <-> UTF-16 Conversions
+//          ==================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Built-in counters of the conversion functions, to see how much time a
+// service spends converting strings without an external profiler.
+//
+// Define GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY before including
+// Utf8Conv.h (which includes this header) to compile the counters in; without
+// that macro, no telemetry code is compiled in. Then read the counters with
+// GetConversionTelemetry:
+//
+//      const ConversionTelemetry before = GetConversionTelemetry();
+//      ...
+//      const ConversionTelemetry delta = GetConversionTelemetry() - before;
+//      delta.utf16FromUtf8.calls, delta.utf16FromUtf8.nanoseconds, ...
+//
+// The non-empty conversions of Utf16FromUtf8 and Utf8FromUtf16 (all their
+// overloads, including the allocator and offset map ones, and the
+// AdaptiveConverter members), of the scoped scratch-buffer conversions and of
+// the small-string conversions are counted (and so are the wchar_t ones, when
+// wchar_t is 16-bit), with their input bytes, output code units, time, and the
+// exceptions they throw; the UTF-32 conversions are not. Conversion errors are
+// counted by kind wherever a Utf8ConversionException is created (helper
+// headers included).
+//
+// Each thread updates its own counters, with plain (relaxed) loads and stores
+// and no read-modify-write atomics; GetConversionTelemetry adds up the
+// counters of all the threads, including the threads that have exited.
+//
+// Reading the clock costs about as much as converting a short string, so
+// only one call in GIOVANNI_DICANIO_UTF8CONV_TELEMETRY_TIMING_PERIOD (16 by
+// default) on each thread is timed; define it as 1 to time all the calls.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <atomic>       // For std::atomic
+#include <chrono>       // For std::chrono::steady_clock
+#include <cstddef>      // For std::size_t
+#include <cstdint>      // For std::uint64_t
+#include <mutex>        // For std::mutex, std::lock_guard
+#include <vector>       // For std::vector
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>     // For _BitScanReverse64
+#endif
+
+#ifndef GIOVANNI_DICANIO_UTF8CONV_TELEMETRY_TIMING_PERIOD
+#define GIOVANNI_DICANIO_UTF8CONV_TELEMETRY_TIMING_PERIOD 16
+#endif
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+// Kinds of conversion errors
+enum class ConversionErrorKind
+{
+    InvalidSequence,    // Invalid UTF-8 or UTF-16 input (ERROR_NO_UNICODE_TRANSLATION)
+    InputTooLong,       // Input length doesn't fit into an int (ERROR_INVALID_PARAMETER)
+    InsufficientBuffer, // Destination buffer too small (ERROR_INSUFFICIENT_BUFFER)
+    InvalidArgument,    // Other invalid arguments, e.g. out-of-range offsets (ERROR_INVALID_PARAMETER)
+    Other               // Other errors reported by the Win32 APIs
+};
+
+constexpr int kConversionErrorKindCount = 5;
+
+// Histogram buckets: bucket 0 counts zeros, bucket i values in [2^(i-1), 2^i),
+// and the last bucket values from 2^31 up
+constexpr int kTelemetryBuckets = 33;
+
+
+//------------------------------------------------------------------------------
+// Snapshot of the conversion telemetry counters
+//------------------------------------------------------------------------------
+struct ConversionTelemetry
+{
+    // Counters of a conversion function
+    struct Function
+    {
+        std::uint64_t calls = 0;        // Non-empty conversions, including the failed ones
+        std::uint64_t exceptions = 0;   // Calls that threw (conversion errors, out of memory)
+        std::uint64_t inputBytes = 0;   // Of the successful calls
+        std::uint64_t outputUnits = 0;  // Of the successful calls, in code units (chars or Utf16Chars)
+        std::uint64_t timedCalls = 0;   // Successful calls that were timed
+        std::uint64_t nanoseconds = 0;  // Time spent in the timed calls
+
+        // Timed calls by time in nanoseconds, and successful calls by input length in bytes
+        std::uint64_t timeHistogram[kTelemetryBuckets] = {};
+        std::uint64_t sizeHistogram[kTelemetryBuckets] = {};
+    };
+
+    Function utf16FromUtf8;
+    Function utf8FromUtf16;
+
+    // Utf8ConversionExceptions created, by ConversionErrorKind
+    std::uint64_t errors[kConversionErrorKindCount] = {};
+};
+
+// Difference of two snapshots (e.g. the counts of an interval)
+inline ConversionTelemetry operator-(const ConversionTelemetry& later, const ConversionTelemetry& earlier) noexcept
+{
+    ConversionTelemetry result;
+
+    auto subtract = [](ConversionTelemetry::Function& to,
+                       const ConversionTelemetry::Function& a, const ConversionTelemetry::Function& b)
+    {
+        to.calls = a.calls - b.calls;
+        to.exceptions = a.exceptions - b.exceptions;
+        to.inputBytes = a.inputBytes - b.inputBytes;
+        to.outputUnits = a.outputUnits - b.outputUnits;
+        to.timedCalls = a.timedCalls - b.timedCalls;
+        to.nanoseconds = a.nanoseconds - b.nanoseconds;
+        for (int i = 0; i < kTelemetryBuckets; ++i)
+        {
+            to.timeHistogram[i] = a.timeHistogram[i] - b.timeHistogram[i];
+            to.sizeHistogram[i] = a.sizeHistogram[i] - b.sizeHistogram[i];
+        }
+    };
+    subtract(result.utf16FromUtf8, later.utf16FromUtf8, earlier.utf16FromUtf8);
+    subtract(result.utf8FromUtf16, later.utf8FromUtf16, earlier.utf8FromUtf16);
+
+    for (int i = 0; i < kConversionErrorKindCount; ++i)
+    {
+        result.errors[i] = later.errors[i] - earlier.errors[i];
+    }
+    return result;
+}
+
+
+namespace detail
+{
+
+// Indexes of the counters of the conversion functions
+constexpr int kTelemetryUtf16FromUtf8 = 0;
+constexpr int kTelemetryUtf8FromUtf16 = 1;
+
+// Counter updated only by its owner thread, and read by any thread
+class TelemetryCounter
+{
+public:
+    // Relaxed load and store, not an atomic increment: a plain add
+    void Add(std::uint64_t value) noexcept
+    {
+        m_value.store(m_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    std::uint64_t Get() const noexcept
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> m_value{ 0 };
+};
+
+// Counters of a conversion function, for a thread
+struct FunctionCounters
+{
+    TelemetryCounter calls;
+    TelemetryCounter exceptions;
+    TelemetryCounter inputBytes;
+    TelemetryCounter outputUnits;
+    TelemetryCounter timedCalls;
+    TelemetryCounter nanoseconds;
+    TelemetryCounter timeHistogram[kTelemetryBuckets];
+    TelemetryCounter sizeHistogram[kTelemetryBuckets];
+
+    void AddTo(ConversionTelemetry::Function& total) const noexcept
+    {
+        total.calls += calls.Get();
+        total.exceptions += exceptions.Get();
+        total.inputBytes += inputBytes.Get();
+        total.outputUnits += outputUnits.Get();
+        total.timedCalls += timedCalls.Get();
+        total.nanoseconds += nanoseconds.Get();
+        for (int i = 0; i < kTelemetryBuckets; ++i)
+        {
+            total.timeHistogram[i] += timeHistogram[i].Get();
+            total.sizeHistogram[i] += sizeHistogram[i].Get();
+        }
+    }
+};
+
+// Counters of a thread
+struct TelemetryCounters
+{
+    FunctionCounters functions[2];
+    TelemetryCounter errors[kConversionErrorKindCount];
+
+    // Calls left before the next timed one (read by the owner thread only)
+    unsigned int callsToNextTiming = 1;
+
+    void AddTo(ConversionTelemetry& total) const noexcept
+    {
+        functions[kTelemetryUtf16FromUtf8].AddTo(total.utf16FromUtf8);
+        functions[kTelemetryUtf8FromUtf16].AddTo(total.utf8FromUtf16);
+        for (int i = 0; i < kConversionErrorKindCount; ++i)
+        {
+            total.errors[i] += errors[i].Get();
+        }
+    }
+};
+
+// Counters of the live threads, and totals of the exited ones
+struct TelemetryRegistry
+{
+    std::mutex mutex;
+    std::vector<const TelemetryCounters*> threads;
+    ConversionTelemetry exited;
+};
+
+inline TelemetryRegistry& GetTelemetryRegistry()
+{
+    // Never destroyed, as threads may exit after the static destructors ran
+    static TelemetryRegistry* const registry = new TelemetryRegistry();
+    return *registry;
+}
+
+// Registers the counters of a thread for its lifetime
+class ThreadTelemetry
+{
+public:
+    ThreadTelemetry()
+    {
+        TelemetryRegistry& registry = GetTelemetryRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.threads.push_back(&m_counters);
+    }
+
+    ~ThreadTelemetry()
+    {
+        TelemetryRegistry& registry = GetTelemetryRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        m_counters.AddTo(registry.exited);
+        for (std::size_t i = 0; i < registry.threads.size(); ++i)
+        {
+            if (registry.threads[i] == &m_counters)
+            {
+                registry.threads[i] = registry.threads.back();
+                registry.threads.pop_back();
+                break;
+            }
+        }
+    }
+
+    ThreadTelemetry(const ThreadTelemetry&) = delete;
+    ThreadTelemetry& operator=(const ThreadTelemetry&) = delete;
+
+    TelemetryCounters& Counters() noexcept
+    {
+        return m_counters;
+    }
+
+private:
+    TelemetryCounters m_counters;
+};
+
+// Counters of the calling thread
+inline TelemetryCounters& ThreadTelemetryCounters()
+{
+    thread_local ThreadTelemetry telemetry;
+    return telemetry.Counters();
+}
+
+// Histogram bucket of a value
+inline int TelemetryBucket(std::uint64_t value) noexcept
+{
+    int bucket = 0;
+#if defined(__GNUC__) || defined(__clang__)
+    bucket = (value == 0) ? 0 : 64 - __builtin_clzll(value);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index = 0;
+    bucket = _BitScanReverse64(&index, value) ? static_cast<int>(index) + 1 : 0;
+#else
+    for (; value != 0; value >>= 1)
+    {
+        ++bucket;
+    }
+#endif
+    return (bucket < kTelemetryBuckets) ? bucket : kTelemetryBuckets - 1;
+}
+
+// Count a Utf8ConversionException
+inline void CountConversionError(ConversionErrorKind kind)
+{
+    ThreadTelemetryCounters().errors[static_cast<int>(kind)].Add(1);
+}
+
+//------------------------------------------------------------------------------
+// Counts a call of a conversion function: a call that leaves the scope
+// without Complete() has thrown.
+//------------------------------------------------------------------------------
+class TelemetryScope
+{
+public:
+    explicit TelemetryScope(int function)
+        : m_thread(ThreadTelemetryCounters())
+        , m_counters(m_thread.functions[function])
+        , m_timed(false)
+        , m_completed(false)
+    {
+        if (--m_thread.callsToNextTiming == 0)
+        {
+            m_thread.callsToNextTiming = GIOVANNI_DICANIO_UTF8CONV_TELEMETRY_TIMING_PERIOD;
+            m_timed = true;
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TelemetryScope()
+    {
+        m_counters.calls.Add(1);
+        if (!m_completed)
+        {
+            m_counters.exceptions.Add(1);
+        }
+    }
+
+    TelemetryScope(const TelemetryScope&) = delete;
+    TelemetryScope& operator=(const TelemetryScope&) = delete;
+
+    // Count the successful conversion of 'inputBytes' into 'outputUnits' code units
+    void Complete(std::size_t inputBytes, std::size_t outputUnits) noexcept
+    {
+        if (m_timed)
+        {
+            const std::uint64_t nanoseconds = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - m_start).count());
+            m_counters.timedCalls.Add(1);
+            m_counters.nanoseconds.Add(nanoseconds);
+            m_counters.timeHistogram[TelemetryBucket(nanoseconds)].Add(1);
+        }
+
+        m_counters.inputBytes.Add(inputBytes);
+        m_counters.outputUnits.Add(outputUnits);
+        m_counters.sizeHistogram[TelemetryBucket(inputBytes)].Add(1);
+        m_completed = true;
+    }
+
+private:
+    TelemetryCounters& m_thread;
+    FunctionCounters& m_counters;
+    std::chrono::steady_clock::time_point m_start;
+    bool m_timed;
+    bool m_completed;
+};
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// Snapshot of the conversion telemetry counters, added up over all the
+// threads (the counts of calls still in progress on other threads may be
+// partially included).
+//------------------------------------------------------------------------------
+inline ConversionTelemetry GetConversionTelemetry()
+{
+    detail::TelemetryRegistry& registry = detail::GetTelemetryRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    ConversionTelemetry total = registry.exited;
+    for (const detail::TelemetryCounters* counters : registry.threads)
+    {
+        counters->AddTo(total);
+    }
+    return total;
+}
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CONVTELEMETRY_H
@@ -7,13 +7,45 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 
-#include "Utf8Conv.h"   // UTF-8 conversion functions to test
-#include <iostream>     // For console output
-#include <exception>    // For std::exception
+#include "Utf8Conv.h"       // UTF-8 conversion functions to test
+#include "Utf8CodePoints.h" // Code-point iterators to test
+#include "Utf8OffsetMap.h"  // UTF-8 <-> UTF-16 offset map to test
+#include "Utf16Mirror.h"    // Incremental UTF-16 mirror to test
+#include "Utf8Rope.h"       // Dual-encoding rope to test
+#include "DualString.h"     // Lazily converting dual string to test
+#include "Utf8ConvCache.h"  // Conversion memoization cache to test
+#include "Utf16Interner.h"  // UTF-16 interning table to test
+#include "Utf8ConvBatch.h"  // Dictionary-aware batch conversions to test
+#include "Utf8ConvAlloc.h"  // Conversions with custom allocators to test
+#include "Utf8ConvScratch.h" // Scoped scratch-buffer conversions to test
+#include "Utf8ConvSmallString.h" // Small-buffer conversion results to test
+#include "Utf8ConvUtf32.h"  // UTF-32 and wchar_t conversions to test
+#include "Utf8ConvLiteral.h" // Compile-time conversions to test
+#include "Utf8ConvAdaptive.h" // Adaptive kernel selection to test
+#include <algorithm>        // For std::find
+#include <cstdlib>          // For std::malloc, std::free
+#include <iostream>         // For console output
+#include <iterator>         // For std::distance
+#include <memory>           // For std::allocator
+#include <thread>           // For std::thread
+#include <vector>           // For std::vector
+#include <exception>        // For std::exception
+#include <new>              // For std::bad_alloc
 
 using namespace GiovanniDicanio;
 using std::cout;
 
+#ifndef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+// Portable build: use the library's replacements for the ATL and Win32 definitions
+using win32::CStringW;
+using win32::DWORD;
+using win32::ERROR_INVALID_PARAMETER;
+using win32::ERROR_NO_UNICODE_TRANSLATION;
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+// UTF-16 string and character literals (L"..." with ATL, u"..." in portable builds)
+#define U16(s) GIOVANNI_DICANIO_UTF16_LITERAL(s)
+
 //
 // Tests with gigantic strings (whose lengths expressed in size_t can't fit
 // into an int and can't be passed to the MultiByteToWideChar 
@@ -41,6 +73,13 @@ void PrintTestError(const char* const file, const int line, const char* const ms
 } // anonymous namespace
 
 
+// Suppress the "conditional expression is constant" warning with MSVC
+#ifdef _MSC_VER
+#define TEST_ERROR_WHILE_FALSE __pragma(warning(suppress:4127)) while (0)
+#else
+#define TEST_ERROR_WHILE_FALSE while (0)
+#endif
+
 //------------------------------------------------------------------------------
 // Macro to print test error messages, and increase the global error count.
 // Use it in test cases to log failed tests.
@@ -51,12 +90,50 @@ void PrintTestError(const char* const file, const int line, const char* const ms
         ++g_testErrors;                             \
         PrintTestError(__FILE__, __LINE__, (msg));  \
     }                                               \
-    __pragma(warning(suppress:4127)) while (0)
+    TEST_ERROR_WHILE_FALSE
 
 
 // Count of test errors
 static int g_testErrors = 0;
 
+
+//------------------------------------------------------------------------------
+// Replaced global allocation functions, to test the behavior of the editing
+// functions when an allocation fails: on the calling thread, operator new
+// throws std::bad_alloc once g_allocationsBeforeFailure allocations have been
+// done (a negative value disables the failure).
+//------------------------------------------------------------------------------
+static thread_local int g_allocationsBeforeFailure = -1;
+
+void* operator new(std::size_t size)
+{
+    if (g_allocationsBeforeFailure == 0)
+    {
+        throw std::bad_alloc();
+    }
+    if (g_allocationsBeforeFailure > 0)
+    {
+        --g_allocationsBeforeFailure;
+    }
+
+    void * const p = std::malloc((size != 0) ? size : 1);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
 // Entry point for tests
 void RunTests();
 
@@ -109,7 +186,7 @@ int main()
 
 void TestBasicConversionsWithStlStrings()
 {
-    CStringW s1u16 = L"Hello world";
+    CStringW s1u16 = U16("Hello world");
     std::string s1u8 = win32::Utf8FromUtf16(s1u16);
     CStringW s1u16back = win32::Utf16FromUtf8(s1u8);
     if (s1u16back != s1u16)
@@ -129,7 +206,7 @@ void TestBasicConversionsWithStlStrings()
 
 void TestBasicConversionWithRawPointers()
 {
-    const wchar_t* const s1u16 = L"Hello world";
+    const win32::Utf16Char* const s1u16 = U16("Hello world");
     std::string s1u8 = win32::Utf8FromUtf16(s1u16);
     CStringW s1u16back = win32::Utf16FromUtf8(s1u8);
     if (s1u16back != s1u16)
@@ -162,7 +239,7 @@ void TestEmptyStringConversions()
         TEST_ERROR("Empty UTF-8 string is not converted to an empty UTF-16.");
     }
 
-    if (!win32::Utf8FromUtf16(L"").empty())
+    if (!win32::Utf8FromUtf16(U16("")).empty())
     {
         TEST_ERROR("Empty UTF-16 raw string ptr is not converted to an empty UTF-8.");
     }
@@ -183,7 +260,7 @@ void TestJapaneseKin()
     //
 
     const std::string kinU8 = "\xE9\x87\x91";
-    const CStringW kinU16 = L"\x91D1";
+    const CStringW kinU16 = U16("\x91D1");
     if (win32::Utf16FromUtf8(kinU8) != kinU16)
     {
         TEST_ERROR("Converting Japanese 'kin' from UTF-8 to UTF-16 failed.");
@@ -222,7 +299,7 @@ void TestInvalidUnicodeSequences()
     try
     {
         // String containing invalid UTF-16
-        const CStringW invalidUtf16 = L"Invalid UTF-16: \xD800\x0100";
+        const CStringW invalidUtf16 = U16("Invalid UTF-16: \xD800\x0100");
 
         // The following line should throw because of invalid UTF-16 sequence
         // in input string
@@ -242,64 +319,1306 @@ void TestInvalidUnicodeSequences()
 }
 
 
-#ifdef TEST_GIGANTIC_STRINGS
-void TestGiganticStrings()
+void TestCodePointIterators()
 {
+    //
+    // "a", Japanese "kin" (U+91D1), grinning face emoji (U+1F600), "z"
+    //
+    const std::string textU8 = "a\xE9\x87\x91\xF0\x9F\x98\x80z";
+    const CStringW textU16 = U16("a\x91D1\xD83D\xDE00z");
+    const char32_t expected[] = { U'a', 0x91D1, 0x1F600, U'z' };
+
+    const win32::Utf8CodePointView u8View = win32::CodePointsFromUtf8(textU8);
+    const win32::Utf16CodePointView u16View = win32::CodePointsFromUtf16(textU16);
+
+    if (std::distance(u8View.begin(), u8View.end()) != 4 || u8View.CountCodePoints() != 4)
+    {
+        TEST_ERROR("Wrong code point count walking UTF-8 string.");
+    }
+
+    if (std::distance(u16View.begin(), u16View.end()) != 4 || u16View.CountCodePoints() != 4)
+    {
+        TEST_ERROR("Wrong code point count walking UTF-16 string.");
+    }
+
+    int i = 0;
+    for (char32_t codePoint : u8View)
+    {
+        if (codePoint != expected[i++])
+        {
+            TEST_ERROR("Wrong code point decoded from UTF-8 string.");
+        }
+    }
+
+    // Walk the UTF-16 string backwards
+    i = 4;
+    for (win32::Utf16CodePointIterator it = u16View.end(); it != u16View.begin(); )
+    {
+        --it;
+        if (*it != expected[--i])
+        {
+            TEST_ERROR("Wrong code point decoded walking UTF-16 string backwards.");
+        }
+    }
+
+    if (std::find(u8View.begin(), u8View.end(), 0x1F600).Offset() != 4)
+    {
+        TEST_ERROR("std::find on UTF-8 code points returned the wrong position.");
+    }
+
+    const std::string longAsciiU8 = std::string(100, 'x') + "\xE9\x87\x91";
+    const win32::Utf8CodePointIterator kin = win32::CodePointsFromUtf8(longAsciiU8).Find(0x91D1);
+    if (kin.Offset() != 100 || *kin != 0x91D1)
+    {
+        TEST_ERROR("Find skipping ASCII runs returned the wrong position.");
+    }
+
     try
     {
-        // Build a gigantic std::string
-        constexpr size_t giga = 1ULL * 1024 * 1024 * 1024;
-        const std::string hugeUtf8(5 * giga, 'C');
-        
-        // This code should throw because of the gigantic std::string 
-        CStringW hugeUtf16 = win32::Utf16FromUtf8(hugeUtf8);
+        const std::string invalidUtf8 = "Invalid UTF-8 follows: \xC0\x76\x77";
+        win32::CodePointsFromUtf8(invalidUtf8).CountCodePoints();
+        TEST_ERROR("Exception not thrown walking invalid UTF-8.");
+    }
+    catch (const win32::Utf8ConversionException& e)
+    {
+        if (e.ErrorCode() != ERROR_NO_UNICODE_TRANSLATION)
+        {
+            TEST_ERROR("Error code different than ERROR_NO_UNICODE_TRANSLATION.");
+        }
+    }
 
-        // Correct code should *not* get here:
-        TEST_ERROR("Exception not thrown in presence of UTF-8 string whose length can't fit into an int.");
+    try
+    {
+        const CStringW invalidUtf16 = U16("Invalid UTF-16: \xD800\x0100");
+        win32::CodePointsFromUtf16(invalidUtf16).CountCodePoints();
+        TEST_ERROR("Exception not thrown walking invalid UTF-16.");
     }
     catch (const win32::Utf8ConversionException& e)
     {
-        // All right
-        cout << "\nHuge UTF-8 string throwing exception as expected; error code=" << e.ErrorCode()
-             << ".\n";
+        if (e.ErrorCode() != ERROR_NO_UNICODE_TRANSLATION)
+        {
+            TEST_ERROR("Error code different than ERROR_NO_UNICODE_TRANSLATION.");
+        }
     }
+}
 
-    // NOTE:
-    // Can't have a huge CStringW, as CString's lengths are expressed using int 
-    // (i.e. signed integers; not size_t).
-    // However, can build a huge std::wstring, and pass [start, finish) to the conversion function.
+
+void TestOffsetMap()
+{
+    //
+    // Build a text mixing ASCII, 2-byte, 3-byte and 4-byte UTF-8 sequences,
+    // long enough to span several checkpoints.
+    //
+    const char* const pieces[] = { "abc", "\xC3\xA8", "\xE9\x87\x91", "\xF0\x9F\x98\x80", "xyz\n" };
+    std::string textU8;
+    for (int i = 0; i < 200; ++i)
+    {
+        textU8 += pieces[i % 5];
+        textU8 += pieces[(i * 7) % 5];
+    }
+
+    win32::Utf8Utf16OffsetMap offsetMap(16);
+    const CStringW textU16 = win32::Utf16FromUtf8(textU8, offsetMap);
+    if (textU16 != win32::Utf16FromUtf8(textU8))
+    {
+        TEST_ERROR("Conversion building the offset map gives different result.");
+    }
+
+    if (offsetMap.Utf8Length() != textU8.length()
+        || offsetMap.Utf16Length() != static_cast<size_t>(textU16.GetLength()))
+    {
+        TEST_ERROR("Offset map has wrong lengths.");
+    }
+
+    // Compare the map with the offsets found walking the code points
+    const win32::Utf8CodePointView view = win32::CodePointsFromUtf8(textU8);
+    size_t utf16Offset = 0;
+    for (win32::Utf8CodePointIterator it = view.begin(); it != view.end(); ++it)
+    {
+        const size_t utf8Offset = static_cast<size_t>(it.Offset());
+        if (offsetMap.Utf16OffsetFromUtf8(textU8.data(), utf8Offset) != utf16Offset)
+        {
+            TEST_ERROR("Wrong UTF-16 offset from offset map.");
+        }
+
+        if (offsetMap.Utf8OffsetFromUtf16(textU8.data(), utf16Offset) != utf8Offset)
+        {
+            TEST_ERROR("Wrong UTF-8 offset from offset map.");
+        }
+
+        utf16Offset += (*it >= 0x10000) ? 2 : 1;
+    }
+
+    // Offsets inside a code point map to its beginning
+    const size_t kinOffset = textU8.find("\xE9\x87\x91");
+    if (offsetMap.Utf16OffsetFromUtf8(textU8.data(), kinOffset + 2)
+        != offsetMap.Utf16OffsetFromUtf8(textU8.data(), kinOffset))
+    {
+        TEST_ERROR("Offset inside a UTF-8 sequence not mapped to its beginning.");
+    }
+
+    if (offsetMap.Utf16OffsetFromUtf8(textU8.data(), textU8.length()) != utf16Offset)
+    {
+        TEST_ERROR("End of text not mapped to end of UTF-16 text.");
+    }
+
+    // Invalid input leaves the map unchanged
     try
     {
-        // Build a gigantic std::wstring
-        constexpr size_t giga = 1ULL * 1024 * 1024 * 1024;
-        const std::wstring hugeUtf16(5 * giga, L'C');
+        win32::Utf16FromUtf8("Invalid UTF-8 follows: \xC0\x76\x77", offsetMap);
+        TEST_ERROR("Exception not thrown in presence of invalid UTF-8.");
+    }
+    catch (const win32::Utf8ConversionException&)
+    {
+        if (offsetMap.Utf8Length() != textU8.length())
+        {
+            TEST_ERROR("Offset map modified by failed conversion.");
+        }
+    }
+}
 
-        // This code should throw because of the gigantic std::wstring 
-        const wchar_t * const utf16Start = hugeUtf16.data();
-        const wchar_t * const utf16Finish = utf16Start + hugeUtf16.length();
-        std::string hugeUtf8 = win32::Utf8FromUtf16(utf16Start, utf16Finish);
 
-        // Correct code should *not* get here:
-        TEST_ERROR("Exception not thrown in presence of UTF-16 string whose length can't fit into an int.");
+void TestUtf16Mirror()
+{
+    win32::Utf16Mirror mirror(std::string(300, 'a'), 16);
+
+    //
+    // Apply a sequence of edits, and check that the incremental result
+    // matches a full conversion of the edited text.
+    //
+    const std::string longRun(200, 'z');
+    struct EditStep
+    {
+        size_t offset;
+        size_t removed;
+        const char* inserted;
+    };
+    const EditStep edits[] =
+    {
+        { 0, 0, "\xE9\x87\x91" },                    // insert at the beginning
+        { 100, 1, "\xF0\x9F\x98\x80xyz" },            // replace in the middle
+        { 4, 150, "" },                                 // delete a long run
+        { 1, 0, "b" },                                  // insert inside "kin": widened
+        { 0, 0, "\xC3\xA8" },
+        { 10, 5, longRun.c_str() },
+    };
+
+    std::string expectedU8 = mirror.Utf8();
+    int step = 0;
+    for (const EditStep& edit : edits)
+    {
+        if (step++ == 3)
+        {
+            // Inserting an ASCII char inside a 3-byte sequence gives invalid UTF-8
+            try
+            {
+                mirror.Edit(edit.offset, edit.removed, edit.inserted);
+                TEST_ERROR("Exception not thrown for edit producing invalid UTF-8.");
+            }
+            catch (const win32::Utf8ConversionException&)
+            {
+            }
+            continue;
+        }
+
+        mirror.Edit(edit.offset, edit.removed, edit.inserted);
+        expectedU8.replace(edit.offset, edit.removed, edit.inserted);
+    }
+
+    if (mirror.Utf8() != expectedU8 || mirror.Utf16() != win32::Utf16FromUtf8(expectedU8))
+    {
+        TEST_ERROR("Incrementally edited UTF-16 mirror differs from full conversion.");
+    }
+
+    // Check the patched offset map against a freshly built one
+    win32::Utf8Utf16OffsetMap expectedMap;
+    win32::Utf16FromUtf8(expectedU8, expectedMap);
+    for (size_t utf8Offset = 0; utf8Offset <= expectedU8.length(); ++utf8Offset)
+    {
+        const size_t utf16Offset = expectedMap.Utf16OffsetFromUtf8(expectedU8.data(), utf8Offset);
+        if (mirror.Utf16OffsetFromUtf8(utf8Offset) != utf16Offset)
+        {
+            TEST_ERROR("Wrong UTF-16 offset after incremental edits.");
+            break;
+        }
+
+        if (mirror.Utf8OffsetFromUtf16(utf16Offset)
+            != expectedMap.Utf8OffsetFromUtf16(expectedU8.data(), utf16Offset))
+        {
+            TEST_ERROR("Wrong UTF-8 offset after incremental edits.");
+            break;
+        }
+    }
+
+    try
+    {
+        mirror.Edit(expectedU8.length() + 1, 0, "x");
+        TEST_ERROR("Exception not thrown for out-of-range edit.");
     }
     catch (const win32::Utf8ConversionException& e)
     {
-        // All right
-        cout << "\nHuge UTF-16 string throwing exception as expected; error code=" << e.ErrorCode()
-            << ".\n";
+        if (e.ErrorCode() != ERROR_INVALID_PARAMETER)
+        {
+            TEST_ERROR("Error code different than ERROR_INVALID_PARAMETER.");
+        }
     }
 }
-#endif // TEST_GIGANTIC_STRINGS
 
 
-// Run all tests
-void RunTests()
+void TestUtf8Rope()
 {
-    TestBasicConversionsWithStlStrings();
-    TestBasicConversionWithRawPointers();
-    TestEmptyStringConversions();
-    TestJapaneseKin();
-    TestInvalidUnicodeSequences();
+    // Build a text spanning several rope chunks
+    std::string expectedU8;
+    for (int i = 0; i < 300; ++i)
+    {
+        expectedU8 += "ab\xC3\xA8\xE9\x87\x91\xF0\x9F\x98\x80";
+    }
+
+    win32::Utf8Rope rope(expectedU8);
+
+    // Insert by UTF-8 offset (in the middle of the text, and at both ends)
+    rope.Insert(13 * 100, "xyz");
+    expectedU8.insert(13 * 100, "xyz");
+    rope.Insert(0, "\xF0\x9F\x98\x80");
+    expectedU8.insert(0, "\xF0\x9F\x98\x80");
+    rope.Insert(rope.Utf8Length(), "end");
+    expectedU8 += "end";
+
+    // Erase by UTF-8 offsets, across chunk boundaries
+    rope.Erase(500, 2000);
+    expectedU8.erase(500, 1500);
+
+    // Insert and erase by UTF-16 offsets
+    const size_t utf16Offset = rope.Utf16OffsetFromUtf8(13 * 20 + 4);
+    rope.InsertUtf16(utf16Offset, CStringW(U16("\x91D1!")));
+    expectedU8.insert(13 * 20 + 4, "\xE9\x87\x91!");
+    rope.EraseUtf16(0, 2);
+    expectedU8.erase(0, 4);
+
+    if (rope.ToUtf8() != expectedU8 || rope.Utf8Length() != expectedU8.length())
+    {
+        TEST_ERROR("Rope UTF-8 content differs from expected text.");
+    }
+
+    const CStringW expectedU16 = win32::Utf16FromUtf8(expectedU8);
+    if (rope.ToUtf16() != expectedU16
+        || rope.Utf16Length() != static_cast<size_t>(expectedU16.GetLength()))
+    {
+        TEST_ERROR("Rope UTF-16 content differs from expected text.");
+    }
+
+    // Slices by both offset spaces
+    if (rope.Utf8Slice(100, 1100) != expectedU8.substr(100, 1000))
+    {
+        TEST_ERROR("Wrong rope UTF-8 slice.");
+    }
+
+    if (rope.Utf16Slice(50, 950) != CStringW(expectedU16.GetString() + 50, 900))
+    {
+        TEST_ERROR("Wrong rope UTF-16 slice.");
+    }
+
+    // Offsets inside a code point are rejected
+    try
+    {
+        rope.Insert(expectedU8.find("\xC3\xA8") + 1, "x");
+        TEST_ERROR("Exception not thrown inserting inside a code point.");
+    }
+    catch (const win32::Utf8ConversionException& e)
+    {
+        if (e.ErrorCode() != ERROR_INVALID_PARAMETER || rope.ToUtf8() != expectedU8)
+        {
+            TEST_ERROR("Wrong error handling inserting inside a code point.");
+        }
+    }
+
+    // UTF-16 offsets inside a surrogate pair are rejected, as by EraseUtf16
+    const win32::Utf8Rope emojiRope(std::string("a\xF0\x9F\x98\x80" "b"));
+    try
+    {
+        emojiRope.Utf16Slice(2, 3);
+        TEST_ERROR("Exception not thrown slicing inside a surrogate pair.");
+    }
+    catch (const win32::Utf8ConversionException& e)
+    {
+        if (e.ErrorCode() != ERROR_INVALID_PARAMETER)
+        {
+            TEST_ERROR("Wrong error code slicing inside a surrogate pair.");
+        }
+    }
+    if (emojiRope.Utf16Slice(1, 3) != U16("\xD83D\xDE00"))
+    {
+        TEST_ERROR("Wrong UTF-16 slice of a surrogate pair.");
+    }
+
+    try
+    {
+        rope.Insert(0, "\xC0\x76");
+        TEST_ERROR("Exception not thrown inserting invalid UTF-8.");
+    }
+    catch (const win32::Utf8ConversionException& e)
+    {
+        if (e.ErrorCode() != ERROR_NO_UNICODE_TRANSLATION)
+        {
+            TEST_ERROR("Error code different than ERROR_NO_UNICODE_TRANSLATION.");
+        }
+    }
+
+    // The rope is left unchanged when an edit fails to allocate: let the n-th
+    // allocation fail, for increasing n, until the edit succeeds
+    const std::string bigInsertion(1200, 'q');
+    const size_t multiChunkOffset = expectedU8.find("\xE9\x87\x91", 1000);
+    for (int edit = 0; edit < 4; ++edit)
+    {
+        for (int allocations = 0; ; ++allocations)
+        {
+            win32::Utf8Rope failingRope(expectedU8);
+            std::string editedU8 = expectedU8;
+            try
+            {
+                switch (edit)
+                {
+                case 0: // small insertion, growing a chunk
+                    editedU8.insert(2, "xyz");
+                    g_allocationsBeforeFailure = allocations;
+                    failingRope.Insert(2, "xyz");
+                    break;
+
+                case 1: // insertion of new chunks in the middle of a chunk
+                    editedU8.insert(multiChunkOffset, bigInsertion);
+                    g_allocationsBeforeFailure = allocations;
+                    failingRope.Insert(multiChunkOffset, bigInsertion);
+                    break;
+
+                case 2: // erasure across chunks
+                    editedU8.erase(2, multiChunkOffset - 2);
+                    g_allocationsBeforeFailure = allocations;
+                    failingRope.Erase(2, multiChunkOffset);
+                    break;
+
+                default: // erasure inside a chunk
+                    editedU8.erase(multiChunkOffset, 3);
+                    g_allocationsBeforeFailure = allocations;
+                    failingRope.Erase(multiChunkOffset, multiChunkOffset + 3);
+                    break;
+                }
+                g_allocationsBeforeFailure = -1;
+
+                if (failingRope.ToUtf8() != editedU8
+                    || failingRope.Utf16Length() != static_cast<size_t>(win32::Utf16FromUtf8(editedU8).GetLength()))
+                {
+                    TEST_ERROR("Wrong rope content after an edit.");
+                }
+                break;
+            }
+            catch (const std::bad_alloc&)
+            {
+                g_allocationsBeforeFailure = -1;
+                if (failingRope.ToUtf8() != expectedU8 || failingRope.Utf16Length() != static_cast<size_t>(expectedU16.GetLength()))
+                {
+                    TEST_ERROR("Rope changed by an edit that failed to allocate.");
+                }
+            }
+        }
+    }
+}
+
+
+void TestDualString()
+{
+    win32::DualString kin(std::string("\xE9\x87\x91"));
+    if (kin.IsConverted())
+    {
+        TEST_ERROR("DualString converted before first request.");
+    }
+
+    // Concurrent first reads must all see the same, single conversion
+    std::vector<std::thread> readers;
+    std::vector<const win32::Utf16Char*> results(8);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        readers.emplace_back([&kin, &results, i]()
+        {
+            results[i] = kin.Utf16().GetString();
+        });
+    }
+    for (std::thread& reader : readers)
+    {
+        reader.join();
+    }
+
+    for (const win32::Utf16Char* result : results)
+    {
+        if (result != kin.Utf16().GetString())
+        {
+            TEST_ERROR("DualString converted more than once.");
+        }
+    }
+
+    if (!kin.IsConverted() || kin.Utf16() != CStringW(U16("\x91D1")))
+    {
+        TEST_ERROR("Wrong DualString UTF-16 conversion.");
+    }
+
+    // Copies share the cached conversion
+    const win32::DualString copy(kin);
+    if (!copy.IsConverted() || copy.Utf16() != kin.Utf16())
+    {
+        TEST_ERROR("DualString copy doesn't keep the cached conversion.");
+    }
+
+    // Moves take the cached conversion, and leave the source empty
+    win32::DualString moved(std::move(kin));
+    if (!moved.IsConverted() || moved.Utf16() != copy.Utf16() || moved.Utf8() != copy.Utf8()
+        || !kin.IsEmpty())
+    {
+        TEST_ERROR("DualString move doesn't keep the cached conversion.");
+    }
+
+    kin = std::move(moved);
+    if (!kin.IsConverted() || kin.Utf16() != copy.Utf16() || !moved.IsEmpty())
+    {
+        TEST_ERROR("DualString move assignment doesn't keep the cached conversion.");
+    }
+
+    // Assigning drops the cache
+    kin = CStringW(U16("Hello"));
+    if (kin.IsConverted() || kin.Utf8() != "Hello" || !kin.IsConverted())
+    {
+        TEST_ERROR("Wrong DualString conversion after assignment.");
+    }
+
+    try
+    {
+        win32::DualString invalid(std::string("\xC0\x76"));
+        invalid.Utf16();
+        TEST_ERROR("Exception not thrown converting invalid UTF-8 DualString.");
+    }
+    catch (const win32::Utf8ConversionException&)
+    {
+    }
+}
+
+
+void TestConversionCache()
+{
+    // Small cache with a single shard, to exercise LRU eviction
+    win32::Utf16ConversionCache cache(2, 1);
+
+    const std::string kinU8 = "\xE9\x87\x91";
+    if (cache.Utf16FromUtf8(kinU8) != CStringW(U16("\x91D1"))
+        || cache.Utf16FromUtf8(kinU8) != CStringW(U16("\x91D1")))
+    {
+        TEST_ERROR("Wrong UTF-16 string from conversion cache.");
+    }
+
+    cache.Utf16FromUtf8("Hello");
+    cache.Utf16FromUtf8(kinU8);     // hit: "kin" is now the most recently used
+    cache.Utf16FromUtf8("world");   // evicts "Hello"
+    cache.Utf16FromUtf8("Hello");   // miss
+
+    win32::Utf16ConversionCache::Statistics statistics = cache.GetStatistics();
+    if (statistics.hits != 2 || statistics.misses != 4
+        || statistics.evictions != 2 || statistics.size != 2)
+    {
+        TEST_ERROR("Wrong conversion cache statistics.");
+    }
+
+    // Long inputs bypass the cache
+    cache.Utf16FromUtf8(std::string(1000, 'x'));
+    statistics = cache.GetStatistics();
+    if (statistics.bypasses != 1 || statistics.size != 2)
+    {
+        TEST_ERROR("Long input not bypassing the conversion cache.");
+    }
+
+    try
+    {
+        cache.Utf16FromUtf8("\xC0\x76");
+        TEST_ERROR("Exception not thrown converting invalid UTF-8 with cache.");
+    }
+    catch (const win32::Utf8ConversionException&)
+    {
+        if (cache.GetStatistics().size != 2)
+        {
+            TEST_ERROR("Invalid UTF-8 added to the conversion cache.");
+        }
+    }
+}
+
+
+void TestUtf16Interner()
+{
+    win32::Utf16Interner interner;
+
+    const win32::InternedUtf16 kin1 = interner.Intern(std::string("\xE9\x87\x91"));
+    const win32::InternedUtf16 hello = interner.Intern("Hello");
+    const win32::InternedUtf16 kin2 = interner.Intern(std::string("\xE9\x87\x91"));
+
+    if (kin1 != kin2 || kin1.Data() != kin2.Data() || kin1 == hello)
+    {
+        TEST_ERROR("Interned strings not deduplicated.");
+    }
+
+    if (kin1.ToCStringW() != CStringW(U16("\x91D1")) || hello.ToCStringW() != CStringW(U16("Hello"))
+        || hello.Data()[hello.Length()] != U16('\0'))
+    {
+        TEST_ERROR("Wrong interned UTF-16 string.");
+    }
+
+    if (interner.Size() != 2 || !interner.Intern("").IsEmpty())
+    {
+        TEST_ERROR("Wrong number of interned strings.");
+    }
+
+    // Strings larger than an arena block
+    const std::string hugeU8(200000, 'x');
+    if (interner.Intern(hugeU8).Length() != hugeU8.length()
+        || interner.Intern(hugeU8) != interner.Intern(hugeU8))
+    {
+        TEST_ERROR("Wrong interning of huge string.");
+    }
+
+    try
+    {
+        interner.Intern("\xC0\x76");
+        TEST_ERROR("Exception not thrown interning invalid UTF-8.");
+    }
+    catch (const win32::Utf8ConversionException&)
+    {
+    }
+}
+
+
+void TestBatchConversions()
+{
+    const std::string kinU8 = "\xE9\x87\x91";
+    const std::vector<std::string> columnU8 = { "IT", kinU8, "IT", "", "US", kinU8, "IT" };
+
+    const win32::Utf16DictionaryBatch dictionary = win32::Utf16DictionaryFromUtf8(columnU8);
+    const std::vector<size_t> expectedIndices = { 0, 1, 0, 2, 3, 1, 0 };
+    if (dictionary.dictionary.size() != 4 || dictionary.indices != expectedIndices)
+    {
+        TEST_ERROR("Wrong dictionary-encoded batch conversion.");
+    }
+
+    const std::vector<CStringW> columnU16 = win32::Utf16BatchFromUtf8(columnU8);
+    if (columnU16.size() != columnU8.size())
+    {
+        TEST_ERROR("Wrong size of expanded batch conversion.");
+    }
+
+    for (size_t i = 0; i < columnU8.size(); ++i)
+    {
+        if (columnU16[i] != win32::Utf16FromUtf8(columnU8[i]))
+        {
+            TEST_ERROR("Wrong string in expanded UTF-8 -> UTF-16 batch conversion.");
+        }
+    }
+
+    const std::vector<std::string> backU8 = win32::Utf8BatchFromUtf16(columnU16);
+    if (backU8 != columnU8 || win32::Utf8DictionaryFromUtf16(columnU16).dictionary.size() != 4)
+    {
+        TEST_ERROR("Wrong UTF-16 -> UTF-8 batch conversion.");
+    }
+
+    try
+    {
+        const std::vector<std::string> invalidU8 = { "IT", "\xC0\x76" };
+        win32::Utf16BatchFromUtf8(invalidU8);
+        TEST_ERROR("Exception not thrown in batch conversion of invalid UTF-8.");
+    }
+    catch (const win32::Utf8ConversionException&)
+    {
+    }
+}
+
+
+namespace
+{
+
+// Allocator counting the bytes allocated through it
+template <typename T>
+struct CountingAllocator
+{
+    typedef T value_type;
+
+    size_t* allocatedBytes;
+
+    explicit CountingAllocator(size_t* counter) noexcept
+        : allocatedBytes(counter)
+    {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) noexcept
+        : allocatedBytes(other.allocatedBytes)
+    {}
+
+    T* allocate(size_t n)
+    {
+        *allocatedBytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    friend bool operator==(const CountingAllocator& lhs, const CountingAllocator& rhs) noexcept
+    {
+        return lhs.allocatedBytes == rhs.allocatedBytes;
+    }
+
+    friend bool operator!=(const CountingAllocator& lhs, const CountingAllocator& rhs) noexcept
+    {
+        return lhs.allocatedBytes != rhs.allocatedBytes;
+    }
+};
+
+} // anonymous namespace
+
+
+void TestAllocatorConversions()
+{
+    // Long enough to defeat the small string optimization
+    const std::string textU8 = std::string(100, 'x') + "\xE9\x87\x91";
+    const CStringW textU16 = win32::Utf16FromUtf8(textU8);
+
+    size_t allocatedBytes = 0;
+    const auto u16 = win32::Utf16FromUtf8(textU8, CountingAllocator<win32::Utf16Char>(&allocatedBytes));
+    if (CStringW(u16.c_str()) != textU16 || allocatedBytes == 0)
+    {
+        TEST_ERROR("Wrong UTF-8 -> UTF-16 conversion with custom allocator.");
+    }
+
+    allocatedBytes = 0;
+    const auto u8 = win32::Utf8FromUtf16(textU16, CountingAllocator<char>(&allocatedBytes));
+    if (u8.c_str() != textU8 || allocatedBytes == 0)
+    {
+        TEST_ERROR("Wrong UTF-16 -> UTF-8 conversion with custom allocator.");
+    }
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_PMR
+    // Results allocated from a monotonic arena
+    unsigned char buffer[4096];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+
+    const std::pmr::basic_string<win32::Utf16Char> pmrU16 = win32::Utf16FromUtf8(textU8, &arena);
+    const std::pmr::string pmrU8 = win32::Utf8FromUtf16(textU16, &arena);
+    if (CStringW(pmrU16.c_str()) != textU16 || pmrU8.c_str() != textU8)
+    {
+        TEST_ERROR("Wrong conversion with std::pmr memory resource.");
+    }
+
+    const void* const u16Data = pmrU16.data();
+    if (u16Data < buffer || u16Data >= buffer + sizeof(buffer))
+    {
+        TEST_ERROR("Conversion result not allocated from the memory resource.");
+    }
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_PMR
+}
+
+
+void TestScratchConversions()
+{
+    const std::string textU8 = "Euro \xE2\x82\xAC, Kin \xE9\x87\x91";
+    const CStringW textU16 = win32::Utf16FromUtf8(textU8);
+
+    const win32::Utf16Char* scratchData = nullptr;
+    {
+        const win32::ScopedUtf16FromUtf8 u16(textU8);
+        if (CStringW(u16.Data(), static_cast<int>(u16.Length())) != textU16
+            || u16.Data()[u16.Length()] != U16('\0'))
+        {
+            TEST_ERROR("Wrong scoped UTF-8 -> UTF-16 conversion.");
+        }
+        scratchData = u16.Data();
+
+        // Nested scope: must not clobber the outer result
+        const win32::ScopedUtf16FromUtf8 nested(std::string("xyz"));
+        if (nested.Data() == u16.Data() || CStringW(nested.Data()) != U16("xyz")
+            || CStringW(u16.Data()) != textU16)
+        {
+            TEST_ERROR("Nested scoped conversion overwrote the outer result.");
+        }
+    }
+
+    {
+        // The scratch buffer is reused by the next conversion on this thread
+        const win32::ScopedUtf16FromUtf8 u16(textU8);
+        if (u16.Data() != scratchData)
+        {
+            TEST_ERROR("Scratch buffer not reused by the following conversion.");
+        }
+    }
+
+    {
+        const win32::ScopedUtf8FromUtf16 u8(textU16);
+        if (std::string(u8.Data(), u8.Length()) != textU8)
+        {
+            TEST_ERROR("Wrong scoped UTF-16 -> UTF-8 conversion.");
+        }
+
+        const win32::ScopedUtf8FromUtf16 empty(CStringW(U16("")));
+        if (!empty.IsEmpty() || empty.Data()[0] != '\0')
+        {
+            TEST_ERROR("Wrong scoped conversion of empty string.");
+        }
+    }
+
+    // Invalid input must leave the scratch buffer available
+    try
+    {
+        const win32::ScopedUtf16FromUtf8 invalid(std::string("\xC0\x80"));
+        TEST_ERROR("Scoped conversion of invalid UTF-8 didn't throw.");
+    }
+    catch (const win32::Utf8ConversionException&)
+    {
+    }
+
+    {
+        // Above the high-water mark the scratch buffer is released at scope exit
+        const std::string huge(win32::ScopedUtf16FromUtf8::kMaxRetainedLength + 1, 'h');
+        const win32::ScopedUtf16FromUtf8 u16(huge);
+        if (u16.Length() != huge.length())
+        {
+            TEST_ERROR("Wrong scoped conversion of long string.");
+        }
+    }
+
+    {
+        const win32::ScopedUtf16FromUtf8 u16(textU8);
+        if (CStringW(u16.Data()) != textU16)
+        {
+            TEST_ERROR("Wrong scoped conversion after releasing the scratch buffer.");
+        }
+    }
+}
+
+void TestSmallStringConversions()
+{
+    const std::string shortU8 = "Kin \xE9\x87\x91, Euro \xE2\x82\xAC";
+    const CStringW shortU16 = win32::Utf16FromUtf8(shortU8);
+
+    const win32::SmallUtf16String u16 = win32::SmallUtf16FromUtf8(shortU8);
+    if (!u16.IsInline() || u16.ToCStringW() != shortU16 || CStringW(u16.Data()) != shortU16)
+    {
+        TEST_ERROR("Wrong small-buffer UTF-8 -> UTF-16 conversion.");
+    }
+
+    const std::u16string u16Std = u16.ToU16String();
+    if (u16Std.length() != u16.Length() || u16Std[4] != u'\x91D1')
+    {
+        TEST_ERROR("Wrong small-buffer result conversion to std::u16string.");
+    }
+
+    const win32::SmallUtf8String u8 = win32::SmallUtf8FromUtf16(shortU16);
+    if (!u8.IsInline() || u8.ToStdString() != shortU8)
+    {
+        TEST_ERROR("Wrong small-buffer UTF-16 -> UTF-8 conversion.");
+    }
+
+    // Longer results spill to the heap
+    const std::string longU8 = std::string(100, 'x') + shortU8;
+    const win32::SmallUtf16String longU16 = win32::SmallUtf16FromUtf8(longU8);
+    if (longU16.IsInline() || longU16.ToCStringW() != win32::Utf16FromUtf8(longU8))
+    {
+        TEST_ERROR("Wrong small-buffer conversion of long string.");
+    }
+
+    const auto longBack = win32::SmallUtf8FromUtf16(longU16.Data(), longU16.Data() + longU16.Length());
+    if (longBack.IsInline() || longBack.ToStdString() != longU8)
+    {
+        TEST_ERROR("Wrong small-buffer conversion of long UTF-16 string.");
+    }
+
+    // Custom inline capacity; copies and moves
+    win32::BasicSmallString<win32::Utf16Char, 8> tiny = win32::SmallUtf16FromUtf8<8>(shortU8);
+    const win32::BasicSmallString<win32::Utf16Char, 8> tinyCopy = tiny;
+    const win32::BasicSmallString<win32::Utf16Char, 8> tinyMoved = std::move(tiny);
+    if (tinyCopy.IsInline() || tinyCopy != tinyMoved || tinyCopy.ToCStringW() != shortU16
+        || !tiny.IsEmpty())
+    {
+        TEST_ERROR("Wrong copy or move of small-buffer string.");
+    }
+
+    try
+    {
+        win32::SmallUtf16FromUtf8(std::string("\xE9\x87"));
+        TEST_ERROR("Small-buffer conversion of invalid UTF-8 didn't throw.");
+    }
+    catch (const win32::Utf8ConversionException&)
+    {
+    }
+}
+
+#ifndef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+void TestUtf16String()
+{
+    const CStringW original = win32::Utf16FromUtf8(std::string("Kin \xE9\x87\x91"));
+
+    // Copies share the reference-counted data
+    CStringW copy = original;
+    if (copy.GetString() != original.GetString() || copy != original)
+    {
+        TEST_ERROR("Utf16String copy doesn't share the string data.");
+    }
+
+    // Writing to a copy detaches it from the shared data
+    win32::Utf16Char* buffer = copy.GetBuffer(original.GetLength() + 1);
+    buffer[original.GetLength()] = U16('!');
+    copy.ReleaseBuffer(original.GetLength() + 1);
+    if (copy.GetString() == original.GetString() || original != U16("Kin \x91D1")
+        || copy != U16("Kin \x91D1!"))
+    {
+        TEST_ERROR("Utf16String copy-on-write failed.");
+    }
+
+    // ReleaseBuffer() without length looks for the terminating NUL
+    buffer = copy.GetBuffer();
+    buffer[3] = 0;
+    copy.ReleaseBuffer();
+    if (copy.GetLength() != 3 || copy != U16("Kin"))
+    {
+        TEST_ERROR("Utf16String ReleaseBuffer() failed.");
+    }
+
+    // Comparisons with shorter or longer NUL-terminated strings
+    const char16_t shorter[] = u"Ki";
+    const char16_t longer[] = u"Kin!";
+    if (original == shorter || original == longer || original != U16("Kin \x91D1"))
+    {
+        TEST_ERROR("Wrong Utf16String comparison with NUL-terminated string.");
+    }
+
+    CStringW moved = std::move(copy);
+    copy.Empty();
+    if (!copy.IsEmpty() || copy.GetString()[0] != 0 || moved.GetAt(2) != U16('n'))
+    {
+        TEST_ERROR("Utf16String move or Empty() failed.");
+    }
+}
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+void TestUtf32Conversions()
+{
+    // Long ASCII runs around the non-ASCII code points, to exercise the block fast paths
+    const std::string textU8 = "Plain ASCII text before, "
+                               "Kin \xE9\x87\x91, grinning \xF0\x9F\x98\x80, "
+                               "and more plain ASCII text after";
+    const std::u32string textU32 = U"Plain ASCII text before, "
+                                   U"Kin \x91D1, grinning \x1F600, "
+                                   U"and more plain ASCII text after";
+
+    if (win32::Utf32FromUtf8(textU8) != textU32 || win32::Utf8FromUtf32(textU32) != textU8)
+    {
+        TEST_ERROR("Wrong UTF-8 <-> UTF-32 conversion.");
+    }
+
+    const CStringW textU16 = win32::Utf16FromUtf8(textU8);
+    if (win32::Utf32FromUtf16(textU16) != textU32 || win32::Utf16FromUtf32(textU32) != textU16)
+    {
+        TEST_ERROR("Wrong UTF-16 <-> UTF-32 conversion.");
+    }
+
+    const std::u16string kinU16 = u"Kin \x91D1";
+    if (win32::Utf8FromUtf16(kinU16.data(), kinU16.data() + kinU16.length()) != "Kin \xE9\x87\x91")
+    {
+        TEST_ERROR("Wrong conversion from char16_t UTF-16 string.");
+    }
+
+    // wchar_t strings are UTF-16 or UTF-32, depending on the size of wchar_t
+    const std::wstring wide = win32::WideFromUtf8(textU8);
+    const std::size_t expectedWideLength = (sizeof(wchar_t) == 2)
+        ? static_cast<std::size_t>(textU16.GetLength()) : textU32.length();
+    if (wide.length() != expectedWideLength || win32::Utf8FromWide(wide) != textU8)
+    {
+        TEST_ERROR("Wrong UTF-8 <-> wchar_t string conversion.");
+    }
+
+    const char32_t invalidCodePoints[] = { 0xD800, 0x110000 };
+    for (char32_t invalid : invalidCodePoints)
+    {
+        const std::u32string invalidU32 = U"abc" + std::u32string(1, invalid);
+        try
+        {
+            win32::Utf8FromUtf32(invalidU32);
+            TEST_ERROR("UTF-32 -> UTF-8 conversion of invalid code point didn't throw.");
+        }
+        catch (const win32::Utf8ConversionException& e)
+        {
+            if (e.ErrorCode() != ERROR_NO_UNICODE_TRANSLATION)
+            {
+                TEST_ERROR("Error code different than ERROR_NO_UNICODE_TRANSLATION.");
+            }
+        }
+
+        try
+        {
+            win32::Utf16FromUtf32(invalidU32);
+            TEST_ERROR("UTF-32 -> UTF-16 conversion of invalid code point didn't throw.");
+        }
+        catch (const win32::Utf8ConversionException&)
+        {
+        }
+    }
+
+    try
+    {
+        win32::Utf32FromUtf8(std::string("abc\xED\xA0\x80"));
+        TEST_ERROR("UTF-8 -> UTF-32 conversion of encoded surrogate didn't throw.");
+    }
+    catch (const win32::Utf8ConversionException&)
+    {
+    }
+}
+
+void TestNulTerminatedAndViewConversions()
+{
+    // NUL-terminated inputs are converted up to the (first) terminator
+    const char textU8[] = "Kin \xE9\x87\x91, grinning \xF0\x9F\x98\x80\0ignored";
+    const win32::Utf16Char textU16[] = U16("Kin \x91D1, grinning \xD83D\xDE00\0ignored");
+
+    const CStringW u16 = win32::Utf16FromUtf8(textU8);
+    if (u16 != textU16 || u16.GetLength() != 18)
+    {
+        TEST_ERROR("Wrong conversion of NUL-terminated UTF-8 string.");
+    }
+
+    const std::string u8 = win32::Utf8FromUtf16(textU16);
+    if (u8 != textU8 || u8.length() != 22)
+    {
+        TEST_ERROR("Wrong conversion of NUL-terminated UTF-16 string.");
+    }
+
+    if (!win32::Utf16FromUtf8("").IsEmpty() || !win32::Utf8FromUtf16(U16("")).empty())
+    {
+        TEST_ERROR("Empty NUL-terminated string is not converted to an empty string.");
+    }
+
+    // Truncated sequences right before the terminator
+    const char* const invalidUtf8[] = { "abc\xE9\x87", "\xF0\x9F\x98", "\xC0\x76" };
+    for (const char* invalid : invalidUtf8)
+    {
+        try
+        {
+            win32::Utf16FromUtf8(invalid);
+            TEST_ERROR("Exception not thrown in presence of invalid NUL-terminated UTF-8.");
+        }
+        catch (const win32::Utf8ConversionException& e)
+        {
+            if (e.ErrorCode() != ERROR_NO_UNICODE_TRANSLATION)
+            {
+                TEST_ERROR("Error code different than ERROR_NO_UNICODE_TRANSLATION.");
+            }
+        }
+    }
+
+    try
+    {
+        win32::Utf8FromUtf16(U16("abc\xD83D"));
+        TEST_ERROR("Exception not thrown in presence of invalid NUL-terminated UTF-16.");
+    }
+    catch (const win32::Utf8ConversionException& e)
+    {
+        if (e.ErrorCode() != ERROR_NO_UNICODE_TRANSLATION)
+        {
+            TEST_ERROR("Error code different than ERROR_NO_UNICODE_TRANSLATION.");
+        }
+    }
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+    // Views are converted up to their length, not to a terminator
+    const std::string_view viewU8(textU8, 7);
+    if (win32::Utf16FromUtf8(viewU8) != U16("Kin \x91D1"))
+    {
+        TEST_ERROR("Wrong conversion of UTF-8 std::string_view.");
+    }
+
+    const std::basic_string_view<win32::Utf16Char> viewU16(textU16, 5);
+    if (win32::Utf8FromUtf16(viewU16) != "Kin \xE9\x87\x91")
+    {
+        TEST_ERROR("Wrong conversion of UTF-16 std::basic_string_view.");
+    }
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_CHAR8_T
+    if (win32::Utf16FromUtf8(u8"Kin \u91D1") != U16("Kin \x91D1"))
+    {
+        TEST_ERROR("Wrong conversion of UTF-8 std::u8string_view.");
+    }
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_CHAR8_T
+}
+
+
+void TestCompileTimeConversions()
+{
+    // Converted at compile time
+    constexpr auto kinU16 = win32::Utf16FromUtf8Literal("Kin \xE9\x87\x91, grinning \xF0\x9F\x98\x80");
+    static_assert(kinU16.Length() == 18, "Wrong length of compile-time conversion.");
+    static_assert(kinU16.Data()[4] == 0x91D1 && kinU16.Data()[18] == 0,
+                  "Wrong compile-time conversion.");
+
+    if (kinU16.ToCStringW() != win32::Utf16FromUtf8("Kin \xE9\x87\x91, grinning \xF0\x9F\x98\x80")
+        || kinU16.ToU16String() != u"Kin \x91D1, grinning \xD83D\xDE00")
+    {
+        TEST_ERROR("Compile-time conversion differs from runtime conversion.");
+    }
+
+    constexpr auto emptyU16 = win32::Utf16FromUtf8Literal("");
+    static_assert(emptyU16.IsEmpty(), "Empty literal is not converted to an empty string.");
+
+    // Invalid UTF-8 in a constexpr conversion doesn't compile, e.g.:
+    //
+    //   constexpr auto invalid = win32::Utf16FromUtf8Literal("\xC0\x76");
+    //
+    // at runtime, it throws as the other conversion functions.
+    try
+    {
+        win32::Utf16FromUtf8Literal("Invalid UTF-8 follows: \xC0\x76\x77");
+        TEST_ERROR("Exception not thrown in presence of invalid UTF-8 literal.");
+    }
+    catch (const win32::Utf8ConversionException& e)
+    {
+        if (e.ErrorCode() != ERROR_NO_UNICODE_TRANSLATION)
+        {
+            TEST_ERROR("Error code different than ERROR_NO_UNICODE_TRANSLATION.");
+        }
+    }
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_LITERAL_OPERATOR
+    using namespace win32::literals;
+
+    // The literal operator sizes the result exactly
+    static_assert("Kin \xE9\x87\x91"_u16.Length() == 5, "Wrong length of _u16 literal.");
+    static_assert(sizeof("Kin \xE9\x87\x91"_u16) == sizeof(win32::FixedUtf16String<5>),
+                  "_u16 literal not sized exactly.");
+
+    // Each literal is stored once
+    if (&"Kin \xE9\x87\x91"_u16 != &"Kin \xE9\x87\x91"_u16
+        || CStringW("Kin \xE9\x87\x91"_u16) != U16("Kin \x91D1"))
+    {
+        TEST_ERROR("Wrong _u16 literal.");
+    }
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_LITERAL_OPERATOR
+}
+
+
+void TestAdaptiveConversions()
+{
+    using win32::AdaptiveConverter;
+    using win32::ConversionDirection;
+    using win32::ConversionKernel;
+
+    // Both kernels give the same results, and errors, of the conversion functions
+    const std::string samples[] = { "Hello", "Kin \xE9\x87\x91", "\xF0\x9F\x98\x80 smile", std::string(100, 'x') };
+    for (ConversionKernel kernel : { ConversionKernel::Ascii, ConversionKernel::Multibyte })
+    {
+        AdaptiveConverter converter;
+        converter.PinKernel(ConversionDirection::Utf8ToUtf16, kernel);
+        converter.PinKernel(ConversionDirection::Utf16ToUtf8, kernel);
+        for (const std::string& utf8 : samples)
+        {
+            const CStringW utf16 = win32::Utf16FromUtf8(utf8);
+            if (converter.Utf16FromUtf8(utf8) != utf16 || converter.Utf8FromUtf16(utf16) != utf8)
+            {
+                TEST_ERROR("Wrong result from AdaptiveConverter kernel.");
+            }
+        }
+        if (!converter.Utf16FromUtf8(std::string()).IsEmpty() || !converter.Utf8FromUtf16(CStringW()).empty())
+        {
+            TEST_ERROR("Empty input not converted to empty result by AdaptiveConverter.");
+        }
+
+        try
+        {
+            converter.Utf16FromUtf8(std::string("abc\xE9\x87"));
+            TEST_ERROR("Exception not thrown converting invalid UTF-8 with AdaptiveConverter.");
+        }
+        catch (const win32::Utf8ConversionException& e)
+        {
+            if (e.ErrorCode() != ERROR_NO_UNICODE_TRANSLATION)
+            {
+                TEST_ERROR("Wrong error code converting invalid UTF-8 with AdaptiveConverter.");
+            }
+        }
+        try
+        {
+            const win32::Utf16Char unpaired[] = { 'a', 0xD800, 'b' };
+            converter.Utf8FromUtf16(unpaired, unpaired + 3);
+            TEST_ERROR("Exception not thrown converting invalid UTF-16 with AdaptiveConverter.");
+        }
+        catch (const win32::Utf8ConversionException& e)
+        {
+            if (e.ErrorCode() != ERROR_NO_UNICODE_TRANSLATION)
+            {
+                TEST_ERROR("Wrong error code converting invalid UTF-16 with AdaptiveConverter.");
+            }
+        }
+    }
+
+    AdaptiveConverter converter;
+    const std::string ascii(64, 'a');
+    const std::string cjk = "\xE9\x87\x91\xE9\x8A\x80";
+    const std::string mostlyAscii = std::string(97, 'a') + "\xE9\x87\x91";    // 97% ASCII bytes
+
+    // Text between the two thresholds doesn't change the kernel, either way
+    for (int i = 0; i < 200; ++i)
+    {
+        converter.Utf16FromUtf8(mostlyAscii);
+    }
+    win32::AdaptiveKernelStatus status = converter.Status(ConversionDirection::Utf8ToUtf16);
+    if (status.kernel != ConversionKernel::Ascii || status.switches != 0 || status.conversions != 200
+        || status.asciiFraction < 0.96 || status.asciiFraction > 0.98)
+    {
+        TEST_ERROR("Wrong AdaptiveConverter status for mostly ASCII input.");
+    }
+
+    for (int i = 0; i < 200; ++i)
+    {
+        converter.Utf16FromUtf8(cjk);
+    }
+    status = converter.Status(ConversionDirection::Utf8ToUtf16);
+    if (status.kernel != ConversionKernel::Multibyte || status.switches != 1
+        || status.multibyteFraction < 0.99 || status.surrogateFraction != 0.0)
+    {
+        TEST_ERROR("AdaptiveConverter not switching to the multibyte kernel.");
+    }
+
+    for (int i = 0; i < 200; ++i)
+    {
+        converter.Utf16FromUtf8(mostlyAscii);
+    }
+    if (converter.Status(ConversionDirection::Utf8ToUtf16).kernel != ConversionKernel::Multibyte)
+    {
+        TEST_ERROR("AdaptiveConverter switching kernel between the thresholds.");
+    }
+
+    for (int i = 0; i < 200; ++i)
+    {
+        converter.Utf16FromUtf8(ascii);
+    }
+    status = converter.Status(ConversionDirection::Utf8ToUtf16);
+    if (status.kernel != ConversionKernel::Ascii || status.switches != 2 || status.asciiFraction < 0.99)
+    {
+        TEST_ERROR("AdaptiveConverter not switching back to the ASCII kernel.");
+    }
+
+    // The directions are independent; supplementary characters are surrogate content
+    const CStringW emoji = win32::Utf16FromUtf8("\xF0\x9F\x98\x80\xF0\x9F\x98\x81");
+    for (int i = 0; i < 200; ++i)
+    {
+        converter.Utf8FromUtf16(emoji);
+    }
+    status = converter.Status(ConversionDirection::Utf16ToUtf8);
+    if (status.kernel != ConversionKernel::Multibyte || status.conversions != 200
+        || status.surrogateFraction < 0.99)
+    {
+        TEST_ERROR("Wrong AdaptiveConverter status for supplementary characters.");
+    }
+    if (converter.Status(ConversionDirection::Utf8ToUtf16).kernel != ConversionKernel::Ascii)
+    {
+        TEST_ERROR("AdaptiveConverter directions not independent.");
+    }
+
+    // Pinned kernels are kept whatever the input, until unpinned
+    converter.PinKernel(ConversionDirection::Utf8ToUtf16, ConversionKernel::Multibyte);
+    for (int i = 0; i < 200; ++i)
+    {
+        converter.Utf16FromUtf8(ascii);
+    }
+    status = converter.Status(ConversionDirection::Utf8ToUtf16);
+    if (status.kernel != ConversionKernel::Multibyte || !status.pinned || status.switches != 2)
+    {
+        TEST_ERROR("AdaptiveConverter not keeping the pinned kernel.");
+    }
+
+    converter.UnpinKernel(ConversionDirection::Utf8ToUtf16);
+    converter.Utf16FromUtf8(ascii);
+    status = converter.Status(ConversionDirection::Utf8ToUtf16);
+    if (status.kernel != ConversionKernel::Ascii || status.pinned || status.switches != 3)
+    {
+        TEST_ERROR("AdaptiveConverter not adapting after unpinning the kernel.");
+    }
+}
+
+#ifdef TEST_GIGANTIC_STRINGS
+void TestGiganticStrings()
+{
+    try
+    {
+        // Build a gigantic std::string
+        constexpr size_t giga = 1ULL * 1024 * 1024 * 1024;
+        const std::string hugeUtf8(5 * giga, 'C');
+        
+        // This code should throw because of the gigantic std::string 
+        CStringW hugeUtf16 = win32::Utf16FromUtf8(hugeUtf8);
+
+        // Correct code should *not* get here:
+        TEST_ERROR("Exception not thrown in presence of UTF-8 string whose length can't fit into an int.");
+    }
+    catch (const win32::Utf8ConversionException& e)
+    {
+        // All right
+        cout << "\nHuge UTF-8 string throwing exception as expected; error code=" << e.ErrorCode()
+             << ".\n";
+    }
+
+    // NOTE:
+    // Can't have a huge CStringW, as CString's lengths are expressed using int 
+    // (i.e. signed integers; not size_t).
+    // However, can build a huge std::wstring, and pass [start, finish) to the conversion function.
+    try
+    {
+        // Build a gigantic std::wstring
+        constexpr size_t giga = 1ULL * 1024 * 1024 * 1024;
+        const std::basic_string<win32::Utf16Char> hugeUtf16(5 * giga, U16('C'));
+
+        // This code should throw because of the gigantic std::wstring 
+        const win32::Utf16Char * const utf16Start = hugeUtf16.data();
+        const win32::Utf16Char * const utf16Finish = utf16Start + hugeUtf16.length();
+        std::string hugeUtf8 = win32::Utf8FromUtf16(utf16Start, utf16Finish);
+
+        // Correct code should *not* get here:
+        TEST_ERROR("Exception not thrown in presence of UTF-16 string whose length can't fit into an int.");
+    }
+    catch (const win32::Utf8ConversionException& e)
+    {
+        // All right
+        cout << "\nHuge UTF-16 string throwing exception as expected; error code=" << e.ErrorCode()
+            << ".\n";
+    }
+}
+#endif // TEST_GIGANTIC_STRINGS
+
+
+// Run all tests
+void RunTests()
+{
+    TestBasicConversionsWithStlStrings();
+    TestBasicConversionWithRawPointers();
+    TestEmptyStringConversions();
+    TestJapaneseKin();
+    TestInvalidUnicodeSequences();
+    TestCodePointIterators();
+    TestOffsetMap();
+    TestUtf16Mirror();
+    TestUtf8Rope();
+    TestDualString();
+    TestConversionCache();
+    TestUtf16Interner();
+    TestBatchConversions();
+    TestAllocatorConversions();
+    TestScratchConversions();
+    TestSmallStringConversions();
+#ifndef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+    TestUtf16String();
+#endif
+    TestUtf32Conversions();
+    TestNulTerminatedAndViewConversions();
+    TestCompileTimeConversions();
+    TestAdaptiveConversions();
 
 #ifdef TEST_GIGANTIC_STRINGS
     TestGiganticStrings();
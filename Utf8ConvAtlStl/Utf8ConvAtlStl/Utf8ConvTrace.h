@@ -0,0 +1,575 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CONVTRACE_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CONVTRACE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Workload Traces of UTF-8 <-> UTF-16 Conversions
+//          ===============================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module capturing the shape of a real conversion workload, to
+// tune the conversions against it (see the --replay mode of Utf8ConvBench).
+//
+// Each sampled conversion is recorded as its direction, its input length,
+// and the script class of its text: the longest UTF-8 sequence it contains
+// (ASCII only, 2-byte sequences as in Latin, Greek or Cyrillic text, 3-byte
+// sequences as in CJK text, or 4-byte sequences as in emoji). Optionally,
+// an anonymized sample of the text is recorded too: every letter and digit
+// is replaced by a random one of the same UTF-8 length (and, outside ASCII,
+// of the same 64-code-point block), preserving the byte structure but not
+// the content.
+//
+// Recording needs the conversion sampling hook of Utf8Conv.h: define
+// GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING before including the headers.
+//
+//      ConversionTraceRecorder recorder(1024);     // Sample 1 in 1024
+//      ...
+//      recorder.Save("conversions.u8ct");
+//
+// Trace file format (compact, little-endian): the "U8CT" magic, a version
+// byte, and then one record per sampled conversion:
+//
+//      flags   1 byte:  bit 0 direction (1: UTF-16 -> UTF-8),
+//                       bits 1-2 script class, bit 3 sample present
+//      length  LEB128:  input length, in code units
+//      sample  LEB128 byte count, followed by the anonymized UTF-8 text
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Core conversion functions
+
+#include <cstddef>      // For std::size_t
+#include <cstdint>      // For std::uint8_t, std::uint32_t, std::uint64_t
+#include <fstream>      // For std::ifstream, std::ofstream
+#include <istream>      // For std::istream
+#include <ostream>      // For std::ostream
+#include <stdexcept>    // For std::runtime_error, std::logic_error
+#include <string>       // For std::string
+#include <utility>      // For std::move
+#include <vector>       // For std::vector
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+#include <mutex>        // For std::mutex, std::lock_guard
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+// Script class of a text: the length of the longest UTF-8 sequence in it
+enum class ScriptClass : std::uint8_t
+{
+    Ascii,      // ASCII only
+    TwoByte,    // Up to U+07FF (Latin, Greek, Cyrillic, Hebrew, Arabic, ...)
+    ThreeByte,  // Up to U+FFFF (CJK, Indic scripts, ...)
+    FourByte    // Supplementary planes (emoji, rare ideographs, ...)
+};
+
+constexpr int kScriptClassCount = 4;
+
+// Inputs longer than this (in code units) are recorded without text sample
+constexpr std::size_t kMaxTraceSampleLength = 4096;
+
+// Short name of the given script class, for reports
+inline const char* ScriptClassName(ScriptClass scriptClass) noexcept
+{
+    static const char* const names[kScriptClassCount] = { "ascii", "2-byte", "3-byte", "4-byte" };
+    return names[static_cast<int>(scriptClass)];
+}
+
+// A sampled conversion
+struct TraceRecord
+{
+    ConversionDirection direction = ConversionDirection::Utf8ToUtf16;
+    ScriptClass         scriptClass = ScriptClass::Ascii;
+
+    // Input length, in chars (UTF-8 -> UTF-16) or Utf16Chars (UTF-16 -> UTF-8)
+    std::uint32_t       length = 0;
+
+    // Anonymized UTF-8 text of the input, if recorded (empty otherwise)
+    std::string         sample;
+};
+
+
+namespace detail
+{
+
+// Script class of a valid UTF-8 text
+inline ScriptClass ClassifyUtf8(const char* utf8, std::size_t length) noexcept
+{
+    // The largest byte is the lead byte of the longest sequence:
+    // 110xxxxx, 1110xxxx or 11110xxx (continuation bytes are 10xxxxxx)
+    unsigned char largest = 0;
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        const unsigned char byte = static_cast<unsigned char>(utf8[i]);
+        largest = (byte > largest) ? byte : largest;
+    }
+
+    if (largest >= 0xF0)
+    {
+        return ScriptClass::FourByte;
+    }
+    if (largest >= 0xE0)
+    {
+        return ScriptClass::ThreeByte;
+    }
+    return (largest >= 0x80) ? ScriptClass::TwoByte : ScriptClass::Ascii;
+}
+
+// Script class of a valid UTF-16 text
+template <typename CharT>
+inline ScriptClass ClassifyUtf16(const CharT* utf16, std::size_t length) noexcept
+{
+    ScriptClass scriptClass = ScriptClass::Ascii;
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        const char32_t codeUnit = utf16[i];
+        if (codeUnit >= 0xD800 && codeUnit <= 0xDFFF)
+        {
+            return ScriptClass::FourByte;
+        }
+        if (codeUnit >= 0x800)
+        {
+            scriptClass = ScriptClass::ThreeByte;
+        }
+        else if (codeUnit >= 0x80 && scriptClass == ScriptClass::Ascii)
+        {
+            scriptClass = ScriptClass::TwoByte;
+        }
+    }
+    return scriptClass;
+}
+
+// Small pseudo-random generator (xorshift64*) for the anonymization
+class TraceRandom
+{
+public:
+    explicit TraceRandom(std::uint64_t seed) noexcept
+        : m_state(seed != 0 ? seed : 0x9E3779B97F4A7C15ull)
+    {}
+
+    // Uniform value in [0, bound)
+    std::uint32_t Below(std::uint32_t bound) noexcept
+    {
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        const std::uint32_t value = static_cast<std::uint32_t>((m_state * 0x2545F4914F6CDD1Dull) >> 32);
+        return static_cast<std::uint32_t>((static_cast<std::uint64_t>(value) * bound) >> 32);
+    }
+
+private:
+    std::uint64_t m_state;
+};
+
+//
+// Anonymized replacement of a code point: ASCII letters and digits become
+// random letters (of the same case) and digits, other ASCII characters are
+// kept, and other code points get random low 6 bits. Surrogates and
+// U+10FFFF are in 64-aligned blocks: the result is a valid code point of the
+// same UTF-8 length.
+//
+inline char32_t AnonymizeCodePoint(char32_t codePoint, TraceRandom& random) noexcept
+{
+    if (codePoint >= 'a' && codePoint <= 'z')
+    {
+        return 'a' + random.Below(26);
+    }
+    if (codePoint >= 'A' && codePoint <= 'Z')
+    {
+        return 'A' + random.Below(26);
+    }
+    if (codePoint >= '0' && codePoint <= '9')
+    {
+        return '0' + random.Below(10);
+    }
+    if (codePoint < 0x80)
+    {
+        return codePoint;
+    }
+    return (codePoint & ~char32_t(0x3F)) | random.Below(64);
+}
+
+inline char32_t DecodeTraceCodePoint(const char*& pos, const char* finish) noexcept
+{
+    return DecodeUtf8(pos, finish);
+}
+
+template <typename CharT>
+inline char32_t DecodeTraceCodePoint(const CharT*& pos, const CharT* finish) noexcept
+{
+    return DecodeUtf16(pos, finish);
+}
+
+// Anonymized copy, in UTF-8, of a valid UTF-8 or UTF-16 text
+template <typename CharT>
+inline std::string AnonymizeText(const CharT* text, std::size_t length, TraceRandom& random)
+{
+    std::string result;
+    result.reserve(length * (sizeof(CharT) == 1 ? 1 : 3));
+
+    const CharT* pos = text;
+    const CharT* const finish = text + length;
+    while (pos < finish)
+    {
+        const char32_t codePoint = DecodeTraceCodePoint(pos, finish);
+        if (codePoint == kInvalidCodePoint)
+        {
+            // Not reached with validated input: stop at the invalid sequence
+            break;
+        }
+
+        char buffer[4];
+        const char* const end = EncodeUtf8(AnonymizeCodePoint(codePoint, random), buffer);
+        result.append(buffer, static_cast<std::size_t>(end - buffer));
+    }
+    return result;
+}
+
+inline void WriteVarint(std::ostream& output, std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        output.put(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    output.put(static_cast<char>(value));
+}
+
+// Read a LEB128 value of at most 'maxBits' bits; returns false at end of input
+inline bool ReadVarint(std::istream& input, std::uint64_t& value, int maxBits)
+{
+    value = 0;
+    for (int shift = 0; shift < maxBits; shift += 7)
+    {
+        const std::istream::int_type ch = input.get();
+        if (ch == std::istream::traits_type::eof())
+        {
+            return false;
+        }
+        value |= static_cast<std::uint64_t>(ch & 0x7F) << shift;
+        if ((ch & 0x80) == 0)
+        {
+            return (value >> maxBits) == 0;
+        }
+    }
+    throw std::runtime_error("Invalid conversion trace: length out of range.");
+}
+
+constexpr char kTraceMagic[4] = { 'U', '8', 'C', 'T' };
+constexpr char kTraceVersion = 1;
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// Write a conversion trace to a binary stream
+//------------------------------------------------------------------------------
+inline void WriteConversionTrace(std::ostream& output, const std::vector<TraceRecord>& records)
+{
+    output.write(detail::kTraceMagic, sizeof(detail::kTraceMagic));
+    output.put(detail::kTraceVersion);
+
+    for (const TraceRecord& record : records)
+    {
+        const int flags = (record.direction == ConversionDirection::Utf16ToUtf8 ? 1 : 0)
+                        | (static_cast<int>(record.scriptClass) << 1)
+                        | (record.sample.empty() ? 0 : 8);
+        output.put(static_cast<char>(flags));
+        detail::WriteVarint(output, record.length);
+        if (!record.sample.empty())
+        {
+            detail::WriteVarint(output, record.sample.length());
+            output.write(record.sample.data(), static_cast<std::streamsize>(record.sample.length()));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Read a conversion trace from a binary stream.
+// Throws std::runtime_error on malformed traces (including samples that are
+// not valid UTF-8).
+//------------------------------------------------------------------------------
+inline std::vector<TraceRecord> ReadConversionTrace(std::istream& input)
+{
+    char header[sizeof(detail::kTraceMagic) + 1] = {};
+    input.read(header, sizeof(header));
+    if (!input || std::char_traits<char>::compare(header, detail::kTraceMagic, sizeof(detail::kTraceMagic)) != 0)
+    {
+        throw std::runtime_error("Not a conversion trace.");
+    }
+    if (header[sizeof(detail::kTraceMagic)] != detail::kTraceVersion)
+    {
+        throw std::runtime_error("Unsupported conversion trace version.");
+    }
+
+    std::vector<TraceRecord> records;
+    for (;;)
+    {
+        const std::istream::int_type flags = input.get();
+        if (flags == std::istream::traits_type::eof())
+        {
+            return records;
+        }
+        if ((flags & ~0x0F) != 0)
+        {
+            throw std::runtime_error("Invalid conversion trace: unknown record flags.");
+        }
+
+        TraceRecord record;
+        record.direction = (flags & 1) ? ConversionDirection::Utf16ToUtf8 : ConversionDirection::Utf8ToUtf16;
+        record.scriptClass = static_cast<ScriptClass>((flags >> 1) & 3);
+
+        std::uint64_t length = 0;
+        if (!detail::ReadVarint(input, length, 31))
+        {
+            throw std::runtime_error("Invalid conversion trace: truncated record.");
+        }
+        record.length = static_cast<std::uint32_t>(length);
+
+        if (flags & 8)
+        {
+            std::uint64_t sampleLength = 0;
+            if (!detail::ReadVarint(input, sampleLength, 31) || sampleLength == 0)
+            {
+                throw std::runtime_error("Invalid conversion trace: truncated record.");
+            }
+            record.sample.resize(static_cast<std::size_t>(sampleLength));
+            input.read(&record.sample[0], static_cast<std::streamsize>(sampleLength));
+            if (!input)
+            {
+                throw std::runtime_error("Invalid conversion trace: truncated record.");
+            }
+
+            const char* pos = record.sample.data();
+            const char* const finish = pos + record.sample.length();
+            while (pos < finish)
+            {
+                if (detail::DecodeUtf8(pos, finish) == detail::kInvalidCodePoint)
+                {
+                    throw std::runtime_error("Invalid conversion trace: sample is not valid UTF-8.");
+                }
+            }
+        }
+        records.push_back(std::move(record));
+    }
+}
+
+// Read a conversion trace from a file; throws std::runtime_error on errors
+inline std::vector<TraceRecord> LoadConversionTrace(const char* path)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+        throw std::runtime_error(std::string("Can't open the conversion trace ") + path + ".");
+    }
+    return ReadConversionTrace(input);
+}
+
+
+// Counts of the records of a trace, by direction and script class
+struct TraceSummary
+{
+    std::uint64_t counts[2][kScriptClassCount] = {};
+
+    // Input lengths: counts[i] of lengths in [2^(i-1), 2^i), and of 0 for i == 0
+    std::uint64_t lengthBuckets[33] = {};
+
+    std::uint64_t samples = 0;
+};
+
+inline TraceSummary SummarizeConversionTrace(const std::vector<TraceRecord>& records) noexcept
+{
+    TraceSummary summary;
+    for (const TraceRecord& record : records)
+    {
+        ++summary.counts[static_cast<int>(record.direction)][static_cast<int>(record.scriptClass)];
+
+        int bucket = 0;
+        for (std::uint32_t length = record.length; length != 0; length >>= 1)
+        {
+            ++bucket;
+        }
+        ++summary.lengthBuckets[bucket];
+
+        summary.samples += record.sample.empty() ? 0 : 1;
+    }
+    return summary;
+}
+
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+//------------------------------------------------------------------------------
+// Records the conversions sampled while alive, through the sampling hook of
+// the conversion functions. Only one recorder can be active at a time.
+//
+// Recording locks a mutex, so the sampling period should keep the sampled
+// conversions rare (e.g. 1 in 1024) on busy multithreaded workloads.
+//------------------------------------------------------------------------------
+class ConversionTraceRecorder
+{
+public:
+
+    // Default maximum number of records (further samples are dropped)
+    static constexpr std::size_t kDefaultMaxRecords = 1024 * 1024;
+
+    //
+    // Start recording one conversion in every 'period' (on each thread, for
+    // each direction), with anonymized text samples if 'recordSamples' is true.
+    // Throws std::logic_error if another recorder is active.
+    //
+    explicit ConversionTraceRecorder(std::uint32_t period,
+                                     bool recordSamples = false,
+                                     std::size_t maxRecords = kDefaultMaxRecords,
+                                     std::uint64_t seed = 0x7ACE5EED)
+        : m_recordSamples(recordSamples)
+        , m_maxRecords(maxRecords)
+        , m_dropped(0)
+        , m_random(seed)
+    {
+        std::lock_guard<std::mutex> lock(Mutex());
+        if (ActiveRecorder() != nullptr)
+        {
+            throw std::logic_error("Another conversion trace recorder is active.");
+        }
+        ActiveRecorder() = this;
+        SetConversionSampler(&ConversionTraceRecorder::Sample, period);
+    }
+
+    ~ConversionTraceRecorder()
+    {
+        Stop();
+    }
+
+    ConversionTraceRecorder(const ConversionTraceRecorder&) = delete;
+    ConversionTraceRecorder& operator=(const ConversionTraceRecorder&) = delete;
+
+    // Stop recording (the records are kept)
+    void Stop() noexcept
+    {
+        std::lock_guard<std::mutex> lock(Mutex());
+        if (ActiveRecorder() == this)
+        {
+            SetConversionSampler(nullptr);
+            ActiveRecorder() = nullptr;
+        }
+    }
+
+    // Copy of the records so far
+    std::vector<TraceRecord> Records() const
+    {
+        std::lock_guard<std::mutex> lock(Mutex());
+        return m_records;
+    }
+
+    // Number of sampled conversions not recorded, as the record limit was reached
+    std::uint64_t DroppedCount() const
+    {
+        std::lock_guard<std::mutex> lock(Mutex());
+        return m_dropped;
+    }
+
+    // Write the records so far to a trace file; throws std::runtime_error on errors
+    void Save(const char* path) const
+    {
+        const std::vector<TraceRecord> records = Records();
+
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        WriteConversionTrace(output, records);
+        output.close();
+        if (!output)
+        {
+            throw std::runtime_error(std::string("Can't write the conversion trace ") + path + ".");
+        }
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    bool m_recordSamples;
+    std::size_t m_maxRecords;
+    std::vector<TraceRecord> m_records;
+    std::uint64_t m_dropped;
+    detail::TraceRandom m_random;
+
+    // Guards the active recorder and its state
+    static std::mutex& Mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static ConversionTraceRecorder*& ActiveRecorder()
+    {
+        static ConversionTraceRecorder* recorder = nullptr;
+        return recorder;
+    }
+
+    // The sampler installed in the conversion functions
+    static void Sample(ConversionDirection direction, const void* input, std::size_t length) noexcept
+    {
+        try
+        {
+            std::lock_guard<std::mutex> lock(Mutex());
+            ConversionTraceRecorder* const recorder = ActiveRecorder();
+            if (recorder != nullptr)
+            {
+                recorder->Record(direction, input, length);
+            }
+        }
+        catch (...)
+        {
+            // Out of memory: skip the sample, sampling must not fail the conversion
+        }
+    }
+
+    void Record(ConversionDirection direction, const void* input, std::size_t length)
+    {
+        if (m_records.size() >= m_maxRecords)
+        {
+            ++m_dropped;
+            return;
+        }
+
+        TraceRecord record;
+        record.direction = direction;
+        record.length = static_cast<std::uint32_t>(length);
+        if (direction == ConversionDirection::Utf8ToUtf16)
+        {
+            const char* const utf8 = static_cast<const char*>(input);
+            record.scriptClass = detail::ClassifyUtf8(utf8, length);
+            if (m_recordSamples && length <= kMaxTraceSampleLength)
+            {
+                record.sample = detail::AnonymizeText(utf8, length, m_random);
+            }
+        }
+        else
+        {
+            const Utf16Char* const utf16 = static_cast<const Utf16Char*>(input);
+            record.scriptClass = detail::ClassifyUtf16(utf16, length);
+            if (m_recordSamples && length <= kMaxTraceSampleLength)
+            {
+                record.sample = detail::AnonymizeText(utf16, length, m_random);
+            }
+        }
+        m_records.push_back(std::move(record));
+    }
+};
+
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CONVTRACE_H
@@ -0,0 +1,537 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8CONVUTF32_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8CONVUTF32_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          UTF-32 and wchar_t-Width-Agnostic Conversions
+//          =============================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module adding conversions from and to UTF-32 (char32_t), and
+// between UTF-8 and wchar_t strings on any platform.
+//
+// wchar_t is 16 bits on Windows (UTF-16), and 32 bits on Linux and most other
+// platforms (UTF-32): WideFromUtf8 and Utf8FromWide pick the right encoding
+// at compile time, based on sizeof(wchar_t), so std::wstring data is always
+// converted correctly.
+//
+// The UTF-32 conversions don't depend on Win32 APIs. ASCII runs, which are
+// the common case in most text, are processed eight bytes at a time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Core conversion functions
+
+#include <cstddef>      // For std::size_t
+#include <cstdint>      // For std::uint64_t
+#include <cstring>      // For std::memcpy
+#include <string>       // For std::string, std::u32string, std::wstring
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+namespace detail
+{
+
+// Throw the exception signaling an invalid UTF-32 code point
+[[noreturn]] inline void ThrowInvalidUtf32()
+{
+    throw Utf8ConversionException(
+        "Invalid UTF-32 code point in input string.\n",
+        ERROR_NO_UNICODE_TRANSLATION);
+}
+
+// Is the given UTF-32 code unit a valid Unicode scalar value?
+inline bool IsValidCodePoint(char32_t codePoint) noexcept
+{
+    return codePoint < 0xD800 || (codePoint > 0xDFFF && codePoint <= 0x10FFFF);
+}
+
+//
+// UTF-32 conversion kernels.
+// Char32T is char32_t, or wchar_t where it's 32 bits wide.
+// The length functions validate the input (throwing Utf8ConversionException),
+// the conversion functions expect input already validated by them.
+//
+
+// Length, in code points, of the UTF-32 conversion of the UTF-8 range [pos, finish)
+inline std::size_t Utf32LengthFromUtf8(const char* pos, const char* finish)
+{
+    std::size_t length = 0;
+    while (pos != finish)
+    {
+        const char* const asciiEnd = SkipAsciiUtf8(pos, finish);
+        length += asciiEnd - pos;
+        pos = asciiEnd;
+        if (pos == finish)
+        {
+            break;
+        }
+
+        if (DecodeUtf8(pos, finish) == kInvalidCodePoint)
+        {
+            ThrowInvalidUtf8();
+        }
+        ++length;
+    }
+    return length;
+}
+
+template <typename Char32T>
+inline Char32T* ConvertUtf8ToUtf32(const char* pos, const char* finish, Char32T* out) noexcept
+{
+    static_assert(sizeof(Char32T) == 4, "UTF-32 code units must be 32 bits wide.");
+    constexpr std::uint64_t kHighBits = 0x8080808080808080ULL;
+
+    while (pos != finish)
+    {
+        // Widen eight ASCII bytes at a time
+        while (finish - pos >= 8)
+        {
+            std::uint64_t block;
+            std::memcpy(&block, pos, sizeof(block));
+            if ((block & kHighBits) != 0)
+            {
+                break;
+            }
+            for (int i = 0; i < 8; ++i)
+            {
+                out[i] = static_cast<Char32T>(pos[i]);
+            }
+            pos += 8;
+            out += 8;
+        }
+        if (pos == finish)
+        {
+            break;
+        }
+
+        const char32_t codePoint = DecodeUtf8(pos, finish);
+        ATLASSERT(codePoint != kInvalidCodePoint);
+        *out++ = static_cast<Char32T>(codePoint);
+    }
+    return out;
+}
+
+// Length, in bytes, of the UTF-8 conversion of the UTF-32 range [pos, finish)
+template <typename Char32T>
+inline std::size_t Utf8LengthFromUtf32(const Char32T* pos, const Char32T* finish)
+{
+    static_assert(sizeof(Char32T) == 4, "UTF-32 code units must be 32 bits wide.");
+    constexpr std::uint64_t kNonAsciiBits = 0xFFFFFF80FFFFFF80ULL;
+
+    std::size_t length = 0;
+    while (pos != finish)
+    {
+        // Two ASCII code points at a time
+        if (finish - pos >= 2)
+        {
+            std::uint64_t block;
+            std::memcpy(&block, pos, sizeof(block));
+            if ((block & kNonAsciiBits) == 0)
+            {
+                length += 2;
+                pos += 2;
+                continue;
+            }
+        }
+
+        const char32_t codePoint = static_cast<char32_t>(*pos++);
+        if (!IsValidCodePoint(codePoint))
+        {
+            ThrowInvalidUtf32();
+        }
+        length += Utf8EncodedLength(codePoint);
+    }
+    return length;
+}
+
+template <typename Char32T>
+inline char* ConvertUtf32ToUtf8(const Char32T* pos, const Char32T* finish, char* out) noexcept
+{
+    while (pos != finish)
+    {
+        const char32_t codePoint = static_cast<char32_t>(*pos++);
+        if (codePoint < 0x80)
+        {
+            *out++ = static_cast<char>(codePoint);
+        }
+        else
+        {
+            out = EncodeUtf8(codePoint, out);
+        }
+    }
+    return out;
+}
+
+// Length, in code points, of the UTF-32 conversion of the UTF-16 range [pos, finish)
+template <typename Char16T>
+inline std::size_t Utf32LengthFromUtf16(const Char16T* pos, const Char16T* finish)
+{
+    std::size_t length = 0;
+    while (pos != finish)
+    {
+        const Char16T* const asciiEnd = SkipAsciiUtf16(pos, finish);
+        length += asciiEnd - pos;
+        pos = asciiEnd;
+        if (pos == finish)
+        {
+            break;
+        }
+
+        if (DecodeUtf16(pos, finish) == kInvalidCodePoint)
+        {
+            ThrowInvalidUtf16();
+        }
+        ++length;
+    }
+    return length;
+}
+
+template <typename Char16T, typename Char32T>
+inline Char32T* ConvertUtf16ToUtf32(const Char16T* pos, const Char16T* finish, Char32T* out) noexcept
+{
+    static_assert(sizeof(Char32T) == 4, "UTF-32 code units must be 32 bits wide.");
+    constexpr std::uint64_t kNonAsciiBits = 0xFF80FF80FF80FF80ULL;
+
+    while (pos != finish)
+    {
+        // Widen four ASCII code units at a time
+        while (finish - pos >= 4)
+        {
+            std::uint64_t block;
+            std::memcpy(&block, pos, sizeof(block));
+            if ((block & kNonAsciiBits) != 0)
+            {
+                break;
+            }
+            for (int i = 0; i < 4; ++i)
+            {
+                out[i] = static_cast<Char32T>(static_cast<char16_t>(pos[i]));
+            }
+            pos += 4;
+            out += 4;
+        }
+        if (pos == finish)
+        {
+            break;
+        }
+
+        const char32_t codePoint = DecodeUtf16(pos, finish);
+        ATLASSERT(codePoint != kInvalidCodePoint);
+        *out++ = static_cast<Char32T>(codePoint);
+    }
+    return out;
+}
+
+// Length, in UTF-16 code units, of the UTF-16 conversion of the UTF-32 range [pos, finish)
+template <typename Char32T>
+inline std::size_t Utf16LengthFromUtf32(const Char32T* pos, const Char32T* finish)
+{
+    std::size_t length = 0;
+    for (; pos != finish; ++pos)
+    {
+        const char32_t codePoint = static_cast<char32_t>(*pos);
+        if (!IsValidCodePoint(codePoint))
+        {
+            ThrowInvalidUtf32();
+        }
+        length += (codePoint < 0x10000) ? 1 : 2;
+    }
+    return length;
+}
+
+template <typename Char32T, typename Char16T>
+inline Char16T* ConvertUtf32ToUtf16(const Char32T* pos, const Char32T* finish, Char16T* out) noexcept
+{
+    for (; pos != finish; ++pos)
+    {
+        out = EncodeUtf16(static_cast<char32_t>(*pos), out);
+    }
+    return out;
+}
+
+//
+// UTF-8 <-> wchar_t conversion engines, selected by the size of wchar_t.
+// (Partial specializations, so that only the selected engine is instantiated.)
+//
+template <typename WideCharT, std::size_t WideCharSize = sizeof(WideCharT)>
+struct WideConversion;
+
+// 16-bit wchar_t (Windows): wchar_t strings are UTF-16
+template <typename WideCharT>
+struct WideConversion<WideCharT, 2>
+{
+    static std::basic_string<WideCharT> FromUtf8(const char* utf8Start, const char* utf8Finish)
+    {
+        std::basic_string<WideCharT> wide;
+        if (utf8Start == utf8Finish)
+        {
+            return wide;
+        }
+
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_entry, utf8Start, utf8Finish - utf8Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        TelemetryScope telemetry(kTelemetryUtf16FromUtf8);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+        const int utf8Length = CheckedIntLength(utf8Finish - utf8Start);
+        const int utf16Length = Utf16LengthFromUtf8(utf8Start, utf8Length);
+        wide.resize(utf16Length);
+
+        // wchar_t and Utf16Char have the same size and representation here
+        ConvertUtf8ToUtf16(utf8Start, utf8Length, reinterpret_cast<Utf16Char*>(&wide[0]), utf16Length);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+        detail::SampleConversion(ConversionDirection::Utf8ToUtf16, utf8Start, utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+        telemetry.Complete(utf8Length, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+        GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_return, utf8Length, utf16Length);
+
+        return wide;
+    }
+
+    static std::string ToUtf8(const WideCharT* wideStart, const WideCharT* wideFinish)
+    {
+        return Utf8FromUtf16(reinterpret_cast<const Utf16Char*>(wideStart),
+                             reinterpret_cast<const Utf16Char*>(wideFinish));
+    }
+};
+
+// 32-bit wchar_t (Linux and most other platforms): wchar_t strings are UTF-32
+template <typename WideCharT>
+struct WideConversion<WideCharT, 4>
+{
+    static std::basic_string<WideCharT> FromUtf8(const char* utf8Start, const char* utf8Finish)
+    {
+        std::basic_string<WideCharT> wide(Utf32LengthFromUtf8(utf8Start, utf8Finish), WideCharT());
+        if (!wide.empty())
+        {
+            ConvertUtf8ToUtf32(utf8Start, utf8Finish, &wide[0]);
+        }
+        return wide;
+    }
+
+    static std::string ToUtf8(const WideCharT* wideStart, const WideCharT* wideFinish)
+    {
+        std::string utf8(Utf8LengthFromUtf32(wideStart, wideFinish), '\0');
+        if (!utf8.empty())
+        {
+            ConvertUtf32ToUtf8(wideStart, wideFinish, &utf8[0]);
+        }
+        return utf8;
+    }
+};
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-32.
+//
+// UTF-8 strings are specified using an STL-style [start, finish) range,
+// or std::string.
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::u32string Utf32FromUtf8(const char* utf8Start, const char* utf8Finish)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(utf8Start <= utf8Finish);
+
+    std::u32string utf32(detail::Utf32LengthFromUtf8(utf8Start, utf8Finish), U'\0');
+    if (!utf32.empty())
+    {
+        detail::ConvertUtf8ToUtf32(utf8Start, utf8Finish, &utf32[0]);
+    }
+    return utf32;
+}
+
+inline std::u32string Utf32FromUtf8(const std::string& utf8)
+{
+    const char * const utf8Start = utf8.data();
+    return Utf32FromUtf8(utf8Start, utf8Start + utf8.length());
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-32 to UTF-8.
+//
+// UTF-32 strings are specified using an STL-style [start, finish) range,
+// or std::u32string.
+//
+// On conversion errors (surrogates or values above U+10FFFF in the input
+// string), throws Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::string Utf8FromUtf32(const char32_t* utf32Start, const char32_t* utf32Finish)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(utf32Start <= utf32Finish);
+
+    std::string utf8(detail::Utf8LengthFromUtf32(utf32Start, utf32Finish), '\0');
+    if (!utf8.empty())
+    {
+        detail::ConvertUtf32ToUtf8(utf32Start, utf32Finish, &utf8[0]);
+    }
+    return utf8;
+}
+
+inline std::string Utf8FromUtf32(const std::u32string& utf32)
+{
+    const char32_t * const utf32Start = utf32.data();
+    return Utf8FromUtf32(utf32Start, utf32Start + utf32.length());
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-16 to UTF-32.
+//
+// UTF-16 strings are specified using an STL-style [start, finish) range,
+// or CStringW.
+//
+// On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::u32string Utf32FromUtf16(const Utf16Char* utf16Start, const Utf16Char* utf16Finish)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(utf16Start <= utf16Finish);
+
+    std::u32string utf32(detail::Utf32LengthFromUtf16(utf16Start, utf16Finish), U'\0');
+    if (!utf32.empty())
+    {
+        detail::ConvertUtf16ToUtf32(utf16Start, utf16Finish, &utf32[0]);
+    }
+    return utf32;
+}
+
+inline std::u32string Utf32FromUtf16(const CStringW& utf16)
+{
+    const Utf16Char * const utf16Start = utf16.GetString();
+    return Utf32FromUtf16(utf16Start, utf16Start + utf16.GetLength());
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-32 to UTF-16.
+//
+// UTF-32 strings are specified using an STL-style [start, finish) range,
+// or std::u32string.
+// UTF-16 strings are stored in CStringW.
+//
+// On conversion errors (surrogates or values above U+10FFFF in the input
+// string), throws Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline CStringW Utf16FromUtf32(const char32_t* utf32Start, const char32_t* utf32Finish)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(utf32Start <= utf32Finish);
+
+    CStringW utf16;
+    const int utf16Length = detail::CheckedIntLength(
+        detail::Utf16LengthFromUtf32(utf32Start, utf32Finish));
+    if (utf16Length != 0)
+    {
+        Utf16Char * const utf16Buffer = utf16.GetBuffer(utf16Length);
+        detail::ConvertUtf32ToUtf16(utf32Start, utf32Finish, utf16Buffer);
+        utf16.ReleaseBuffer(utf16Length);
+    }
+    return utf16;
+}
+
+inline CStringW Utf16FromUtf32(const std::u32string& utf32)
+{
+    const char32_t * const utf32Start = utf32.data();
+    return Utf16FromUtf32(utf32Start, utf32Start + utf32.length());
+}
+
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+//------------------------------------------------------------------------------
+// Convert form UTF-16 to UTF-8, for char16_t input with ATL
+// (in portable builds, Utf16Char is char16_t, so Utf8Conv.h already
+// provides this overload).
+//
+// On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::string Utf8FromUtf16(const char16_t* utf16Start, const char16_t* utf16Finish)
+{
+    static_assert(sizeof(char16_t) == sizeof(wchar_t), "wchar_t must be 16 bits wide with ATL.");
+
+    return Utf8FromUtf16(reinterpret_cast<const wchar_t*>(utf16Start),
+                         reinterpret_cast<const wchar_t*>(utf16Finish));
+}
+
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to a wchar_t string: UTF-16 where wchar_t is 16 bits
+// wide (Windows), UTF-32 where it's 32 bits wide (e.g. Linux).
+//
+// UTF-8 strings are specified using an STL-style [start, finish) range,
+// or std::string.
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::wstring WideFromUtf8(const char* utf8Start, const char* utf8Finish)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(utf8Start <= utf8Finish);
+
+    return detail::WideConversion<wchar_t>::FromUtf8(utf8Start, utf8Finish);
+}
+
+inline std::wstring WideFromUtf8(const std::string& utf8)
+{
+    const char * const utf8Start = utf8.data();
+    return WideFromUtf8(utf8Start, utf8Start + utf8.length());
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form a wchar_t string (UTF-16 or UTF-32, depending on the size of
+// wchar_t) to UTF-8.
+//
+// wchar_t strings are specified using an STL-style [start, finish) range,
+// or std::wstring.
+//
+// On conversion errors (e.g. invalid UTF-16 sequence in input string), throws
+// Utf8ConversionException.
+//------------------------------------------------------------------------------
+inline std::string Utf8FromWide(const wchar_t* wideStart, const wchar_t* wideFinish)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(wideStart <= wideFinish);
+
+    return detail::WideConversion<wchar_t>::ToUtf8(wideStart, wideFinish);
+}
+
+inline std::string Utf8FromWide(const std::wstring& wide)
+{
+    const wchar_t * const wideStart = wide.data();
+    return Utf8FromWide(wideStart, wideStart + wide.length());
+}
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8CONVUTF32_H
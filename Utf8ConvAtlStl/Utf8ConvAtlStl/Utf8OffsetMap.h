@@ -0,0 +1,426 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8OFFSETMAP_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8OFFSETMAP_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          UTF-8 <-> UTF-16 Offset Mapping Built During Conversion
+//          =======================================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module providing a variant of Utf16FromUtf8 that, in the same
+// pass over the input, builds a sparse map between UTF-8 byte offsets and
+// UTF-16 code unit offsets.
+//
+// The map stores a checkpoint every 'stride' UTF-8 bytes (64 by default),
+// so translating an offset costs an O(1) (UTF-8 -> UTF-16) or O(log n)
+// (UTF-16 -> UTF-8) lookup, followed by a walk of at most 'stride' bytes.
+// This is useful e.g. for language servers, which receive positions as
+// UTF-16 offsets but keep the text buffers in UTF-8.
+//
+// After an edit of the UTF-8 text, the map can be patched with Splice,
+// walking only the edited region (see Utf16Mirror.h).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Core conversion helpers
+
+#include <algorithm>    // For std::lower_bound, std::upper_bound
+#include <cstddef>      // For std::size_t
+#include <string>       // For std::string
+#include <utility>      // For std::swap
+#include <vector>       // For std::vector
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+//------------------------------------------------------------------------------
+// Sparse map between UTF-8 byte offsets and UTF-16 code unit offsets
+// of the same text.
+//
+// The translation functions require the UTF-8 text the map was built from.
+// Offsets falling inside a multi-unit code point are mapped to the beginning
+// of that code point.
+//------------------------------------------------------------------------------
+class Utf8Utf16OffsetMap
+{
+public:
+
+    // Default distance, in UTF-8 bytes, between two checkpoints
+    static constexpr std::size_t kDefaultStride = 64;
+
+    // Create an empty map, with the given distance between checkpoints
+    explicit Utf8Utf16OffsetMap(std::size_t stride = kDefaultStride)
+        : m_stride(stride)
+        , m_utf8Length(0)
+        , m_utf16Length(0)
+        , m_uniform(true)
+    {
+        ATLASSERT(stride > 0);
+        m_checkpoints.push_back(Checkpoint{ 0, 0 });
+    }
+
+    // Distance, in UTF-8 bytes, between two checkpoints
+    std::size_t Stride() const noexcept
+    {
+        return m_stride;
+    }
+
+    // Length of the mapped text, in UTF-8 bytes
+    std::size_t Utf8Length() const noexcept
+    {
+        return m_utf8Length;
+    }
+
+    // Length of the mapped text, in UTF-16 code units
+    std::size_t Utf16Length() const noexcept
+    {
+        return m_utf16Length;
+    }
+
+    // Translate a UTF-8 byte offset to the corresponding UTF-16 code unit offset.
+    // 'utf8Start' points to the beginning of the UTF-8 text the map was built from.
+    std::size_t Utf16OffsetFromUtf8(const char* utf8Start, std::size_t utf8Offset) const noexcept
+    {
+        ATLASSERT(utf8Offset <= m_utf8Length);
+        if (utf8Offset >= m_utf8Length)
+        {
+            return m_utf16Length;
+        }
+
+        const Checkpoint& checkpoint = FindCheckpointByUtf8(utf8Offset);
+
+        std::size_t utf8 = checkpoint.utf8Offset;
+        std::size_t utf16 = checkpoint.utf16Offset;
+        for (;;)
+        {
+            const std::ptrdiff_t length =
+                detail::Utf8SequenceLength(static_cast<unsigned char>(utf8Start[utf8]));
+            if (utf8 + length > utf8Offset)
+            {
+                return utf16;
+            }
+            utf8 += length;
+            utf16 += (length == 4) ? 2 : 1;
+        }
+    }
+
+    // Translate a UTF-16 code unit offset to the corresponding UTF-8 byte offset.
+    // 'utf8Start' points to the beginning of the UTF-8 text the map was built from.
+    std::size_t Utf8OffsetFromUtf16(const char* utf8Start, std::size_t utf16Offset) const noexcept
+    {
+        ATLASSERT(utf16Offset <= m_utf16Length);
+        if (utf16Offset >= m_utf16Length)
+        {
+            return m_utf8Length;
+        }
+
+        // Binary search for the last checkpoint not past the requested offset
+        auto it = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), utf16Offset,
+            [](std::size_t offset, const Checkpoint& checkpoint)
+            {
+                return offset < checkpoint.utf16Offset;
+            });
+        --it;
+
+        std::size_t utf8 = it->utf8Offset;
+        std::size_t utf16 = it->utf16Offset;
+        for (;;)
+        {
+            const std::ptrdiff_t length =
+                detail::Utf8SequenceLength(static_cast<unsigned char>(utf8Start[utf8]));
+            const std::size_t units = (length == 4) ? 2 : 1;
+            if (utf16 + units > utf16Offset)
+            {
+                return utf8;
+            }
+            utf8 += length;
+            utf16 += units;
+        }
+    }
+
+    //
+    // Update the map after the UTF-8 range [utf8Begin, oldUtf8End) of the mapped
+    // text, corresponding to the UTF-16 range [utf16Begin, oldUtf16End), has been
+    // replaced with new text, ending at newUtf8End and newUtf16End respectively.
+    //
+    // 'utf8Start' points to the beginning of the *new* UTF-8 text, which must be
+    // valid UTF-8; the range boundaries must be at code point boundaries.
+    //
+    // Only the replaced region (plus at most a stride of the following text)
+    // is walked; the checkpoints past it are shifted by the length differences.
+    // If an exception is thrown, the map is left unchanged.
+    //
+    void Splice(const char* utf8Start,
+                std::size_t utf8Begin, std::size_t oldUtf8End, std::size_t newUtf8End,
+                std::size_t utf16Begin, std::size_t oldUtf16End, std::size_t newUtf16End)
+    {
+        ATLASSERT(utf8Begin <= oldUtf8End && utf8Begin <= newUtf8End);
+        ATLASSERT(utf16Begin <= oldUtf16End && utf16Begin <= newUtf16End);
+        ATLASSERT(oldUtf8End <= m_utf8Length && oldUtf16End <= m_utf16Length);
+
+        // Checkpoints in [first, last) are inside the replaced range, and are
+        // regenerated; the ones from 'last' on are kept, shifted
+        const auto byUtf8 = [](const Checkpoint& checkpoint, std::size_t offset)
+        {
+            return checkpoint.utf8Offset < offset;
+        };
+        const auto first = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), utf8Begin,
+            [](std::size_t offset, const Checkpoint& checkpoint)
+            {
+                return offset < checkpoint.utf8Offset;
+            });
+        const auto last = std::lower_bound(first, m_checkpoints.end(), oldUtf8End, byUtf8);
+
+        const std::size_t newUtf8Length = m_utf8Length - oldUtf8End + newUtf8End;
+        const std::size_t newUtf16Length = m_utf16Length - oldUtf16End + newUtf16End;
+
+        // Walk the new text up to the next kept checkpoint (or to the end of text),
+        // to keep the distance between checkpoints bounded by the stride
+        const std::size_t stop = (last != m_checkpoints.end())
+            ? last->utf8Offset - oldUtf8End + newUtf8End
+            : newUtf8Length;
+
+        std::vector<Checkpoint> added;
+        std::size_t previous = (first - 1)->utf8Offset;
+        std::size_t utf8 = utf8Begin;
+        std::size_t utf16 = utf16Begin;
+        while (utf8 < stop)
+        {
+            if (utf8 - previous >= m_stride)
+            {
+                added.push_back(Checkpoint{ utf8, utf16 });
+                previous = utf8;
+            }
+
+            const std::ptrdiff_t length =
+                detail::Utf8SequenceLength(static_cast<unsigned char>(utf8Start[utf8]));
+            utf8 += length;
+            utf16 += (length == 4) ? 2 : 1;
+        }
+
+        // Allocate before touching the checkpoints, so that on failure the map
+        // is left unchanged; the reserve invalidates the iterators
+        const std::size_t firstIndex = first - m_checkpoints.begin();
+        const std::size_t lastIndex = last - m_checkpoints.begin();
+        m_checkpoints.reserve(m_checkpoints.size() - (lastIndex - firstIndex) + added.size());
+
+        // Shift the kept checkpoints, and replace the regenerated ones
+        for (auto it = m_checkpoints.begin() + lastIndex; it != m_checkpoints.end(); ++it)
+        {
+            it->utf8Offset = it->utf8Offset - oldUtf8End + newUtf8End;
+            it->utf16Offset = it->utf16Offset - oldUtf16End + newUtf16End;
+        }
+        const auto insertPos = m_checkpoints.erase(m_checkpoints.begin() + firstIndex,
+                                                   m_checkpoints.begin() + lastIndex);
+        m_checkpoints.insert(insertPos, added.begin(), added.end());
+
+        m_utf8Length = newUtf8Length;
+        m_utf16Length = newUtf16Length;
+
+        // Checkpoints are no longer at multiples of the stride
+        m_uniform = false;
+    }
+
+    // Swap the content of two maps
+    void Swap(Utf8Utf16OffsetMap& other) noexcept
+    {
+        std::swap(m_stride, other.m_stride);
+        std::swap(m_utf8Length, other.m_utf8Length);
+        std::swap(m_utf16Length, other.m_utf16Length);
+        std::swap(m_uniform, other.m_uniform);
+        m_checkpoints.swap(other.m_checkpoints);
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+
+    // Corresponding offsets of a code point boundary in the two encodings
+    struct Checkpoint
+    {
+        std::size_t utf8Offset;
+        std::size_t utf16Offset;
+    };
+
+    // Checkpoints, sorted by offset.
+    // When m_uniform is true (i.e. the map was built by a conversion and never
+    // spliced), checkpoint #k is the last code point boundary at or before
+    // the UTF-8 offset k * m_stride.
+    std::vector<Checkpoint> m_checkpoints;
+
+    std::size_t m_stride;
+    std::size_t m_utf8Length;
+    std::size_t m_utf16Length;
+    bool m_uniform;
+
+    // Last checkpoint at or before the given UTF-8 offset
+    const Checkpoint& FindCheckpointByUtf8(std::size_t utf8Offset) const noexcept
+    {
+        if (m_uniform)
+        {
+            // Direct O(1) lookup
+            return m_checkpoints[utf8Offset / m_stride];
+        }
+
+        auto it = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), utf8Offset,
+            [](std::size_t offset, const Checkpoint& checkpoint)
+            {
+                return offset < checkpoint.utf8Offset;
+            });
+        --it;
+        return *it;
+    }
+
+    // Record the checkpoints falling in the UTF-8 range [utf8Begin, utf8End),
+    // that starts at the UTF-16 offset utf16Begin.
+    // If the range is made by ASCII chars only, every byte is a code point boundary;
+    // else, the range is a single code point.
+    void AddCheckpoints(std::size_t utf8Begin, std::size_t utf8End, std::size_t utf16Begin, bool ascii)
+    {
+        std::size_t next = m_checkpoints.size() * m_stride;
+        while (next < utf8End)
+        {
+            if (ascii)
+            {
+                m_checkpoints.push_back(Checkpoint{ next, utf16Begin + (next - utf8Begin) });
+            }
+            else
+            {
+                m_checkpoints.push_back(Checkpoint{ utf8Begin, utf16Begin });
+            }
+            next += m_stride;
+        }
+    }
+
+    friend CStringW Utf16FromUtf8(const char* utf8Start, const char* utf8Finish,
+                                  Utf8Utf16OffsetMap& offsetMap);
+};
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-16, building the offset map in the same pass.
+//
+// UTF-8 strings are specified using an STL-style [start, finish) range.
+// UTF-16 strings are stored in CStringW.
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException, and the offset map is left unchanged.
+//------------------------------------------------------------------------------
+inline CStringW Utf16FromUtf8(const char* utf8Start, const char* utf8Finish,
+                              Utf8Utf16OffsetMap& offsetMap)
+{
+    // Check input range parameters in debug builds
+    ATLASSERT(utf8Start <= utf8Finish);
+
+    // Build the new map aside, to leave the caller's one untouched on errors
+    Utf8Utf16OffsetMap newMap(offsetMap.Stride());
+
+    // Special case of empty input
+    if (utf8Start == utf8Finish)
+    {
+        offsetMap.Swap(newMap);
+        return CStringW();
+    }
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_entry, utf8Start, utf8Finish - utf8Start);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    detail::TelemetryScope telemetry(detail::kTelemetryUtf16FromUtf8);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    // Safely cast the length of the source UTF-8 string from size_t to int,
+    // as the result is stored in a CStringW
+    const int utf8Length = detail::CheckedIntLength(utf8Finish - utf8Start);
+
+    // Size the destination buffer exactly (this also validates the input)
+    const int utf16Length = detail::Utf16LengthFromUtf8(utf8Start, utf8Length);
+    CStringW utf16;
+    Utf16Char * const utf16Buffer = utf16.GetBuffer(utf16Length);
+    ATLASSERT(utf16Buffer != nullptr);
+
+    Utf16Char * out = utf16Buffer;
+    const char * pos = utf8Start;
+    while (pos != utf8Finish)
+    {
+        // Copy the run of ASCII chars (if any) in bulk
+        const char * const asciiEnd = detail::SkipAsciiUtf8(pos, utf8Finish);
+        if (asciiEnd != pos)
+        {
+            newMap.AddCheckpoints(pos - utf8Start, asciiEnd - utf8Start, out - utf16Buffer, true);
+            while (pos != asciiEnd)
+            {
+                *out++ = static_cast<unsigned char>(*pos++);
+            }
+
+            if (pos == utf8Finish)
+            {
+                break;
+            }
+        }
+
+        // Decode and validate the following non-ASCII code point
+        const char * const codePointStart = pos;
+        const char32_t codePoint = detail::DecodeUtf8(pos, utf8Finish);
+        if (codePoint == detail::kInvalidCodePoint)
+        {
+            throw Utf8ConversionException(
+                "Error in converting from UTF-8 to UTF-16.\n",
+                ERROR_NO_UNICODE_TRANSLATION);
+        }
+
+        newMap.AddCheckpoints(codePointStart - utf8Start, pos - utf8Start, out - utf16Buffer, false);
+        out = detail::EncodeUtf16(codePoint, out);
+    }
+
+    ATLASSERT(out - utf16Buffer == utf16Length);
+    utf16.ReleaseBuffer(utf16Length);
+
+    newMap.m_utf8Length = static_cast<std::size_t>(utf8Length);
+    newMap.m_utf16Length = static_cast<std::size_t>(utf16Length);
+    offsetMap.Swap(newMap);
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+    detail::SampleConversion(ConversionDirection::Utf8ToUtf16, utf8Start, utf8Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+    telemetry.Complete(utf8Length, utf16Length);
+#endif // GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+
+    GIOVANNI_DICANIO_UTF8CONV_PROBE2(utf16_from_utf8_return, utf8Length, utf16Length);
+
+    return utf16;
+}
+
+
+//------------------------------------------------------------------------------
+// Convert form UTF-8 to UTF-16, building the offset map in the same pass.
+//
+// UTF-8 strings are stored using std::string.
+// UTF-16 strings are stored in CStringW.
+//
+// On conversion errors (e.g. invalid UTF-8 sequence in input string), throws
+// Utf8ConversionException, and the offset map is left unchanged.
+//------------------------------------------------------------------------------
+inline CStringW Utf16FromUtf8(const std::string& utf8, Utf8Utf16OffsetMap& offsetMap)
+{
+    // Delegate the conversion to the [start, finish) range overload
+    const char * const utf8Start = utf8.data();
+    const char * const utf8Finish = utf8Start + utf8.length();
+    return Utf16FromUtf8(utf8Start, utf8Finish, offsetMap);
+}
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8OFFSETMAP_H
@@ -0,0 +1,658 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_UTF8ROPE_H
+#define GIOVANNI_DICANIO_INCLUDE_UTF8ROPE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//          Dual-Encoding (UTF-8 / UTF-16) Rope
+//          ===================================
+//
+//                  Copyright (C) by Giovanni Dicanio
+//                   <giovanni.dicanio AT gmail.com>
+//
+// Header-only module providing Utf8Rope, a text container for editors that
+// need to address the same text both as UTF-8 and as UTF-16.
+//
+// The text is stored as UTF-8 chunks (leaves) in a balanced tree (a treap);
+// every node caches the UTF-8 and UTF-16 lengths of its subtree.
+// So inserting, erasing, translating offsets and slicing, by either UTF-8
+// or UTF-16 offsets, costs O(log n) plus the size of the involved text:
+// mutations never require a full Utf16FromUtf8 / Utf8FromUtf16 pass.
+//
+// UTF-16 slices are produced on demand by the conversion functions
+// of Utf8Conv.h.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // Core conversion functions
+
+#include <cstddef>      // For std::size_t
+#include <cstdint>      // For std::uint32_t
+#include <memory>       // For std::unique_ptr
+#include <string>       // For std::string
+#include <utility>      // For std::move
+
+
+namespace GiovanniDicanio
+{
+
+namespace win32
+{
+
+//------------------------------------------------------------------------------
+// Rope storing UTF-8 text, addressable by UTF-8 byte offsets and by UTF-16
+// code unit offsets.
+//
+// Offsets passed to the editing functions must be at code point boundaries.
+// Errors (invalid UTF-8/UTF-16 text, offsets out of range or inside a code point)
+// are signaled throwing Utf8ConversionException; in that case the rope is
+// left unchanged.
+//------------------------------------------------------------------------------
+class Utf8Rope
+{
+public:
+
+    // Maximum size, in bytes, of the UTF-8 chunk stored in a leaf
+    static constexpr std::size_t kMaxChunkLength = 512;
+
+    // Create an empty rope
+    Utf8Rope() noexcept
+        : m_seed(0x9E3779B9)
+    {}
+
+    // Create a rope storing the given UTF-8 text
+    Utf8Rope(const char* utf8Start, const char* utf8Finish)
+        : m_seed(0x9E3779B9)
+    {
+        Insert(0, utf8Start, utf8Finish);
+    }
+
+    // Create a rope storing the given UTF-8 text
+    explicit Utf8Rope(const std::string& utf8)
+        : m_seed(0x9E3779B9)
+    {
+        Insert(0, utf8);
+    }
+
+    // Ropes can be moved, but not copied
+    Utf8Rope(Utf8Rope&&) = default;
+    Utf8Rope& operator=(Utf8Rope&&) = default;
+    Utf8Rope(const Utf8Rope&) = delete;
+    Utf8Rope& operator=(const Utf8Rope&) = delete;
+
+    // Length of the text, in UTF-8 bytes
+    std::size_t Utf8Length() const noexcept
+    {
+        return Utf8LengthOf(m_root);
+    }
+
+    // Length of the text, in UTF-16 code units
+    std::size_t Utf16Length() const noexcept
+    {
+        return Utf16LengthOf(m_root);
+    }
+
+    bool IsEmpty() const noexcept
+    {
+        return !m_root;
+    }
+
+    // Insert UTF-8 text at the given UTF-8 offset
+    void Insert(std::size_t utf8Offset, const char* utf8Start, const char* utf8Finish)
+    {
+        ATLASSERT(utf8Start <= utf8Finish);
+        CheckBoundary(utf8Offset);
+
+        // Validate the inserted text before touching the tree
+        const std::size_t utf16Length = CountUtf16(utf8Start, utf8Finish);
+        if (utf8Start == utf8Finish)
+        {
+            return;
+        }
+
+        // Allocate everything before detaching the tree, so that the rope is left
+        // unchanged if an allocation fails.
+        // Typing usually inserts small pieces: grow the preceding chunk if possible,
+        // reserving its room in advance
+        const std::size_t length = utf8Finish - utf8Start;
+        std::size_t cut = 0;
+        Node * const chunk = FindChunk(utf8Offset, cut);
+        const bool grow = (chunk != nullptr && cut + length <= kMaxChunkLength);
+        NodePtr inserted;
+        if (grow)
+        {
+            chunk->text.reserve(cut + length);
+        }
+        else
+        {
+            inserted = BuildTree(utf8Start, utf8Finish);
+        }
+        NodePtr tail = MakeSplitTail(chunk, cut);
+
+        NodePtr left;
+        NodePtr right;
+        Split(std::move(m_root), utf8Offset, left, right, tail);
+
+        if (grow)
+        {
+            AppendToRightmost(left.get(), utf8Start, utf8Finish, utf16Length);
+        }
+        else
+        {
+            left = Merge(std::move(left), std::move(inserted));
+        }
+
+        m_root = Merge(std::move(left), std::move(right));
+    }
+
+    // Insert UTF-8 text at the given UTF-8 offset
+    void Insert(std::size_t utf8Offset, const std::string& utf8)
+    {
+        const char * const utf8Start = utf8.data();
+        Insert(utf8Offset, utf8Start, utf8Start + utf8.length());
+    }
+
+    // Insert UTF-16 text at the given UTF-16 offset
+    void InsertUtf16(std::size_t utf16Offset, const Utf16Char* utf16Start, const Utf16Char* utf16Finish)
+    {
+        const std::size_t utf8Offset = Utf8OffsetFromUtf16Checked(utf16Offset);
+        const std::string utf8 = Utf8FromUtf16(utf16Start, utf16Finish);
+        Insert(utf8Offset, utf8);
+    }
+
+    // Insert UTF-16 text at the given UTF-16 offset
+    void InsertUtf16(std::size_t utf16Offset, const CStringW& utf16)
+    {
+        const Utf16Char * const utf16Start = utf16.GetString();
+        InsertUtf16(utf16Offset, utf16Start, utf16Start + utf16.GetLength());
+    }
+
+    // Erase the UTF-8 range [utf8Begin, utf8End)
+    void Erase(std::size_t utf8Begin, std::size_t utf8End)
+    {
+        CheckBoundary(utf8Begin);
+        CheckBoundary(utf8End);
+        if (utf8Begin > utf8End)
+        {
+            ThrowInvalidRange();
+        }
+
+        if (utf8Begin == utf8End)
+        {
+            return;
+        }
+
+        // Allocate the chunks split at the range ends before detaching the tree
+        std::size_t beginCut = 0;
+        const Node * const beginChunk = FindChunk(utf8Begin, beginCut);
+        std::size_t endCut = 0;
+        const Node * const endChunk = FindChunk(utf8End, endCut);
+        NodePtr beginTail = MakeSplitTail(beginChunk, beginCut);
+        NodePtr endTail = MakeSplitTail(endChunk, endCut);
+
+        NodePtr left;
+        NodePtr middle;
+        NodePtr right;
+        Split(std::move(m_root), utf8Begin, left, middle, beginTail);
+        Split(std::move(middle), utf8End - utf8Begin, middle, right, endTail);
+        m_root = Merge(std::move(left), std::move(right));
+    }
+
+    // Erase the UTF-16 range [utf16Begin, utf16End)
+    void EraseUtf16(std::size_t utf16Begin, std::size_t utf16End)
+    {
+        const std::size_t utf8Begin = Utf8OffsetFromUtf16Checked(utf16Begin);
+        const std::size_t utf8End = Utf8OffsetFromUtf16Checked(utf16End);
+        Erase(utf8Begin, utf8End);
+    }
+
+    // Translate a UTF-8 byte offset to the corresponding UTF-16 code unit offset.
+    // Offsets inside a code point are mapped to the beginning of that code point.
+    std::size_t Utf16OffsetFromUtf8(std::size_t utf8Offset) const noexcept
+    {
+        ATLASSERT(utf8Offset <= Utf8Length());
+
+        std::size_t utf16 = 0;
+        const Node* node = m_root.get();
+        while (node != nullptr)
+        {
+            const std::size_t leftUtf8 = Utf8LengthOf(node->left);
+            if (utf8Offset < leftUtf8)
+            {
+                node = node->left.get();
+                continue;
+            }
+
+            utf8Offset -= leftUtf8;
+            utf16 += Utf16LengthOf(node->left);
+            if (utf8Offset < node->text.length())
+            {
+                // Walk the chunk up to the requested offset
+                std::size_t pos = 0;
+                for (;;)
+                {
+                    const std::ptrdiff_t length =
+                        detail::Utf8SequenceLength(static_cast<unsigned char>(node->text[pos]));
+                    if (pos + length > utf8Offset)
+                    {
+                        return utf16;
+                    }
+                    pos += length;
+                    utf16 += (length == 4) ? 2 : 1;
+                }
+            }
+
+            utf8Offset -= node->text.length();
+            utf16 += node->textUtf16Length;
+            node = node->right.get();
+        }
+        return utf16;
+    }
+
+    // Translate a UTF-16 code unit offset to the corresponding UTF-8 byte offset.
+    // Offsets inside a surrogate pair are mapped to the beginning of the pair.
+    std::size_t Utf8OffsetFromUtf16(std::size_t utf16Offset) const noexcept
+    {
+        ATLASSERT(utf16Offset <= Utf16Length());
+
+        std::size_t utf8 = 0;
+        const Node* node = m_root.get();
+        while (node != nullptr)
+        {
+            const std::size_t leftUtf16 = Utf16LengthOf(node->left);
+            if (utf16Offset < leftUtf16)
+            {
+                node = node->left.get();
+                continue;
+            }
+
+            utf16Offset -= leftUtf16;
+            utf8 += Utf8LengthOf(node->left);
+            if (utf16Offset < node->textUtf16Length)
+            {
+                // Walk the chunk up to the requested offset
+                std::size_t pos = 0;
+                std::size_t utf16 = 0;
+                for (;;)
+                {
+                    const std::ptrdiff_t length =
+                        detail::Utf8SequenceLength(static_cast<unsigned char>(node->text[pos]));
+                    const std::size_t units = (length == 4) ? 2 : 1;
+                    if (utf16 + units > utf16Offset)
+                    {
+                        return utf8 + pos;
+                    }
+                    pos += length;
+                    utf16 += units;
+                }
+            }
+
+            utf16Offset -= node->textUtf16Length;
+            utf8 += node->text.length();
+            node = node->right.get();
+        }
+        return utf8;
+    }
+
+    // UTF-8 text in the UTF-8 range [utf8Begin, utf8End)
+    std::string Utf8Slice(std::size_t utf8Begin, std::size_t utf8End) const
+    {
+        if (utf8Begin > utf8End || utf8End > Utf8Length())
+        {
+            ThrowInvalidRange();
+        }
+
+        std::string utf8;
+        utf8.reserve(utf8End - utf8Begin);
+        AppendSlice(m_root.get(), utf8Begin, utf8End, utf8);
+        return utf8;
+    }
+
+    // UTF-16 text in the UTF-16 range [utf16Begin, utf16End);
+    // offsets inside a surrogate pair are rejected
+    CStringW Utf16Slice(std::size_t utf16Begin, std::size_t utf16End) const
+    {
+        if (utf16Begin > utf16End)
+        {
+            ThrowInvalidRange();
+        }
+
+        return Utf16FromUtf8(Utf8Slice(Utf8OffsetFromUtf16Checked(utf16Begin),
+                                        Utf8OffsetFromUtf16Checked(utf16End)));
+    }
+
+    // The whole text, in UTF-8
+    std::string ToUtf8() const
+    {
+        return Utf8Slice(0, Utf8Length());
+    }
+
+    // The whole text, in UTF-16
+    CStringW ToUtf16() const
+    {
+        return Utf16FromUtf8(ToUtf8());
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+
+    // Tree node, storing a chunk of UTF-8 text
+    struct Node;
+    typedef std::unique_ptr<Node> NodePtr;
+
+    struct Node
+    {
+        std::string text;               // UTF-8 chunk
+        std::size_t textUtf16Length;    // length of the chunk, in UTF-16 code units
+        std::size_t utf8Length;         // length of the subtree text, in UTF-8 bytes
+        std::size_t utf16Length;        // length of the subtree text, in UTF-16 code units
+        std::uint32_t priority;         // treap heap priority
+        NodePtr left;
+        NodePtr right;
+    };
+
+    NodePtr m_root;
+    std::uint32_t m_seed;   // state of the priority generator
+
+    static std::size_t Utf8LengthOf(const NodePtr& node) noexcept
+    {
+        return node ? node->utf8Length : 0;
+    }
+
+    static std::size_t Utf16LengthOf(const NodePtr& node) noexcept
+    {
+        return node ? node->utf16Length : 0;
+    }
+
+    // Recompute the cached subtree lengths of a node
+    static void Update(Node* node) noexcept
+    {
+        node->utf8Length = Utf8LengthOf(node->left) + node->text.length() + Utf8LengthOf(node->right);
+        node->utf16Length = Utf16LengthOf(node->left) + node->textUtf16Length + Utf16LengthOf(node->right);
+    }
+
+    // Validate the UTF-8 range [start, finish), returning its length in UTF-16 code units
+    static std::size_t CountUtf16(const char* start, const char* finish)
+    {
+        std::size_t count = 0;
+        while (start != finish)
+        {
+            const char * const asciiEnd = detail::SkipAsciiUtf8(start, finish);
+            count += asciiEnd - start;
+            start = asciiEnd;
+            if (start != finish)
+            {
+                const char32_t codePoint = detail::DecodeUtf8(start, finish);
+                if (codePoint == detail::kInvalidCodePoint)
+                {
+                    detail::ThrowInvalidUtf8();
+                }
+                count += (codePoint >= 0x10000) ? 2 : 1;
+            }
+        }
+        return count;
+    }
+
+    [[noreturn]] static void ThrowInvalidRange()
+    {
+        throw Utf8ConversionException(
+            "Invalid rope offset or range.\n",
+            ERROR_INVALID_PARAMETER);
+    }
+
+    // Pseudo-random priority for a new node (xorshift32)
+    std::uint32_t NextPriority() noexcept
+    {
+        m_seed ^= m_seed << 13;
+        m_seed ^= m_seed >> 17;
+        m_seed ^= m_seed << 5;
+        return m_seed;
+    }
+
+    NodePtr MakeNode(std::string text, std::size_t textUtf16Length)
+    {
+        NodePtr node(new Node());
+        node->text = std::move(text);
+        node->textUtf16Length = textUtf16Length;
+        node->priority = NextPriority();
+        Update(node.get());
+        return node;
+    }
+
+    // Build a tree of chunks storing the (already validated) UTF-8 text [start, finish)
+    NodePtr BuildTree(const char* start, const char* finish)
+    {
+        NodePtr tree;
+        while (start != finish)
+        {
+            // Cut the chunk at a code point boundary
+            const char* end = start + kMaxChunkLength;
+            if (end >= finish)
+            {
+                end = finish;
+            }
+            else
+            {
+                while ((static_cast<unsigned char>(*end) & 0xC0) == 0x80)
+                {
+                    --end;
+                }
+            }
+
+            tree = Merge(std::move(tree), MakeNode(std::string(start, end), CountUtf16(start, end)));
+            start = end;
+        }
+        return tree;
+    }
+
+    static NodePtr Merge(NodePtr left, NodePtr right)
+    {
+        if (!left)
+        {
+            return right;
+        }
+        if (!right)
+        {
+            return left;
+        }
+
+        if (left->priority > right->priority)
+        {
+            left->right = Merge(std::move(left->right), std::move(right));
+            Update(left.get());
+            return left;
+        }
+
+        right->left = Merge(std::move(left), std::move(right->left));
+        Update(right.get());
+        return right;
+    }
+
+    // Chunk containing the byte preceding the given UTF-8 offset (nullptr at offset 0),
+    // with the offset relative to the chunk in 'cut'
+    Node* FindChunk(std::size_t utf8Offset, std::size_t& cut) noexcept
+    {
+        Node* node = m_root.get();
+        while (node != nullptr)
+        {
+            const std::size_t leftLength = Utf8LengthOf(node->left);
+            if (utf8Offset <= leftLength)
+            {
+                node = node->left.get();
+            }
+            else if (utf8Offset <= leftLength + node->text.length())
+            {
+                cut = utf8Offset - leftLength;
+                return node;
+            }
+            else
+            {
+                utf8Offset -= leftLength + node->text.length();
+                node = node->right.get();
+            }
+        }
+        return nullptr;
+    }
+
+    // Leaf storing the text of 'chunk' from 'cut' on, if splitting the tree at
+    // that point of the chunk cuts the chunk itself; nullptr otherwise
+    NodePtr MakeSplitTail(const Node* chunk, std::size_t cut)
+    {
+        if (chunk == nullptr || cut == chunk->text.length())
+        {
+            return NodePtr();
+        }
+
+        const char * const text = chunk->text.data();
+        return MakeNode(chunk->text.substr(cut), CountUtf16(text + cut, text + chunk->text.length()));
+    }
+
+    //
+    // Split a tree in the text before and after the given UTF-8 offset.
+    // If the offset is inside a chunk, 'tail' must be the leaf made for it by
+    // MakeSplitTail: so splitting doesn't allocate, and can't fail.
+    //
+    static void Split(NodePtr node, std::size_t utf8Offset, NodePtr& left, NodePtr& right,
+                      NodePtr& tail) noexcept
+    {
+        if (!node)
+        {
+            left.reset();
+            right.reset();
+            return;
+        }
+
+        const std::size_t leftLength = Utf8LengthOf(node->left);
+        const std::size_t textLength = node->text.length();
+        if (utf8Offset <= leftLength)
+        {
+            Split(std::move(node->left), utf8Offset, left, node->left, tail);
+            Update(node.get());
+            right = std::move(node);
+        }
+        else if (utf8Offset >= leftLength + textLength)
+        {
+            Split(std::move(node->right), utf8Offset - leftLength - textLength, node->right, right, tail);
+            Update(node.get());
+            left = std::move(node);
+        }
+        else
+        {
+            // Split the chunk itself, moving its end to the prepared tail leaf
+            ATLASSERT(tail && tail->text.length() == textLength - (utf8Offset - leftLength));
+            node->text.erase(utf8Offset - leftLength);
+            node->textUtf16Length -= tail->textUtf16Length;
+
+            NodePtr nodeRight = std::move(node->right);
+            Update(node.get());
+            left = std::move(node);
+            right = Merge(std::move(tail), std::move(nodeRight));
+        }
+    }
+
+    // Append validated UTF-8 text to the rightmost chunk of a tree
+    // (which doesn't allocate, if the room was reserved)
+    static void AppendToRightmost(Node* node, const char* start, const char* finish, std::size_t utf16Length)
+    {
+        if (node->right)
+        {
+            AppendToRightmost(node->right.get(), start, finish, utf16Length);
+        }
+        else
+        {
+            node->text.append(start, finish);
+            node->textUtf16Length += utf16Length;
+        }
+        Update(node);
+    }
+
+    // Append to 'utf8' the text of the subtree in the range [begin, end)
+    static void AppendSlice(const Node* node, std::size_t begin, std::size_t end, std::string& utf8)
+    {
+        if (node == nullptr || begin >= end)
+        {
+            return;
+        }
+
+        const std::size_t leftLength = Utf8LengthOf(node->left);
+        const std::size_t textLength = node->text.length();
+        if (begin < leftLength)
+        {
+            AppendSlice(node->left.get(), begin, (end < leftLength) ? end : leftLength, utf8);
+        }
+
+        if (end > leftLength && begin < leftLength + textLength)
+        {
+            const std::size_t from = (begin > leftLength) ? begin - leftLength : 0;
+            const std::size_t to = (end < leftLength + textLength) ? end - leftLength : textLength;
+            utf8.append(node->text, from, to - from);
+        }
+
+        if (end > leftLength + textLength)
+        {
+            const std::size_t skipped = leftLength + textLength;
+            AppendSlice(node->right.get(),
+                        (begin > skipped) ? begin - skipped : 0,
+                        end - skipped,
+                        utf8);
+        }
+    }
+
+    // Throw if the UTF-8 offset is out of range or inside a code point
+    void CheckBoundary(std::size_t utf8Offset) const
+    {
+        if (utf8Offset > Utf8Length())
+        {
+            ThrowInvalidRange();
+        }
+
+        const Node* node = m_root.get();
+        while (node != nullptr)
+        {
+            const std::size_t leftLength = Utf8LengthOf(node->left);
+            if (utf8Offset < leftLength)
+            {
+                node = node->left.get();
+            }
+            else if (utf8Offset < leftLength + node->text.length())
+            {
+                const unsigned char byte = node->text[utf8Offset - leftLength];
+                if ((byte & 0xC0) == 0x80)
+                {
+                    ThrowInvalidRange();
+                }
+                return;
+            }
+            else
+            {
+                utf8Offset -= leftLength + node->text.length();
+                node = node->right.get();
+            }
+        }
+    }
+
+    // Translate a UTF-16 offset, throwing if out of range or inside a surrogate pair
+    std::size_t Utf8OffsetFromUtf16Checked(std::size_t utf16Offset) const
+    {
+        if (utf16Offset > Utf16Length())
+        {
+            ThrowInvalidRange();
+        }
+
+        const std::size_t utf8Offset = Utf8OffsetFromUtf16(utf16Offset);
+        if (Utf16OffsetFromUtf8(utf8Offset) != utf16Offset)
+        {
+            ThrowInvalidRange();
+        }
+        return utf8Offset;
+    }
+};
+
+
+} // namespace win32
+
+} // namespace GiovanniDicanio
+
+#endif // GIOVANNI_DICANIO_INCLUDE_UTF8ROPE_H
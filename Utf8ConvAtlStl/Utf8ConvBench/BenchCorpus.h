@@ -0,0 +1,233 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_BENCHCORPUS_H
+#define GIOVANNI_DICANIO_INCLUDE_BENCHCORPUS_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// BenchCorpus.h -- Copyright (C) by Giovanni Dicanio
+//
+// Deterministic generation of UTF-8 text corpora for the benchmarks.
+//
+// Each corpus mimics running text in a given script: words of letters from
+// the script's alphabet, separated by ASCII spaces and punctuation (or, for
+// CJK, by ideographic punctuation only). The same corpus kind and length
+// always produce the same text, on every platform.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // For detail::EncodeUtf8
+
+#include <cstddef>      // For std::size_t
+#include <cstdint>      // For std::uint32_t, std::uint64_t
+#include <cstring>      // For std::strcmp
+#include <string>       // For std::string
+
+
+namespace bench
+{
+
+enum class CorpusKind
+{
+    Ascii,
+    Latin1,
+    Cyrillic,
+    Cjk,
+    Emoji,
+    Mixed
+};
+
+struct CorpusInfo
+{
+    CorpusKind  kind;
+    const char* name;
+};
+
+// All the available corpora, in report order
+constexpr CorpusInfo kCorpora[] =
+{
+    { CorpusKind::Ascii,    "ascii"    },
+    { CorpusKind::Latin1,   "latin1"   },
+    { CorpusKind::Cyrillic, "cyrillic" },
+    { CorpusKind::Cjk,      "cjk"      },
+    { CorpusKind::Emoji,    "emoji"    },
+    { CorpusKind::Mixed,    "mixed"    },
+};
+
+// Find a corpus by name; returns nullptr if not found
+inline const CorpusInfo* FindCorpus(const char* name)
+{
+    for (const CorpusInfo& corpus : kCorpora)
+    {
+        if (std::strcmp(corpus.name, name) == 0)
+        {
+            return &corpus;
+        }
+    }
+    return nullptr;
+}
+
+
+//------------------------------------------------------------------------------
+// Small, fast pseudo-random generator (xorshift64*), with the same output
+// sequence on every platform (unlike the std:: distributions).
+//------------------------------------------------------------------------------
+class Random
+{
+public:
+    explicit Random(std::uint64_t seed) noexcept
+        : m_state(seed != 0 ? seed : 0x9E3779B97F4A7C15ull)
+    {}
+
+    std::uint32_t Next() noexcept
+    {
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        return static_cast<std::uint32_t>((m_state * 0x2545F4914F6CDD1Dull) >> 32);
+    }
+
+    // Uniform value in [0, bound)
+    std::uint32_t Below(std::uint32_t bound) noexcept
+    {
+        return static_cast<std::uint32_t>((static_cast<std::uint64_t>(Next()) * bound) >> 32);
+    }
+
+    // Uniform value in [first, last]
+    char32_t Between(char32_t first, char32_t last) noexcept
+    {
+        return first + Below(static_cast<std::uint32_t>(last - first + 1));
+    }
+
+private:
+    std::uint64_t m_state;
+};
+
+
+namespace detail
+{
+
+inline void AppendCodePoint(std::string& text, char32_t codePoint)
+{
+    char buffer[4];
+    const char* const end = GiovanniDicanio::win32::detail::EncodeUtf8(codePoint, buffer);
+    text.append(buffer, static_cast<std::size_t>(end - buffer));
+}
+
+// Letter of a word in the given script ('initial' for the first letter of a sentence)
+inline char32_t NextLetter(CorpusKind kind, Random& random, bool initial)
+{
+    switch (kind)
+    {
+    case CorpusKind::Latin1:
+        // About one letter in six is accented (as in French or German text)
+        if (random.Below(6) == 0)
+        {
+            const char32_t letter = random.Between(0xC0, 0xFF);
+            // Skip the multiplication and division signs
+            return (letter == 0xD7 || letter == 0xF7) ? 0xE9 : letter;
+        }
+        return initial ? random.Between('A', 'Z') : random.Between('a', 'z');
+
+    case CorpusKind::Cyrillic:
+        return initial ? random.Between(0x0410, 0x042F) : random.Between(0x0430, 0x044F);
+
+    case CorpusKind::Cjk:
+        return random.Between(0x4E00, 0x9FFF);
+
+    case CorpusKind::Emoji:
+        return random.Between(0x1F300, 0x1F64F);
+
+    case CorpusKind::Ascii:
+    case CorpusKind::Mixed:
+    default:
+        return initial ? random.Between('A', 'Z') : random.Between('a', 'z');
+    }
+}
+
+// Append a word of the given script, followed by its separator
+inline void AppendWord(std::string& text, CorpusKind kind, Random& random, bool& sentenceStart)
+{
+    if (kind == CorpusKind::Cjk)
+    {
+        // No spaces: runs of ideographs ended by an ideographic comma or full stop
+        const std::uint32_t length = 4 + random.Below(16);
+        for (std::uint32_t i = 0; i < length; ++i)
+        {
+            AppendCodePoint(text, NextLetter(kind, random, false));
+        }
+        AppendCodePoint(text, (random.Below(3) == 0) ? 0x3002 : 0x3001);
+        return;
+    }
+
+    const std::uint32_t length = (kind == CorpusKind::Emoji) ? 1 + random.Below(3) : 1 + random.Below(10);
+    for (std::uint32_t i = 0; i < length; ++i)
+    {
+        AppendCodePoint(text, NextLetter(kind, random, sentenceStart && i == 0));
+    }
+
+    sentenceStart = false;
+    const std::uint32_t separator = random.Below(16);
+    if (separator == 0)
+    {
+        text += ".\n";
+        sentenceStart = true;
+    }
+    else if (separator == 1)
+    {
+        text += ". ";
+        sentenceStart = true;
+    }
+    else if (separator == 2)
+    {
+        text += ", ";
+    }
+    else
+    {
+        text += ' ';
+    }
+}
+
+} // namespace detail
+
+
+//------------------------------------------------------------------------------
+// Generate a UTF-8 corpus of the given kind, of at most 'length' bytes (the
+// text is cut at a code point boundary, so it may be a few bytes shorter).
+//------------------------------------------------------------------------------
+inline std::string GenerateUtf8Corpus(CorpusKind kind, std::size_t length)
+{
+    Random random(0x5EED0000u + static_cast<std::uint64_t>(kind));
+
+    std::string text;
+    text.reserve(length + 64);
+
+    // Mixed-script text switches script every few words
+    const CorpusKind mixedScripts[] =
+    {
+        CorpusKind::Ascii, CorpusKind::Latin1, CorpusKind::Cyrillic, CorpusKind::Cjk, CorpusKind::Emoji
+    };
+    CorpusKind script = (kind == CorpusKind::Mixed) ? mixedScripts[0] : kind;
+
+    bool sentenceStart = true;
+    while (text.length() < length)
+    {
+        if (kind == CorpusKind::Mixed && random.Below(4) == 0)
+        {
+            script = mixedScripts[random.Below(5)];
+        }
+        detail::AppendWord(text, script, random, sentenceStart);
+    }
+
+    // Cut at a code point boundary
+    std::size_t end = length;
+    while (end > 0 && (static_cast<unsigned char>(text[end]) & 0xC0) == 0x80)
+    {
+        --end;
+    }
+    text.resize(end);
+    return text;
+}
+
+} // namespace bench
+
+#endif // GIOVANNI_DICANIO_INCLUDE_BENCHCORPUS_H
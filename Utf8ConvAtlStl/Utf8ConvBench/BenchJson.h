@@ -0,0 +1,478 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_BENCHJSON_H
+#define GIOVANNI_DICANIO_INCLUDE_BENCHJSON_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// BenchJson.h -- Copyright (C) by Giovanni Dicanio
+//
+// Minimal JSON support for the benchmark results: quoting strings for
+// writing, and a small parser for reading back baseline files.
+//
+// The parser accepts standard JSON (RFC 8259); \u escapes are decoded to
+// UTF-8, and numbers are read as doubles.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"   // For detail::EncodeUtf8
+
+#include <cstddef>      // For std::size_t
+#include <cstdio>       // For std::snprintf
+#include <cstdlib>      // For std::strtod
+#include <stdexcept>    // For std::runtime_error
+#include <string>       // For std::string
+#include <utility>      // For std::pair
+#include <vector>       // For std::vector
+
+
+namespace bench
+{
+
+//------------------------------------------------------------------------------
+// Quote and escape a string for a JSON document
+//------------------------------------------------------------------------------
+inline std::string JsonQuote(const std::string& text)
+{
+    std::string quoted = "\"";
+    for (char ch : text)
+    {
+        switch (ch)
+        {
+        case '"':  quoted += "\\\""; break;
+        case '\\': quoted += "\\\\"; break;
+        case '\n': quoted += "\\n";  break;
+        case '\r': quoted += "\\r";  break;
+        case '\t': quoted += "\\t";  break;
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20)
+            {
+                char escape[8];
+                std::snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned int>(ch));
+                quoted += escape;
+            }
+            else
+            {
+                quoted += ch;
+            }
+            break;
+        }
+    }
+    quoted += '"';
+    return quoted;
+}
+
+
+//------------------------------------------------------------------------------
+// Parsed JSON value
+//------------------------------------------------------------------------------
+class JsonValue
+{
+public:
+
+    enum class Type
+    {
+        Null,
+        Boolean,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    Type Kind() const noexcept
+    {
+        return m_type;
+    }
+
+    bool IsNumber() const noexcept
+    {
+        return m_type == Type::Number;
+    }
+
+    bool IsString() const noexcept
+    {
+        return m_type == Type::String;
+    }
+
+    bool IsArray() const noexcept
+    {
+        return m_type == Type::Array;
+    }
+
+    bool IsObject() const noexcept
+    {
+        return m_type == Type::Object;
+    }
+
+    bool AsBoolean() const noexcept
+    {
+        return m_boolean;
+    }
+
+    double AsNumber() const noexcept
+    {
+        return m_number;
+    }
+
+    const std::string& AsString() const noexcept
+    {
+        return m_string;
+    }
+
+    // Elements of an array (empty for other types)
+    const std::vector<JsonValue>& Elements() const noexcept
+    {
+        return m_elements;
+    }
+
+    // Member of an object with the given name; returns nullptr if not found
+    const JsonValue* Find(const char* name) const noexcept
+    {
+        for (const auto& member : m_members)
+        {
+            if (member.first == name)
+            {
+                return &member.second;
+            }
+        }
+        return nullptr;
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    friend class JsonParser;
+
+    Type m_type = Type::Null;
+    bool m_boolean = false;
+    double m_number = 0.0;
+    std::string m_string;
+    std::vector<JsonValue> m_elements;
+    std::vector<std::pair<std::string, JsonValue>> m_members;
+};
+
+
+//------------------------------------------------------------------------------
+// Recursive descent JSON parser; throws std::runtime_error on syntax errors.
+//------------------------------------------------------------------------------
+class JsonParser
+{
+public:
+
+    explicit JsonParser(const std::string& text) noexcept
+        : m_text(text)
+        , m_pos(0)
+    {}
+
+    // Parse the whole text as a single JSON value
+    JsonValue Parse()
+    {
+        JsonValue value = ParseValue(0);
+        SkipWhitespace();
+        if (m_pos != m_text.length())
+        {
+            Fail("unexpected characters after the JSON value");
+        }
+        return value;
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    // Nesting limit, to fail cleanly instead of overflowing the stack
+    static constexpr int kMaxDepth = 64;
+
+    const std::string& m_text;
+    std::size_t m_pos;
+
+    [[noreturn]] void Fail(const std::string& message) const
+    {
+        throw std::runtime_error(std::string("Invalid JSON at offset ") + std::to_string(m_pos) + ": " + message);
+    }
+
+    void SkipWhitespace() noexcept
+    {
+        while (m_pos < m_text.length()
+               && (m_text[m_pos] == ' ' || m_text[m_pos] == '\t' || m_text[m_pos] == '\n' || m_text[m_pos] == '\r'))
+        {
+            ++m_pos;
+        }
+    }
+
+    // Skip a comma separating members or elements, if present
+    bool SkipComma() noexcept
+    {
+        SkipWhitespace();
+        if (m_pos < m_text.length() && m_text[m_pos] == ',')
+        {
+            ++m_pos;
+            return true;
+        }
+        return false;
+    }
+
+    bool Match(const char* literal) noexcept
+    {
+        const std::string::size_type length = std::char_traits<char>::length(literal);
+        if (m_text.compare(m_pos, length, literal) == 0)
+        {
+            m_pos += length;
+            return true;
+        }
+        return false;
+    }
+
+    void Expect(char ch)
+    {
+        SkipWhitespace();
+        if (m_pos == m_text.length() || m_text[m_pos] != ch)
+        {
+            Fail(std::string("expected '") + ch + "'");
+        }
+        ++m_pos;
+    }
+
+    JsonValue ParseValue(int depth)
+    {
+        if (depth > kMaxDepth)
+        {
+            Fail("nesting too deep");
+        }
+
+        SkipWhitespace();
+        if (m_pos == m_text.length())
+        {
+            Fail("unexpected end of text");
+        }
+
+        JsonValue value;
+        const char ch = m_text[m_pos];
+        if (ch == '{')
+        {
+            ++m_pos;
+            value.m_type = JsonValue::Type::Object;
+            SkipWhitespace();
+            if (m_pos < m_text.length() && m_text[m_pos] == '}')
+            {
+                ++m_pos;
+                return value;
+            }
+            do
+            {
+                SkipWhitespace();
+                std::string name = ParseString();
+                Expect(':');
+                value.m_members.emplace_back(std::move(name), ParseValue(depth + 1));
+            } while (SkipComma());
+            Expect('}');
+        }
+        else if (ch == '[')
+        {
+            ++m_pos;
+            value.m_type = JsonValue::Type::Array;
+            SkipWhitespace();
+            if (m_pos < m_text.length() && m_text[m_pos] == ']')
+            {
+                ++m_pos;
+                return value;
+            }
+            do
+            {
+                value.m_elements.push_back(ParseValue(depth + 1));
+            } while (SkipComma());
+            Expect(']');
+        }
+        else if (ch == '"')
+        {
+            value.m_type = JsonValue::Type::String;
+            value.m_string = ParseString();
+        }
+        else if (Match("true"))
+        {
+            value.m_type = JsonValue::Type::Boolean;
+            value.m_boolean = true;
+        }
+        else if (Match("false"))
+        {
+            value.m_type = JsonValue::Type::Boolean;
+        }
+        else if (Match("null"))
+        {
+            value.m_type = JsonValue::Type::Null;
+        }
+        else
+        {
+            value.m_type = JsonValue::Type::Number;
+            value.m_number = ParseNumber();
+        }
+        return value;
+    }
+
+    double ParseNumber()
+    {
+        // Validate the JSON number syntax, which is stricter than strtod's
+        const std::size_t start = m_pos;
+        auto digits = [this]()
+        {
+            const std::size_t first = m_pos;
+            while (m_pos < m_text.length() && m_text[m_pos] >= '0' && m_text[m_pos] <= '9')
+            {
+                ++m_pos;
+            }
+            return m_pos > first;
+        };
+        auto next = [this](const char* chars)
+        {
+            return m_pos < m_text.length() && std::char_traits<char>::find(
+                chars, std::char_traits<char>::length(chars), m_text[m_pos]) != nullptr;
+        };
+
+        if (next("-"))
+        {
+            ++m_pos;
+        }
+        if (!digits())
+        {
+            Fail("invalid value");
+        }
+        if (next("."))
+        {
+            ++m_pos;
+            if (!digits())
+            {
+                Fail("invalid number");
+            }
+        }
+        if (next("eE"))
+        {
+            ++m_pos;
+            if (next("+-"))
+            {
+                ++m_pos;
+            }
+            if (!digits())
+            {
+                Fail("invalid number");
+            }
+        }
+
+        return std::strtod(m_text.substr(start, m_pos - start).c_str(), nullptr);
+    }
+
+    unsigned int ParseHex4()
+    {
+        if (m_text.length() - m_pos < 4)
+        {
+            Fail("truncated \\u escape");
+        }
+        unsigned int value = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            const char ch = m_text[m_pos++];
+            value <<= 4;
+            if (ch >= '0' && ch <= '9')
+            {
+                value |= ch - '0';
+            }
+            else if (ch >= 'a' && ch <= 'f')
+            {
+                value |= ch - 'a' + 10;
+            }
+            else if (ch >= 'A' && ch <= 'F')
+            {
+                value |= ch - 'A' + 10;
+            }
+            else
+            {
+                Fail("invalid \\u escape");
+            }
+        }
+        return value;
+    }
+
+    std::string ParseString()
+    {
+        if (m_pos == m_text.length() || m_text[m_pos] != '"')
+        {
+            Fail("expected a string");
+        }
+        ++m_pos;
+
+        std::string result;
+        for (;;)
+        {
+            if (m_pos == m_text.length())
+            {
+                Fail("unterminated string");
+            }
+
+            const char ch = m_text[m_pos++];
+            if (ch == '"')
+            {
+                return result;
+            }
+            if (static_cast<unsigned char>(ch) < 0x20)
+            {
+                Fail("control character in string");
+            }
+            if (ch != '\\')
+            {
+                result += ch;
+                continue;
+            }
+
+            if (m_pos == m_text.length())
+            {
+                Fail("unterminated string");
+            }
+            const char escape = m_text[m_pos++];
+            switch (escape)
+            {
+            case '"':  result += '"';  break;
+            case '\\': result += '\\'; break;
+            case '/':  result += '/';  break;
+            case 'b':  result += '\b'; break;
+            case 'f':  result += '\f'; break;
+            case 'n':  result += '\n'; break;
+            case 'r':  result += '\r'; break;
+            case 't':  result += '\t'; break;
+            case 'u':
+            {
+                char32_t codePoint = ParseHex4();
+                if (codePoint >= 0xD800 && codePoint <= 0xDBFF && Match("\\u"))
+                {
+                    const char32_t low = ParseHex4();
+                    if (low < 0xDC00 || low > 0xDFFF)
+                    {
+                        Fail("invalid surrogate pair");
+                    }
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                if (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+                {
+                    Fail("unpaired surrogate");
+                }
+
+                char buffer[4];
+                const char* const end = GiovanniDicanio::win32::detail::EncodeUtf8(codePoint, buffer);
+                result.append(buffer, static_cast<std::size_t>(end - buffer));
+                break;
+            }
+            default:
+                Fail("invalid escape");
+            }
+        }
+    }
+};
+
+// Parse a JSON document; throws std::runtime_error on syntax errors
+inline JsonValue ParseJson(const std::string& text)
+{
+    return JsonParser(text).Parse();
+}
+
+} // namespace bench
+
+#endif // GIOVANNI_DICANIO_INCLUDE_BENCHJSON_H
@@ -0,0 +1,508 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_BENCHMEASURE_H
+#define GIOVANNI_DICANIO_INCLUDE_BENCHMEASURE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// BenchMeasure.h -- Copyright (C) by Giovanni Dicanio
+//
+// Timing, cycle counting and allocation counting for the benchmarks.
+//
+// Cycles are read from the time-stamp counter on x86/x64: they're reference
+// cycles, ticking at the nominal CPU frequency regardless of turbo or power
+// states. On other architectures, cycle counts are not available.
+//
+// Multi-threaded measurements run the same kind of call on several threads
+// at once, for a fixed time, and report the aggregate totals.
+//
+// Repeated measurements are compared with Welch's t-test, as 95% confidence
+// intervals of the difference of the means.
+//
+// Latencies of single calls are timed with fenced time-stamp counter reads
+// on x86/x64 (converted to nanoseconds with a calibrated frequency), and with
+// steady_clock elsewhere; the overhead of the timer reads is subtracted.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "BenchPerfCounters.h" // Hardware performance counters
+
+#include <algorithm>    // For std::sort, std::min
+#include <atomic>       // For std::atomic
+#include <chrono>       // For std::chrono::steady_clock
+#include <cmath>        // For std::sqrt, std::floor
+#include <cstddef>      // For std::size_t
+#include <cstdint>      // For std::uint64_t
+#include <cstring>      // For std::memcpy
+#include <fstream>      // For std::ifstream
+#include <string>       // For std::string
+#include <thread>       // For std::thread
+#include <vector>       // For std::vector
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>     // For __rdtsc, __rdtscp, _mm_lfence
+#define BENCH_HAS_CYCLE_COUNTER
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>      // For __get_cpuid
+#include <x86intrin.h>  // For __rdtsc, __rdtscp, _mm_lfence
+#define BENCH_HAS_CYCLE_COUNTER
+#endif
+
+
+namespace bench
+{
+
+// Number of memory allocations (operator new calls) done so far by the process
+std::uint64_t AllocationCount() noexcept;
+
+#ifdef BENCH_HAS_CYCLE_COUNTER
+constexpr bool kHasCycleCounter = true;
+
+inline std::uint64_t ReadCycleCounter() noexcept
+{
+    return __rdtsc();
+}
+#else
+constexpr bool kHasCycleCounter = false;
+
+inline std::uint64_t ReadCycleCounter() noexcept
+{
+    return 0;
+}
+#endif // BENCH_HAS_CYCLE_COUNTER
+
+
+// Totals measured over a number of calls of the benchmarked function
+struct Measurement
+{
+    std::uint64_t calls = 0;
+    double        seconds = 0.0;
+    std::uint64_t cycles = 0;
+    std::uint64_t allocations = 0;
+
+    // Hardware events, when counted
+    double        events[kPerfEventCount] = {};
+};
+
+// Add the totals of 'measurement' to 'total'
+inline void Accumulate(Measurement& total, const Measurement& measurement) noexcept
+{
+    total.calls += measurement.calls;
+    total.seconds += measurement.seconds;
+    total.cycles += measurement.cycles;
+    total.allocations += measurement.allocations;
+    for (int event = 0; event < kPerfEventCount; ++event)
+    {
+        total.events[event] += measurement.events[event];
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Call 'call' repeatedly, in batches of doubling size, until at least
+// 'minSeconds' have been spent (and at least once), after a warm-up call.
+// Each call must return a value depending on its result, so that it can't be
+// optimized away.
+// If 'counters' is not null, the hardware events are counted too.
+//------------------------------------------------------------------------------
+template <typename Call>
+Measurement Measure(Call&& call, double minSeconds, const PerfCounters* counters = nullptr)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    volatile std::size_t sink = call();
+
+    Measurement total;
+    std::uint64_t batch = 1;
+    while (total.calls == 0 || total.seconds < minSeconds)
+    {
+        const PerfSnapshot eventsStart = (counters != nullptr) ? counters->Read() : PerfSnapshot();
+        const std::uint64_t allocationsStart = AllocationCount();
+        const std::uint64_t cyclesStart = ReadCycleCounter();
+        const Clock::time_point start = Clock::now();
+
+        for (std::uint64_t i = 0; i < batch; ++i)
+        {
+            sink = sink + call();
+        }
+
+        const Clock::time_point finish = Clock::now();
+        total.cycles += ReadCycleCounter() - cyclesStart;
+        total.allocations += AllocationCount() - allocationsStart;
+        total.seconds += std::chrono::duration<double>(finish - start).count();
+        total.calls += batch;
+
+        if (counters != nullptr)
+        {
+            const PerfSnapshot eventsFinish = counters->Read();
+            for (int event = 0; event < kPerfEventCount; ++event)
+            {
+                total.events[event] += PerfCounters::Delta(eventsStart, eventsFinish, event);
+            }
+        }
+
+        batch *= 2;
+    }
+
+    static_cast<void>(sink);
+    return total;
+}
+
+
+// Totals measured over the calls of all the threads of a multi-threaded run
+struct ThreadedMeasurement
+{
+    std::uint64_t calls = 0;
+    double        seconds = 0.0;
+    std::uint64_t allocations = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// Run calls concurrently on 'threadCount' threads, for about 'minSeconds'.
+//
+// Each thread gets its call from 'makeCall(threadIndex)', so that it owns its
+// inputs and buffers (allocated, and first touched, by that thread), makes a
+// warm-up call, and then waits for the others: all the threads start calling
+// together, and stop after the first call completed past the time limit.
+// As with Measure, each call must return a value depending on its result.
+//------------------------------------------------------------------------------
+template <typename MakeCall>
+ThreadedMeasurement MeasureOnThreads(int threadCount, MakeCall&& makeCall, double minSeconds)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    std::atomic<int> readyCount(0);
+    std::atomic<bool> started(false);
+    std::atomic<bool> stopped(false);
+    std::vector<std::uint64_t> calls(threadCount);
+    std::vector<std::size_t> sinks(threadCount);
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount);
+    for (int threadIndex = 0; threadIndex < threadCount; ++threadIndex)
+    {
+        threads.emplace_back([&, threadIndex]()
+        {
+            auto call = makeCall(threadIndex);
+            std::size_t sink = call();
+
+            readyCount.fetch_add(1, std::memory_order_release);
+            while (!started.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+
+            std::uint64_t count = 0;
+            do
+            {
+                sink += call();
+                ++count;
+            } while (!stopped.load(std::memory_order_relaxed));
+
+            // Written once, at the end: no false sharing while measuring
+            calls[threadIndex] = count;
+            sinks[threadIndex] = sink;
+        });
+    }
+
+    while (readyCount.load(std::memory_order_acquire) < threadCount)
+    {
+        std::this_thread::yield();
+    }
+
+    ThreadedMeasurement total;
+    const std::uint64_t allocationsStart = AllocationCount();
+    const Clock::time_point start = Clock::now();
+    started.store(true, std::memory_order_release);
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(minSeconds));
+    stopped.store(true, std::memory_order_relaxed);
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    total.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    total.allocations = AllocationCount() - allocationsStart;
+
+    volatile std::size_t sink = 0;
+    for (int threadIndex = 0; threadIndex < threadCount; ++threadIndex)
+    {
+        total.calls += calls[threadIndex];
+        sink = sink + sinks[threadIndex];
+    }
+    static_cast<void>(sink);
+    return total;
+}
+
+
+//------------------------------------------------------------------------------
+// Timestamps for timing single calls, in ticks.
+// Read the start timestamp right before the call, and the finish timestamp
+// right after it: the fences keep the call from being reordered around them.
+//------------------------------------------------------------------------------
+#ifdef BENCH_HAS_CYCLE_COUNTER
+inline std::uint64_t ReadStartTimestamp() noexcept
+{
+    _mm_lfence();
+    const std::uint64_t timestamp = __rdtsc();
+    _mm_lfence();
+    return timestamp;
+}
+
+inline std::uint64_t ReadFinishTimestamp() noexcept
+{
+    unsigned int processor;
+    const std::uint64_t timestamp = __rdtscp(&processor);
+    _mm_lfence();
+    return timestamp;
+}
+#else
+inline std::uint64_t ReadStartTimestamp() noexcept
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+inline std::uint64_t ReadFinishTimestamp() noexcept
+{
+    return ReadStartTimestamp();
+}
+#endif // BENCH_HAS_CYCLE_COUNTER
+
+// Timestamp ticks per nanosecond (measured once, on first call)
+inline double TimestampTicksPerNanosecond()
+{
+    static const double ticksPerNanosecond = []()
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        const Clock::time_point start = Clock::now();
+        const std::uint64_t startTicks = ReadStartTimestamp();
+        while (Clock::now() - start < std::chrono::milliseconds(50))
+        {
+        }
+        const std::uint64_t finishTicks = ReadFinishTimestamp();
+        const double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        return static_cast<double>(finishTicks - startTicks) / nanoseconds;
+    }();
+    return ticksPerNanosecond;
+}
+
+// Ticks measured timing an empty code region (measured once, on first call)
+inline std::uint64_t TimestampOverhead()
+{
+    static const std::uint64_t overhead = []()
+    {
+        std::uint64_t minimum = ~std::uint64_t(0);
+        for (int i = 0; i < 10000; ++i)
+        {
+            const std::uint64_t start = ReadStartTimestamp();
+            minimum = (std::min)(minimum, ReadFinishTimestamp() - start);
+        }
+        return minimum;
+    }();
+    return overhead;
+}
+
+
+// Percentiles of a latency distribution, in nanoseconds
+struct LatencyPercentiles
+{
+    double p50 = 0.0;
+    double p99 = 0.0;
+    double p999 = 0.0;
+};
+
+//------------------------------------------------------------------------------
+// Compute the percentiles (nearest-rank) of the given per-call latencies,
+// in timestamp ticks including the timer overhead. Sorts the samples.
+//------------------------------------------------------------------------------
+inline LatencyPercentiles ComputePercentiles(std::vector<std::uint64_t>& samples)
+{
+    LatencyPercentiles percentiles;
+    if (samples.empty())
+    {
+        return percentiles;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    const std::uint64_t overhead = TimestampOverhead();
+    const double ticksPerNanosecond = TimestampTicksPerNanosecond();
+    auto percentile = [&](double fraction)
+    {
+        std::size_t rank = static_cast<std::size_t>(fraction * static_cast<double>(samples.size()));
+        rank = (std::min)(rank, samples.size() - 1);
+        const std::uint64_t ticks = samples[rank] > overhead ? samples[rank] - overhead : 0;
+        return static_cast<double>(ticks) / ticksPerNanosecond;
+    };
+
+    percentiles.p50 = percentile(0.50);
+    percentiles.p99 = percentile(0.99);
+    percentiles.p999 = percentile(0.999);
+    return percentiles;
+}
+
+
+// Mean and variance of a set of samples
+struct SampleStatistics
+{
+    std::size_t count = 0;
+    double      mean = 0.0;
+    double      variance = 0.0;     // Unbiased sample variance
+};
+
+inline SampleStatistics ComputeStatistics(const std::vector<double>& samples)
+{
+    SampleStatistics statistics;
+    statistics.count = samples.size();
+    if (samples.empty())
+    {
+        return statistics;
+    }
+
+    for (double sample : samples)
+    {
+        statistics.mean += sample;
+    }
+    statistics.mean /= static_cast<double>(samples.size());
+
+    if (samples.size() > 1)
+    {
+        for (double sample : samples)
+        {
+            statistics.variance += (sample - statistics.mean) * (sample - statistics.mean);
+        }
+        statistics.variance /= static_cast<double>(samples.size() - 1);
+    }
+    return statistics;
+}
+
+// Two-sided 95% critical value of Student's t distribution
+inline double StudentT95(double degreesOfFreedom) noexcept
+{
+    static const double kCriticalValues[] =
+    {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+         2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+         2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    constexpr int kTableSize = sizeof(kCriticalValues) / sizeof(kCriticalValues[0]);
+
+    // Round the degrees of freedom down, which widens the interval
+    const int rounded = static_cast<int>(std::floor(degreesOfFreedom));
+    if (rounded < 1)
+    {
+        return kCriticalValues[0];
+    }
+    if (rounded <= kTableSize)
+    {
+        return kCriticalValues[rounded - 1];
+    }
+    return (rounded <= 60) ? 2.000 : (rounded <= 120) ? 1.980 : 1.960;
+}
+
+// 95% confidence interval of the difference of two means
+struct DifferenceInterval
+{
+    bool   valid = false;   // Needs at least two samples on each side
+    double difference = 0.0;
+    double low = 0.0;
+    double high = 0.0;
+};
+
+//------------------------------------------------------------------------------
+// Welch's confidence interval of 'current.mean - baseline.mean', which
+// doesn't assume equal variances of the two sets of samples.
+//------------------------------------------------------------------------------
+inline DifferenceInterval ComputeDifferenceInterval(const SampleStatistics& baseline,
+                                                    const SampleStatistics& current)
+{
+    DifferenceInterval interval;
+    interval.difference = current.mean - baseline.mean;
+    if (baseline.count < 2 || current.count < 2)
+    {
+        return interval;
+    }
+
+    const double baselineTerm = baseline.variance / static_cast<double>(baseline.count);
+    const double currentTerm = current.variance / static_cast<double>(current.count);
+    const double standardError = std::sqrt(baselineTerm + currentTerm);
+
+    // Welch-Satterthwaite degrees of freedom
+    double degreesOfFreedom = static_cast<double>(baseline.count + current.count - 2);
+    if (standardError > 0.0)
+    {
+        degreesOfFreedom = (baselineTerm + currentTerm) * (baselineTerm + currentTerm)
+            / (baselineTerm * baselineTerm / static_cast<double>(baseline.count - 1)
+               + currentTerm * currentTerm / static_cast<double>(current.count - 1));
+    }
+
+    const double halfWidth = StudentT95(degreesOfFreedom) * standardError;
+    interval.valid = true;
+    interval.low = interval.difference - halfWidth;
+    interval.high = interval.difference + halfWidth;
+    return interval;
+}
+
+
+//------------------------------------------------------------------------------
+// Model name of the CPU, for reports (empty if unknown)
+//------------------------------------------------------------------------------
+inline std::string CpuModel()
+{
+    std::string model;
+
+#if defined(BENCH_HAS_CYCLE_COUNTER)
+    // Processor brand string, from the extended CPUID leaves
+    unsigned int registers[12] = {};
+    bool available = true;
+    for (unsigned int leaf = 0; leaf < 3 && available; ++leaf)
+    {
+#ifdef _MSC_VER
+        int values[4];
+        __cpuid(values, static_cast<int>(0x80000002u + leaf));
+        std::memcpy(&registers[leaf * 4], values, sizeof(values));
+#else
+        available = __get_cpuid(0x80000002u + leaf, &registers[leaf * 4], &registers[leaf * 4 + 1],
+                                &registers[leaf * 4 + 2], &registers[leaf * 4 + 3]) != 0;
+#endif // _MSC_VER
+    }
+    if (available)
+    {
+        char brand[sizeof(registers) + 1] = {};
+        std::memcpy(brand, registers, sizeof(registers));
+        model = brand;
+    }
+#endif // BENCH_HAS_CYCLE_COUNTER
+
+#ifdef __linux__
+    if (model.empty())
+    {
+        std::ifstream cpuInfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuInfo, line))
+        {
+            if (line.compare(0, 10, "model name") == 0 || line.compare(0, 9, "Processor") == 0)
+            {
+                const std::string::size_type colon = line.find(':');
+                if (colon != std::string::npos)
+                {
+                    model = line.substr(colon + 1);
+                    break;
+                }
+            }
+        }
+    }
+#endif // __linux__
+
+    // Trim the padding spaces
+    const std::string::size_type first = model.find_first_not_of(' ');
+    const std::string::size_type last = model.find_last_not_of(' ');
+    return (first == std::string::npos) ? std::string() : model.substr(first, last - first + 1);
+}
+
+} // namespace bench
+
+#endif // GIOVANNI_DICANIO_INCLUDE_BENCHMEASURE_H
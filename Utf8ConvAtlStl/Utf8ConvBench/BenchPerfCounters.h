@@ -0,0 +1,235 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_BENCHPERFCOUNTERS_H
+#define GIOVANNI_DICANIO_INCLUDE_BENCHPERFCOUNTERS_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// BenchPerfCounters.h -- Copyright (C) by Giovanni Dicanio
+//
+// Hardware performance counters for the benchmarks, read with the Linux
+// perf_event_open system call: cycles, instructions, branch misses,
+// L1 data cache misses and last-level cache misses, counted in user mode
+// for the calling thread.
+//
+// Counters the kernel or the CPU don't support (e.g. in virtual machines,
+// or with a restrictive /proc/sys/kernel/perf_event_paranoid setting) are
+// reported as unavailable; on other platforms, none is available.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <cstdint>      // For std::uint64_t
+#include <string>       // For std::string
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#define BENCH_HAS_PERF_EVENTS
+#endif
+#endif
+
+#ifdef BENCH_HAS_PERF_EVENTS
+#include <cerrno>               // For errno
+#include <cstring>              // For std::strerror
+#include <linux/perf_event.h>   // For perf_event_attr
+#include <sys/syscall.h>        // For SYS_perf_event_open
+#include <unistd.h>             // For syscall, read, close
+#endif // BENCH_HAS_PERF_EVENTS
+
+
+namespace bench
+{
+
+enum PerfEvent
+{
+    kPerfCycles,
+    kPerfInstructions,
+    kPerfBranchMisses,
+    kPerfL1dMisses,
+    kPerfLlcMisses,
+
+    kPerfEventCount
+};
+
+// Short name of the given event, for reports
+inline const char* PerfEventName(int event) noexcept
+{
+    static const char* const names[kPerfEventCount] =
+    {
+        "cycles", "instr", "br-miss", "L1d-miss", "LLC-miss"
+    };
+    return names[event];
+}
+
+// Raw reading of a counter: with multiplexing, a counter runs only for part
+// of the time it's enabled, and its value must be scaled accordingly
+struct PerfReading
+{
+    std::uint64_t value = 0;
+    std::uint64_t timeEnabled = 0;
+    std::uint64_t timeRunning = 0;
+};
+
+// Readings of all the counters at a given time
+struct PerfSnapshot
+{
+    PerfReading readings[kPerfEventCount];
+};
+
+
+//------------------------------------------------------------------------------
+// Set of hardware counters, opened on construction for the calling thread.
+//------------------------------------------------------------------------------
+class PerfCounters
+{
+public:
+
+    PerfCounters()
+    {
+        for (int event = 0; event < kPerfEventCount; ++event)
+        {
+            m_fds[event] = Open(event);
+        }
+    }
+
+    ~PerfCounters()
+    {
+#ifdef BENCH_HAS_PERF_EVENTS
+        for (int fd : m_fds)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+#endif // BENCH_HAS_PERF_EVENTS
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool IsAvailable(int event) const noexcept
+    {
+        return m_fds[event] >= 0;
+    }
+
+    // Is any counter available?
+    bool IsAnyAvailable() const noexcept
+    {
+        for (int fd : m_fds)
+        {
+            if (fd >= 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Why the counters are not available (empty if they are)
+    const std::string& ErrorMessage() const noexcept
+    {
+        return m_error;
+    }
+
+    PerfSnapshot Read() const noexcept
+    {
+        PerfSnapshot snapshot;
+#ifdef BENCH_HAS_PERF_EVENTS
+        for (int event = 0; event < kPerfEventCount; ++event)
+        {
+            if (m_fds[event] >= 0)
+            {
+                std::uint64_t data[3] = {};
+                if (::read(m_fds[event], data, sizeof(data)) == static_cast<ssize_t>(sizeof(data)))
+                {
+                    snapshot.readings[event].value = data[0];
+                    snapshot.readings[event].timeEnabled = data[1];
+                    snapshot.readings[event].timeRunning = data[2];
+                }
+            }
+        }
+#endif // BENCH_HAS_PERF_EVENTS
+        return snapshot;
+    }
+
+    // Count of the given event between two snapshots, scaled for multiplexing
+    static double Delta(const PerfSnapshot& start, const PerfSnapshot& finish, int event) noexcept
+    {
+        const PerfReading& first = start.readings[event];
+        const PerfReading& last = finish.readings[event];
+        const double value = static_cast<double>(last.value - first.value);
+        const std::uint64_t running = last.timeRunning - first.timeRunning;
+        const std::uint64_t enabled = last.timeEnabled - first.timeEnabled;
+        if (running == 0 || running == enabled)
+        {
+            return value;
+        }
+        return value * static_cast<double>(enabled) / static_cast<double>(running);
+    }
+
+
+    // *** PRIVATE IMPLEMENTATION ***
+
+private:
+    int m_fds[kPerfEventCount];
+    std::string m_error;
+
+    int Open(int event)
+    {
+#ifdef BENCH_HAS_PERF_EVENTS
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        const std::uint64_t cacheReadMiss =
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        switch (event)
+        {
+        case kPerfCycles:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+
+        case kPerfInstructions:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+
+        case kPerfBranchMisses:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+
+        case kPerfL1dMisses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | cacheReadMiss;
+            break;
+
+        case kPerfLlcMisses:
+        default:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_LL | cacheReadMiss;
+            break;
+        }
+
+        // This thread, any CPU
+        const long fd = ::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd < 0 && m_error.empty())
+        {
+            m_error = std::string("perf_event_open failed for ") + PerfEventName(event)
+                + ": " + std::strerror(errno);
+        }
+        return static_cast<int>(fd);
+#else
+        static_cast<void>(event);
+        m_error = "hardware counters are only supported on Linux";
+        return -1;
+#endif // BENCH_HAS_PERF_EVENTS
+    }
+};
+
+} // namespace bench
+
+#endif // GIOVANNI_DICANIO_INCLUDE_BENCHPERFCOUNTERS_H
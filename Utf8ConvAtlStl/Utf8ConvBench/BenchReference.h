@@ -0,0 +1,472 @@
+#ifndef GIOVANNI_DICANIO_INCLUDE_BENCHREFERENCE_H
+#define GIOVANNI_DICANIO_INCLUDE_BENCHREFERENCE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// BenchReference.h -- Copyright (C) by Giovanni Dicanio
+//
+// Reference UTF-8 <-> UTF-16 conversion engines, to compare the library's
+// conversion functions with on the same machine and the same corpora:
+//
+//  - naive:    a simple scalar decoder/encoder, one code point at a time,
+//              written independently of the library's kernels;
+//  - codecvt:  the standard std::codecvt<char16_t, char, std::mbstate_t>
+//              facet (UTF-8 <-> UTF-16, independent of the locale);
+//  - mbrtoc16: the C11 mbrtoc16/c16rtomb functions, in a UTF-8 locale;
+//  - iconv:    the POSIX iconv API (e.g. glibc's), where available.
+//
+// All the engines return their results in new strings, as the library's
+// functions do, and report invalid input (or unavailable conversions)
+// returning false.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <climits>      // For MB_LEN_MAX
+#include <clocale>      // For std::setlocale
+#include <cstddef>      // For std::size_t
+#include <cwchar>       // For std::mbstate_t
+#include <locale>       // For std::codecvt, std::locale
+#include <string>       // For std::string, std::u16string
+
+#if defined(__has_include)
+#if __has_include(<cuchar>)
+#include <cuchar>       // For std::mbrtoc16, std::c16rtomb
+#define BENCH_HAS_CUCHAR
+#endif
+#if __has_include(<iconv.h>) && !defined(_WIN32)
+#include <iconv.h>      // For iconv_open, iconv, iconv_close
+#define BENCH_HAS_ICONV
+#endif
+#endif // __has_include
+
+
+namespace bench
+{
+
+struct ReferenceEngine
+{
+    const char* name;
+
+    // Is the engine usable on this machine?
+    bool (*isAvailable)();
+
+    // Conversions: return false on invalid input or conversion failure
+    bool (*utf16FromUtf8)(const std::string& utf8, std::u16string& utf16);
+    bool (*utf8FromUtf16)(const std::u16string& utf16, std::string& utf8);
+};
+
+
+namespace detail
+{
+
+//------------------------------------------------------------------------------
+// Naive scalar engine
+//------------------------------------------------------------------------------
+
+inline bool AlwaysAvailable()
+{
+    return true;
+}
+
+inline bool NaiveUtf16FromUtf8(const std::string& utf8, std::u16string& utf16)
+{
+    utf16.clear();
+    utf16.reserve(utf8.length());
+
+    std::size_t pos = 0;
+    while (pos < utf8.length())
+    {
+        const unsigned char lead = static_cast<unsigned char>(utf8[pos]);
+        std::size_t length = 0;
+        char32_t codePoint = 0;
+        char32_t minimum = 0;
+        if (lead < 0x80)
+        {
+            length = 1;
+            codePoint = lead;
+        }
+        else if ((lead & 0xE0) == 0xC0)
+        {
+            length = 2;
+            codePoint = lead & 0x1F;
+            minimum = 0x80;
+        }
+        else if ((lead & 0xF0) == 0xE0)
+        {
+            length = 3;
+            codePoint = lead & 0x0F;
+            minimum = 0x800;
+        }
+        else if ((lead & 0xF8) == 0xF0)
+        {
+            length = 4;
+            codePoint = lead & 0x07;
+            minimum = 0x10000;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (utf8.length() - pos < length)
+        {
+            return false;
+        }
+        for (std::size_t i = 1; i < length; ++i)
+        {
+            const unsigned char trail = static_cast<unsigned char>(utf8[pos + i]);
+            if ((trail & 0xC0) != 0x80)
+            {
+                return false;
+            }
+            codePoint = (codePoint << 6) | (trail & 0x3F);
+        }
+
+        // Overlong sequences, surrogates, and values above U+10FFFF
+        if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+        {
+            return false;
+        }
+        pos += length;
+
+        if (codePoint < 0x10000)
+        {
+            utf16.push_back(static_cast<char16_t>(codePoint));
+        }
+        else
+        {
+            utf16.push_back(static_cast<char16_t>(0xD800 + ((codePoint - 0x10000) >> 10)));
+            utf16.push_back(static_cast<char16_t>(0xDC00 + ((codePoint - 0x10000) & 0x3FF)));
+        }
+    }
+    return true;
+}
+
+inline bool NaiveUtf8FromUtf16(const std::u16string& utf16, std::string& utf8)
+{
+    utf8.clear();
+    utf8.reserve(utf16.length() * 3);
+
+    std::size_t pos = 0;
+    while (pos < utf16.length())
+    {
+        char32_t codePoint = utf16[pos++];
+        if (codePoint >= 0xD800 && codePoint <= 0xDBFF)
+        {
+            if (pos == utf16.length() || utf16[pos] < 0xDC00 || utf16[pos] > 0xDFFF)
+            {
+                return false;
+            }
+            codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (utf16[pos++] - 0xDC00);
+        }
+        else if (codePoint >= 0xDC00 && codePoint <= 0xDFFF)
+        {
+            return false;
+        }
+
+        if (codePoint < 0x80)
+        {
+            utf8.push_back(static_cast<char>(codePoint));
+        }
+        else if (codePoint < 0x800)
+        {
+            utf8.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+            utf8.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else if (codePoint < 0x10000)
+        {
+            utf8.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+            utf8.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            utf8.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else
+        {
+            utf8.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+            utf8.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+            utf8.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            utf8.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// std::codecvt engine
+//------------------------------------------------------------------------------
+
+// The char16_t facet is deprecated in C++20 (in favor of the char8_t one),
+// but it's still the one standard facet converting char strings
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#elif defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable : 4996)
+#endif
+
+typedef std::codecvt<char16_t, char, std::mbstate_t> Utf16Codecvt;
+
+inline const Utf16Codecvt& GetUtf16Codecvt()
+{
+    static const Utf16Codecvt& facet = std::use_facet<Utf16Codecvt>(std::locale::classic());
+    return facet;
+}
+
+inline bool CodecvtUtf16FromUtf8(const std::string& utf8, std::u16string& utf16)
+{
+    utf16.resize(utf8.length());
+
+    std::mbstate_t state = std::mbstate_t();
+    const char* fromNext = nullptr;
+    char16_t* toNext = nullptr;
+    const std::codecvt_base::result result = GetUtf16Codecvt().in(
+        state, utf8.data(), utf8.data() + utf8.length(), fromNext,
+        &utf16[0], &utf16[0] + utf16.length(), toNext);
+
+    utf16.resize(static_cast<std::size_t>(toNext - utf16.data()));
+    return result == std::codecvt_base::ok
+        || (result == std::codecvt_base::noconv && utf8.empty());
+}
+
+inline bool CodecvtUtf8FromUtf16(const std::u16string& utf16, std::string& utf8)
+{
+    utf8.resize(utf16.length() * 3);
+
+    std::mbstate_t state = std::mbstate_t();
+    const char16_t* fromNext = nullptr;
+    char* toNext = nullptr;
+    const std::codecvt_base::result result = GetUtf16Codecvt().out(
+        state, utf16.data(), utf16.data() + utf16.length(), fromNext,
+        &utf8[0], &utf8[0] + utf8.length(), toNext);
+
+    utf8.resize(static_cast<std::size_t>(toNext - utf8.data()));
+    return result == std::codecvt_base::ok
+        || (result == std::codecvt_base::noconv && utf16.empty());
+}
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#elif defined(_MSC_VER)
+#pragma warning(pop)
+#endif
+
+
+//------------------------------------------------------------------------------
+// mbrtoc16/c16rtomb engine
+//------------------------------------------------------------------------------
+
+#ifdef BENCH_HAS_CUCHAR
+
+// Switch the C library to a UTF-8 locale for multibyte characters (once)
+inline bool IsUtf8LocaleAvailable()
+{
+    static const bool available = []()
+    {
+        const char* const names[] = { "C.UTF-8", "C.utf8", "en_US.UTF-8", ".UTF-8" };
+        for (const char* name : names)
+        {
+            if (std::setlocale(LC_CTYPE, name) != nullptr)
+            {
+                return true;
+            }
+        }
+        return false;
+    }();
+    return available;
+}
+
+inline bool Mbrtoc16Utf16FromUtf8(const std::string& utf8, std::u16string& utf16)
+{
+    utf16.clear();
+    utf16.reserve(utf8.length());
+
+    std::mbstate_t state = std::mbstate_t();
+    const char* pos = utf8.data();
+    const char* const finish = utf8.data() + utf8.length();
+    while (pos < finish)
+    {
+        char16_t codeUnit = 0;
+        const std::size_t result = std::mbrtoc16(&codeUnit, pos, static_cast<std::size_t>(finish - pos), &state);
+        if (result == static_cast<std::size_t>(-1) || result == static_cast<std::size_t>(-2))
+        {
+            return false;
+        }
+
+        utf16.push_back(codeUnit);
+        pos += (result == 0) ? 1 : result;   // 0: a NUL character was read
+
+        if (codeUnit >= 0xD800 && codeUnit <= 0xDBFF)
+        {
+            // The low surrogate is returned by the next call, without reading input
+            if (std::mbrtoc16(&codeUnit, pos, 0, &state) != static_cast<std::size_t>(-3))
+            {
+                return false;
+            }
+            utf16.push_back(codeUnit);
+        }
+    }
+    return true;
+}
+
+inline bool C16rtombUtf8FromUtf16(const std::u16string& utf16, std::string& utf8)
+{
+    utf8.clear();
+    utf8.reserve(utf16.length() * 3);
+
+    std::mbstate_t state = std::mbstate_t();
+    char buffer[MB_LEN_MAX];
+    for (char16_t codeUnit : utf16)
+    {
+        const std::size_t result = std::c16rtomb(buffer, codeUnit, &state);
+        if (result == static_cast<std::size_t>(-1))
+        {
+            return false;
+        }
+        utf8.append(buffer, result);
+    }
+    return true;
+}
+
+#endif // BENCH_HAS_CUCHAR
+
+
+//------------------------------------------------------------------------------
+// iconv engine
+//------------------------------------------------------------------------------
+
+#ifdef BENCH_HAS_ICONV
+
+// Name of the UTF-16 encoding in native byte order, without byte order mark
+inline const char* NativeUtf16Name()
+{
+    const char16_t probe = 1;
+    return (*reinterpret_cast<const unsigned char*>(&probe) == 1) ? "UTF-16LE" : "UTF-16BE";
+}
+
+// Conversion descriptor, opened once and reused by all the conversions
+class IconvHandle
+{
+public:
+    IconvHandle(const char* to, const char* from) noexcept
+        : m_handle(::iconv_open(to, from))
+    {}
+
+    ~IconvHandle()
+    {
+        if (IsOpen())
+        {
+            ::iconv_close(m_handle);
+        }
+    }
+
+    IconvHandle(const IconvHandle&) = delete;
+    IconvHandle& operator=(const IconvHandle&) = delete;
+
+    bool IsOpen() const noexcept
+    {
+        return m_handle != reinterpret_cast<iconv_t>(-1);
+    }
+
+    // Convert 'inputBytes' bytes into at most 'outputBytes' bytes; returns the
+    // number of bytes written, or -1 on failure
+    std::ptrdiff_t Convert(const void* input, std::size_t inputBytes, void* output, std::size_t outputBytes) noexcept
+    {
+        if (!IsOpen())
+        {
+            return -1;
+        }
+
+        // Reset the conversion state
+        ::iconv(m_handle, nullptr, nullptr, nullptr, nullptr);
+
+        char* in = static_cast<char*>(const_cast<void*>(input));
+        char* out = static_cast<char*>(output);
+        std::size_t outLeft = outputBytes;
+        if (::iconv(m_handle, &in, &inputBytes, &out, &outLeft) == static_cast<std::size_t>(-1))
+        {
+            return -1;
+        }
+        return static_cast<std::ptrdiff_t>(outputBytes - outLeft);
+    }
+
+private:
+    iconv_t m_handle;
+};
+
+inline IconvHandle& Utf8ToUtf16Iconv()
+{
+    static IconvHandle handle(NativeUtf16Name(), "UTF-8");
+    return handle;
+}
+
+inline IconvHandle& Utf16ToUtf8Iconv()
+{
+    static IconvHandle handle("UTF-8", NativeUtf16Name());
+    return handle;
+}
+
+inline bool IsIconvAvailable()
+{
+    return Utf8ToUtf16Iconv().IsOpen() && Utf16ToUtf8Iconv().IsOpen();
+}
+
+inline bool IconvUtf16FromUtf8(const std::string& utf8, std::u16string& utf16)
+{
+    utf16.resize(utf8.length());
+    const std::ptrdiff_t bytes = Utf8ToUtf16Iconv().Convert(
+        utf8.data(), utf8.length(), &utf16[0], utf16.length() * sizeof(char16_t));
+    if (bytes < 0)
+    {
+        return false;
+    }
+    utf16.resize(static_cast<std::size_t>(bytes) / sizeof(char16_t));
+    return true;
+}
+
+inline bool IconvUtf8FromUtf16(const std::u16string& utf16, std::string& utf8)
+{
+    utf8.resize(utf16.length() * 3);
+    const std::ptrdiff_t bytes = Utf16ToUtf8Iconv().Convert(
+        utf16.data(), utf16.length() * sizeof(char16_t), &utf8[0], utf8.length());
+    if (bytes < 0)
+    {
+        return false;
+    }
+    utf8.resize(static_cast<std::size_t>(bytes));
+    return true;
+}
+
+#endif // BENCH_HAS_ICONV
+
+} // namespace detail
+
+
+// All the reference engines, in report order (engines not compiled in have
+// null conversion functions)
+constexpr ReferenceEngine kReferenceEngines[] =
+{
+    { "naive", &detail::AlwaysAvailable, &detail::NaiveUtf16FromUtf8, &detail::NaiveUtf8FromUtf16 },
+    { "codecvt", &detail::AlwaysAvailable, &detail::CodecvtUtf16FromUtf8, &detail::CodecvtUtf8FromUtf16 },
+#ifdef BENCH_HAS_CUCHAR
+    { "mbrtoc16", &detail::IsUtf8LocaleAvailable, &detail::Mbrtoc16Utf16FromUtf8, &detail::C16rtombUtf8FromUtf16 },
+#else
+    { "mbrtoc16", nullptr, nullptr, nullptr },
+#endif // BENCH_HAS_CUCHAR
+#ifdef BENCH_HAS_ICONV
+    { "iconv", &detail::IsIconvAvailable, &detail::IconvUtf16FromUtf8, &detail::IconvUtf8FromUtf16 },
+#else
+    { "iconv", nullptr, nullptr, nullptr },
+#endif // BENCH_HAS_ICONV
+};
+
+// Is the given engine compiled in, and usable on this machine?
+inline bool IsReferenceEngineAvailable(const ReferenceEngine& engine)
+{
+    return engine.isAvailable != nullptr && engine.isAvailable();
+}
+
+} // namespace bench
+
+#endif // GIOVANNI_DICANIO_INCLUDE_BENCHREFERENCE_H
@@ -0,0 +1,2077 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Utf8ConvBench.cpp -- Copyright (C) by Giovanni Dicanio
+//
+// Benchmarks for the UTF-8 encoding conversion functions.
+//
+// Runs Utf16FromUtf8 and Utf8FromUtf16 over generated text corpora (see
+// BenchCorpus.h), for string lengths from 8 bytes to 64 MB, and reports:
+//
+//  - throughput, in GB/s (10^9 bytes per second) of UTF-8 text, for both
+//    conversion directions;
+//  - cycles per UTF-8 byte (reference cycles, see BenchMeasure.h);
+//  - memory allocations per call.
+//
+// Allocations are counted replacing the global operator new: with ATL,
+// CStringW allocates through the CRT heap directly, so the UTF-16 results
+// of Utf16FromUtf8 are not counted.
+//
+// With --perf, it also reads the hardware performance counters (see
+// BenchPerfCounters.h) around each measured loop, including loops over the
+// single conversion kernels, and reports them per byte and per code point.
+//
+// With --scaling, it runs the conversions on 1 to N threads at once, both
+// returning new strings and converting into caller-provided buffers, and
+// reports the aggregate throughput and the scaling efficiency, next to the
+// memory bandwidth measured copying with memcpy on the same threads.
+//
+// With --json=FILE, it also writes the results to a JSON file; with
+// --compare=FILE, it compares them with a baseline written by --json, and
+// flags the statistically significant slowdowns. In both cases, all the
+// conversion overloads of Utf8Conv.h are measured, and each case is repeated
+// (5 times by default) to estimate the run-to-run variation.
+//
+// With --reference, it runs the same corpora through reference conversion
+// engines (see BenchReference.h), and reports their throughput side by side
+// with the library's; each result is cross-checked first, and no throughput
+// is reported for wrong results.
+//
+// With --adaptive, it compares the ASCII and multibyte kernels of
+// AdaptiveConverter (see Utf8ConvAdaptive.h), pinned and chosen adaptively,
+// on each corpus, and on traffic alternating phases of ASCII and CJK text.
+//
+// With --replay=FILE, it replays the conversions of a workload trace (see
+// Utf8ConvTrace.h), reporting the trace's histograms and the throughput of
+// its conversions, by direction and script class; --write-trace=FILE writes
+// a synthetic trace from the corpora, to try the replay.
+//
+// With --latency, it measures instead the per-call latency distributions
+// (p50, p99, p99.9) of conversions of tiny strings (5 to 50 bytes), with
+// warm caches and with cold inputs, breaking out the cost of the steps of
+// the conversion functions.
+//
+// Run with --help for the available options.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "Utf8Conv.h"       // UTF-8 conversion functions to benchmark
+#include "BenchCorpus.h"    // Generated text corpora
+#include "BenchJson.h"      // JSON export and baseline parsing
+#include "BenchMeasure.h"   // Timing and allocation counting
+#include "BenchReference.h" // Reference conversion engines
+#include "Utf8ConvTrace.h"  // Workload traces
+#include "Utf8ConvAdaptive.h" // Adaptive kernel selection
+#include <algorithm>        // For std::min, std::max
+#include <atomic>           // For std::atomic
+#include <cstdint>          // For std::uint64_t
+#include <cstdio>           // For std::printf, std::fopen, std::fprintf
+#include <cstdlib>          // For std::malloc, std::free, std::strtod, std::strtoull
+#include <cstring>          // For std::strcmp, std::strncmp, std::memcpy
+#include <exception>        // For std::exception
+#include <fstream>          // For std::ifstream
+#include <map>              // For std::map
+#include <sstream>          // For std::ostringstream
+#include <stdexcept>        // For std::runtime_error
+#include <memory>           // For std::unique_ptr
+#include <new>              // For std::bad_alloc
+#include <string>           // For std::string
+#include <thread>           // For std::thread::hardware_concurrency
+#include <utility>          // For std::move, std::swap
+#include <vector>           // For std::vector
+
+using namespace GiovanniDicanio;
+
+#ifndef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+using win32::CStringW;
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+// Suppress the "conditional expression is constant" warning with MSVC
+// (the latency variants are selected by template parameters)
+#ifdef _MSC_VER
+#pragma warning(disable : 4127)
+#endif
+
+
+//------------------------------------------------------------------------------
+// Allocation counting
+//------------------------------------------------------------------------------
+
+// GCC can't tell that the replaced operator new allocates with malloc,
+// when the replaced operator delete is inlined
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+namespace
+{
+
+std::atomic<std::uint64_t> g_allocationCount(0);
+
+} // anonymous namespace
+
+std::uint64_t bench::AllocationCount() noexcept
+{
+    return g_allocationCount.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size)
+{
+    g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* const block = std::malloc(size != 0 ? size : 1))
+    {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete[](void* block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept
+{
+    std::free(block);
+}
+
+void operator delete[](void* block, std::size_t) noexcept
+{
+    std::free(block);
+}
+
+
+namespace
+{
+
+//------------------------------------------------------------------------------
+// Command line options
+//------------------------------------------------------------------------------
+
+// Benchmarked string lengths, in UTF-8 bytes
+constexpr std::size_t kLengths[] =
+{
+    8, 64, 512, 4 * 1024, 32 * 1024, 256 * 1024, 2 * 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024
+};
+
+struct Options
+{
+    std::vector<const bench::CorpusInfo*> corpora;
+    std::size_t minLength = 0;
+    std::size_t maxLength = 64 * 1024 * 1024;
+    double      minSeconds = 0.25;
+    bool        perf = false;
+    bool        reference = false;
+    bool        adaptive = false;
+
+    // Result export and comparison (with either, all the overloads are measured)
+    int         repetitions = 0;    // 0: default, 1 or 5
+    const char* jsonPath = nullptr;
+    const char* comparePath = nullptr;
+    double      thresholdPercent = 2.0;
+
+    // Scaling benchmark
+    bool        scaling = false;
+    int         maxThreads = static_cast<int>((std::max)(std::thread::hardware_concurrency(), 1u));
+    std::size_t threadLength = 4 * 1024 * 1024;
+    std::size_t copyLength = 256 * 1024 * 1024;
+
+    // Workload traces
+    const char* replayPath = nullptr;
+    const char* writeTracePath = nullptr;
+
+    // Latency benchmark
+    bool        latency = false;
+    std::size_t samples = 100000;
+    std::size_t coldPoolSize = 512 * 1024;
+};
+
+void PrintUsage()
+{
+    std::printf(
+        "Usage: Utf8ConvBench [options]\n"
+        "\n"
+        "  --corpus=NAME     Benchmark only the given corpus (can be repeated):\n"
+        "                    ascii, latin1, cyrillic, cjk, emoji, mixed\n"
+        "  --min-length=N    Skip strings shorter than N bytes (K and M suffixes allowed)\n"
+        "  --max-length=N    Skip strings longer than N bytes (default: 64M)\n"
+        "  --min-time=S      Minimum time spent measuring each case, in seconds (default: 0.25)\n"
+        "  --perf            Also count hardware events (Linux perf_event_open), and measure\n"
+        "                    the single conversion kernels too\n"
+        "  --repetitions=N   Measure each case N times (default: 1; 5 with --json or --compare)\n"
+        "  --json=FILE       Write the results to a JSON file\n"
+        "  --compare=FILE    Compare the results with a baseline JSON file, and flag\n"
+        "                    significant slowdowns (exit code 2 if any)\n"
+        "  --threshold=P     Smallest slowdown flagged by --compare, in percent (default: 2)\n"
+        "  --reference       Compare the throughput with reference engines (naive scalar,\n"
+        "                    std::codecvt, mbrtoc16, iconv), cross-checking their results\n"
+        "  --adaptive        Compare the kernels of AdaptiveConverter (Utf8ConvAdaptive.h),\n"
+        "                    pinned and chosen adaptively, on each corpus and on phased traffic\n"
+        "  --scaling         Measure the throughput of conversions on 1 to N threads at once,\n"
+        "                    instead of single-threaded throughput\n"
+        "  --threads=N       Maximum number of threads of the scaling benchmark\n"
+        "                    (default: the number of hardware threads)\n"
+        "  --thread-length=N Length of the strings converted by each thread (default: 4M)\n"
+        "  --replay=FILE     Replay the conversions of a workload trace (Utf8ConvTrace.h)\n"
+        "  --write-trace=FILE Write a synthetic workload trace of the corpora, and exit\n"
+        "  --latency         Measure per-call latencies of tiny strings, instead of throughput\n"
+        "  --samples=N       Latency samples per case (default: 100000)\n"
+        "  --cold-pool=N     Distinct inputs for the cold-input latencies (default: 512K)\n"
+        "  --quick           Short run, for smoke testing: --max-length=4K --min-time=0.005\n"
+        "                    --thread-length=64K --samples=2000 --cold-pool=4K\n"
+        "  --help            Show this help\n");
+}
+
+// Parse a length with an optional K or M suffix; returns false on invalid input
+bool ParseLength(const char* text, std::size_t& length)
+{
+    char* end = nullptr;
+    unsigned long long value = std::strtoull(text, &end, 10);
+    if (end == text)
+    {
+        return false;
+    }
+    if (*end == 'K' || *end == 'k')
+    {
+        value *= 1024;
+        ++end;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        value *= 1024 * 1024;
+        ++end;
+    }
+    length = static_cast<std::size_t>(value);
+    return *end == '\0';
+}
+
+// Parse the command line; returns false if the benchmark shouldn't run
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* const arg = argv[i];
+        if (std::strncmp(arg, "--corpus=", 9) == 0)
+        {
+            const bench::CorpusInfo* const corpus = bench::FindCorpus(arg + 9);
+            if (corpus == nullptr)
+            {
+                std::printf("Unknown corpus: %s\n", arg + 9);
+                return false;
+            }
+            options.corpora.push_back(corpus);
+        }
+        else if (std::strncmp(arg, "--min-length=", 13) == 0)
+        {
+            if (!ParseLength(arg + 13, options.minLength))
+            {
+                std::printf("Invalid length: %s\n", arg + 13);
+                return false;
+            }
+        }
+        else if (std::strncmp(arg, "--max-length=", 13) == 0)
+        {
+            if (!ParseLength(arg + 13, options.maxLength))
+            {
+                std::printf("Invalid length: %s\n", arg + 13);
+                return false;
+            }
+        }
+        else if (std::strncmp(arg, "--min-time=", 11) == 0)
+        {
+            options.minSeconds = std::strtod(arg + 11, nullptr);
+        }
+        else if (std::strcmp(arg, "--perf") == 0)
+        {
+            options.perf = true;
+        }
+        else if (std::strncmp(arg, "--repetitions=", 14) == 0)
+        {
+            std::size_t repetitions = 0;
+            if (!ParseLength(arg + 14, repetitions) || repetitions == 0 || repetitions > 1000)
+            {
+                std::printf("Invalid repetition count: %s\n", arg + 14);
+                return false;
+            }
+            options.repetitions = static_cast<int>(repetitions);
+        }
+        else if (std::strncmp(arg, "--json=", 7) == 0)
+        {
+            options.jsonPath = arg + 7;
+        }
+        else if (std::strncmp(arg, "--compare=", 10) == 0)
+        {
+            options.comparePath = arg + 10;
+        }
+        else if (std::strncmp(arg, "--threshold=", 12) == 0)
+        {
+            options.thresholdPercent = std::strtod(arg + 12, nullptr);
+        }
+        else if (std::strcmp(arg, "--reference") == 0)
+        {
+            options.reference = true;
+        }
+        else if (std::strcmp(arg, "--adaptive") == 0)
+        {
+            options.adaptive = true;
+        }
+        else if (std::strcmp(arg, "--scaling") == 0)
+        {
+            options.scaling = true;
+        }
+        else if (std::strncmp(arg, "--threads=", 10) == 0)
+        {
+            std::size_t threads = 0;
+            if (!ParseLength(arg + 10, threads) || threads == 0 || threads > 1024)
+            {
+                std::printf("Invalid thread count: %s\n", arg + 10);
+                return false;
+            }
+            options.maxThreads = static_cast<int>(threads);
+        }
+        else if (std::strncmp(arg, "--thread-length=", 16) == 0)
+        {
+            if (!ParseLength(arg + 16, options.threadLength) || options.threadLength == 0)
+            {
+                std::printf("Invalid length: %s\n", arg + 16);
+                return false;
+            }
+        }
+        else if (std::strncmp(arg, "--replay=", 9) == 0)
+        {
+            options.replayPath = arg + 9;
+        }
+        else if (std::strncmp(arg, "--write-trace=", 14) == 0)
+        {
+            options.writeTracePath = arg + 14;
+        }
+        else if (std::strcmp(arg, "--latency") == 0)
+        {
+            options.latency = true;
+        }
+        else if (std::strncmp(arg, "--samples=", 10) == 0)
+        {
+            if (!ParseLength(arg + 10, options.samples) || options.samples == 0)
+            {
+                std::printf("Invalid sample count: %s\n", arg + 10);
+                return false;
+            }
+        }
+        else if (std::strncmp(arg, "--cold-pool=", 12) == 0)
+        {
+            if (!ParseLength(arg + 12, options.coldPoolSize) || options.coldPoolSize == 0)
+            {
+                std::printf("Invalid pool size: %s\n", arg + 12);
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--quick") == 0)
+        {
+            options.maxLength = 4 * 1024;
+            options.minSeconds = 0.005;
+            options.threadLength = 64 * 1024;
+            options.copyLength = 16 * 1024 * 1024;
+            options.samples = 2000;
+            options.coldPoolSize = 4 * 1024;
+        }
+        else
+        {
+            if (std::strcmp(arg, "--help") != 0)
+            {
+                std::printf("Unknown option: %s\n\n", arg);
+            }
+            PrintUsage();
+            return false;
+        }
+    }
+
+    if (options.repetitions == 0)
+    {
+        options.repetitions = (options.jsonPath != nullptr || options.comparePath != nullptr) ? 5 : 1;
+    }
+
+    if (options.corpora.empty())
+    {
+        for (const bench::CorpusInfo& corpus : bench::kCorpora)
+        {
+            options.corpora.push_back(&corpus);
+        }
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Throughput benchmark
+//------------------------------------------------------------------------------
+
+void PrintHeader()
+{
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+    const char* const implementation = "Win32 APIs, ATL CStringW";
+#else
+    const char* const implementation = "portable, Utf16String";
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+    std::printf("\nUTF-8/UTF-16 Conversion Benchmarks (%s)\n", implementation);
+    std::printf("GB/s and cycles/B are relative to the UTF-8 length.\n\n");
+    std::printf("%-9s %10s  %-21s %9s %9s %12s %12s\n",
+                "corpus", "bytes", "function", "GB/s", "cycles/B", "allocs/call", "calls");
+}
+
+// Throughput of a measurement, in GB/s of UTF-8 text
+double GigabytesPerSecond(std::size_t utf8Length, const bench::Measurement& measurement)
+{
+    return static_cast<double>(utf8Length) * static_cast<double>(measurement.calls) / measurement.seconds / 1e9;
+}
+
+void PrintResult(const char* corpus, std::size_t utf8Length, const char* function,
+                 const bench::Measurement& measurement)
+{
+    const double bytes = static_cast<double>(utf8Length) * static_cast<double>(measurement.calls);
+    const double gigabytesPerSecond = GigabytesPerSecond(utf8Length, measurement);
+    const double allocationsPerCall =
+        static_cast<double>(measurement.allocations) / static_cast<double>(measurement.calls);
+
+    char cyclesPerByte[32] = "-";
+    if (bench::kHasCycleCounter)
+    {
+        std::snprintf(cyclesPerByte, sizeof(cyclesPerByte), "%.3f",
+                      static_cast<double>(measurement.cycles) / bytes);
+    }
+
+    std::printf("%-9s %10zu  %-21s %9.3f %9s %12.2f %12llu\n",
+                corpus, utf8Length, function, gigabytesPerSecond, cyclesPerByte,
+                allocationsPerCall, static_cast<unsigned long long>(measurement.calls));
+}
+
+// Results of a measured case: totals of all the repetitions, and the
+// throughput of each repetition
+struct CaseResult
+{
+    const char*         corpus;
+    std::size_t         utf8Length;
+    std::size_t         codePoints;
+    const char*         function;
+    bench::Measurement  measurement;
+    std::vector<double> gigabytesPerSecond;
+};
+
+// Number of code points in the given UTF-8 string
+std::size_t CountCodePoints(const std::string& utf8)
+{
+    std::size_t count = 0;
+    for (char ch : utf8)
+    {
+        count += (static_cast<unsigned char>(ch) & 0xC0) != 0x80;
+    }
+    return count;
+}
+
+void PrintPerfResults(const bench::PerfCounters& counters, const std::vector<CaseResult>& results)
+{
+    for (int perCodePoint = 0; perCodePoint < 2; ++perCodePoint)
+    {
+        std::printf("\nHardware events per %s\n\n", perCodePoint ? "code point" : "UTF-8 byte");
+        std::printf("%-9s %10s  %-21s", "corpus", "bytes", "function");
+        for (int event = 0; event < bench::kPerfEventCount; ++event)
+        {
+            std::printf(" %10s", bench::PerfEventName(event));
+        }
+        std::printf("\n");
+
+        for (const CaseResult& result : results)
+        {
+            const double units = static_cast<double>(perCodePoint ? result.codePoints : result.utf8Length)
+                               * static_cast<double>(result.measurement.calls);
+
+            std::printf("%-9s %10zu  %-21s", result.corpus, result.utf8Length, result.function);
+            for (int event = 0; event < bench::kPerfEventCount; ++event)
+            {
+                if (counters.IsAvailable(event))
+                {
+                    std::printf(" %10.4f", result.measurement.events[event] / units);
+                }
+                else
+                {
+                    std::printf(" %10s", "-");
+                }
+            }
+            std::printf("\n");
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Write the results to a JSON file; throws std::runtime_error on I/O errors
+//------------------------------------------------------------------------------
+void WriteJsonResults(const char* path, const Options& options, const bench::PerfCounters* counters,
+                      const std::vector<CaseResult>& results)
+{
+    std::FILE* const file = std::fopen(path, "w");
+    if (file == nullptr)
+    {
+        throw std::runtime_error(std::string("Can't open ") + path + " for writing");
+    }
+
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+    const char* const implementation = "atl";
+#else
+    const char* const implementation = "portable";
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+#if defined(_MSC_VER)
+    const std::string compiler = "MSVC " + std::to_string(_MSC_FULL_VER);
+#elif defined(__clang__)
+    const std::string compiler = __VERSION__;
+#elif defined(__GNUC__)
+    const std::string compiler = "GCC " __VERSION__;
+#else
+    const std::string compiler;
+#endif
+
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "  \"benchmark\": \"Utf8ConvBench\",\n");
+    std::fprintf(file, "  \"version\": 1,\n");
+    std::fprintf(file, "  \"implementation\": \"%s\",\n", implementation);
+    std::fprintf(file, "  \"cpu\": %s,\n", bench::JsonQuote(bench::CpuModel()).c_str());
+    std::fprintf(file, "  \"compiler\": %s,\n", bench::JsonQuote(compiler).c_str());
+    std::fprintf(file, "  \"minSeconds\": %g,\n", options.minSeconds);
+    std::fprintf(file, "  \"repetitions\": %d,\n", options.repetitions);
+    std::fprintf(file, "  \"results\": [");
+
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        const CaseResult& result = results[i];
+        const double bytes = static_cast<double>(result.utf8Length) * static_cast<double>(result.measurement.calls);
+
+        std::fprintf(file, "%s\n    {\n", (i == 0) ? "" : ",");
+        std::fprintf(file, "      \"corpus\": \"%s\",\n", result.corpus);
+        std::fprintf(file, "      \"bytes\": %zu,\n", result.utf8Length);
+        std::fprintf(file, "      \"function\": \"%s\",\n", result.function);
+        std::fprintf(file, "      \"gbps\": %.6g,\n", GigabytesPerSecond(result.utf8Length, result.measurement));
+        std::fprintf(file, "      \"gbpsSamples\": [");
+        for (std::size_t sample = 0; sample < result.gigabytesPerSecond.size(); ++sample)
+        {
+            std::fprintf(file, "%s%.6g", (sample == 0) ? "" : ", ", result.gigabytesPerSecond[sample]);
+        }
+        std::fprintf(file, "],\n");
+        if (bench::kHasCycleCounter)
+        {
+            std::fprintf(file, "      \"cyclesPerByte\": %.6g,\n", static_cast<double>(result.measurement.cycles) / bytes);
+        }
+        if (counters != nullptr && counters->IsAnyAvailable())
+        {
+            // Hardware events per UTF-8 byte
+            std::fprintf(file, "      \"eventsPerByte\": {");
+            const char* separator = "";
+            for (int event = 0; event < bench::kPerfEventCount; ++event)
+            {
+                if (counters->IsAvailable(event))
+                {
+                    std::fprintf(file, "%s\"%s\": %.6g", separator, bench::PerfEventName(event),
+                                 result.measurement.events[event] / bytes);
+                    separator = ", ";
+                }
+            }
+            std::fprintf(file, "},\n");
+        }
+        std::fprintf(file, "      \"allocsPerCall\": %.6g,\n",
+                     static_cast<double>(result.measurement.allocations) / static_cast<double>(result.measurement.calls));
+        std::fprintf(file, "      \"calls\": %llu\n", static_cast<unsigned long long>(result.measurement.calls));
+        std::fprintf(file, "    }");
+    }
+    std::fprintf(file, "\n  ]\n}\n");
+
+    const bool succeeded = (std::ferror(file) == 0);
+    if (std::fclose(file) != 0 || !succeeded)
+    {
+        throw std::runtime_error(std::string("Error writing ") + path);
+    }
+    std::printf("\nResults written to %s.\n", path);
+}
+
+// Throughput samples of a baseline case, by "corpus/bytes/function"
+typedef std::map<std::string, std::vector<double>> BaselineSamples;
+
+std::string CaseKey(const std::string& corpus, std::size_t utf8Length, const std::string& function)
+{
+    return corpus + "/" + std::to_string(utf8Length) + "/" + function;
+}
+
+//------------------------------------------------------------------------------
+// Read the results of a baseline JSON file written by --json.
+// Throws std::runtime_error if the file can't be read or parsed.
+//------------------------------------------------------------------------------
+BaselineSamples ReadBaseline(const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error(std::string("Can't open the baseline file ") + path);
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+
+    const bench::JsonValue root = bench::ParseJson(text.str());
+    const bench::JsonValue* const results = root.IsObject() ? root.Find("results") : nullptr;
+    if (results == nullptr || !results->IsArray())
+    {
+        throw std::runtime_error(std::string("No results in the baseline file ") + path);
+    }
+
+    BaselineSamples baseline;
+    for (const bench::JsonValue& result : results->Elements())
+    {
+        const bench::JsonValue* const corpus = result.Find("corpus");
+        const bench::JsonValue* const bytes = result.Find("bytes");
+        const bench::JsonValue* const function = result.Find("function");
+        const bench::JsonValue* const samples = result.Find("gbpsSamples");
+        if (corpus == nullptr || !corpus->IsString() || bytes == nullptr || !bytes->IsNumber()
+            || function == nullptr || !function->IsString() || samples == nullptr || !samples->IsArray())
+        {
+            throw std::runtime_error(std::string("Invalid result in the baseline file ") + path);
+        }
+
+        std::vector<double>& values = baseline[CaseKey(corpus->AsString(),
+            static_cast<std::size_t>(bytes->AsNumber()), function->AsString())];
+        for (const bench::JsonValue& sample : samples->Elements())
+        {
+            values.push_back(sample.AsNumber());
+        }
+    }
+    return baseline;
+}
+
+//------------------------------------------------------------------------------
+// Compare the results with the baseline, case by case.
+// A case is a slowdown when the whole 95% confidence interval of the
+// difference of the mean throughputs is below zero, and the slowdown is at
+// least the threshold. Returns the number of slowdowns.
+//------------------------------------------------------------------------------
+int CompareWithBaseline(const BaselineSamples& baseline, const std::vector<CaseResult>& results,
+                        const Options& options)
+{
+    std::printf("\nComparison with the baseline %s\n", options.comparePath);
+    std::printf("Changes of the mean GB/s, with their 95%% confidence intervals (Welch's t-test);\n");
+    std::printf("slowdowns are flagged when significant and at least %.1f%%.\n\n", options.thresholdPercent);
+    std::printf("%-9s %10s  %-21s %9s %9s %8s %19s  %s\n",
+                "corpus", "bytes", "function", "baseline", "current", "change", "95% interval", "verdict");
+
+    int slowdowns = 0;
+    int unmatched = 0;
+    for (const CaseResult& result : results)
+    {
+        const auto found = baseline.find(CaseKey(result.corpus, result.utf8Length, result.function));
+        if (found == baseline.end() || found->second.empty())
+        {
+            ++unmatched;
+            continue;
+        }
+
+        const bench::SampleStatistics before = bench::ComputeStatistics(found->second);
+        const bench::SampleStatistics after = bench::ComputeStatistics(result.gigabytesPerSecond);
+        const bench::DifferenceInterval interval = bench::ComputeDifferenceInterval(before, after);
+        const double percent = 100.0 / before.mean;
+
+        const char* verdict = "";
+        char range[32] = "-";
+        if (interval.valid)
+        {
+            std::snprintf(range, sizeof(range), "[%+.1f%%, %+.1f%%]", interval.low * percent, interval.high * percent);
+            if (interval.high < 0.0 && -interval.difference * percent >= options.thresholdPercent)
+            {
+                verdict = "SLOWER";
+                ++slowdowns;
+            }
+            else if (interval.low > 0.0)
+            {
+                verdict = "faster";
+            }
+        }
+        else
+        {
+            verdict = "(too few samples)";
+        }
+
+        std::printf("%-9s %10zu  %-21s %9.3f %9.3f %+7.1f%% %19s  %s\n",
+                    result.corpus, result.utf8Length, result.function, before.mean, after.mean,
+                    interval.difference * percent, range, verdict);
+    }
+
+    if (unmatched != 0)
+    {
+        std::printf("\n%d case(s) not in the baseline (run with the baseline's options to compare them).\n",
+                    unmatched);
+    }
+    std::printf("\n%d significant slowdown(s).\n", slowdowns);
+    return slowdowns;
+}
+
+//------------------------------------------------------------------------------
+// Run the throughput benchmarks; returns false if the results are
+// significantly slower than the baseline.
+//------------------------------------------------------------------------------
+bool RunThroughputBenchmarks(const Options& options)
+{
+    // Read the baseline first, to fail before running the benchmarks
+    BaselineSamples baseline;
+    if (options.comparePath != nullptr)
+    {
+        baseline = ReadBaseline(options.comparePath);
+    }
+    const bool allFunctions = (options.jsonPath != nullptr || options.comparePath != nullptr);
+
+    std::unique_ptr<bench::PerfCounters> counters;
+    if (options.perf)
+    {
+        counters.reset(new bench::PerfCounters());
+        if (!counters->IsAnyAvailable())
+        {
+            std::printf("\nHardware counters not available (%s).\n", counters->ErrorMessage().c_str());
+        }
+        else if (!counters->ErrorMessage().empty())
+        {
+            std::printf("\nSome hardware counters are not available (%s).\n", counters->ErrorMessage().c_str());
+        }
+    }
+    std::vector<CaseResult> results;
+
+    PrintHeader();
+
+    for (const bench::CorpusInfo* corpus : options.corpora)
+    {
+        for (std::size_t length : kLengths)
+        {
+            if (length < options.minLength || length > options.maxLength)
+            {
+                continue;
+            }
+
+            const std::string utf8 = bench::GenerateUtf8Corpus(corpus->kind, length);
+            const CStringW utf16 = win32::Utf16FromUtf8(utf8);
+            const std::size_t codePoints = CountCodePoints(utf8);
+
+            auto measure = [&](const char* function, auto&& call)
+            {
+                CaseResult result{ corpus->name, utf8.length(), codePoints, function, bench::Measurement(), {} };
+                for (int repetition = 0; repetition < options.repetitions; ++repetition)
+                {
+                    const bench::Measurement measurement = bench::Measure(call, options.minSeconds, counters.get());
+                    result.gigabytesPerSecond.push_back(GigabytesPerSecond(utf8.length(), measurement));
+                    bench::Accumulate(result.measurement, measurement);
+                }
+                PrintResult(corpus->name, utf8.length(), function, result.measurement);
+                results.push_back(result);
+            };
+
+            measure("Utf16FromUtf8", [&utf8]()
+            {
+                return static_cast<std::size_t>(win32::Utf16FromUtf8(utf8).GetLength());
+            });
+
+            measure("Utf8FromUtf16", [&utf16]()
+            {
+                return win32::Utf8FromUtf16(utf16).length();
+            });
+
+            if (allFunctions)
+            {
+                // The other overloads of Utf8Conv.h
+                const win32::Utf16Char* const utf16Start = utf16.GetString();
+                const win32::Utf16Char* const utf16Finish = utf16Start + utf16.GetLength();
+
+                measure("Utf16FromUtf8(range)", [&utf8]()
+                {
+                    return static_cast<std::size_t>(
+                        win32::Utf16FromUtf8(utf8.data(), utf8.data() + utf8.length()).GetLength());
+                });
+                measure("Utf16FromUtf8(cstr)", [&utf8]()
+                {
+                    return static_cast<std::size_t>(win32::Utf16FromUtf8(utf8.c_str()).GetLength());
+                });
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+                measure("Utf16FromUtf8(view)", [&utf8]()
+                {
+                    return static_cast<std::size_t>(win32::Utf16FromUtf8(std::string_view(utf8)).GetLength());
+                });
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_CHAR8_T
+                measure("Utf16FromUtf8(u8view)", [&utf8]()
+                {
+                    const std::u8string_view view(reinterpret_cast<const char8_t*>(utf8.data()), utf8.length());
+                    return static_cast<std::size_t>(win32::Utf16FromUtf8(view).GetLength());
+                });
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_CHAR8_T
+
+                measure("Utf8FromUtf16(range)", [utf16Start, utf16Finish]()
+                {
+                    return win32::Utf8FromUtf16(utf16Start, utf16Finish).length();
+                });
+                measure("Utf8FromUtf16(cstr)", [utf16Start]()
+                {
+                    return win32::Utf8FromUtf16(utf16Start).length();
+                });
+#ifdef GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+                measure("Utf8FromUtf16(view)", [utf16Start, utf16Finish]()
+                {
+                    const std::basic_string_view<win32::Utf16Char> view(
+                        utf16Start, static_cast<std::size_t>(utf16Finish - utf16Start));
+                    return win32::Utf8FromUtf16(view).length();
+                });
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_STRING_VIEW
+            }
+
+            if (!options.perf)
+            {
+                continue;
+            }
+
+            // The single conversion kernels, into preallocated buffers
+            const int utf8Length = win32::detail::CheckedIntLength(utf8.length());
+            const int utf16Length = utf16.GetLength();
+            std::vector<win32::Utf16Char> utf16Buffer(utf16Length);
+            std::string utf8Buffer(utf8.length(), '\0');
+
+            measure("Utf16LengthFromUtf8", [&]()
+            {
+                return static_cast<std::size_t>(win32::detail::Utf16LengthFromUtf8(utf8.data(), utf8Length));
+            });
+
+            measure("ConvertUtf8ToUtf16", [&]()
+            {
+                return static_cast<std::size_t>(win32::detail::ConvertUtf8ToUtf16(
+                    utf8.data(), utf8Length, utf16Buffer.data(), utf16Length));
+            });
+
+            measure("Utf8LengthFromUtf16", [&]()
+            {
+                return static_cast<std::size_t>(win32::detail::Utf8LengthFromUtf16(utf16.GetString(), utf16Length));
+            });
+
+            measure("ConvertUtf16ToUtf8", [&]()
+            {
+                return static_cast<std::size_t>(win32::detail::ConvertUtf16ToUtf8(
+                    utf16.GetString(), utf16Length, &utf8Buffer[0], utf8Length));
+            });
+        }
+    }
+
+    if (counters && counters->IsAnyAvailable())
+    {
+        PrintPerfResults(*counters, results);
+    }
+
+    if (options.jsonPath != nullptr)
+    {
+        WriteJsonResults(options.jsonPath, options, counters.get(), results);
+    }
+    return options.comparePath == nullptr || CompareWithBaseline(baseline, results, options) == 0;
+}
+
+//------------------------------------------------------------------------------
+// Reference engines benchmark
+//------------------------------------------------------------------------------
+
+// Copy a library UTF-16 string into a std::u16string, for the reference engines
+std::u16string ToU16String(const CStringW& utf16)
+{
+    std::u16string result(static_cast<std::size_t>(utf16.GetLength()), u'\0');
+    if (!result.empty())
+    {
+        std::memcpy(&result[0], utf16.GetString(), result.length() * sizeof(char16_t));
+    }
+    return result;
+}
+
+// Cell of the reference table: the throughput, or why it's not reported
+std::string ReferenceCell(bool available, bool succeeded, bool correct, const bench::Measurement& measurement,
+                          std::size_t utf8Length)
+{
+    if (!available)
+    {
+        return "-";
+    }
+    if (!succeeded)
+    {
+        return "error";
+    }
+    if (!correct)
+    {
+        return "WRONG";
+    }
+
+    const double bytes = static_cast<double>(utf8Length) * static_cast<double>(measurement.calls);
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", bytes / measurement.seconds / 1e9);
+    return text;
+}
+
+void PrintReferenceHeader()
+{
+    std::printf("\nUTF-8/UTF-16 Conversions vs Reference Engines, in GB/s of UTF-8 text\n\n");
+    std::printf("  library   Utf16FromUtf8 and Utf8FromUtf16\n");
+    std::printf("  naive     simple scalar conversion, one code point at a time\n");
+    std::printf("  codecvt   std::codecvt<char16_t, char, std::mbstate_t>\n");
+    std::printf("  mbrtoc16  mbrtoc16 and c16rtomb, in a UTF-8 locale\n");
+    std::printf("  iconv     iconv (e.g. glibc's)\n\n");
+    std::printf("Each result is checked first: the UTF-8 outputs against the original text,\n");
+    std::printf("the UTF-16 outputs against the library's (itself checked against naive).\n");
+    std::printf("\"-\" marks unavailable engines, \"error\" failed conversions, \"WRONG\" wrong results.\n\n");
+
+    std::printf("%-9s %10s  %-14s %9s", "corpus", "bytes", "function", "library");
+    for (const bench::ReferenceEngine& engine : bench::kReferenceEngines)
+    {
+        std::printf(" %9s", engine.name);
+    }
+    std::printf("\n");
+}
+
+//------------------------------------------------------------------------------
+// Run the library and the reference engines on the selected corpora.
+// Returns false if any library result is wrong.
+//------------------------------------------------------------------------------
+bool RunReferenceBenchmarks(const Options& options)
+{
+    PrintReferenceHeader();
+
+    bool libraryCorrect = true;
+    for (const bench::CorpusInfo* corpus : options.corpora)
+    {
+        for (std::size_t length : kLengths)
+        {
+            if (length < options.minLength || length > options.maxLength)
+            {
+                continue;
+            }
+
+            const std::string utf8 = bench::GenerateUtf8Corpus(corpus->kind, length);
+            const CStringW utf16 = win32::Utf16FromUtf8(utf8);
+            const std::u16string expectedUtf16 = ToU16String(utf16);
+
+            // The library's results, checked against the naive engine and the original text
+            std::u16string naiveUtf16;
+            const bool naiveSucceeded = bench::detail::NaiveUtf16FromUtf8(utf8, naiveUtf16);
+            const bool libraryUtf16Correct = naiveSucceeded && naiveUtf16 == expectedUtf16;
+            const bool libraryUtf8Correct = win32::Utf8FromUtf16(utf16) == utf8;
+            libraryCorrect = libraryCorrect && libraryUtf16Correct && libraryUtf8Correct;
+
+            std::vector<std::string> toUtf16Cells;
+            std::vector<std::string> toUtf8Cells;
+
+            bench::Measurement measurement;
+            if (libraryUtf16Correct)
+            {
+                measurement = bench::Measure([&utf8]()
+                {
+                    return static_cast<std::size_t>(win32::Utf16FromUtf8(utf8).GetLength());
+                }, options.minSeconds);
+            }
+            toUtf16Cells.push_back(ReferenceCell(true, true, libraryUtf16Correct, measurement, utf8.length()));
+
+            measurement = bench::Measurement();
+            if (libraryUtf8Correct)
+            {
+                measurement = bench::Measure([&utf16]()
+                {
+                    return win32::Utf8FromUtf16(utf16).length();
+                }, options.minSeconds);
+            }
+            toUtf8Cells.push_back(ReferenceCell(true, true, libraryUtf8Correct, measurement, utf8.length()));
+
+            for (const bench::ReferenceEngine& engine : bench::kReferenceEngines)
+            {
+                const bool available = bench::IsReferenceEngineAvailable(engine);
+
+                std::u16string engineUtf16;
+                const bool toUtf16Succeeded = available && engine.utf16FromUtf8(utf8, engineUtf16);
+                const bool toUtf16Correct = toUtf16Succeeded && libraryUtf16Correct && engineUtf16 == expectedUtf16;
+                measurement = bench::Measurement();
+                if (toUtf16Correct)
+                {
+                    measurement = bench::Measure([&engine, &utf8]()
+                    {
+                        std::u16string result;
+                        engine.utf16FromUtf8(utf8, result);
+                        return result.length();
+                    }, options.minSeconds);
+                }
+                toUtf16Cells.push_back(ReferenceCell(available, toUtf16Succeeded, toUtf16Correct,
+                                                     measurement, utf8.length()));
+
+                std::string engineUtf8;
+                const bool toUtf8Succeeded = available && engine.utf8FromUtf16(expectedUtf16, engineUtf8);
+                const bool toUtf8Correct = toUtf8Succeeded && engineUtf8 == utf8;
+                measurement = bench::Measurement();
+                if (toUtf8Correct)
+                {
+                    measurement = bench::Measure([&engine, &expectedUtf16]()
+                    {
+                        std::string result;
+                        engine.utf8FromUtf16(expectedUtf16, result);
+                        return result.length();
+                    }, options.minSeconds);
+                }
+                toUtf8Cells.push_back(ReferenceCell(available, toUtf8Succeeded, toUtf8Correct,
+                                                    measurement, utf8.length()));
+            }
+
+            auto printRow = [&](const char* function, const std::vector<std::string>& cells)
+            {
+                std::printf("%-9s %10zu  %-14s", corpus->name, utf8.length(), function);
+                for (const std::string& cell : cells)
+                {
+                    std::printf(" %9s", cell.c_str());
+                }
+                std::printf("\n");
+            };
+            printRow("Utf16FromUtf8", toUtf16Cells);
+            printRow("Utf8FromUtf16", toUtf8Cells);
+        }
+    }
+
+    if (!libraryCorrect)
+    {
+        std::printf("\n*** ERROR: wrong results from the library's conversion functions.\n");
+    }
+    return libraryCorrect;
+}
+
+//------------------------------------------------------------------------------
+// Adaptive kernel selection benchmark
+//------------------------------------------------------------------------------
+
+// Throughput, in GB/s of UTF-8 text, of a measurement converting 'bytesPerCall' bytes per call
+double Throughput(const bench::Measurement& measurement, std::size_t bytesPerCall)
+{
+    const double bytes = static_cast<double>(bytesPerCall) * static_cast<double>(measurement.calls);
+    return bytes / measurement.seconds / 1e9;
+}
+
+void PrintAdaptiveHeader()
+{
+    std::printf("\nAdaptive Kernel Selection (Utf8ConvAdaptive.h), in GB/s of UTF-8 text\n\n");
+    std::printf("  library    Utf16FromUtf8 and Utf8FromUtf16\n");
+    std::printf("  ascii      AdaptiveConverter, with the ASCII kernel pinned\n");
+    std::printf("  multibyte  AdaptiveConverter, with the multibyte kernel pinned\n");
+    std::printf("  adaptive   AdaptiveConverter, choosing the kernel (shown, with the\n");
+    std::printf("             running average of the ASCII fraction of the input code units)\n\n");
+
+    std::printf("%-9s %10s  %-14s %9s %9s %9s %9s  %-9s %6s\n", "corpus", "bytes", "function",
+                "library", "ascii", "multibyte", "adaptive", "kernel", "ascii%");
+}
+
+//------------------------------------------------------------------------------
+// Measure a conversion function of AdaptiveConverter on the given inputs, in
+// order, with the given kernel pinned, or chosen adaptively if 'pinned' is false.
+// Returns the converter's status at the end.
+//------------------------------------------------------------------------------
+template <typename Input, typename Convert>
+win32::AdaptiveKernelStatus MeasureAdaptive(win32::ConversionDirection direction, bool pinned,
+                                            win32::ConversionKernel kernel, const std::vector<Input>& inputs,
+                                            Convert&& convert, double minSeconds, bench::Measurement& measurement)
+{
+    win32::AdaptiveConverter converter;
+    if (pinned)
+    {
+        converter.PinKernel(direction, kernel);
+    }
+
+    measurement = bench::Measure([&converter, &inputs, &convert]()
+    {
+        std::size_t length = 0;
+        for (const Input& input : inputs)
+        {
+            length += convert(converter, input);
+        }
+        return length;
+    }, minSeconds);
+
+    return converter.Status(direction);
+}
+
+//------------------------------------------------------------------------------
+// Measure the library's conversion functions, and AdaptiveConverter's (pinned
+// to each kernel, and adaptive) on the given inputs, and print a table row for
+// each direction. Returns false if any AdaptiveConverter result is wrong.
+//------------------------------------------------------------------------------
+bool MeasureAdaptiveCase(const char* name, std::size_t bytesPerInput, const std::vector<std::string>& utf8Inputs,
+                         double minSeconds)
+{
+    using win32::AdaptiveConverter;
+    using win32::ConversionDirection;
+    using win32::ConversionKernel;
+
+    std::vector<CStringW> utf16Inputs;
+    std::size_t totalBytes = 0;
+    for (const std::string& utf8 : utf8Inputs)
+    {
+        utf16Inputs.push_back(win32::Utf16FromUtf8(utf8));
+        totalBytes += utf8.length();
+    }
+
+    // Cross-check the results of both kernels first
+    for (ConversionKernel kernel : { ConversionKernel::Ascii, ConversionKernel::Multibyte })
+    {
+        AdaptiveConverter converter;
+        converter.PinKernel(ConversionDirection::Utf8ToUtf16, kernel);
+        converter.PinKernel(ConversionDirection::Utf16ToUtf8, kernel);
+        for (std::size_t i = 0; i < utf8Inputs.size(); ++i)
+        {
+            if (converter.Utf16FromUtf8(utf8Inputs[i]) != utf16Inputs[i]
+                || converter.Utf8FromUtf16(utf16Inputs[i]) != utf8Inputs[i])
+            {
+                std::printf("%-9s *** WRONG results from the %s kernel\n", name,
+                            win32::ConversionKernelName(kernel));
+                return false;
+            }
+        }
+    }
+
+    auto toUtf16 = [](AdaptiveConverter& converter, const std::string& utf8)
+    {
+        return static_cast<std::size_t>(converter.Utf16FromUtf8(utf8).GetLength());
+    };
+    auto toUtf8 = [](AdaptiveConverter& converter, const CStringW& utf16)
+    {
+        return converter.Utf8FromUtf16(utf16).length();
+    };
+
+    auto printRow = [&](const char* function, const bench::Measurement& library, const bench::Measurement& ascii,
+                        const bench::Measurement& multibyte, const bench::Measurement& adaptive,
+                        const win32::AdaptiveKernelStatus& status)
+    {
+        std::printf("%-9s %10zu  %-14s %9.3f %9.3f %9.3f %9.3f  %-9s %6.1f\n", name, bytesPerInput, function,
+                    Throughput(library, totalBytes), Throughput(ascii, totalBytes),
+                    Throughput(multibyte, totalBytes), Throughput(adaptive, totalBytes),
+                    win32::ConversionKernelName(status.kernel), 100.0 * status.asciiFraction);
+    };
+
+    bench::Measurement library = bench::Measure([&utf8Inputs]()
+    {
+        std::size_t length = 0;
+        for (const std::string& utf8 : utf8Inputs)
+        {
+            length += static_cast<std::size_t>(win32::Utf16FromUtf8(utf8).GetLength());
+        }
+        return length;
+    }, minSeconds);
+    bench::Measurement ascii;
+    bench::Measurement multibyte;
+    bench::Measurement adaptive;
+    MeasureAdaptive(ConversionDirection::Utf8ToUtf16, true, ConversionKernel::Ascii,
+                    utf8Inputs, toUtf16, minSeconds, ascii);
+    MeasureAdaptive(ConversionDirection::Utf8ToUtf16, true, ConversionKernel::Multibyte,
+                    utf8Inputs, toUtf16, minSeconds, multibyte);
+    win32::AdaptiveKernelStatus status = MeasureAdaptive(ConversionDirection::Utf8ToUtf16, false,
+        ConversionKernel::Ascii, utf8Inputs, toUtf16, minSeconds, adaptive);
+    printRow("Utf16FromUtf8", library, ascii, multibyte, adaptive, status);
+
+    library = bench::Measure([&utf16Inputs]()
+    {
+        std::size_t length = 0;
+        for (const CStringW& utf16 : utf16Inputs)
+        {
+            length += win32::Utf8FromUtf16(utf16).length();
+        }
+        return length;
+    }, minSeconds);
+    MeasureAdaptive(ConversionDirection::Utf16ToUtf8, true, ConversionKernel::Ascii,
+                    utf16Inputs, toUtf8, minSeconds, ascii);
+    MeasureAdaptive(ConversionDirection::Utf16ToUtf8, true, ConversionKernel::Multibyte,
+                    utf16Inputs, toUtf8, minSeconds, multibyte);
+    status = MeasureAdaptive(ConversionDirection::Utf16ToUtf8, false,
+        ConversionKernel::Ascii, utf16Inputs, toUtf8, minSeconds, adaptive);
+    printRow("Utf8FromUtf16", library, ascii, multibyte, adaptive, status);
+
+    return true;
+}
+
+// Generate 'count' strings of about 'length' bytes of the given corpus,
+// splitting the text on code point boundaries
+std::vector<std::string> GenerateCorpusStrings(bench::CorpusKind kind, std::size_t count, std::size_t length)
+{
+    const std::string text = bench::GenerateUtf8Corpus(kind, length * count + 4);
+    const char* const textFinish = text.data() + text.length();
+
+    std::vector<std::string> strings;
+    const char* pos = text.data();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const char* finish = (std::min)(pos + length, textFinish);
+        while (finish != textFinish && (static_cast<unsigned char>(*finish) & 0xC0) == 0x80)
+        {
+            ++finish;
+        }
+        strings.emplace_back(pos, finish);
+        pos = finish;
+    }
+    return strings;
+}
+
+//------------------------------------------------------------------------------
+// Run the adaptive kernel selection benchmark: each corpus on its own, and a
+// workload alternating phases of ASCII and CJK text, where the adaptive
+// converter has to switch kernel at each phase change.
+// Returns false if any result is wrong.
+//------------------------------------------------------------------------------
+bool RunAdaptiveBenchmarks(const Options& options)
+{
+    PrintAdaptiveHeader();
+
+    // Each measured call converts several different strings, so that short
+    // conversions aren't measured on the same input over and over
+    constexpr std::size_t kInputsPerCall = 16;
+
+    bool correct = true;
+    for (const bench::CorpusInfo* corpus : options.corpora)
+    {
+        for (std::size_t length : kLengths)
+        {
+            if (length < options.minLength || length > options.maxLength || length > 16 * 1024 * 1024)
+            {
+                continue;
+            }
+
+            const std::vector<std::string> inputs = GenerateCorpusStrings(corpus->kind, kInputsPerCall, length);
+            correct = MeasureAdaptiveCase(corpus->name, length, inputs, options.minSeconds) && correct;
+        }
+    }
+
+    // Phases of ASCII and CJK text, as traffic changing over the day
+    constexpr std::size_t kPhaseInputs = 256;
+    const std::size_t length = (std::min)(options.maxLength, std::size_t(512));
+    std::vector<std::string> phases;
+    for (int phase = 0; phase < 4; ++phase)
+    {
+        const bench::CorpusKind kind = (phase % 2 == 0) ? bench::CorpusKind::Ascii : bench::CorpusKind::Cjk;
+        for (std::string& input : GenerateCorpusStrings(kind, kPhaseInputs, length))
+        {
+            phases.push_back(std::move(input));
+        }
+    }
+    std::printf("\nPhases of %zu ASCII, %zu CJK, %zu ASCII and %zu CJK strings:\n\n",
+                kPhaseInputs, kPhaseInputs, kPhaseInputs, kPhaseInputs);
+    correct = MeasureAdaptiveCase("phases", length, phases, options.minSeconds) && correct;
+
+    return correct;
+}
+
+//------------------------------------------------------------------------------
+// Multi-thread scaling benchmark
+//------------------------------------------------------------------------------
+
+// Thread counts of the scaling benchmark: powers of 2 up to maxThreads, and maxThreads
+std::vector<int> ScalingThreadCounts(int maxThreads)
+{
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+    {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+    return threadCounts;
+}
+
+//------------------------------------------------------------------------------
+// Measure the memory bandwidth available to the given number of threads, in
+// bytes read and written per second, copying with memcpy (each thread its
+// own share of a total much larger than the caches).
+// The reads done by the CPU to allocate the destination lines in the cache
+// (if any) are not counted, as for the conversions.
+//------------------------------------------------------------------------------
+double MeasureCopyBandwidth(int threadCount, const Options& options)
+{
+    const std::size_t length = (std::max)(options.copyLength / threadCount, std::size_t(1024 * 1024));
+
+    const bench::ThreadedMeasurement measurement = bench::MeasureOnThreads(threadCount, [length](int)
+    {
+        return [source = std::vector<char>(length, 'x'), destination = std::vector<char>(length)]() mutable
+        {
+            std::memcpy(destination.data(), source.data(), source.size());
+            return static_cast<std::size_t>(destination.back());
+        };
+    }, options.minSeconds);
+
+    return 2.0 * static_cast<double>(length) * static_cast<double>(measurement.calls) / measurement.seconds;
+}
+
+void PrintScalingHeader(int maxThreads)
+{
+    std::printf("\nUTF-8/UTF-16 Conversion Scaling, on 1 to %d threads (hardware threads: %u)\n\n",
+                maxThreads, std::thread::hardware_concurrency());
+    std::printf("  string   the public conversion function, returning a new string\n");
+    std::printf("  buffer   the same conversion into a buffer owned by the thread (no allocations)\n\n");
+    std::printf("GB/s is the aggregate throughput of all the threads, relative to the UTF-8 length.\n");
+    std::printf("Efficiency is the speedup over 1 thread, divided by the number of threads.\n");
+    std::printf("%%bw is the memory traffic (input read, output written) as a percentage of the\n");
+    std::printf("memcpy bandwidth on the same number of threads.\n\n");
+}
+
+//------------------------------------------------------------------------------
+// Measure a conversion on each of the thread counts, and print the results.
+// 'makeCall' gets a thread its own copy of the input and of the buffers.
+//------------------------------------------------------------------------------
+template <typename MakeCall>
+void MeasureScaling(const char* corpus, std::size_t utf8Length, std::size_t trafficPerCall,
+                    const char* function, const char* result,
+                    const std::vector<int>& threadCounts, const std::vector<double>& copyBandwidths,
+                    const Options& options, MakeCall&& makeCall)
+{
+    double singleThreadThroughput = 0.0;
+    for (std::size_t i = 0; i < threadCounts.size(); ++i)
+    {
+        const int threads = threadCounts[i];
+        const bench::ThreadedMeasurement measurement = bench::MeasureOnThreads(threads, makeCall, options.minSeconds);
+
+        const double calls = static_cast<double>(measurement.calls);
+        const double throughput = static_cast<double>(utf8Length) * calls / measurement.seconds;
+        if (i == 0)
+        {
+            // The first thread count is always 1
+            singleThreadThroughput = throughput;
+        }
+        const double speedup = throughput / singleThreadThroughput;
+        const double traffic = static_cast<double>(trafficPerCall) * calls / measurement.seconds;
+
+        std::printf("%-9s %10zu  %-14s %-7s %7d %9.3f %8.2f %9.1f%% %6.1f%% %12.2f\n",
+                    corpus, utf8Length, function, result, threads, throughput / 1e9, speedup,
+                    100.0 * speedup / threads, 100.0 * traffic / copyBandwidths[i],
+                    static_cast<double>(measurement.allocations) / calls);
+    }
+}
+
+void RunScalingBenchmarks(const Options& options)
+{
+    const std::vector<int> threadCounts = ScalingThreadCounts(options.maxThreads);
+
+    PrintScalingHeader(options.maxThreads);
+
+    std::printf("Memory bandwidth ceiling (memcpy, bytes read + written)\n\n");
+    std::printf("%7s %9s\n", "threads", "GB/s");
+    std::vector<double> copyBandwidths;
+    for (int threads : threadCounts)
+    {
+        copyBandwidths.push_back(MeasureCopyBandwidth(threads, options));
+        std::printf("%7d %9.3f\n", threads, copyBandwidths.back() / 1e9);
+    }
+
+    std::printf("\n%-9s %10s  %-14s %-7s %7s %9s %8s %10s %7s %12s\n",
+                "corpus", "bytes", "function", "result", "threads", "GB/s", "speedup",
+                "efficiency", "%bw", "allocs/call");
+
+    for (const bench::CorpusInfo* corpus : options.corpora)
+    {
+        const std::string text = bench::GenerateUtf8Corpus(corpus->kind, options.threadLength);
+        const CStringW text16 = win32::Utf16FromUtf8(text);
+        const int utf8Length = win32::detail::CheckedIntLength(text.length());
+        const int utf16Length = text16.GetLength();
+        const std::size_t trafficPerCall = text.length() + utf16Length * sizeof(win32::Utf16Char);
+
+        auto measure = [&](const char* function, const char* result, auto&& makeCall)
+        {
+            MeasureScaling(corpus->name, text.length(), trafficPerCall, function, result,
+                           threadCounts, copyBandwidths, options, makeCall);
+        };
+
+        // Each thread converts its own copy of the input (copies of CStringWs
+        // are made from the characters, as ATL CStringW copies share them)
+
+        measure("Utf16FromUtf8", "string", [&](int)
+        {
+            return [utf8 = text]()
+            {
+                return static_cast<std::size_t>(win32::Utf16FromUtf8(utf8).GetLength());
+            };
+        });
+
+        measure("Utf16FromUtf8", "buffer", [&](int)
+        {
+            return [utf8 = text, utf16 = std::vector<win32::Utf16Char>(utf16Length), utf8Length]() mutable
+            {
+                const int length = win32::detail::Utf16LengthFromUtf8(utf8.data(), utf8Length);
+                return static_cast<std::size_t>(win32::detail::ConvertUtf8ToUtf16(
+                    utf8.data(), utf8Length, utf16.data(), length));
+            };
+        });
+
+        measure("Utf8FromUtf16", "string", [&](int)
+        {
+            return [utf16 = CStringW(text16.GetString(), utf16Length)]()
+            {
+                return win32::Utf8FromUtf16(utf16).length();
+            };
+        });
+
+        measure("Utf8FromUtf16", "buffer", [&](int)
+        {
+            return [utf16 = CStringW(text16.GetString(), utf16Length), utf8 = std::string(text.length(), '\0'),
+                    utf16Length]() mutable
+            {
+                const int length = win32::detail::Utf8LengthFromUtf16(utf16.GetString(), utf16Length);
+                return static_cast<std::size_t>(win32::detail::ConvertUtf16ToUtf8(
+                    utf16.GetString(), utf16Length, &utf8[0], length));
+            };
+        });
+    }
+}
+
+//------------------------------------------------------------------------------
+// Workload trace replay
+//------------------------------------------------------------------------------
+
+// Corpus of synthesized replay inputs, for each script class
+constexpr bench::CorpusKind kScriptClassCorpora[win32::kScriptClassCount] =
+{
+    bench::CorpusKind::Ascii, bench::CorpusKind::Latin1, bench::CorpusKind::Cjk, bench::CorpusKind::Emoji
+};
+
+const char* DirectionName(win32::ConversionDirection direction)
+{
+    return (direction == win32::ConversionDirection::Utf8ToUtf16) ? "Utf16FromUtf8" : "Utf8FromUtf16";
+}
+
+//------------------------------------------------------------------------------
+// Write a synthetic trace: a conversion in each direction of every corpus
+// string of the benchmarked lengths, with the text as sample for the shorter
+// ones (the longer ones are synthesized by class when replayed).
+//------------------------------------------------------------------------------
+void WriteSyntheticTrace(const Options& options)
+{
+    std::vector<win32::TraceRecord> records;
+    for (const bench::CorpusInfo* corpus : options.corpora)
+    {
+        for (std::size_t length : kLengths)
+        {
+            if (length < options.minLength || length > options.maxLength)
+            {
+                continue;
+            }
+
+            const std::string utf8 = bench::GenerateUtf8Corpus(corpus->kind, length);
+            const CStringW utf16 = win32::Utf16FromUtf8(utf8);
+
+            win32::TraceRecord record;
+            record.scriptClass = win32::detail::ClassifyUtf8(utf8.data(), utf8.length());
+
+            record.direction = win32::ConversionDirection::Utf8ToUtf16;
+            record.length = static_cast<std::uint32_t>(utf8.length());
+            record.sample = (utf8.length() <= win32::kMaxTraceSampleLength) ? utf8 : std::string();
+            records.push_back(record);
+
+            record.direction = win32::ConversionDirection::Utf16ToUtf8;
+            record.length = static_cast<std::uint32_t>(utf16.GetLength());
+            record.sample = (static_cast<std::size_t>(utf16.GetLength()) <= win32::kMaxTraceSampleLength)
+                ? utf8 : std::string();
+            records.push_back(record);
+        }
+    }
+
+    std::ofstream output(options.writeTracePath, std::ios::binary | std::ios::trunc);
+    win32::WriteConversionTrace(output, records);
+    output.close();
+    if (!output)
+    {
+        throw std::runtime_error(std::string("Can't write the trace file ") + options.writeTracePath + ".");
+    }
+    std::printf("Wrote %zu conversions to %s\n", records.size(), options.writeTracePath);
+}
+
+// Input of a replayed conversion, in both encodings
+struct ReplayInput
+{
+    win32::ConversionDirection direction;
+    win32::ScriptClass         scriptClass;
+    std::string                utf8;
+    CStringW                   utf16;
+};
+
+//------------------------------------------------------------------------------
+// Build the input of a trace record: its sample if recorded, or else a slice
+// of the corpus of its script class, of (about) the recorded length.
+//------------------------------------------------------------------------------
+ReplayInput MakeReplayInput(const win32::TraceRecord& record, const std::string& text, const CStringW& text16,
+                            bench::Random& random)
+{
+    ReplayInput input{ record.direction, record.scriptClass, std::string(), CStringW() };
+
+    if (!record.sample.empty())
+    {
+        input.utf8 = record.sample;
+        input.utf16 = win32::Utf16FromUtf8(input.utf8);
+    }
+    else if (record.direction == win32::ConversionDirection::Utf8ToUtf16)
+    {
+        auto isContinuationByte = [&text](std::size_t pos)
+        {
+            return pos < text.length() && (static_cast<unsigned char>(text[pos]) & 0xC0) == 0x80;
+        };
+
+        std::size_t start = random.Below(static_cast<std::uint32_t>(text.length() - record.length + 1));
+        std::size_t finish = start + record.length;
+        while (isContinuationByte(start))
+        {
+            --start;
+            --finish;
+        }
+        while (isContinuationByte(finish))
+        {
+            --finish;
+        }
+
+        input.utf8.assign(text, start, finish - start);
+        input.utf16 = win32::Utf16FromUtf8(input.utf8);
+    }
+    else
+    {
+        const win32::Utf16Char* const chars = text16.GetString();
+        const std::size_t textLength = static_cast<std::size_t>(text16.GetLength());
+        auto isLowSurrogate = [chars, textLength](std::size_t pos)
+        {
+            return pos < textLength && chars[pos] >= 0xDC00 && chars[pos] <= 0xDFFF;
+        };
+
+        std::size_t start = random.Below(static_cast<std::uint32_t>(textLength - record.length + 1));
+        std::size_t finish = start + record.length;
+        if (isLowSurrogate(start))
+        {
+            --start;
+            --finish;
+        }
+        if (isLowSurrogate(finish))
+        {
+            --finish;
+        }
+
+        input.utf16 = CStringW(chars + start, static_cast<int>(finish - start));
+        input.utf8 = win32::Utf8FromUtf16(input.utf16);
+    }
+    return input;
+}
+
+//------------------------------------------------------------------------------
+// Build the inputs of all the records of a trace, generating the corpora
+// needed by the records without sample
+//------------------------------------------------------------------------------
+std::vector<ReplayInput> MakeReplayInputs(const std::vector<win32::TraceRecord>& records)
+{
+    // The corpora must be longer than the longest record without sample
+    std::size_t corpusLength[win32::kScriptClassCount] = {};
+    for (const win32::TraceRecord& record : records)
+    {
+        if (record.sample.empty())
+        {
+            std::size_t& length = corpusLength[static_cast<int>(record.scriptClass)];
+            length = (std::max)(length, static_cast<std::size_t>(record.length) * 4 + 64);
+        }
+    }
+
+    std::string texts[win32::kScriptClassCount];
+    CStringW texts16[win32::kScriptClassCount];
+    for (int i = 0; i < win32::kScriptClassCount; ++i)
+    {
+        if (corpusLength[i] != 0)
+        {
+            const std::size_t length = (std::max)(corpusLength[i], std::size_t(64 * 1024));
+            texts[i] = bench::GenerateUtf8Corpus(kScriptClassCorpora[i], length);
+            texts16[i] = win32::Utf16FromUtf8(texts[i]);
+        }
+    }
+
+    bench::Random random(0x5EED7ACE);
+    std::vector<ReplayInput> inputs;
+    inputs.reserve(records.size());
+    for (const win32::TraceRecord& record : records)
+    {
+        const int scriptClass = static_cast<int>(record.scriptClass);
+        inputs.push_back(MakeReplayInput(record, texts[scriptClass], texts16[scriptClass], random));
+    }
+    return inputs;
+}
+
+void PrintTraceSummary(const std::vector<win32::TraceRecord>& records)
+{
+    const win32::TraceSummary summary = win32::SummarizeConversionTrace(records);
+
+    std::printf("%zu conversions, %llu with samples\n\n", records.size(),
+                static_cast<unsigned long long>(summary.samples));
+
+    std::printf("%-14s", "function");
+    for (int scriptClass = 0; scriptClass < win32::kScriptClassCount; ++scriptClass)
+    {
+        std::printf(" %10s", win32::ScriptClassName(static_cast<win32::ScriptClass>(scriptClass)));
+    }
+    std::printf("\n");
+    for (int direction = 0; direction < 2; ++direction)
+    {
+        std::printf("%-14s", DirectionName(static_cast<win32::ConversionDirection>(direction)));
+        for (int scriptClass = 0; scriptClass < win32::kScriptClassCount; ++scriptClass)
+        {
+            std::printf(" %10llu", static_cast<unsigned long long>(summary.counts[direction][scriptClass]));
+        }
+        std::printf("\n");
+    }
+
+    std::printf("\n%-23s %10s\n", "input length", "count");
+    for (int bucket = 0; bucket < 33; ++bucket)
+    {
+        if (summary.lengthBuckets[bucket] == 0)
+        {
+            continue;
+        }
+
+        char range[32] = "0";
+        if (bucket > 0)
+        {
+            std::snprintf(range, sizeof(range), "%llu-%llu",
+                          1ull << (bucket - 1), (1ull << bucket) - 1);
+        }
+        std::printf("%-23s %10llu\n", range, static_cast<unsigned long long>(summary.lengthBuckets[bucket]));
+    }
+}
+
+//------------------------------------------------------------------------------
+// Replay the conversions of the given inputs in trace order, and report their
+// throughput (relative to the UTF-8 length, as in the throughput benchmark)
+//------------------------------------------------------------------------------
+void MeasureReplay(const char* function, const char* scriptClass, const std::vector<const ReplayInput*>& inputs,
+                   const Options& options)
+{
+    if (inputs.empty())
+    {
+        return;
+    }
+
+    std::size_t utf8Bytes = 0;
+    for (const ReplayInput* input : inputs)
+    {
+        utf8Bytes += input->utf8.length();
+    }
+
+    const bench::Measurement measurement = bench::Measure([&inputs]()
+    {
+        std::size_t total = 0;
+        for (const ReplayInput* input : inputs)
+        {
+            if (input->direction == win32::ConversionDirection::Utf8ToUtf16)
+            {
+                total += win32::Utf16FromUtf8(input->utf8).GetLength();
+            }
+            else
+            {
+                total += win32::Utf8FromUtf16(input->utf16).length();
+            }
+        }
+        return total;
+    }, options.minSeconds);
+
+    const double conversions = static_cast<double>(measurement.calls) * static_cast<double>(inputs.size());
+    std::printf("%-14s %-6s %10zu %12zu %9.3f %12.1f %12.2f\n",
+                function, scriptClass, inputs.size(), utf8Bytes,
+                GigabytesPerSecond(utf8Bytes, measurement),
+                measurement.seconds * 1e9 / conversions,
+                static_cast<double>(measurement.allocations) / conversions);
+}
+
+void RunReplayBenchmarks(const Options& options)
+{
+    const std::vector<win32::TraceRecord> records = win32::LoadConversionTrace(options.replayPath);
+
+    std::printf("\nReplay of the workload trace %s\n\n", options.replayPath);
+    PrintTraceSummary(records);
+
+    const std::vector<ReplayInput> inputs = MakeReplayInputs(records);
+
+    std::printf("\nGB/s are relative to the UTF-8 length; bytes are per replay of the conversions.\n\n");
+    std::printf("%-14s %-6s %10s %12s %9s %12s %12s\n",
+                "function", "class", "calls", "bytes", "GB/s", "ns/call", "allocs/call");
+
+    std::vector<const ReplayInput*> all;
+    for (const ReplayInput& input : inputs)
+    {
+        all.push_back(&input);
+    }
+    MeasureReplay("all", "all", all, options);
+
+    for (int direction = 0; direction < 2; ++direction)
+    {
+        for (int scriptClass = 0; scriptClass < win32::kScriptClassCount; ++scriptClass)
+        {
+            std::vector<const ReplayInput*> selected;
+            for (const ReplayInput& input : inputs)
+            {
+                if (static_cast<int>(input.direction) == direction
+                    && static_cast<int>(input.scriptClass) == scriptClass)
+                {
+                    selected.push_back(&input);
+                }
+            }
+            MeasureReplay(DirectionName(static_cast<win32::ConversionDirection>(direction)),
+                          win32::ScriptClassName(static_cast<win32::ScriptClass>(scriptClass)),
+                          selected, options);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Latency benchmark
+//------------------------------------------------------------------------------
+
+// Tiny input lengths of the latency benchmark, in UTF-8 bytes
+constexpr std::size_t kLatencyLengths[] = { 5, 10, 20, 50 };
+
+// Inputs used for the warm-cache latencies, small enough to stay in L1
+constexpr std::size_t kWarmPoolSize = 64;
+
+// Keeps the results of the timed calls alive
+volatile std::size_t g_latencySink = 0;
+
+// An input string of the latency benchmark, in both encodings
+struct LatencyInput
+{
+    std::string utf8;
+    CStringW    utf16;
+    int         utf8Length;
+    int         utf16Length;
+};
+
+// Build 'count' distinct inputs of (about) 'length' bytes, cut at random offsets of the given text
+std::vector<LatencyInput> MakeLatencyInputs(const std::string& text, std::size_t length,
+                                            std::size_t count, bench::Random& random)
+{
+    auto isContinuationByte = [&text](std::size_t pos)
+    {
+        return (static_cast<unsigned char>(text[pos]) & 0xC0) == 0x80;
+    };
+
+    std::vector<LatencyInput> inputs(count);
+    for (LatencyInput& input : inputs)
+    {
+        std::size_t start = random.Below(static_cast<std::uint32_t>(text.length() - length));
+        while (isContinuationByte(start))
+        {
+            --start;
+        }
+        std::size_t finish = start + length;
+        while (isContinuationByte(finish))
+        {
+            --finish;
+        }
+
+        input.utf8.assign(text, start, finish - start);
+        input.utf16 = win32::Utf16FromUtf8(input.utf8);
+        input.utf8Length = static_cast<int>(input.utf8.length());
+        input.utf16Length = input.utf16.GetLength();
+    }
+    return inputs;
+}
+
+//------------------------------------------------------------------------------
+// Time single calls of 'call' on the inputs in the given order, and return
+// the percentiles of their latencies.
+//------------------------------------------------------------------------------
+template <typename Call>
+bench::LatencyPercentiles SampleLatencies(const std::vector<LatencyInput>& inputs,
+                                          const std::vector<std::uint32_t>& order, Call&& call)
+{
+    std::vector<std::uint64_t> samples(order.size());
+    std::size_t sink = 0;
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        const LatencyInput& input = inputs[order[i]];
+        const std::uint64_t start = bench::ReadStartTimestamp();
+        sink += static_cast<std::size_t>(call(input));
+        samples[i] = bench::ReadFinishTimestamp() - start;
+    }
+    g_latencySink = g_latencySink + sink;
+    return bench::ComputePercentiles(samples);
+}
+
+//
+// Copies of the bodies of Utf16FromUtf8 and Utf8FromUtf16, optionally without
+// the empty-input shortcut or the size_t -> int range check, to measure their cost
+//
+template <bool kEmptyShortcut, bool kRangeCheck>
+int Utf16FromUtf8Variant(const std::string& utf8)
+{
+    if (kEmptyShortcut && utf8.empty())
+    {
+        return 0;
+    }
+
+    const int utf8Length = kRangeCheck
+        ? win32::detail::CheckedIntLength(utf8.length()) : static_cast<int>(utf8.length());
+    const int utf16Length = win32::detail::Utf16LengthFromUtf8(utf8.data(), utf8Length);
+
+    CStringW utf16;
+    win32::Utf16Char * const buffer = utf16.GetBuffer(utf16Length);
+    win32::detail::ConvertUtf8ToUtf16(utf8.data(), utf8Length, buffer, utf16Length);
+    utf16.ReleaseBuffer(utf16Length);
+    return utf16.GetLength();
+}
+
+template <bool kEmptyShortcut, bool kRangeCheck>
+int Utf8FromUtf16Variant(const CStringW& utf16)
+{
+    if (kEmptyShortcut && utf16.IsEmpty())
+    {
+        return 0;
+    }
+
+    const int utf16Length = kRangeCheck
+        ? win32::detail::CheckedIntLength(static_cast<std::size_t>(utf16.GetLength())) : utf16.GetLength();
+    const int utf8Length = win32::detail::Utf8LengthFromUtf16(utf16.GetString(), utf16Length);
+
+    std::string utf8;
+    utf8.resize(utf8Length);
+    win32::detail::ConvertUtf16ToUtf8(utf16.GetString(), utf16Length, &utf8[0], utf8Length);
+    return static_cast<int>(utf8.length());
+}
+
+void PrintLatencyHeader()
+{
+    std::printf("\nUTF-8/UTF-16 Conversion Latencies, in ns per call\n\n");
+    std::printf("  call         the public conversion function\n");
+    std::printf("  no-shortcut  the same steps, without the empty-input check\n");
+    std::printf("  no-check     the same steps, without the size_t -> int range check\n");
+    std::printf("  alloc        only allocating (and freeing) the result string\n");
+    std::printf("  convert      only the conversion kernels, into a preallocated buffer\n\n");
+    std::printf("Warm: a few inputs, converted over and over (caches and predictors warm).\n");
+    std::printf("Cold: each input is read once, from a pool much larger than the caches.\n\n");
+    std::printf("%-9s %5s  %-14s %-12s | %8s %8s %8s | %8s %8s %8s\n",
+                "corpus", "bytes", "function", "variant",
+                "warm p50", "p99", "p99.9", "cold p50", "p99", "p99.9");
+}
+
+void PrintLatencyResult(const char* corpus, std::size_t length, const char* function, const char* variant,
+                        const bench::LatencyPercentiles& warm, const bench::LatencyPercentiles* cold)
+{
+    std::printf("%-9s %5zu  %-14s %-12s | %8.1f %8.1f %8.1f |",
+                corpus, length, function, variant, warm.p50, warm.p99, warm.p999);
+    if (cold != nullptr)
+    {
+        std::printf(" %8.1f %8.1f %8.1f\n", cold->p50, cold->p99, cold->p999);
+    }
+    else
+    {
+        std::printf(" %8s %8s %8s\n", "-", "-", "-");
+    }
+}
+
+//------------------------------------------------------------------------------
+// Measure the latency of one variant, with warm caches and with cold inputs
+//------------------------------------------------------------------------------
+template <typename Call>
+void MeasureLatencyVariant(const char* corpus, std::size_t length, const char* function, const char* variant,
+                           const std::vector<LatencyInput>& warmInputs, const std::vector<LatencyInput>& coldInputs,
+                           const Options& options, bench::Random& random, Call&& call)
+{
+    // Warm: cycle over a few inputs, after a first untimed round
+    std::vector<std::uint32_t> order(warmInputs.size());
+    for (std::size_t i = 0; i < warmInputs.size(); ++i)
+    {
+        order[i] = static_cast<std::uint32_t>(i);
+    }
+    SampleLatencies(warmInputs, order, call);
+
+    order.resize(options.samples);
+    for (std::size_t i = 0; i < options.samples; ++i)
+    {
+        order[i] = static_cast<std::uint32_t>(i % warmInputs.size());
+    }
+    const bench::LatencyPercentiles warm = SampleLatencies(warmInputs, order, call);
+
+    // Cold: read each input once, in random order
+    order.resize(coldInputs.size());
+    for (std::size_t i = 0; i < coldInputs.size(); ++i)
+    {
+        order[i] = static_cast<std::uint32_t>(i);
+    }
+    for (std::size_t i = order.size() - 1; i > 0; --i)
+    {
+        std::swap(order[i], order[random.Below(static_cast<std::uint32_t>(i + 1))]);
+    }
+    order.resize((std::min)(options.samples, coldInputs.size()));
+    const bench::LatencyPercentiles cold = SampleLatencies(coldInputs, order, call);
+
+    PrintLatencyResult(corpus, length, function, variant, warm, &cold);
+}
+
+void RunLatencyBenchmarks(const Options& options)
+{
+    PrintLatencyHeader();
+
+    bench::Random random(0x1A7E9C);
+    std::vector<win32::Utf16Char> utf16Buffer(256);
+    std::vector<char> utf8Buffer(256);
+
+    for (const bench::CorpusInfo* corpus : options.corpora)
+    {
+        const std::string text = bench::GenerateUtf8Corpus(corpus->kind, 1024 * 1024);
+
+        for (std::size_t length : kLatencyLengths)
+        {
+            if (length < options.minLength || length > options.maxLength)
+            {
+                continue;
+            }
+
+            const std::vector<LatencyInput> warmInputs = MakeLatencyInputs(text, length, kWarmPoolSize, random);
+            const std::vector<LatencyInput> coldInputs = MakeLatencyInputs(text, length, options.coldPoolSize, random);
+
+            auto measure = [&](const char* function, const char* variant, auto&& call)
+            {
+                MeasureLatencyVariant(corpus->name, length, function, variant,
+                                      warmInputs, coldInputs, options, random, call);
+            };
+
+            measure("Utf16FromUtf8", "call", [](const LatencyInput& input)
+            {
+                return win32::Utf16FromUtf8(input.utf8).GetLength();
+            });
+            measure("Utf16FromUtf8", "no-shortcut", [](const LatencyInput& input)
+            {
+                return Utf16FromUtf8Variant<false, true>(input.utf8);
+            });
+            measure("Utf16FromUtf8", "no-check", [](const LatencyInput& input)
+            {
+                return Utf16FromUtf8Variant<true, false>(input.utf8);
+            });
+            measure("Utf16FromUtf8", "alloc", [](const LatencyInput& input)
+            {
+                CStringW utf16;
+                utf16.GetBuffer(input.utf16Length);
+                utf16.ReleaseBuffer(0);
+                return input.utf16Length;
+            });
+            measure("Utf16FromUtf8", "convert", [&utf16Buffer](const LatencyInput& input)
+            {
+                const int utf8Length = win32::detail::CheckedIntLength(input.utf8.length());
+                const int utf16Length = win32::detail::Utf16LengthFromUtf8(input.utf8.data(), utf8Length);
+                return win32::detail::ConvertUtf8ToUtf16(input.utf8.data(), utf8Length,
+                                                         utf16Buffer.data(), utf16Length);
+            });
+
+            measure("Utf8FromUtf16", "call", [](const LatencyInput& input)
+            {
+                return static_cast<int>(win32::Utf8FromUtf16(input.utf16).length());
+            });
+            measure("Utf8FromUtf16", "no-shortcut", [](const LatencyInput& input)
+            {
+                return Utf8FromUtf16Variant<false, true>(input.utf16);
+            });
+            measure("Utf8FromUtf16", "no-check", [](const LatencyInput& input)
+            {
+                return Utf8FromUtf16Variant<true, false>(input.utf16);
+            });
+            measure("Utf8FromUtf16", "alloc", [](const LatencyInput& input)
+            {
+                std::string utf8;
+                utf8.resize(input.utf8Length);
+                return static_cast<int>(utf8.length());
+            });
+            measure("Utf8FromUtf16", "convert", [&utf8Buffer](const LatencyInput& input)
+            {
+                const int utf16Length = win32::detail::CheckedIntLength(
+                    static_cast<std::size_t>(input.utf16Length));
+                const int utf8Length = win32::detail::Utf8LengthFromUtf16(input.utf16.GetString(), utf16Length);
+                return win32::detail::ConvertUtf16ToUtf8(input.utf16.GetString(), utf16Length,
+                                                         utf8Buffer.data(), utf8Length);
+            });
+        }
+    }
+
+    // The empty-input shortcut, on its own
+    const std::vector<LatencyInput> emptyInputs(kWarmPoolSize, LatencyInput{ std::string(), CStringW(), 0, 0 });
+    std::vector<std::uint32_t> order(options.samples);
+    for (std::size_t i = 0; i < options.samples; ++i)
+    {
+        order[i] = static_cast<std::uint32_t>(i % kWarmPoolSize);
+    }
+
+    const bench::LatencyPercentiles emptyToUtf16 = SampleLatencies(emptyInputs, order, [](const LatencyInput& input)
+    {
+        return win32::Utf16FromUtf8(input.utf8).GetLength();
+    });
+    PrintLatencyResult("empty", 0, "Utf16FromUtf8", "call", emptyToUtf16, nullptr);
+
+    const bench::LatencyPercentiles emptyToUtf8 = SampleLatencies(emptyInputs, order, [](const LatencyInput& input)
+    {
+        return static_cast<int>(win32::Utf8FromUtf16(input.utf16).length());
+    });
+    PrintLatencyResult("empty", 0, "Utf8FromUtf16", "call", emptyToUtf8, nullptr);
+}
+
+} // anonymous namespace
+
+
+//------------------------------------------------------------------------------
+// Benchmark console application's entry point
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    constexpr int kExitOk = 0;
+    constexpr int kExitError = 1;
+    constexpr int kExitSlower = 2;    // Significantly slower than the baseline
+
+    try
+    {
+        Options options;
+        if (!ParseOptions(argc, argv, options))
+        {
+            return kExitError;
+        }
+
+        if (options.writeTracePath != nullptr)
+        {
+            WriteSyntheticTrace(options);
+        }
+        else if (options.replayPath != nullptr)
+        {
+            RunReplayBenchmarks(options);
+        }
+        else if (options.latency)
+        {
+            RunLatencyBenchmarks(options);
+        }
+        else if (options.scaling)
+        {
+            RunScalingBenchmarks(options);
+        }
+        else if (options.reference)
+        {
+            if (!RunReferenceBenchmarks(options))
+            {
+                return kExitError;
+            }
+        }
+        else if (options.adaptive)
+        {
+            if (!RunAdaptiveBenchmarks(options))
+            {
+                return kExitError;
+            }
+        }
+        else if (!RunThroughputBenchmarks(options))
+        {
+            return kExitSlower;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::printf("\n*** FATAL: std::exception; what(): %s\n", e.what());
+        return kExitError;
+    }
+
+    return kExitOk;
+}
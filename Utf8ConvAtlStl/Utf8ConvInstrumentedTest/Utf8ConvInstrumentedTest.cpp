@@ -0,0 +1,400 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Utf8ConvInstrumentedTest.cpp -- Copyright (C) by Giovanni Dicanio
+//
+// Unit Test for the instrumentation of the UTF-8 encoding conversion
+// functions: the conversion sampling hook (with the workload traces built on
+// it) and the telemetry counters.
+//
+// They are compiled in by macros that change the conversion functions, so
+// they are tested in this separate program, leaving the main unit test
+// (Utf8ConvTest.cpp) on the default configuration.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+// Compile in the conversion sampling hook and the telemetry counters, to test them
+#define GIOVANNI_DICANIO_UTF8CONV_ENABLE_SAMPLING
+#define GIOVANNI_DICANIO_UTF8CONV_ENABLE_TELEMETRY
+#define GIOVANNI_DICANIO_UTF8CONV_TELEMETRY_TIMING_PERIOD 1
+
+#include "Utf8Conv.h"       // UTF-8 conversion functions to test
+#include "Utf8OffsetMap.h"  // Offset map conversions
+#include "Utf16Mirror.h"    // Incremental UTF-16 mirror
+#include "Utf8ConvAlloc.h"  // Conversions with custom allocators
+#include "Utf8ConvScratch.h" // Scoped scratch-buffer conversions
+#include "Utf8ConvSmallString.h" // Small-buffer conversion results
+#include "Utf8ConvAdaptive.h" // Adaptive kernel selection
+#include "Utf8ConvTrace.h"  // Workload traces to test
+#include <iostream>         // For console output
+#include <memory>           // For std::allocator
+#include <sstream>          // For std::stringstream
+#include <thread>           // For std::thread
+#include <vector>           // For std::vector
+#include <exception>        // For std::exception
+
+using namespace GiovanniDicanio;
+using std::cout;
+
+#ifndef GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+// Portable build: use the library's replacement for CStringW
+using win32::CStringW;
+#endif // GIOVANNI_DICANIO_UTF8CONV_HAS_ATL
+
+
+namespace
+{
+
+//------------------------------------------------------------------------------
+// Helper function to print a test error message.
+// Don't use it in test case code (use the TEST_ERROR macro instead).
+//------------------------------------------------------------------------------
+void PrintTestError(const char* const file, const int line, const char* const msg)
+{
+    cout << "[ERROR] " << file << " (" << line << "): " << msg << '\n';
+}
+
+} // anonymous namespace
+
+
+// Suppress the "conditional expression is constant" warning with MSVC
+#ifdef _MSC_VER
+#define TEST_ERROR_WHILE_FALSE __pragma(warning(suppress:4127)) while (0)
+#else
+#define TEST_ERROR_WHILE_FALSE while (0)
+#endif
+
+//------------------------------------------------------------------------------
+// Macro to print test error messages, and increase the global error count.
+// Use it in test cases to log failed tests.
+//------------------------------------------------------------------------------
+#define TEST_ERROR(msg)                             \
+    do                                              \
+    {                                               \
+        ++g_testErrors;                             \
+        PrintTestError(__FILE__, __LINE__, (msg));  \
+    }                                               \
+    TEST_ERROR_WHILE_FALSE
+
+
+// Count of test errors
+static int g_testErrors = 0;
+
+// Entry point for tests
+void RunTests();
+
+
+//------------------------------------------------------------------------------
+// Test console application's entry point
+//------------------------------------------------------------------------------
+int main()
+{
+    constexpr int kExitOk = 0;
+    constexpr int kExitError = 1;
+    int exitCode = kExitOk;
+
+    try
+    {
+        cout << "\nTesting UTF-8/UTF-16 Conversion Sampling and Telemetry\n";
+        cout << "           -- by Giovanni Dicanio --\n\n";
+        RunTests();
+    }
+    catch (const std::exception& e)
+    {
+        cout << "\n*** FATAL: std::exception; what(): " << e.what() << '\n';
+        exitCode = kExitError;
+    }
+    catch (...)
+    {
+        cout << "\n*** FATAL: Unknown C++ exception.\n";
+        exitCode = kExitError;
+    }
+
+    if (g_testErrors != 0)
+    {
+        cout << "\n*** " << g_testErrors << " error(s) detected.\n";
+        exitCode = kExitError;
+    }
+
+    if (exitCode == kExitOk)
+    {
+        // All right!! :)
+        cout << "\n*** No errors detected! :) ***\n";
+    }
+
+    return exitCode;
+}
+
+
+//------------------------------------------------------------------------------
+// Various Tests
+//------------------------------------------------------------------------------
+
+void TestConversionTraces()
+{
+    const std::string kinU8 = "Kin \xE9\x87\x91";                 // 3-byte class
+    const std::string emojiU8 = "Smile \xF0\x9F\x98\x80 ok";    // 4-byte class
+    const CStringW cafeU16 = win32::Utf16FromUtf8(std::string("Caf\xC3\xA9 42")); // 2-byte class
+
+    std::vector<win32::TraceRecord> records;
+    {
+        win32::ConversionTraceRecorder recorder(1, true);
+
+        try
+        {
+            const win32::ConversionTraceRecorder other(1);
+            TEST_ERROR("Second active trace recorder didn't throw.");
+        }
+        catch (const std::logic_error&)
+        {
+        }
+
+        win32::Utf16FromUtf8(kinU8);
+        win32::Utf16FromUtf8(emojiU8);
+        win32::Utf8FromUtf16(cafeU16);
+        win32::Utf16FromUtf8(std::string());     // Empty inputs are not sampled
+
+        recorder.Stop();
+        win32::Utf16FromUtf8(kinU8);
+        records = recorder.Records();
+    }
+
+    if (records.size() != 3
+        || records[0].direction != win32::ConversionDirection::Utf8ToUtf16
+        || records[0].scriptClass != win32::ScriptClass::ThreeByte || records[0].length != kinU8.length()
+        || records[1].scriptClass != win32::ScriptClass::FourByte || records[1].length != emojiU8.length()
+        || records[2].direction != win32::ConversionDirection::Utf16ToUtf8
+        || records[2].scriptClass != win32::ScriptClass::TwoByte
+        || records[2].length != static_cast<std::uint32_t>(cafeU16.GetLength()))
+    {
+        TEST_ERROR("Wrong sampled conversion records.");
+    }
+
+    // Anonymized samples keep the byte structure of the text, and its punctuation
+    for (const win32::TraceRecord& record : records)
+    {
+        const std::string& original = (&record == &records[0]) ? kinU8
+                                    : (&record == &records[1]) ? emojiU8 : win32::Utf8FromUtf16(cafeU16);
+        bool sameStructure = (record.sample.length() == original.length());
+        for (std::size_t i = 0; sameStructure && i < original.length(); ++i)
+        {
+            const unsigned char originalByte = static_cast<unsigned char>(original[i]);
+            const unsigned char sampleByte = static_cast<unsigned char>(record.sample[i]);
+            sameStructure = (originalByte >= 0x80) ? ((sampleByte & 0xC0) == (originalByte & 0xC0))
+                                                   : (sampleByte < 0x80);
+            if (originalByte == ' ' && sampleByte != ' ')
+            {
+                sameStructure = false;
+            }
+        }
+        if (!sameStructure || record.sample == original)
+        {
+            TEST_ERROR("Wrong anonymized conversion sample.");
+        }
+    }
+
+    // Sampling 1 in N conversions
+    {
+        win32::ConversionTraceRecorder recorder(4);
+        for (int i = 0; i < 16; ++i)
+        {
+            win32::Utf16FromUtf8(kinU8);
+        }
+        if (recorder.Records().size() != 4)
+        {
+            TEST_ERROR("Wrong number of sampled conversions with a sampling period.");
+        }
+    }
+
+    // The conversions of the helper headers are sampled as well
+    {
+        win32::ConversionTraceRecorder recorder(1);
+        win32::Utf16FromUtf8(kinU8, std::allocator<win32::Utf16Char>());
+        win32::Utf8FromUtf16(cafeU16, std::allocator<char>());
+        win32::Utf8Utf16OffsetMap offsetMap;
+        win32::Utf16FromUtf8(kinU8, offsetMap);
+        {
+            const win32::ScopedUtf16FromUtf8 scopedUtf16(kinU8);
+            const win32::ScopedUtf8FromUtf16 scopedUtf8(cafeU16);
+        }
+        win32::SmallUtf16FromUtf8(kinU8);
+        win32::SmallUtf8FromUtf16(cafeU16);
+        win32::AdaptiveConverter converter;
+        converter.Utf16FromUtf8(kinU8);
+        converter.Utf8FromUtf16(cafeU16);
+
+        const std::vector<win32::TraceRecord> helperRecords = recorder.Records();
+        bool sameInputs = (helperRecords.size() == 9);
+        for (std::size_t i = 0; sameInputs && i < helperRecords.size(); ++i)
+        {
+            sameInputs = (helperRecords[i].direction == win32::ConversionDirection::Utf8ToUtf16)
+                ? helperRecords[i].length == kinU8.length()
+                : helperRecords[i].length == static_cast<std::uint32_t>(cafeU16.GetLength());
+        }
+        if (!sameInputs)
+        {
+            TEST_ERROR("Wrong sampled conversions of the helper headers.");
+        }
+    }
+
+    // Binary trace round trip
+    records[0].sample.clear();
+    std::stringstream trace;
+    win32::WriteConversionTrace(trace, records);
+    const std::vector<win32::TraceRecord> readBack = win32::ReadConversionTrace(trace);
+    bool sameRecords = (readBack.size() == records.size());
+    for (std::size_t i = 0; sameRecords && i < records.size(); ++i)
+    {
+        sameRecords = readBack[i].direction == records[i].direction
+                      && readBack[i].scriptClass == records[i].scriptClass
+                      && readBack[i].length == records[i].length
+                      && readBack[i].sample == records[i].sample;
+    }
+    if (!sameRecords)
+    {
+        TEST_ERROR("Conversion trace round trip failed.");
+    }
+
+    const win32::TraceSummary summary = win32::SummarizeConversionTrace(readBack);
+    if (summary.samples != 2 || summary.counts[0][static_cast<int>(win32::ScriptClass::FourByte)] != 1
+        || summary.lengthBuckets[3] != 2)
+    {
+        TEST_ERROR("Wrong conversion trace summary.");
+    }
+
+    // Malformed traces are rejected
+    const char* const malformedTraces[] =
+    {
+        "U8CX\x01",                      // Bad magic
+        "U8CT\x01\x10\x05",              // Unknown flags
+        "U8CT\x01\x02\x80",              // Truncated length
+        "U8CT\x01\x08\x02\x02\xC0",      // Truncated sample
+        "U8CT\x01\x08\x02\x02\xC0\x80",  // Invalid UTF-8 sample
+    };
+    for (const char* malformed : malformedTraces)
+    {
+        std::istringstream input(malformed);
+        try
+        {
+            win32::ReadConversionTrace(input);
+            TEST_ERROR("Malformed conversion trace not rejected.");
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+}
+
+void TestConversionTelemetry()
+{
+    const std::string kinU8 = "Kin \xE9\x87\x91";
+    const CStringW kinU16 = win32::Utf16FromUtf8(kinU8);
+
+    const win32::ConversionTelemetry before = win32::GetConversionTelemetry();
+
+    win32::Utf16FromUtf8(kinU8);
+    win32::Utf16FromUtf8(kinU8.c_str());
+    win32::Utf16FromUtf8(std::string());     // Empty inputs are not counted
+    win32::Utf8FromUtf16(kinU16);
+    try
+    {
+        win32::Utf16FromUtf8(std::string("\xC0\x80"));
+        TEST_ERROR("Conversion of invalid UTF-8 didn't throw.");
+    }
+    catch (const win32::Utf8ConversionException&)
+    {
+    }
+
+    // The counters of exited threads are kept
+    std::thread thread([&kinU16]()
+    {
+        win32::Utf8FromUtf16(kinU16.GetString());
+    });
+    thread.join();
+
+    const win32::ConversionTelemetry delta = win32::GetConversionTelemetry() - before;
+
+    const win32::ConversionTelemetry::Function& toUtf16 = delta.utf16FromUtf8;
+    if (toUtf16.calls != 3 || toUtf16.exceptions != 1
+        || toUtf16.inputBytes != 2 * kinU8.length()
+        || toUtf16.outputUnits != 2 * static_cast<std::uint64_t>(kinU16.GetLength())
+        || toUtf16.sizeHistogram[3] != 2)
+    {
+        TEST_ERROR("Wrong Utf16FromUtf8 telemetry counters.");
+    }
+
+    const win32::ConversionTelemetry::Function& toUtf8 = delta.utf8FromUtf16;
+    if (toUtf8.calls != 2 || toUtf8.exceptions != 0
+        || toUtf8.inputBytes != 2 * kinU16.GetLength() * sizeof(win32::Utf16Char)
+        || toUtf8.outputUnits != 2 * kinU8.length())
+    {
+        TEST_ERROR("Wrong Utf8FromUtf16 telemetry counters.");
+    }
+
+    std::uint64_t timedCalls = 0;
+    for (std::uint64_t count : toUtf8.timeHistogram)
+    {
+        timedCalls += count;
+    }
+    if (timedCalls != 2 || toUtf8.timedCalls != 2)
+    {
+        TEST_ERROR("Wrong telemetry time histogram.");
+    }
+
+    if (delta.errors[static_cast<int>(win32::ConversionErrorKind::InvalidSequence)] != 1
+        || delta.errors[static_cast<int>(win32::ConversionErrorKind::InputTooLong)] != 0)
+    {
+        TEST_ERROR("Wrong telemetry error counters.");
+    }
+
+    // The conversions of the helper headers are counted as well
+    const win32::ConversionTelemetry beforeHelpers = win32::GetConversionTelemetry();
+
+    win32::Utf16FromUtf8(kinU8, std::allocator<win32::Utf16Char>());
+    win32::Utf8FromUtf16(kinU16, std::allocator<char>());
+    win32::Utf8Utf16OffsetMap offsetMap;
+    win32::Utf16FromUtf8(kinU8, offsetMap);
+    {
+        const win32::ScopedUtf16FromUtf8 scopedUtf16(kinU8);
+        const win32::ScopedUtf8FromUtf16 scopedUtf8(kinU16);
+    }
+    win32::SmallUtf16FromUtf8(kinU8);
+    win32::SmallUtf8FromUtf16(kinU16);
+    win32::AdaptiveConverter converter;
+    converter.Utf16FromUtf8(kinU8);
+    converter.Utf8FromUtf16(kinU16);
+
+    const win32::ConversionTelemetry helpers = win32::GetConversionTelemetry() - beforeHelpers;
+    if (helpers.utf16FromUtf8.calls != 5 || helpers.utf8FromUtf16.calls != 4
+        || helpers.utf16FromUtf8.inputBytes != 5 * kinU8.length()
+        || helpers.utf8FromUtf16.outputUnits != 4 * kinU8.length())
+    {
+        TEST_ERROR("Wrong telemetry counters of the helper conversions.");
+    }
+
+    // Out-of-range offsets are invalid arguments, not too long inputs
+    const win32::ConversionTelemetry beforeRanges = win32::GetConversionTelemetry();
+    win32::Utf16Mirror mirror(kinU8);
+    try
+    {
+        mirror.Edit(kinU8.length() + 1, 0, "x");
+        TEST_ERROR("Out-of-range Utf16Mirror edit didn't throw.");
+    }
+    catch (const win32::Utf8ConversionException&)
+    {
+    }
+    const win32::ConversionTelemetry ranges = win32::GetConversionTelemetry() - beforeRanges;
+    if (ranges.errors[static_cast<int>(win32::ConversionErrorKind::InvalidArgument)] != 1
+        || ranges.errors[static_cast<int>(win32::ConversionErrorKind::InputTooLong)] != 0)
+    {
+        TEST_ERROR("Wrong telemetry error kind of an invalid range.");
+    }
+}
+
+
+// Run all tests
+void RunTests()
+{
+    TestConversionTraces();
+    TestConversionTelemetry();
+}